@@ -779,8 +779,23 @@ int main(int argc, char *argv[])
 		schedule->max_networks = config->max_networks;
 		schedule->stats_interval = config->stats_interval;
 
+		schedule->network_cpus = config->network_cpus;
+		schedule->worker_cpus = config->worker_cpus;
+		schedule->network_numa_node = config->network_numa_node;
+		schedule->network_numa_node_is_set = config->network_numa_node_is_set;
+		schedule->worker_numa_node = config->worker_numa_node;
+		schedule->worker_numa_node_is_set = config->worker_numa_node_is_set;
+
 		schedule->network.max_outstanding = config->max_requests;
+		schedule->network.steal_delay = config->steal_delay;
+		schedule->network.busy_poll = config->network_busy_poll;
+		schedule->worker.busy_poll = config->worker_busy_poll;
+		schedule->network.trace = config->trace;
+		schedule->worker.trace = config->trace;
+		schedule->worker.trace_threshold = config->trace_threshold;
+		schedule->worker.trace_file = config->trace_file;
 		schedule->worker.max_requests = config->max_requests;
+		schedule->worker.max_free_requests = config->worker_free_requests;
 		schedule->worker.max_request_time = config->max_request_time;
 
 		/*
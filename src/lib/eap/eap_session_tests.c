@@ -0,0 +1,188 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for starting EAP sessions from decoded RADIUS packets
+ *
+ * @file src/lib/eap/eap_session_tests.c
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+static void eap_session_tests_init(void) __attribute__((constructor));
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+
+#include <freeradius-devel/eap/base.h>
+#include <freeradius-devel/eap/session.h>
+#include <freeradius-devel/radius/radius.h>
+#include <freeradius-devel/server/base.h>
+
+static char const	*dict_dir  = "share/dictionary";
+
+static TALLOC_CTX	*autofree;
+
+static fr_dict_t const *dict_radius;
+
+extern fr_dict_autoload_t eap_session_tests_dict[];
+fr_dict_autoload_t eap_session_tests_dict[] = {
+	{ .out = &dict_radius, .proto = "radius" },
+	{ NULL }
+};
+
+static fr_dict_attr_t const *attr_user_name;
+
+extern fr_dict_attr_autoload_t eap_session_tests_dict_attr[];
+fr_dict_attr_autoload_t eap_session_tests_dict_attr[] = {
+	{ .out = &attr_user_name, .name = "User-Name", .type = FR_TYPE_STRING, .dict = &dict_radius },
+	{ NULL }
+};
+
+/*
+ *	Stands in for the rlm_eap instance, which the session
+ *	only records.
+ */
+static int const	dummy_inst;
+
+/*
+ *	Access-Request, User-Name = "bob",
+ *	EAP-Message = Response/Identity "bob"
+ */
+static uint8_t const	identity_bob[] = {
+	0x01, 0x01, 0x00, 0x23,
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+	0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+	0x01, 0x05, 'b', 'o', 'b',
+	0x4f, 0x0a, 0x02, 0x01, 0x00, 0x08, 0x01, 'b', 'o', 'b'
+};
+
+/*
+ *	Access-Request, User-Name = "alice",
+ *	EAP-Message = Response/Identity "bob"
+ */
+static uint8_t const	identity_mismatch[] = {
+	0x01, 0x01, 0x00, 0x25,
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+	0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+	0x01, 0x07, 'a', 'l', 'i', 'c', 'e',
+	0x4f, 0x0a, 0x02, 0x01, 0x00, 0x08, 0x01, 'b', 'o', 'b'
+};
+
+static void eap_session_tests_init(void)
+{
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("eap_session_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) goto error;
+
+	if (!fr_dict_global_ctx_init(autofree, dict_dir)) goto error;
+
+	/*
+	 *	Needed for the failure messages the session
+	 *	adds to rejected requests.
+	 */
+	if (log_global_init(&default_log, false) < 0) goto error;
+
+	if (request_global_init() < 0) goto error;
+
+	if (fr_radius_init() < 0) goto error;
+
+	if (eap_base_init() < 0) goto error;
+
+	if (fr_dict_autoload(eap_session_tests_dict) < 0) goto error;
+	if (fr_dict_attr_autoload(eap_session_tests_dict_attr) < 0) goto error;
+}
+
+/** Decode a RADIUS packet into the request list of a new request
+ *
+ */
+static request_t *request_from_packet(uint8_t const *data, size_t data_len)
+{
+	request_t	*request;
+	fr_dcursor_t	cursor;
+
+	request = request_local_alloc(autofree, NULL);
+
+	request->packet = fr_radius_packet_alloc(request, false);
+	TEST_CHECK(request->packet != NULL);
+
+	request->reply = fr_radius_packet_alloc(request, false);
+	TEST_CHECK(request->reply != NULL);
+
+	request->packet->data = talloc_memdup(request->packet, data, data_len);
+	request->packet->data_len = data_len;
+
+	fr_dcursor_init(&cursor, &request->request_pairs);
+	TEST_CHECK(fr_radius_decode(request->request_ctx, request->packet->data, request->packet->data_len,
+				    NULL, "testing123", 10, &cursor) == (ssize_t)data_len);
+
+	return request;
+}
+
+static void test_eap_session_identity(void)
+{
+	request_t		*request = request_from_packet(identity_bob, sizeof(identity_bob));
+	eap_packet_raw_t	*eap_packet;
+	eap_session_t		*eap_session;
+	fr_pair_t		*user;
+
+	TEST_CASE("User-Name is decoded into the pair");
+	user = fr_pair_find_by_da(&request->request_pairs, attr_user_name);
+	TEST_CHECK(user != NULL);
+	TEST_CHECK(fr_value_box_is_inline(&user->data));
+
+	TEST_CASE("EAP identity is checked against the User-Name");
+	eap_packet = eap_packet_from_vp(request, &request->request_pairs);
+	TEST_CHECK(eap_packet != NULL);
+
+	eap_session = eap_session_continue(&dummy_inst, &eap_packet, request);
+	TEST_CHECK(eap_session != NULL);
+	TEST_CHECK(eap_session && (talloc_array_length(eap_session->identity) == 4));
+	TEST_CHECK(eap_session && (strcmp(eap_session->identity, "bob") == 0));
+
+	eap_session_destroy(&eap_session);
+	TEST_CHECK_RET(talloc_free(request), 0);
+}
+
+static void test_eap_session_identity_mismatch(void)
+{
+	request_t		*request = request_from_packet(identity_mismatch, sizeof(identity_mismatch));
+	eap_packet_raw_t	*eap_packet;
+	eap_session_t		*eap_session;
+
+	TEST_CASE("EAP identity which doesn't match the User-Name is rejected");
+	eap_packet = eap_packet_from_vp(request, &request->request_pairs);
+	TEST_CHECK(eap_packet != NULL);
+
+	eap_session = eap_session_continue(&dummy_inst, &eap_packet, request);
+	TEST_CHECK(eap_session == NULL);
+	TEST_CHECK(eap_packet == NULL);
+
+	TEST_CHECK_RET(talloc_free(request), 0);
+}
+
+TEST_LIST = {
+	{ "eap_session_identity",		test_eap_session_identity },
+	{ "eap_session_identity_mismatch",	test_eap_session_identity_mismatch },
+
+	{ NULL }
+};
@@ -0,0 +1,14 @@
+TARGET      := eap_session_tests
+SOURCES     := eap_session_tests.c
+
+TGT_PREREQS += libfreeradius-eap.a libfreeradius-radius.a libfreeradius-server.a libfreeradius-unlang.a libfreeradius-util.a
+
+#
+#  libfreeradius-eap references the TLS library when it's built
+#  with OpenSSL support.
+#
+ifneq (${OPENSSL_LIBS},)
+TGT_PREREQS += libfreeradius-tls.a
+endif
+
+TGT_LDLIBS  := $(LIBS)
@@ -443,6 +443,8 @@ eap_session_t *eap_session_continue(void const *instance, eap_packet_raw_t **eap
 	 *	then ignore mismatches.
 	 */
 	} else if ((talloc_array_length(eap_session->identity) - 1) <= RADIUS_MAX_STRING_LENGTH) {
+		size_t identity_len = talloc_array_length(eap_session->identity) - 1;
+
 		/*
 		 *      A little more paranoia.  If the NAS
 		 *      *did* set the User-Name, and it doesn't
@@ -451,8 +453,13 @@ eap_session_t *eap_session_continue(void const *instance, eap_packet_raw_t **eap
 		 *      the EAP transaction), then reject the
 		 *      request as the NAS is doing something
 		 *      funny.
+		 *
+		 *      The User-Name may be stored in the pair
+		 *      itself, so it's not necessarily a talloced
+		 *      buffer.
 		 */
-		if (talloc_memcmp_bstr(eap_session->identity, user->vp_strvalue) != 0) {
+		if ((user->vp_length != identity_len) ||
+		    (memcmp(eap_session->identity, user->vp_strvalue, identity_len) != 0)) {
 			REDEBUG("Identity from EAP Identity-Response \"%s\" does not match User-Name attribute \"%s\"",
 				eap_session->identity, user->vp_strvalue);
 			goto error_round;
@@ -196,7 +196,7 @@ static bool identity_req_set_by_user(request_t *request, eap_aka_sim_session_t *
  *
  */
 static void identity_hint_pairs_add(fr_aka_sim_id_type_t *type_p, fr_aka_sim_method_hint_t *method_p,
-				    request_t *request, char const *identity)
+				    request_t *request, char const *identity, size_t identity_len)
 {
 	fr_aka_sim_id_type_t		type;
 	fr_aka_sim_method_hint_t	method;
@@ -204,8 +204,7 @@ static void identity_hint_pairs_add(fr_aka_sim_id_type_t *type_p, fr_aka_sim_met
 	/*
 	 *	Process the identity that we received.
 	 */
-	if (fr_aka_sim_id_type(&type, &method,
-			   identity, talloc_array_length(identity) - 1) < 0) {
+	if (fr_aka_sim_id_type(&type, &method, identity, identity_len) < 0) {
 		RPWDEBUG2("Failed parsing identity, continuing anyway");
 	}
 
@@ -3814,7 +3813,7 @@ static unlang_action_t aka_identity(rlm_rcode_t *p_result, module_ctx_t const *m
 		 *	Add ID hint attributes to the request to help
 		 *	the user make policy decisions.
 		 */
-		identity_hint_pairs_add(&type, NULL, request, id->vp_strvalue);
+		identity_hint_pairs_add(&type, NULL, request, id->vp_strvalue, id->vp_length);
 		if (type == AKA_SIM_ID_TYPE_PERMANENT) {
 			identity_to_permanent_identity(request, id,
 						       eap_aka_sim_session->type,
@@ -3923,7 +3922,7 @@ static unlang_action_t sim_start(rlm_rcode_t *p_result, module_ctx_t const *mctx
 		 *	Add ID hint attributes to the request to help
 		 *	the user make policy decisions.
 		 */
-		identity_hint_pairs_add(&type, NULL, request, id->vp_strvalue);
+		identity_hint_pairs_add(&type, NULL, request, id->vp_strvalue, id->vp_length);
 		if (type == AKA_SIM_ID_TYPE_PERMANENT) {
 			identity_to_permanent_identity(request, id,
 						       eap_aka_sim_session->type,
@@ -4210,7 +4209,8 @@ unlang_action_t aka_sim_state_machine_start(rlm_rcode_t *p_result, module_ctx_t
 	 *	Add ID hint attributes to the request to help
 	 *	the user make policy decisions.
 	 */
-	identity_hint_pairs_add(&type, NULL, request, eap_session->identity);
+	identity_hint_pairs_add(&type, NULL, request, eap_session->identity,
+				talloc_array_length(eap_session->identity) - 1);
 	if (type == AKA_SIM_ID_TYPE_PERMANENT) {
 		identity_to_permanent_identity(request, vp, eap_session->type,
 					       inst->strip_permanent_identity_hint);
@@ -3,6 +3,7 @@ TARGET	:= libfreeradius-io.a
 SOURCES	:= \
 	app_io.c \
 	atomic_queue.c \
+	busy_poll.c \
 	channel.c \
 	control.c \
 	load.c \
@@ -48,6 +48,7 @@ typedef struct {
 	fr_io_set_fd_t			fd_set;		//!< Set the file descriptor to the instance.
 
 	fr_io_data_read_t		read;		//!< Read from a socket to a data buffer
+	fr_io_data_pending_t		read_pending;	//!< Are there buffered packets for read() to return.
 	fr_io_data_write_t		write;		//!< Write from a data buffer to a socket
 
 	fr_io_data_inject_t		inject;		//!< Inject a packet into a socket.
@@ -57,7 +58,9 @@ typedef struct {
 	fr_io_decode_t			decode;		//!< Translate raw bytes into fr_pair_ts and metadata.
 	fr_io_encode_t			encode;		//!< Pack fr_pair_ts back into a byte array.
 
-	fr_io_signal_t			flush;		//!< Flush the data when the socket is ready for writing.
+	fr_io_signal_t			flush;		//!< Write any packets which write() has queued.  Called
+							///< by the network once it has written all of the replies
+							///< it has for this socket in the current event loop pass.
 
 	fr_io_signal_t			error;		//!< There was an error on the socket.
 	fr_io_close_t			close;		//!< Close the transport.
@@ -66,9 +69,12 @@ typedef struct {
 
 	fr_io_track_create_t		track;		//!< create a tracking structure
 	fr_io_track_cmp_t		compare;	//!< compare two tracking structures
+	fr_io_track_hash_t		track_hash;	//!< hash a tracking structure
 
 	fr_io_connection_set_t		connection_set;	//!< set src/dst IP/port of a connection
 	fr_io_network_get_t		network_get;	//!< get dynamic network information
+	fr_io_shard_get_t		shard_get;	//!< open one socket per network thread
+	fr_io_affinity_get_t		affinity;	//!< which worker a packet should be sent to
 	fr_io_client_find_t		client_find;	//!< find radclient
 	fr_io_name_t			get_name;	//!< get the socket name
 
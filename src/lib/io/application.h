@@ -88,6 +88,17 @@ typedef void (*fr_app_entry_point_set_t)(void const *instance, request_t *reques
  */
 typedef int (*fr_app_priority_get_t)(void const *instance, uint8_t const *buffer, size_t buflen);
 
+/** Get the session affinity of a packet
+ *
+ * @param[in] instance	of the #fr_app_t.
+ * @param[in] buffer	raw packet
+ * @param[in] buflen	length of the packet
+ * @return
+ *	0  - the packet has no affinity
+ *	*  - a hash of the session key
+ */
+typedef uint32_t (*fr_app_affinity_get_t)(void const *instance, uint8_t const *buffer, size_t buflen);
+
 /** Called by the network thread to pass an event list for the module to use for timer events
  */
 typedef void (*fr_app_event_list_set_t)(fr_listen_t *li, fr_event_list_t *el, void *nr);
@@ -131,6 +142,9 @@ typedef struct {
 							///< change based on the packet we received.
 
 	fr_app_priority_get_t		priority;	//!< Assign a priority to the packet.
+
+	fr_app_affinity_get_t		affinity;	//!< Get the session key of a packet, so that all of
+							///< the packets in a session go to the same worker.
 } fr_app_t;
 
 /** Public structure describing an application (protocol) specialisation
@@ -265,6 +265,26 @@ size_t fr_atomic_queue_size(fr_atomic_queue_t *aq)
 	return aq->size;
 }
 
+/** Get the number of entries in the queue
+ *
+ * The result is only a snapshot.  Other threads may push or pop
+ * entries while, or immediately after, it's calculated.
+ *
+ * @param[in] aq	the atomic queue.
+ * @return the number of entries in the queue.
+ */
+size_t fr_atomic_queue_length(fr_atomic_queue_t *aq)
+{
+	int64_t head, tail;
+
+	tail = aquire(aq->tail);
+	head = aquire(aq->head);
+
+	if (head <= tail) return 0;
+
+	return head - tail;
+}
+
 #ifdef WITH_VERIFY_PTR
 /** Check the talloc chunk is still valid
  *
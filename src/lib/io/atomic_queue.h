@@ -58,6 +58,7 @@ void			fr_atomic_queue_free(fr_atomic_queue_t **aq);
 bool			fr_atomic_queue_push(fr_atomic_queue_t *aq, void *data);
 bool			fr_atomic_queue_pop(fr_atomic_queue_t *aq, void **p_data);
 size_t			fr_atomic_queue_size(fr_atomic_queue_t *aq);
+size_t			fr_atomic_queue_length(fr_atomic_queue_t *aq);
 
 #ifdef WITH_VERIFY_PTR
 void			fr_atomic_queue_verify(fr_atomic_queue_t *aq);
@@ -178,6 +178,22 @@ typedef size_t (*fr_io_nak_t)(fr_listen_t *li, void *packet_ctx, uint8_t *const
  */
 typedef ssize_t (*fr_io_data_read_t)(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time, uint8_t *buffer, size_t buffer_len, size_t *leftover, uint32_t *priority, bool *dup);
 
+/** Check whether a reader has buffered packets.
+ *
+ *  Datagram readers may read multiple packets from the socket in one
+ *  system call, and then return them one at a time from read().
+ *  Packets which have been read from the kernel will not make the
+ *  socket readable again, so the network side uses this function to
+ *  decide whether it needs to call read() again before going back to
+ *  the event loop.
+ *
+ * @param[in] li		the listener for this socket
+ * @return
+ *	- true if there are packets which have been read from the socket, but not yet returned.
+ *	- false if there are no buffered packets.
+ */
+typedef bool (*fr_io_data_pending_t)(fr_listen_t const *li);
+
 /** Write a socket.
  *
  *  If the socket is a datagram socket, then the function can read or
@@ -279,9 +295,9 @@ typedef void *(*fr_io_track_create_t)(TALLOC_CTX *ctx, uint8_t const *packet, si
  * at a time.  If the field is different, return the result from that
  * field.
  *
- * The comparison order of the fields should be "very different" to
- * "much the same".  The packets are put into an rbtree, so having a
- * large fanout at the top is useful.
+ * The packets are put into a hash table, so the comparison order
+ * of the fields doesn't matter much.  It should still be "very
+ * different" to "much the same", so that the comparison fails early.
  *
  * Note that this function should not check if the packets are
  * completely identical.  Instead, it checks particular fields in the
@@ -299,6 +315,18 @@ typedef void *(*fr_io_track_create_t)(TALLOC_CTX *ctx, uint8_t const *packet, si
  */
 typedef int (*fr_io_track_cmp_t)(void const *instance, void *thread_instance, RADCLIENT *client, void const *one, void const *two);
 
+/** Hash a tracking structure for storing in a duplicate detection table.
+ *
+ * The hash must only use fields which the compare function always
+ * checks, no matter how the listener is configured.  i.e. two
+ * tracking structures which compare as equal must hash to the same
+ * value.
+ *
+ * @param[in] track		packet tracking structure
+ * @return the hash of the tracking structure.
+ */
+typedef uint32_t (*fr_io_track_hash_t)(void const *track);
+
 /**  Handle an error on the socket.
  *
  *  In general, the only thing to do on errors is to close the
@@ -344,6 +372,35 @@ typedef RADCLIENT *(*fr_io_client_find_t)(fr_listen_t *li, fr_ipaddr_t const *ip
 
 typedef void (*fr_io_network_get_t)(void *instance, int *ipproto, bool *dynamic_clients, fr_trie_t const **trie);
 
+/** Whether the IO handler wants one socket per network thread
+ *
+ * If so, the master IO handler calls open() once for every network
+ * thread, with #fr_listen_t.shard and #fr_listen_t.num_shards set.
+ * The IO handler must set SO_REUSEPORT, so that all of the sockets
+ * can bind to the same address.
+ *
+ * @param[in] instance	of the IO handler.
+ * @return true if the sockets should be sharded.
+ */
+typedef bool (*fr_io_shard_get_t)(void const *instance);
+
+/** Get the session affinity of a packet
+ *
+ * The network thread sends packets with the same (non-zero)
+ * affinity to the same worker, so that all of the packets in a
+ * session are processed by one worker.
+ *
+ * @param[in] li		the listener for this socket
+ * @param[in] packet_ctx	as returned by read()
+ * @param[in] buffer		the raw packet
+ * @param[in] buffer_len	the length of the packet
+ * @return
+ *	- 0 the packet has no affinity, and can go to any worker.
+ *	- the affinity (a hash) of the packet.
+ */
+typedef uint32_t (*fr_io_affinity_get_t)(fr_listen_t const *li, void const *packet_ctx,
+					 uint8_t const *buffer, size_t buffer_len);
+
 typedef char const *(*fr_io_name_t)(fr_listen_t *li);
 
 
@@ -0,0 +1,172 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @brief Adaptive spin-then-sleep for event loops
+ * @file io/busy_poll.c
+ *
+ * Under load, the network and worker threads spend a lot of time
+ * going to sleep in kevent(), only to be woken up again a few
+ * microseconds later.  Instead, a thread can spin for a short
+ * time, checking its atomic queues (which needs no system calls),
+ * before it goes to sleep.
+ *
+ * The time spent spinning adapts to the load.  If the thread sleeps
+ * for longer than the maximum spin time, the load is low, and the
+ * spin time is halved, down to zero.  If the thread is woken up
+ * soon after it goes to sleep, the spin time is doubled, up to the
+ * maximum.
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/io/busy_poll.h>
+#include <freeradius-devel/util/debug.h>
+
+/*
+ *	Check the event list (sockets, timers, control messages)
+ *	every N times around the loop.  Doing that needs a system
+ *	call, so we don't do it every time.
+ */
+#define BUSY_POLL_EVENT_CHECK	(16)
+
+/*
+ *	The smallest spin time, as a fraction of the maximum.
+ */
+#define BUSY_POLL_MIN_DIVISOR	(16)
+
+/** Initialise busy polling for an event loop
+ *
+ * @param[in] bp	to initialise.
+ * @param[in] max	the maximum time to spin before sleeping.  0 disables busy polling.
+ */
+void fr_busy_poll_init(fr_busy_poll_t *bp, fr_time_delta_t max)
+{
+	*bp = (fr_busy_poll_t) {
+		.max = max,
+	};
+}
+
+/** Update the spin time after we've slept
+ *
+ */
+static void busy_poll_adapt(fr_busy_poll_t *bp, fr_time_delta_t slept)
+{
+	fr_time_delta_t min = bp->max / BUSY_POLL_MIN_DIVISOR;
+
+	if (!min) min = 1;
+
+	/*
+	 *	We slept for a long time, so spinning would have been
+	 *	a waste of CPU.
+	 */
+	if (slept >= bp->max) {
+		bp->interval /= 2;
+		if (bp->interval < min) bp->interval = 0;
+		return;
+	}
+
+	/*
+	 *	We were woken up soon after going to sleep.  Spinning
+	 *	for a bit longer would have avoided the sleep.
+	 */
+	bp->interval = bp->interval ? (bp->interval * 2) : min;
+	if (bp->interval > bp->max) bp->interval = bp->max;
+}
+
+/** Gather events, spinning for a time before sleeping
+ *
+ * This is a replacement for fr_event_corral(el, fr_time(), true).
+ *
+ * @param[in] bp	busy polling state for the event loop.
+ * @param[in] el	the event loop.
+ * @param[in] check	checks for work without blocking.
+ * @param[in] uctx	passed to check.
+ * @return
+ *	- <0 on error, or if the event loop is exiting.
+ *	- 0 if there are no events to service.
+ *	- >0 if fr_event_service() should be called.
+ */
+int fr_busy_poll_corral(fr_busy_poll_t *bp, fr_event_list_t *el, fr_busy_poll_check_t check, void *uctx)
+{
+	int		num_events;
+	unsigned int	i;
+	fr_time_t	start, now, end;
+
+	if (bp->interval) {
+		start = now = fr_time();
+		end = start + bp->interval;
+		bp->spins++;
+
+		for (i = 1; now < end; i++) {
+			if (check(uctx)) {
+				bp->hits++;
+				bp->spin_time += fr_time() - start;
+
+				/*
+				 *	The caller has work to do, so
+				 *	make sure that it services the
+				 *	event list.
+				 */
+				num_events = fr_event_corral(el, fr_time(), false);
+				if (num_events < 0) return num_events;
+
+				return num_events + 1;
+			}
+
+			if ((i % BUSY_POLL_EVENT_CHECK) == 0) {
+				num_events = fr_event_corral(el, now, false);
+				if (num_events != 0) {
+					if (num_events > 0) bp->hits++;
+					bp->spin_time += fr_time() - start;
+					return num_events;
+				}
+			}
+
+			CPU_RELAX();
+			now = fr_time();
+		}
+
+		bp->spin_time += now - start;
+	}
+
+	start = fr_time();
+	num_events = fr_event_corral(el, start, true);
+	if (num_events < 0) return num_events;
+
+	bp->wakeups++;
+	if (bp->max) busy_poll_adapt(bp, fr_time() - start);
+
+	return num_events;
+}
+
+/** Print busy polling statistics
+ *
+ * @param[in] fp	to print to.
+ * @param[in] bp	to print.
+ */
+void fr_busy_poll_stats_fprint(FILE *fp, fr_busy_poll_t const *bp)
+{
+	fprintf(fp, "busy_poll.max\t%.9f\n", (double) bp->max / NSEC);
+	fprintf(fp, "busy_poll.interval\t%.9f\n", (double) bp->interval / NSEC);
+	fprintf(fp, "busy_poll.wakeups\t%" PRIu64 "\n", bp->wakeups);
+	fprintf(fp, "busy_poll.spins\t%" PRIu64 "\n", bp->spins);
+	fprintf(fp, "busy_poll.hits\t%" PRIu64 "\n", bp->hits);
+	fprintf(fp, "busy_poll.spin_time\t%.9f\n", (double) bp->spin_time / NSEC);
+}
@@ -0,0 +1,79 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file io/busy_poll.h
+ * @brief Adaptive spin-then-sleep for event loops.
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSIDH(busy_poll_h, "$Id$")
+
+#include <stdio.h>
+#include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Tell the CPU we're spinning, so it can save power, and not starve its sibling hyperthread
+ *
+ */
+#if defined(__i386__) || defined(__x86_64__)
+#  define CPU_RELAX() __asm__ __volatile__("pause")
+#elif defined(__aarch64__)
+#  define CPU_RELAX() __asm__ __volatile__("yield")
+#else
+#  define CPU_RELAX()
+#endif
+
+/** Busy polling state for one event loop
+ *
+ */
+typedef struct {
+	fr_time_delta_t	max;		//!< maximum time to spin.  0 disables busy polling.
+	fr_time_delta_t	interval;	//!< how long we currently spin before sleeping.
+
+	uint64_t	wakeups;	//!< number of times we slept, and then woke up.
+	uint64_t	spins;		//!< number of times we spun.
+	uint64_t	hits;		//!< spins which found work.
+	fr_time_delta_t	spin_time;	//!< total time spent spinning.
+} fr_busy_poll_t;
+
+/** Check for work without blocking
+ *
+ * Should only look at memory, e.g. the atomic queues of channels,
+ * and pull any work it finds into the callers own queues.
+ *
+ * @param[in] uctx	the thread which is spinning.
+ * @return true if there is work to do.
+ */
+typedef bool (*fr_busy_poll_check_t)(void *uctx);
+
+void	fr_busy_poll_init(fr_busy_poll_t *bp, fr_time_delta_t max) CC_HINT(nonnull);
+
+int	fr_busy_poll_corral(fr_busy_poll_t *bp, fr_event_list_t *el,
+			    fr_busy_poll_check_t check, void *uctx) CC_HINT(nonnull(1,2,3));
+
+void	fr_busy_poll_stats_fprint(FILE *fp, fr_busy_poll_t const *bp) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
@@ -24,6 +24,7 @@
  */
 RCSID("$Id$")
 
+#include <freeradius-devel/io/busy_poll.h>
 #include <freeradius-devel/io/channel.h>
 #include <freeradius-devel/io/control.h>
 #include <freeradius-devel/util/log.h>
@@ -35,6 +36,8 @@ RCSID("$Id$")
 #  include <freeradius-devel/util/stdatomic.h>
 #endif
 
+#include <sched.h>
+
 /*
  *	Debugging, mainly for channel_test
  */
@@ -49,6 +52,13 @@ RCSID("$Id$")
  */
 #define ENABLE_SKIPS (0)
 
+/*
+ *	How many times fr_channel_move_request() retries putting a
+ *	request back, spinning and then yielding, before giving up.
+ */
+#define CHANNEL_MOVE_SPINS	(1024)
+#define CHANNEL_MOVE_YIELDS	(1024)
+
 typedef enum {
 	TO_RESPONDER = 0,
 	TO_REQUESTOR = 1
@@ -131,6 +141,9 @@ typedef struct {
 
 	atomic_bool		active;		//!< Whether the channel is active.
 
+	atomic_bool		signal_pending;	//!< We've signalled that there's data ready, and the
+						///< other end hasn't yet seen the signal.
+
 	fr_channel_stats_t	stats;		//!< channel statistics
 } fr_channel_end_t;
 
@@ -261,6 +274,12 @@ fr_channel_t *fr_channel_create(TALLOC_CTX *ctx, fr_control_t *requestor, fr_con
  * end[1].  We also send which end in 'which' (0, 1) to further help
  * the recipient.
  *
+ * Signals are coalesced.  If the other end hasn't yet seen our
+ * previous signal, it will drain the queue when it does.  So there's
+ * no need to wake it up again.  The flag is cleared by
+ * fr_channel_service_message(), before the other end drains the
+ * queue.
+ *
  * @param[in] ch	the channel.
  * @param[in] when	the data was ready.  Typically taken from the message.
  * @param[in] end	of the channel that the message was written to.
@@ -273,6 +292,12 @@ static int fr_channel_data_ready(fr_channel_t *ch, fr_time_t when, fr_channel_en
 {
 	fr_channel_control_t cc;
 
+	if (atomic_exchange(&end->signal_pending, true)) {
+		end->stats.coalesced++;
+		end->must_signal = false;
+		return 0;
+	}
+
 	end->stats.last_sent_signal = when;
 	end->stats.signals++;
 	end->must_signal = false;
@@ -285,7 +310,16 @@ static int fr_channel_data_ready(fr_channel_t *ch, fr_time_t when, fr_channel_en
 	       fr_table_str_by_value(channel_direction, end->direction, "<INVALID>"),
 	       fr_table_str_by_value(channel_signals, which, "<INVALID>"));
 
-	return fr_control_message_send(end->control, end->rb, FR_CONTROL_ID_CHANNEL, &cc, sizeof(cc));
+	if (fr_control_message_send(end->control, end->rb, FR_CONTROL_ID_CHANNEL, &cc, sizeof(cc)) < 0) {
+		/*
+		 *	The signal was never sent, so the next one
+		 *	has to be.
+		 */
+		atomic_store(&end->signal_pending, false);
+		return -1;
+	}
+
+	return 0;
 }
 
 #define IALPHA (8)
@@ -397,6 +431,123 @@ int fr_channel_send_request(fr_channel_t *ch, fr_channel_data_t *cd)
 	return 0;
 }
 
+/** Return the number of requests which the responder hasn't yet read
+ *
+ * @param[in] ch	the channel.
+ * @return the number of requests in the inbound queue of the responder.
+ */
+size_t fr_channel_requests_queued(fr_channel_t *ch)
+{
+	if (ch->same_thread) return 0;
+
+	return fr_atomic_queue_length(ch->end[TO_RESPONDER].aq);
+}
+
+/** Move a request which the responder hasn't yet read, to another channel
+ *
+ * This is used by the requestor to re-balance work when a
+ * responder stops servicing its inbound queue.  The original
+ * responder never sees the request, and the reply comes back on
+ * the new channel.
+ *
+ * Both channels MUST have the same requestor, and this function
+ * MUST be called from the requestor's thread.  The responders
+ * can run concurrently, as popping from the atomic queue is
+ * safe.
+ *
+ * @param[in] to	the channel to move the request to.
+ * @param[in] from	the channel to take the request from.
+ * @return
+ *	- <0 on error.  The request is left in the "from" channel.
+ *	- 0 if there was nothing to move.
+ *	- 1 if a request was moved.
+ */
+int fr_channel_move_request(fr_channel_t *to, fr_channel_t *from)
+{
+	fr_channel_data_t	*cd;
+	fr_channel_end_t	*requestor, *old;
+	unsigned int		i;
+
+	if (to->same_thread || from->same_thread) return 0;
+
+	if (!atomic_load(&to->end[TO_RESPONDER].active)) {
+		fr_strerror_const("Channel not active");
+		return -1;
+	}
+
+	requestor = &(to->end[TO_RESPONDER]);
+	old = &(from->end[TO_RESPONDER]);
+
+	/*
+	 *	We're the only writer, so if there's room now, there
+	 *	will still be room when we push.
+	 */
+	if (fr_atomic_queue_length(requestor->aq) >= fr_atomic_queue_size(requestor->aq)) {
+		fr_strerror_printf("Failed pushing to atomic queue - full.  Queue contains %zu items",
+				   fr_atomic_queue_size(requestor->aq));
+		return -1;
+	}
+
+	/*
+	 *	The responder may have already taken it.
+	 */
+	if (!fr_atomic_queue_pop(old->aq, (void **) &cd)) return 0;
+
+	cd->live.sequence = requestor->sequence + 1;
+	cd->live.ack = requestor->ack;
+
+	if (!fr_atomic_queue_push(requestor->aq, cd)) {
+		fr_strerror_const("Failed pushing to atomic queue - entry is busy");
+
+		/*
+		 *	A responder is part way through popping an
+		 *	entry.  Put the request back with a new sequence
+		 *	number, as the old responder may have read
+		 *	later requests.  We just freed a slot, so this
+		 *	only fails until the other pop finishes.
+		 *
+		 *	That's a few instructions, so spin first.  The
+		 *	responder may be descheduled part way through,
+		 *	so then give up the CPU to it.  If it still
+		 *	hasn't finished, the queue is broken.
+		 */
+		cd->live.sequence = ++old->sequence;
+		cd->live.ack = old->ack;
+		for (i = 0; !fr_atomic_queue_push(old->aq, cd); i++) {
+			fr_fatal_assert_msg(i < (CHANNEL_MOVE_SPINS + CHANNEL_MOVE_YIELDS),
+					    "Failed returning request to channel %p", from);
+
+			if (i < CHANNEL_MOVE_SPINS) {
+				CPU_RELAX();
+			} else {
+				sched_yield();
+			}
+		}
+		return -1;
+	}
+
+	/*
+	 *	The responder ignores gaps in the sequence numbers, so
+	 *	the old channel just sees one less outstanding request.
+	 */
+	fr_assert(old->stats.outstanding > 0);
+	old->stats.outstanding--;
+
+	/*
+	 *	The request is older than ones we've already sent on
+	 *	this channel, so don't update the message interval.
+	 */
+	requestor->sequence = cd->live.sequence;
+	if (requestor->stats.last_write < cd->m.when) requestor->stats.last_write = cd->m.when;
+	requestor->stats.outstanding++;
+	requestor->stats.packets++;
+
+	MPRINT("REQUESTOR moves request, num_outstanding %"PRIu64"\n", requestor->stats.outstanding);
+
+	(void) fr_channel_data_ready(to, cd->m.when, requestor, FR_CHANNEL_SIGNAL_DATA_TO_RESPONDER);
+	return 1;
+}
+
 /** Receive a reply message from the channel
  *
  * @param[in] ch	the channel to read data from.
@@ -489,8 +640,11 @@ bool fr_channel_recv_request(fr_channel_t *ch)
 	responder->ack = cd->live.sequence;
 	responder->their_view_of_my_sequence = cd->live.ack;
 
-	fr_assert(responder->stats.last_read_other <= cd->m.when);
-	responder->stats.last_read_other = cd->m.when;
+	/*
+	 *	Requests moved from another channel can be older than
+	 *	ones we've already read.
+	 */
+	if (responder->stats.last_read_other < cd->m.when) responder->stats.last_read_other = cd->m.when;
 
 	ch->end[TO_REQUESTOR].recv(ch->end[TO_REQUESTOR].recv_uctx, ch, cd);
 
@@ -707,9 +861,22 @@ fr_channel_event_t fr_channel_service_message(fr_time_t when, fr_channel_t **p_c
 	 *	events, and have no extra processing.  We just
 	 *	return them as-is.
 	 */
-	case FR_CHANNEL_SIGNAL_ERROR:
 	case FR_CHANNEL_SIGNAL_DATA_TO_RESPONDER:
+		/*
+		 *	Clear the flag BEFORE the caller drains the
+		 *	queue.  Anything pushed after this will send a
+		 *	new signal.
+		 */
+		atomic_store(&ch->end[TO_RESPONDER].signal_pending, false);
+		MPRINT("channel got %d\n", cs);
+		return (fr_channel_event_t) cs;
+
 	case FR_CHANNEL_SIGNAL_DATA_TO_REQUESTOR:
+		atomic_store(&ch->end[TO_REQUESTOR].signal_pending, false);
+		MPRINT("channel got %d\n", cs);
+		return (fr_channel_event_t) cs;
+
+	case FR_CHANNEL_SIGNAL_ERROR:
 	case FR_CHANNEL_SIGNAL_OPEN:
 	case FR_CHANNEL_SIGNAL_CLOSE:
 		MPRINT("channel got %d\n", cs);
@@ -722,6 +889,7 @@ fr_channel_event_t fr_channel_service_message(fr_time_t when, fr_channel_t **p_c
 	 */
 	case FR_CHANNEL_SIGNAL_DATA_DONE_RESPONDER:
 		MPRINT("channel got data_done_responder\n");
+		atomic_store(&ch->end[TO_REQUESTOR].signal_pending, false);
 		ce = FR_CHANNEL_DATA_READY_REQUESTOR;
 		ch->end[TO_RESPONDER].must_signal = true;
 		break;
@@ -753,6 +921,14 @@ fr_channel_event_t fr_channel_service_message(fr_time_t when, fr_channel_t **p_c
 	fr_assert(ack <= requestor->sequence);
 #endif
 
+	/*
+	 *	Every request we've pushed has either sent a signal,
+	 *	or found that one was still pending.  So unless there
+	 *	are requests which the responder hasn't read, waking it
+	 *	up again is a waste of time.
+	 */
+	if (!fr_atomic_queue_length(requestor->aq)) return ce;
+
 	/*
 	 *	We're signaling it again...
 	 */
@@ -958,11 +1134,16 @@ int fr_channel_signal_open(fr_channel_t *ch)
 	return fr_control_message_send(ch->end[TO_RESPONDER].control, ch->end[TO_RESPONDER].rb, FR_CONTROL_ID_CHANNEL, &cc, sizeof(cc));
 }
 
+#define CHANNEL_PER_SIGNAL(_stats) ((_stats)->signals ? ((double) (_stats)->packets / (_stats)->signals) : 0.0)
+
 void fr_channel_stats_log(fr_channel_t const *ch, fr_log_t const *log, char const *file, int line)
 {
 	fr_log(log, L_INFO, file, line, "requestor\n");
 	fr_log(log, L_INFO, file, line, "\tsignals sent = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.signals);
 	fr_log(log, L_INFO, file, line, "\tsignals re-sent = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.resignals);
+	fr_log(log, L_INFO, file, line, "\tsignals coalesced = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.coalesced);
+	fr_log(log, L_INFO, file, line, "\tmessages per signal = %.2f\n",
+	       CHANNEL_PER_SIGNAL(&ch->end[TO_RESPONDER].stats));
 	fr_log(log, L_INFO, file, line, "\tkevents checked = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.kevents);
 	fr_log(log, L_INFO, file, line, "\toutstanding = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.outstanding);
 	fr_log(log, L_INFO, file, line, "\tpackets processed = %" PRIu64 "\n", ch->end[TO_RESPONDER].stats.packets);
@@ -973,6 +1154,9 @@ void fr_channel_stats_log(fr_channel_t const *ch, fr_log_t const *log, char cons
 
 	fr_log(log, L_INFO, file, line, "responder\n");
 	fr_log(log, L_INFO, file, line, "\tsignals sent = %" PRIu64"\n", ch->end[TO_REQUESTOR].stats.signals);
+	fr_log(log, L_INFO, file, line, "\tsignals coalesced = %" PRIu64 "\n", ch->end[TO_REQUESTOR].stats.coalesced);
+	fr_log(log, L_INFO, file, line, "\tmessages per signal = %.2f\n",
+	       CHANNEL_PER_SIGNAL(&ch->end[TO_REQUESTOR].stats));
 	fr_log(log, L_INFO, file, line, "\tkevents checked = %" PRIu64 "\n", ch->end[TO_REQUESTOR].stats.kevents);
 	fr_log(log, L_INFO, file, line, "\tpackets processed = %" PRIu64 "\n", ch->end[TO_REQUESTOR].stats.packets);
 	fr_log(log, L_INFO, file, line, "\tmessage interval (RTT) = %" PRIu64 "\n", ch->end[TO_REQUESTOR].stats.message_interval);
@@ -81,6 +81,8 @@ typedef struct {
 	uint64_t       		outstanding; 	//!< Number of outstanding requests with no reply.
 	uint64_t		signals;	//!< Number of kevent signals we've sent.
 	uint64_t		resignals;	//!< Number of signals resent.
+	uint64_t		coalesced;	//!< Number of signals we didn't send, because the
+						///< other end hadn't yet seen the previous one.
 
 	uint64_t		packets;	//!< Number of actual data packets.
 
@@ -161,6 +163,9 @@ fr_channel_t *fr_channel_create(TALLOC_CTX *ctx, fr_control_t *frontend, fr_cont
 int	fr_channel_send_request(fr_channel_t *ch, fr_channel_data_t *cm) CC_HINT(nonnull);
 bool	fr_channel_recv_request(fr_channel_t *ch) CC_HINT(nonnull);
 
+size_t	fr_channel_requests_queued(fr_channel_t *ch) CC_HINT(nonnull);
+int	fr_channel_move_request(fr_channel_t *to, fr_channel_t *from) CC_HINT(nonnull);
+
 int	fr_channel_send_reply(fr_channel_t *ch, fr_channel_data_t *cd) CC_HINT(nonnull);
 int	fr_channel_null_reply(fr_channel_t *ch) CC_HINT(nonnull);
 
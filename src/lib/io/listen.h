@@ -26,6 +26,10 @@ struct fr_listen {
 	fr_rb_node_t		virtual_server_node;	//!< Entry into the virtual server's tree of listeners.
 
 	int			fd;			//!< file descriptor for this socket - set by open
+	int			read_fd;		//!< file descriptor which becomes readable when there's
+							///< data to read, if that's not fd, e.g. an eventfd
+							///< signalling completed asynchronous reads.  0 if
+							///< fd should be used - set by open
 	char const		*name;			//!< printable name for this socket - set by open
 
 	fr_app_io_t const	*app_io;		//!< I/O path functions.
@@ -39,6 +43,12 @@ struct fr_listen {
 
 	CONF_SECTION		*server_cs;		//!< CONF_SECTION of the server
 
+	unsigned int		shard;			//!< Which network thread this socket belongs to, when
+							///< the address is shared by one SO_REUSEPORT socket
+							///< per network thread.
+	unsigned int		num_shards;		//!< How many sockets share the address.  0 or 1 if
+							///< the socket isn't sharded.
+
 	bool			connected;		//!< is this for a connected socket?
 	bool			track_duplicates;	//!< do we track duplicate packets?
 	size_t			default_message_size;	//!< copied from app_io, but may be changed
@@ -68,3 +78,11 @@ struct fr_async_s {
 #define request_is_internal(_x) (!request_is_external(_x))
 
 int fr_io_listen_free(fr_listen_t *li);
+
+/** Return the file descriptor to wait on for reads
+ *
+ */
+static inline int fr_listen_read_fd(fr_listen_t const *li)
+{
+	return li->read_fd ? li->read_fd : li->fd;
+}
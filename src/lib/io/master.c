@@ -31,6 +31,7 @@
 #include <freeradius-devel/unlang/base.h>
 
 #include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/oa_hash.h>
 #include <freeradius-devel/util/syserror.h>
 
 typedef struct {
@@ -98,7 +99,7 @@ struct fr_io_client_s {
 	fr_io_instance_t const		*inst;		//!< parent instance for master IO handler
 	fr_io_thread_t			*thread;
 	fr_event_timer_t const		*ev;		//!< when we clean up the client
-	rbtree_t			*table;		//!< tracking table for packets
+	fr_oa_hash_t			*table;		//!< tracking table for packets
 
 	fr_heap_t			*pending;	//!< pending packets for this client
 	fr_hash_table_t			*addresses;	//!< list of src/dst addresses used by this client
@@ -158,9 +159,9 @@ static int track_free(fr_io_track_t *track)
 static int track_dedup_free(fr_io_track_t *track)
 {
 	fr_assert(track->client->table != NULL);
-	fr_assert(rbtree_finddata(track->client->table, track) != NULL);
+	fr_assert(fr_oa_hash_find(track->client->table, track) != NULL);
 
-	if (!rbtree_deletebydata(track->client->table, track)) {
+	if (!fr_oa_hash_delete(track->client->table, track)) {
 		fr_assert(0);
 	}
 
@@ -262,6 +263,54 @@ static int connection_cmp(void const *one, void const *two)
 	return address_cmp(a->address, b->address);
 }
 
+/** Hash the fields of an IP address which fr_ipaddr_cmp() checks
+ *
+ *  fr_ipaddr_t has padding, and bytes past the end of IPv4
+ *  addresses, which aren't always zeroed.  So we can't hash the
+ *  whole structure.
+ */
+static uint32_t ipaddr_hash(fr_ipaddr_t const *ipaddr)
+{
+	uint32_t hash;
+
+	hash = fr_hash(&ipaddr->af, sizeof(ipaddr->af));
+	hash = fr_hash_update(&ipaddr->prefix, sizeof(ipaddr->prefix), hash);
+
+	switch (ipaddr->af) {
+	case AF_INET:
+		return fr_hash_update(&ipaddr->addr.v4, sizeof(ipaddr->addr.v4), hash);
+
+#ifdef HAVE_STRUCT_SOCKADDR_IN6
+	case AF_INET6:
+		hash = fr_hash_update(&ipaddr->scope_id, sizeof(ipaddr->scope_id), hash);
+		return fr_hash_update(&ipaddr->addr.v6, sizeof(ipaddr->addr.v6), hash);
+#endif
+
+	default:
+		return hash;
+	}
+}
+
+/** Hash the fields which track_cmp() always checks
+ *
+ *  If the protocol can't hash its tracking structures, then all
+ *  packets from the same address end up in the same chain.  That's
+ *  slow, but still correct.
+ */
+static uint32_t track_hash(void const *data)
+{
+	fr_io_track_t const *track = talloc_get_type_abort_const(data, fr_io_track_t);
+	fr_io_address_t const *address = track->address;
+	uint32_t hash;
+
+	hash = ipaddr_hash(&address->socket.inet.src_ipaddr);
+	hash = fr_hash_update(&address->socket.inet.src_port, sizeof(address->socket.inet.src_port), hash);
+	hash = fr_hash_update(&address->socket.inet.dst_port, sizeof(address->socket.inet.dst_port), hash);
+
+	if (!track->client->inst->app_io->track_hash) return hash;
+
+	return hash ^ track->client->inst->app_io->track_hash(track->packet);
+}
 
 static int track_cmp(void const *one, void const *two)
 {
@@ -291,6 +340,19 @@ static int track_cmp(void const *one, void const *two)
 						a->packet, b->packet);
 }
 
+/** Hash tracking entries for a connected socket
+ *
+ *  All packets come from the same address, so only the protocol
+ *  fields matter.
+ */
+static uint32_t track_connected_hash(void const *data)
+{
+	fr_io_track_t const *track = talloc_get_type_abort_const(data, fr_io_track_t);
+
+	if (!track->client->inst->app_io->track_hash) return 0;
+
+	return track->client->inst->app_io->track_hash(track->packet);
+}
 
 static int track_connected_cmp(void const *one, void const *two)
 {
@@ -528,8 +590,8 @@ static fr_io_connection_t *fr_io_connection_alloc(fr_io_instance_t const *inst,
 	 *	#todo - unify the code with static clients?
 	 */
 	if (inst->app_io->track_duplicates) {
-		MEM(connection->client->table = rbtree_talloc_alloc(client, fr_io_track_t, node,
-								    track_connected_cmp, NULL, RBTREE_FLAG_NONE));
+		MEM(connection->client->table = fr_oa_hash_alloc(client, track_connected_hash,
+								 track_connected_cmp, 0));
 	}
 
 	/*
@@ -620,6 +682,7 @@ static fr_io_connection_t *fr_io_connection_alloc(fr_io_instance_t const *inst,
 		 *	Glue in the actual app_io
 		 */
 		li->connected = true;
+		li->read_fd = 0;	/* connected sockets are read directly */
 		li->app_io = thread->child->app_io;
 		li->thread_instance = connection;
 		li->app_io_instance = dl_inst->data;
@@ -660,6 +723,7 @@ static fr_io_connection_t *fr_io_connection_alloc(fr_io_instance_t const *inst,
 		fr_assert(li->app_io == &fr_master_app_io);
 
 		li->connected = true;
+		li->read_fd = 0;
 		li->thread_instance = connection;
 		li->app_io_instance = li->thread_instance;
 		li->track_duplicates = thread->child->app_io->track_duplicates;
@@ -895,7 +959,7 @@ static fr_io_track_t *fr_io_track_add(fr_io_client_t *client,
 	/*
 	 *	No existing duplicate.  Return the new tracking entry.
 	 */
-	old = rbtree_finddata(client->table, track);
+	old = fr_oa_hash_find(client->table, track);
 	if (!old) goto do_insert;
 
 	fr_assert(old->client == client);
@@ -905,7 +969,7 @@ static fr_io_track_t *fr_io_track_add(fr_io_client_t *client,
 	 *
 	 *	2020-08-17, this assertion fails randomly in travis.
 	 *	Which means that "track" was in the free list, *and*
-	 *	in the rbtree.
+	 *	in the tracking table.
 	 */
 	fr_assert(old != track);
 
@@ -964,7 +1028,7 @@ static fr_io_track_t *fr_io_track_add(fr_io_client_t *client,
 	} else {
 		fr_assert(client == old->client);
 
-		if (!rbtree_deletebydata(client->table, old)) {
+		if (!fr_oa_hash_delete(client->table, old)) {
 			fr_assert(0);
 		}
 		if (old->ev) (void) fr_event_timer_delete(&old->ev);
@@ -975,7 +1039,7 @@ static fr_io_track_t *fr_io_track_add(fr_io_client_t *client,
 	}
 
 do_insert:
-	if (!rbtree_insert(client->table, track)) {
+	if (!fr_oa_hash_insert(client->table, track)) {
 		fr_assert(0);
 	}
 
@@ -1378,8 +1442,8 @@ do_read:
 			/*
 			 *	Look up the allowed networks.
 			 */
-			network = fr_trie_lookup(inst->networks, &address.socket.inet.src_ipaddr.addr,
-						 address.socket.inet.src_ipaddr.prefix);
+			network = fr_lpm_lookup(inst->networks_lpm, &address.socket.inet.src_ipaddr.addr,
+						address.socket.inet.src_ipaddr.prefix);
 			if (!network) goto ignore;
 
 			/*
@@ -1453,8 +1517,7 @@ do_read:
 		 */
 		if (inst->app_io->track_duplicates) {
 			fr_assert(inst->app_io->compare != NULL);
-			MEM(client->table = rbtree_talloc_alloc(client, fr_io_track_t, node, track_cmp,
-								NULL, RBTREE_FLAG_NONE));
+			MEM(client->table = fr_oa_hash_alloc(client, track_hash, track_cmp, 0));
 		}
 
 		/*
@@ -1725,6 +1788,38 @@ done:
 	return 0;
 }
 
+/** Check if the child has buffered packets
+ *
+ */
+static bool mod_read_pending(fr_listen_t const *li)
+{
+	fr_io_instance_t const *inst;
+	fr_io_connection_t *connection;
+	fr_listen_t *child;
+
+	get_inst(UNCONST(fr_listen_t *, li), &inst, NULL, &connection, &child);
+
+	if (!inst->app_io->read_pending) return false;
+
+	return inst->app_io->read_pending(child);
+}
+
+/** Flush the child's queued writes
+ *
+ */
+static int mod_flush(fr_listen_t *li)
+{
+	fr_io_instance_t const *inst;
+	fr_io_connection_t *connection;
+	fr_listen_t *child;
+
+	get_inst(li, &inst, NULL, &connection, &child);
+
+	if (!inst->app_io->flush) return 0;
+
+	return inst->app_io->flush(child);
+}
+
 /** Inject a packet to a connection.
  *
  *  Always called in the context of the network.
@@ -1794,6 +1889,7 @@ static int mod_open(fr_listen_t *li)
 	if (inst->app_io->open(thread->child) < 0) return -1;
 
 	li->fd = thread->child->fd;	/* copy this back up */
+	li->read_fd = thread->child->read_fd;
 
 	/*
 	 *	Set the name of the socket.
@@ -2591,6 +2687,18 @@ static int mod_bootstrap(void *instance, CONF_SECTION *cs)
 		inst->app_io->network_get(inst->app_io_instance, &inst->ipproto, &inst->dynamic_clients, &inst->networks);
 	}
 
+	/*
+	 *	The networks don't change after this, so build a
+	 *	faster table for looking them up.
+	 */
+	if (inst->networks) {
+		inst->networks_lpm = fr_lpm_alloc_from_trie(inst, inst->networks);
+		if (!inst->networks_lpm) {
+			cf_log_perr(cs, "Failed building table of allowed networks");
+			return -1;
+		}
+	}
+
 	/*
 	 *	The caller determines if we have dynamic clients.
 	 */
@@ -2881,25 +2989,16 @@ int fr_io_listen_free(fr_listen_t *li)
 	return 0;
 }
 
-int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *sc,
-			size_t default_message_size, size_t num_messages)
+/** Create one listener, and add it to the scheduler
+ *
+ */
+static int master_io_listen_shard(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *sc,
+				  size_t default_message_size, size_t num_messages,
+				  unsigned int shard, unsigned int num_shards)
 {
 	fr_listen_t	*li, *child;
 	fr_io_thread_t	*thread;
 
-	/*
-	 *	No IO paths, so we don't initialize them.
-	 */
-	if (!inst->app_io) {
-		fr_assert(!inst->dynamic_clients);
-		return 0;
-	}
-
-	if (!inst->app_io->thread_inst_size) {
-		fr_strerror_const("IO modules MUST set 'thread_inst_size' when using the master IO handler.");
-		return -1;
-	}
-
 	/*
 	 *	Build the #fr_listen_t.  This describes the complete
 	 *	path data takes from the socket to the decoder and
@@ -2908,6 +3007,9 @@ int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *
 	MEM(li = talloc_zero(ctx, fr_listen_t));
 	talloc_set_destructor(li, fr_io_listen_free);
 
+	li->shard = shard;
+	li->num_shards = num_shards;
+
 	/*
 	 *	The first listener is the one for the application
 	 *	(e.g. RADIUS).  However, we mangle the IO path to
@@ -3005,6 +3107,7 @@ int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *
 	}
 
 	li->fd = child->fd;	/* copy this back up */
+	li->read_fd = child->read_fd;
 
 	if (!child->app_io->get_name) {
 		child->name = child->app_io->name;
@@ -3014,9 +3117,10 @@ int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *
 	li->name = child->name;
 
 	/*
-	 *	Record which socket we opened.
+	 *	Record which socket we opened.  The other shards
+	 *	deliberately share the address of the first one.
 	 */
-	if (child->app_io_addr) {
+	if (child->app_io_addr && (shard == 0)) {
 		fr_listen_t *other;
 
 		other = listen_find_any(thread->child);
@@ -3045,6 +3149,65 @@ int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *
 	return 0;
 }
 
+int fr_master_io_listen(TALLOC_CTX *ctx, fr_io_instance_t *inst, fr_schedule_t *sc,
+			size_t default_message_size, size_t num_messages)
+{
+	unsigned int	i, num_shards = 1;
+
+	/*
+	 *	No IO paths, so we don't initialize them.
+	 */
+	if (!inst->app_io) {
+		fr_assert(!inst->dynamic_clients);
+		return 0;
+	}
+
+	if (!inst->app_io->thread_inst_size) {
+		fr_strerror_const("IO modules MUST set 'thread_inst_size' when using the master IO handler.");
+		return -1;
+	}
+
+	/*
+	 *	Open one socket per network thread, and let the
+	 *	kernel spread the packets across them.
+	 */
+	if (inst->app_io->shard_get && inst->app_io->shard_get(inst->app_io_instance)) {
+		num_shards = fr_schedule_num_networks(sc);
+	}
+
+	for (i = 0; i < num_shards; i++) {
+		if (master_io_listen_shard(ctx, inst, sc, default_message_size, num_messages,
+					   i, num_shards) < 0) return -1;
+	}
+
+	return 0;
+}
+
+/** Get the session affinity of a packet
+ *
+ * The application hashes the session key from the packet, and we
+ * add in the client address.  So the same key from different
+ * clients doesn't always go to the same worker.
+ */
+static uint32_t mod_affinity(fr_listen_t const *li, void const *packet_ctx,
+			     uint8_t const *buffer, size_t buffer_len)
+{
+	fr_io_instance_t const	*inst = li->app_io_instance;
+	fr_io_track_t const	*track = packet_ctx;
+	fr_ipaddr_t const	*ipaddr;
+	uint32_t		hash;
+
+	if (li->connected || !inst->app->affinity) return 0;
+
+	hash = inst->app->affinity(inst->app_instance, buffer, buffer_len);
+	if (!hash) return 0;
+
+	ipaddr = &track->address->socket.inet.src_ipaddr;
+	hash = fr_hash_update(&ipaddr->addr, (ipaddr->af == AF_INET) ? sizeof(ipaddr->addr.v4) : sizeof(ipaddr->addr.v6),
+			      hash);
+
+	return hash ? hash : 1;
+}
 
 fr_app_io_t fr_master_app_io = {
 	.magic			= RLM_MODULE_INIT,
@@ -3057,11 +3220,14 @@ fr_app_io_t fr_master_app_io = {
 	.track_duplicates	= true,
 
 	.read			= mod_read,
+	.read_pending		= mod_read_pending,
 	.write			= mod_write,
+	.flush			= mod_flush,
 	.inject			= mod_inject,
 
 	.open			= mod_open,
 	.close			= mod_close,
 	.event_list_set		= mod_event_list_set,
 	.get_name		= mod_name,
+	.affinity		= mod_affinity,
 };
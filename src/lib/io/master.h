@@ -30,6 +30,7 @@ RCSIDH(master_h, "$Id$")
 #include <freeradius-devel/server/base.h>
 #include <freeradius-devel/io/schedule.h>
 #include <freeradius-devel/io/application.h>
+#include <freeradius-devel/util/lpm.h>
 #include <freeradius-devel/util/trie.h>
 
 #ifdef __cplusplus
@@ -39,7 +40,6 @@ extern "C" {
 typedef struct fr_io_client_s fr_io_client_t;
 
 typedef struct {
-	fr_rb_node_t			node;		//!< rbtree node in the tracking tree.
 	fr_event_timer_t const		*ev;		//!< when we clean up this tracking entry
 	fr_time_t			timestamp;	//!< when this packet was received
 	fr_time_t			expires;	//!< when this packet expires
@@ -109,6 +109,7 @@ typedef struct {
 	char const			*transport;			//!< transport, typically name of IP proto
 
 	fr_trie_t const			*networks;     			//!< trie of allowed networks
+	fr_lpm_t const			*networks_lpm;			//!< read-only copy of "networks", for fast lookups
 } fr_io_instance_t;
 
 extern fr_app_io_t fr_master_app_io;
@@ -103,6 +103,9 @@ struct fr_message_set_s {
 
 	size_t			max_allocation;	//!< maximum allocation size
 
+	int			numa_node;	//!< NUMA node of the thread which reads the messages.
+						//!< -1 for any.
+
 	int			allocated;
 	int			freed;
 
@@ -170,10 +173,41 @@ fr_message_set_t *fr_message_set_create(TALLOC_CTX *ctx, int num_messages, size_
 	}
 
 	ms->max_allocation = ring_buffer_size / 2;
+	ms->numa_node = -1;
 
 	return ms;
 }
 
+/** Place the messages and packets of a message set on the reader's NUMA node
+ *
+ *  Message sets are written by the thread which creates them, so
+ *  their memory would otherwise be placed on the writer's node.
+ *  Ring buffers which are added as the message set grows are placed
+ *  on the same node.
+ *
+ * @param[in] ms	to place.
+ * @param[in] node	of the thread which reads the messages.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_message_set_numa_node_set(fr_message_set_t *ms, int node)
+{
+	int i;
+
+	ms->numa_node = node;
+
+	for (i = 0; i <= ms->mr_max; i++) {
+		if (fr_ring_buffer_numa_node_set(ms->mr_array[i], node) < 0) return -1;
+	}
+
+	for (i = 0; i <= ms->rb_max; i++) {
+		if (fr_ring_buffer_numa_node_set(ms->rb_array[i], node) < 0) return -1;
+	}
+
+	return 0;
+}
+
 
 /** Mark a message as done
  *
@@ -757,6 +791,7 @@ static fr_message_t *fr_message_get_message(fr_message_set_t *ms, bool *p_cleane
 		fr_strerror_const_push("Failed allocating ring buffer");
 		return NULL;
 	}
+	if (ms->numa_node >= 0) (void) fr_ring_buffer_numa_node_set(mr, ms->numa_node);
 
 	/*
 	 *	Set the new one as current for all new
@@ -880,6 +915,7 @@ alloc_rb:
 		fr_strerror_const_push("Failed allocating ring buffer");
 		goto cleanup;
 	}
+	if (ms->numa_node >= 0) (void) fr_ring_buffer_numa_node_set(rb, ms->numa_node);
 
 	MPRINT("RING BUFFER DOUBLES\n");
 
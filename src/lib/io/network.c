@@ -38,6 +38,7 @@ RCSID("$Id$")
 #include <freeradius-devel/util/syserror.h>
 #include <freeradius-devel/util/thread_local.h>
 
+#include <freeradius-devel/io/busy_poll.h>
 #include <freeradius-devel/io/channel.h>
 #include <freeradius-devel/io/control.h>
 #include <freeradius-devel/io/listen.h>
@@ -66,10 +67,13 @@ typedef struct {
 	fr_time_t		predicted;		//!< predicted processing time for one packet
 
 	bool			blocked;		//!< is this worker blocked?
+	fr_time_t		last_seen;		//!< last reply, or first request after being idle.
 
 	fr_channel_t		*channel;		//!< channel to the worker
 	fr_worker_t		*worker;		//!< worker pointer
 	fr_io_stats_t		stats;
+	uint64_t		stolen;			//!< requests moved from this worker to other workers.
+	uint64_t		steals;			//!< requests moved from other workers to this one.
 } fr_network_worker_t;
 
 typedef struct {
@@ -95,6 +99,7 @@ typedef struct {
 
 	fr_channel_data_t	*pending;		//!< the currently pending partial packet
 	fr_heap_t		*waiting;		//!< packets waiting to be written
+	fr_dlist_t		flush_entry;		//!< in the list of sockets which need to be flushed.
 	fr_io_stats_t		stats;
 } fr_network_socket_t;
 
@@ -129,8 +134,18 @@ struct fr_network_s {
 	fr_event_list_t		*el;			//!< our event list
 
 	fr_heap_t		*replies;		//!< replies from the worker, ordered by priority / origin time
+	fr_dlist_head_t		flush;			//!< sockets which have queued writes to flush.
 
 	fr_io_stats_t		stats;
+	uint64_t		stolen;			//!< requests moved from a stalled worker to an idle one.
+	uint64_t		affine;			//!< requests sent to the worker for their session.
+	uint64_t		affine_fallback;	//!< requests with affinity, but that worker was blocked.
+	fr_event_timer_t const	*steal_ev;		//!< for checking stalled workers when we're otherwise idle.
+
+	fr_busy_poll_t		busy_poll;		//!< spin before sleeping.
+
+	fr_time_elapsed_t	reply_time;		//!< worker sent the reply, to written to the socket.
+	fr_time_elapsed_t	total_time;		//!< packet received, to reply written to the socket.
 
 	rbtree_t		*sockets;		//!< list of sockets we're managing, ordered by the listener
 	rbtree_t		*sockets_by_num;       	//!< ordered by number;
@@ -150,6 +165,7 @@ struct fr_network_s {
 
 static void fr_network_post_event(fr_event_list_t *el, fr_time_t now, void *uctx);
 static int fr_network_pre_event(void *ctx, fr_time_t wake);
+static bool fr_network_poll(void *uctx);
 static void fr_network_socket_dead(fr_network_t *nr, fr_network_socket_t *s);
 static void fr_network_read(UNUSED fr_event_list_t *el, int sockfd, UNUSED int flags, void *ctx);
 static int8_t reply_cmp(void const *one, void const *two)
@@ -303,7 +319,7 @@ void fr_network_listen_read(fr_network_t *nr, fr_listen_t *li)
 	/*
 	 *	Go read the socket.
 	 */
-	fr_network_read(nr->el, s->listen->fd, 0, s);
+	fr_network_read(nr->el, fr_listen_read_fd(s->listen), 0, s);
 }
 
 
@@ -394,7 +410,7 @@ static int apply(void *data, void *uctx)
 
 	fr_event_update_t *update = uctx;
 
-	fr_event_filter_update(socket->nr->el, socket->listen->fd, FR_EVENT_FILTER_IO, update);
+	fr_event_filter_update(socket->nr->el, fr_listen_read_fd(socket->listen), FR_EVENT_FILTER_IO, update);
 
 	return 0;
 }
@@ -446,6 +462,7 @@ static void fr_network_recv_reply(void *ctx, fr_channel_t *ch, fr_channel_data_t
 	 */
 	worker = fr_channel_requestor_uctx_get(ch);
 	worker->stats.out++;
+	worker->last_seen = cd->m.when;
 	worker->cpu_time = cd->reply.cpu_time;
 	if (!worker->predicted) {
 		worker->predicted = cd->reply.processing_time;
@@ -504,6 +521,13 @@ static void fr_network_channel_callback(void *ctx, void const *data, size_t data
 	case FR_CHANNEL_DATA_READY_REQUESTOR:
 		fr_assert(ch != NULL);
 		while (fr_channel_recv_reply(ch));
+
+		/*
+		 *	We're awake anyway, so drain the replies from
+		 *	all of the workers in one pass.  Their signals
+		 *	may already be queued behind this one.
+		 */
+		if (nr->num_workers > 1) (void) fr_network_poll(nr);
 		break;
 
 	case FR_CHANNEL_DATA_READY_RESPONDER:
@@ -545,16 +569,32 @@ static void fr_network_channel_callback(void *ctx, void const *data, size_t data
 
 /** Send a message on the "best" channel.
  *
- * @param nr the network
- * @param cd the message we've received
+ * Packets which have an affinity always go to the same worker, so
+ * that all of the packets in a session are processed by one
+ * worker.  If that worker is blocked, we pick a worker as usual.
+ *
+ * @param nr		the network
+ * @param cd		the message we've received
+ * @param affinity	of the packet.  0 for none.
  */
-static int fr_network_send_request(fr_network_t *nr, fr_channel_data_t *cd)
+static int fr_network_send_request(fr_network_t *nr, fr_channel_data_t *cd, uint32_t affinity)
 {
 	fr_network_worker_t *worker;
 
 	(void) talloc_get_type_abort(nr, fr_network_t);
 
 retry:
+	if (affinity && (nr->num_workers > 1)) {
+		worker = nr->workers[affinity % nr->num_workers];
+		if (!worker->blocked) {
+			nr->affine++;
+			goto send;
+		}
+
+		nr->affine_fallback++;
+		affinity = 0;
+	}
+
 	if (nr->num_workers == 1) {
 		worker = nr->workers[0];
 		if (worker->blocked) {
@@ -605,6 +645,7 @@ retry:
 		worker = found;
 	}
 
+send:
 	(void) talloc_get_type_abort(worker, fr_network_worker_t);
 
 	/*
@@ -643,6 +684,11 @@ retry:
 		goto retry;
 	}
 
+	/*
+	 *	The worker was idle, so it's expected to reply from
+	 *	about now.
+	 */
+	if (worker->stats.in == worker->stats.out) worker->last_seen = cd->m.when;
 	worker->stats.in++;
 
 	/*
@@ -666,7 +712,8 @@ static void fr_network_socket_dead(fr_network_t *nr, fr_network_socket_t *s)
 
 	s->dead = true;
 
-	fr_event_fd_delete(nr->el, s->listen->fd, s->filter);
+	fr_event_fd_delete(nr->el, fr_listen_read_fd(s->listen), s->filter);
+	if (s->listen->read_fd && s->blocked) fr_event_fd_delete(nr->el, s->listen->fd, s->filter);
 
 	/*
 	 *	If there are no outstanding packets, then we can free
@@ -685,6 +732,30 @@ static void fr_network_socket_dead(fr_network_t *nr, fr_network_socket_t *s)
 	 */
 }
 
+/** Check if the listener has packets buffered which it hasn't yet returned from read()
+ *
+ */
+static inline bool fr_network_read_pending(fr_network_socket_t *s)
+{
+	return s->listen->app_io->read_pending && s->listen->app_io->read_pending(s->listen);
+}
+
+/** Get the session affinity of a packet we've read
+ *
+ */
+static inline uint32_t fr_network_affinity(fr_listen_t const *li, fr_channel_data_t const *cd)
+{
+	if (li->app_io->affinity) return li->app_io->affinity(li, cd->packet_ctx, cd->m.data, cd->m.data_size);
+
+	/*
+	 *	Connected sockets are read by the transport, and
+	 *	already only have one client.
+	 */
+	if (li->app && li->app->affinity) return li->app->affinity(li->app_instance, cd->m.data, cd->m.data_size);
+
+	return 0;
+}
+
 /** Read a packet from the network.
  *
  * @param[in] el	the event list.
@@ -703,8 +774,9 @@ static void fr_network_read(UNUSED fr_event_list_t *el, int sockfd, UNUSED int f
 	fr_time_t		now;
 #endif
 
-	if (!fr_cond_assert_msg(s->listen->fd == sockfd, "Expected listen->fd (%u) to be equal event fd (%u)",
-				s->listen->fd, sockfd)) return;
+	if (!fr_cond_assert_msg(fr_listen_read_fd(s->listen) == sockfd,
+				"Expected listen read fd (%u) to be equal event fd (%u)",
+				fr_listen_read_fd(s->listen), sockfd)) return;
 
 	DEBUG3("Reading data from FD %u", sockfd);
 
@@ -760,6 +832,13 @@ next_message:
 		 *	blocking issues can happen for stream sockets.
 		 */
 		s->cd = cd;
+
+		/*
+		 *	The reader discarded a packet, but has more
+		 *	buffered.  Those won't make the socket
+		 *	readable, so go get them now.
+		 */
+		if (fr_network_read_pending(s)) goto next_message;
 		return;
 	}
 
@@ -824,7 +903,7 @@ next_message:
 	 */
 	fr_assert(cd->m.when == now);
 
-	if (fr_network_send_request(nr, cd) < 0) {
+	if (fr_network_send_request(nr, cd, fr_network_affinity(s->listen, cd)) < 0) {
 		talloc_free(cd->packet_ctx); /* not sure what else to do here */
 		fr_message_done(&cd->m);
 		nr->stats.dropped++;
@@ -850,6 +929,23 @@ next_message:
 		num_messages++;
 		goto next_message;
 	}
+
+	/*
+	 *	The reader read multiple packets from the socket in
+	 *	one system call.  Feed the rest of them to the workers
+	 *	now, as the socket won't become readable again for
+	 *	packets which have already been read.
+	 */
+	if (fr_network_read_pending(s)) {
+		cd = (fr_channel_data_t *) fr_message_reserve(s->ms, s->listen->default_message_size);
+		if (!cd) {
+			ERROR("Failed allocating message size %zd! - Closing socket",
+			      s->listen->default_message_size);
+			fr_network_socket_dead(nr, s);
+			return;
+		}
+		goto next_message;
+	}
 }
 
 
@@ -966,9 +1062,14 @@ static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 					cd = (fr_channel_data_t *) lm;
 				}
 
+				/*
+				 *	If reads are signalled on a different
+				 *	FD, the socket only needs a write
+				 *	callback.
+				 */
 				if (!s->blocked) {
 					if (fr_event_fd_insert(nr, nr->el, s->listen->fd,
-							       fr_network_read,
+							       s->listen->read_fd ? NULL : fr_network_read,
 							       fr_network_write,
 							       fr_network_error,
 							       s) < 0) {
@@ -1011,6 +1112,17 @@ static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 
 		s->written = 0;
 
+		/*
+		 *	The reply has left the building.  The other
+		 *	stages are tracked by the worker.
+		 */
+		if (nr->config.trace) {
+			fr_time_t now = fr_time();
+
+			fr_time_elapsed_update(&nr->reply_time, cd->m.when, now);
+			fr_time_elapsed_update(&nr->total_time, cd->reply.request_time, now);
+		}
+
 		/*
 		 *	Reset for the next message.
 		 */
@@ -1018,6 +1130,15 @@ static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 		nr->stats.out++;
 		s->stats.out++;
 
+		/*
+		 *	The write may have been queued by the
+		 *	transport.  Remember to flush it once all of
+		 *	the replies for this pass have been written.
+		 */
+		if (li->app_io->flush && !fr_dlist_entry_in_list(&s->flush_entry)) {
+			fr_dlist_insert_tail(&nr->flush, s);
+		}
+
 		/*
 		 *	Grab the net entry.
 		 */
@@ -1028,6 +1149,16 @@ static void fr_network_write(UNUSED fr_event_list_t *el, UNUSED int sockfd, UNUS
 	 *	We've successfully written all of the packets.  Remove
 	 *	the write callback.
 	 */
+	if (s->listen->read_fd) {
+		s->blocked = false;
+
+		if (fr_event_fd_delete(nr->el, s->listen->fd, FR_EVENT_FILTER_IO) < 0) {
+			PERROR("Failed removing write callback from event loop");
+			fr_network_socket_dead(nr, s);
+		}
+		return;
+	}
+
 	if (fr_event_fd_insert(nr, nr->el, s->listen->fd,
 			       fr_network_read,
 			       NULL,
@@ -1048,7 +1179,10 @@ static int _network_socket_free(fr_network_socket_t *s)
 	rbtree_deletebydata(nr->sockets, s);
 	rbtree_deletebydata(nr->sockets_by_num, s);
 
-	fr_event_fd_delete(nr->el, s->listen->fd, s->filter);
+	if (fr_dlist_entry_in_list(&s->flush_entry)) fr_dlist_remove(&nr->flush, s);
+
+	fr_event_fd_delete(nr->el, fr_listen_read_fd(s->listen), s->filter);
+	if (s->listen->read_fd && s->blocked) fr_event_fd_delete(nr->el, s->listen->fd, s->filter);
 
 	if (s->listen->app_io->close) {
 		s->listen->app_io->close(s->listen);
@@ -1127,10 +1261,19 @@ static void fr_network_listen_callback(void *ctx, void const *data, size_t data_
 		return;
 	}
 
+	/*
+	 *	Packets are read by the workers, so the memory should
+	 *	live next to them, not next to us.
+	 */
+	if (nr->config.reader_numa_node_is_set &&
+	    (fr_message_set_numa_node_set(s->ms, nr->config.reader_numa_node) < 0)) {
+		PWARN("Failed placing message buffers for network IO");
+	}
+
 	app_io = s->listen->app_io;
 	s->filter = FR_EVENT_FILTER_IO;
 
-	if (fr_event_fd_insert(nr, nr->el, s->listen->fd,
+	if (fr_event_fd_insert(nr, nr->el, fr_listen_read_fd(s->listen),
 			       fr_network_read,
 			       NULL,
 			       fr_network_error,
@@ -1151,7 +1294,7 @@ static void fr_network_listen_callback(void *ctx, void const *data, size_t data_
 	fr_log(nr->log, L_DBG, __FILE__, __LINE__, "Listening on %s bound to virtual server %s",
 	      s->listen->name, cf_section_name2(s->listen->server_cs));
 
-	DEBUG3("Using new socket %s with FD %d", s->listen->name, s->listen->fd);
+	DEBUG3("Using new socket %s with FD %d", s->listen->name, fr_listen_read_fd(s->listen));
 }
 
 /** Handle a network control message callback for a new "watch directory"
@@ -1294,12 +1437,29 @@ static void fr_network_inject_callback(void *ctx, void const *data, size_t data_
 	 *	network.
 	 */
 	if (s->listen->app_io->inject(s->listen, my_inject.packet, my_inject.packet_len, my_inject.recv_time) == 0) {
-		fr_network_read(nr->el, s->listen->fd, 0, s);
+		fr_network_read(nr->el, fr_listen_read_fd(s->listen), 0, s);
 	}
 
 	talloc_free(my_inject.packet);
 }
 
+/** Flush all sockets which have queued writes
+ *
+ * @param[in] nr	the network
+ */
+static void fr_network_flush(fr_network_t *nr)
+{
+	fr_network_socket_t *s;
+
+	while ((s = fr_dlist_pop_head(&nr->flush)) != NULL) {
+		if (s->dead) continue;
+
+		if (s->listen->app_io->flush(s->listen) < 0) {
+			PERROR("Failed flushing socket %s", s->listen->name);
+		}
+	}
+}
+
 /** Run the event loop 'pre' callback
  *
  *  This function MUST DO NO WORK.  All it does is check if there's
@@ -1320,17 +1480,152 @@ static int fr_network_pre_event(void *ctx, UNUSED fr_time_t wake)
 	return 0;
 }
 
+static void fr_network_steal_timer(fr_event_list_t *el, fr_time_t now, void *uctx);
+
+/** Move requests from a worker's queue to another worker
+ *
+ * @param nr		the network
+ * @param thief		the worker to move the requests to.
+ * @param victim	the worker to move the requests from.
+ * @param num		the maximum number of requests to move.
+ */
+static void fr_network_steal_requests(fr_network_t *nr, fr_network_worker_t *thief, fr_network_worker_t *victim,
+				      size_t num)
+{
+	while (num--) {
+		int ret;
+
+		ret = fr_channel_move_request(thief->channel, victim->channel);
+		if (ret < 0) {
+			RATE_LIMIT_GLOBAL(PERROR, "Failed moving request to another worker");
+			return;
+		}
+		if (ret == 0) return;
+
+		fr_assert(victim->stats.in > victim->stats.out);
+		victim->stats.in--;
+		victim->stolen++;
+		if (victim->cpu_time > victim->predicted) victim->cpu_time -= victim->predicted;
+
+		thief->stats.in++;
+		thief->steals++;
+		thief->cpu_time += thief->predicted;
+
+		nr->stolen++;
+	}
+}
+
+/** Move queued requests from stalled workers to idle ones
+ *
+ * A worker which is stuck in a slow synchronous module call
+ * doesn't service its channel, and the requests we've already
+ * sent to it wait, even when other workers are idle.  Those
+ * requests haven't been started, so we can move them to an idle
+ * worker.  The reply comes back to us on the new channel, and is
+ * written to the socket the request came from, as usual.
+ *
+ * @param nr		the network
+ * @param now		the current time
+ */
+static void fr_network_steal(fr_network_t *nr, fr_time_t now)
+{
+	int			i, j;
+	int			num_idle = 0;
+	fr_time_t		next = 0;
+	fr_network_worker_t	*idle[MAX_WORKERS];
+
+	if (!nr->config.steal_delay || (nr->num_workers < 2)) return;
+
+	/*
+	 *	No idle workers means nowhere to move requests to.
+	 *	When a worker becomes idle, its reply wakes us up,
+	 *	and we check again.
+	 */
+	for (i = 0; i < nr->num_workers; i++) {
+		fr_network_worker_t *worker = nr->workers[i];
+
+		if (worker->blocked || (worker->stats.in != worker->stats.out)) continue;
+
+		idle[num_idle++] = worker;
+	}
+	if (!num_idle) return;
+
+	for (i = 0; (i < nr->num_workers) && (num_idle > 0); i++) {
+		fr_network_worker_t	*victim = nr->workers[i];
+		size_t			queued, share;
+
+		if (victim->stats.in == victim->stats.out) continue;
+
+		queued = fr_channel_requests_queued(victim->channel);
+		if (!queued) continue;
+
+		/*
+		 *	It's been busy for a short time.  Check it
+		 *	again later.
+		 */
+		if ((now - victim->last_seen) < nr->config.steal_delay) {
+			if (!next || ((victim->last_seen + nr->config.steal_delay) < next)) {
+				next = victim->last_seen + nr->config.steal_delay;
+			}
+			continue;
+		}
+
+		/*
+		 *	Leave the victim a share, too.  It may only be
+		 *	slow, and not stuck.
+		 */
+		share = queued / (num_idle + 1);
+		if (!share) share = 1;
+
+		DEBUG3("Moving up to %zu requests each from a stalled worker to %d idle workers", share, num_idle);
+
+		for (j = 0; j < num_idle; j++) {
+			idle[j]->last_seen = now;
+			fr_network_steal_requests(nr, idle[j], victim, share);
+		}
+
+		/*
+		 *	The idle workers aren't idle any more.
+		 */
+		num_idle = 0;
+	}
+
+	/*
+	 *	There may not be any more packets, or replies.  So we
+	 *	need a timer to check the stalled workers.
+	 */
+	if (next && !nr->steal_ev &&
+	    (fr_event_timer_at(nr, nr->el, &nr->steal_ev, next, fr_network_steal_timer, nr) < 0)) {
+		RATE_LIMIT_GLOBAL(PERROR, "Failed inserting timer for stalled workers");
+	}
+}
+
+/** Check for stalled workers
+ *
+ * @param el	the event loop
+ * @param now	the current time
+ * @param uctx	the fr_network_t
+ */
+static void fr_network_steal_timer(UNUSED fr_event_list_t *el, fr_time_t now, void *uctx)
+{
+	fr_network_t *nr = talloc_get_type_abort(uctx, fr_network_t);
+
+	fr_network_steal(nr, now);
+}
+
 /** Handle replies after all FD and timer events have been serviced
  *
  * @param el	the event loop
  * @param now	the current time (mostly)
  * @param uctx	the fr_network_t
  */
-static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+static void fr_network_post_event(UNUSED fr_event_list_t *el, fr_time_t now, void *uctx)
 {
 	fr_channel_data_t *cd;
 	fr_network_t *nr = talloc_get_type_abort(uctx, fr_network_t);
 
+	fr_network_steal(nr, now);
+
 	/*
 	 *	Pull the replies off of our global heap, and try to
 	 *	push them to the individual sockets.
@@ -1395,6 +1690,14 @@ static void fr_network_post_event(UNUSED fr_event_list_t *el, UNUSED fr_time_t n
 			fr_network_write(nr->el, s->listen->fd, 0, s);
 		}
 	}
+
+	/*
+	 *	Now that we've drained all of the replies, tell the
+	 *	transports to write anything they've queued.  This
+	 *	lets datagram sockets send all of the replies for one
+	 *	pass with one system call.
+	 */
+	fr_network_flush(nr);
 }
 
 /** Stop a network thread in an orderly way
@@ -1500,6 +1803,23 @@ static void _signal_pipe_read(UNUSED fr_event_list_t *el, int fd, UNUSED int fla
 	fr_network_destroy(nr);
 }
 
+/** Check for replies from the workers, without waiting
+ *
+ * @param[in] uctx	the network
+ * @return true if there are replies.
+ */
+static bool fr_network_poll(void *uctx)
+{
+	int		i;
+	fr_network_t	*nr = uctx;
+
+	for (i = 0; i < nr->num_workers; i++) {
+		while (fr_channel_recv_reply(nr->workers[i]->channel));
+	}
+
+	return (fr_heap_num_elements(nr->replies) > 0);
+}
+
 /** The main network worker function.
  *
  * @param[in] nr the network data structure to run.
@@ -1521,7 +1841,11 @@ void fr_network(fr_network_t *nr)
 		 *	(e.g. exit), we stop looping and clean up.
 		 */
 		DEBUG3("Gathering events - %s", wait_for_event ? "will wait" : "Will not wait");
-		num_events = fr_event_corral(nr->el, fr_time(), wait_for_event);
+		if (wait_for_event) {
+			num_events = fr_busy_poll_corral(&nr->busy_poll, nr->el, fr_network_poll, nr);
+		} else {
+			num_events = fr_event_corral(nr->el, fr_time(), false);
+		}
 		DEBUG3("%u event(s) pending%s",
 		       num_events == -1 ? 0 : num_events, num_events == -1 ? " - event loop exiting" : "");
 		if (num_events < 0) break;
@@ -1601,6 +1925,10 @@ fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_event_list_t *el, char const
 	nr->signal_pipe[1] = -1;
 	if (config) nr->config = *config;
 
+	fr_busy_poll_init(&nr->busy_poll, nr->config.busy_poll);
+
+	fr_dlist_init(&nr->flush, fr_network_socket_t, flush_entry);
+
 	nr->aq_control = fr_atomic_queue_alloc(nr, 1024);
 	if (!nr->aq_control) {
 		talloc_free(nr);
@@ -1710,10 +2038,11 @@ int fr_network_stats(fr_network_t const *nr, int num, uint64_t *stats)
 	if (num >= 3) stats[2] = nr->stats.dup;
 	if (num >= 4) stats[3] = nr->stats.dropped;
 	if (num >= 5) stats[4] = nr->num_workers;
+	if (num >= 6) stats[5] = nr->stolen;
 
-	if (num <= 5) return num;
+	if (num <= 6) return num;
 
-	return 5;
+	return 6;
 }
 
 void fr_network_stats_log(fr_network_t const *nr, fr_log_t const *log)
@@ -1732,6 +2061,7 @@ void fr_network_stats_log(fr_network_t const *nr, fr_log_t const *log)
 
 static int cmd_stats_self(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
 {
+	int i;
 	fr_network_t const *nr = ctx;
 
 	fprintf(fp, "count.in\t%" PRIu64 "\n", nr->stats.in);
@@ -1739,6 +2069,21 @@ static int cmd_stats_self(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cm
 	fprintf(fp, "count.dup\t%" PRIu64 "\n", nr->stats.dup);
 	fprintf(fp, "count.dropped\t%" PRIu64 "\n", nr->stats.dropped);
 	fprintf(fp, "count.sockets\t%u\n", rbtree_num_elements(nr->sockets));
+	fprintf(fp, "count.stolen\t%" PRIu64 "\n", nr->stolen);
+	fprintf(fp, "count.affine\t%" PRIu64 "\n", nr->affine);
+	fprintf(fp, "count.affine_fallback\t%" PRIu64 "\n", nr->affine_fallback);
+
+	for (i = 0; i < nr->num_workers; i++) {
+		fprintf(fp, "worker.%d.stolen\t%" PRIu64 "\n", i, nr->workers[i]->stolen);
+		fprintf(fp, "worker.%d.steals\t%" PRIu64 "\n", i, nr->workers[i]->steals);
+	}
+
+	fr_busy_poll_stats_fprint(fp, &nr->busy_poll);
+
+	if (nr->config.trace) {
+		fr_time_elapsed_fprint(fp, &nr->reply_time, "trace.reply", 4);
+		fr_time_elapsed_fprint(fp, &nr->total_time, "trace.total", 4);
+	}
 
 	return 0;
 }
@@ -44,6 +44,13 @@ extern "C" {
 
 typedef struct {
 	uint32_t	max_outstanding;
+	fr_time_delta_t	steal_delay;		//!< move queued requests from a worker which hasn't
+						///< replied in this long.  0 disables.
+	fr_time_delta_t	busy_poll;		//!< maximum time to spin before sleeping.  0 disables.
+	bool		trace;			//!< record reply and total time histograms.
+
+	uint32_t	reader_numa_node;	//!< NUMA node of the workers which read our messages.
+	bool		reader_numa_node_is_set;
 } fr_network_config_t;
 
 int		fr_network_listen_add(fr_network_t *nr, fr_listen_t *li) CC_HINT(nonnull);
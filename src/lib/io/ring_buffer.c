@@ -27,8 +27,21 @@ RCSID("$Id$")
 #include <freeradius-devel/io/ring_buffer.h>
 #include <freeradius-devel/util/strerror.h>
 #include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/syserror.h>
 #include <string.h>
 
+/*
+ *	Memory placement is Linux specific.
+ */
+#ifdef __linux__
+#  include <unistd.h>
+#  include <sys/syscall.h>
+#  include <linux/mempolicy.h>
+#  ifdef __NR_mbind
+#    define WITH_NUMA_PLACEMENT (1)
+#  endif
+#endif
+
 /*
  *	Ring buffers are allocated in a block.
  */
@@ -102,6 +115,52 @@ fr_ring_buffer_t *fr_ring_buffer_create(TALLOC_CTX *ctx, size_t size)
 }
 
 
+/** Prefer allocating the memory of a ring buffer from a NUMA node
+ *
+ *  Ring buffers are usually written by one thread and read by
+ *  another.  Pages are placed on the node of the thread which first
+ *  touches them, i.e. the writer.  This places them on the node of
+ *  the reader instead.
+ *
+ *  Only pages which lie entirely within the buffer are affected, and
+ *  pages which have already been touched stay where they are.  So
+ *  this should be called just after the ring buffer is created.
+ *
+ * @param[in] rb	to place.
+ * @param[in] node	to prefer.
+ * @return
+ *	- 0 on success, or if memory placement isn't supported.
+ *	- -1 on failure.
+ */
+int fr_ring_buffer_numa_node_set(fr_ring_buffer_t *rb, int node)
+{
+#ifdef WITH_NUMA_PLACEMENT
+	uintptr_t	page = (uintptr_t) sysconf(_SC_PAGESIZE);
+	uintptr_t	start, end;
+	unsigned long	nodemask;
+
+	if ((node < 0) || ((size_t) node >= (sizeof(nodemask) * 8))) {
+		fr_strerror_printf("Invalid NUMA node %d", node);
+		return -1;
+	}
+	nodemask = 1UL << node;
+
+	start = ((uintptr_t) rb->buffer + page - 1) & ~(page - 1);
+	end = ((uintptr_t) rb->buffer + rb->size) & ~(page - 1);
+	if (end <= start) return 0;
+
+	if (syscall(__NR_mbind, start, end - start, MPOL_PREFERRED, &nodemask, sizeof(nodemask) * 8, 0) < 0) {
+		fr_strerror_printf("Failed placing ring buffer on NUMA node %d: %s", node, fr_syserror(errno));
+		return -1;
+	}
+#else
+	UNUSED(rb);
+	UNUSED(node);
+#endif
+
+	return 0;
+}
+
 /** Reserve room in the ring buffer.
  *
  *  The size does not need to be a power of two.  The application is
@@ -28,6 +28,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/autoconf.h>
 
+#include <freeradius-devel/io/listen.h>
 #include <freeradius-devel/io/schedule.h>
 #include <freeradius-devel/util/dlist.h>
 #include <freeradius-devel/util/rbtree.h>
@@ -36,6 +37,16 @@ RCSID("$Id$")
 
 #include <pthread.h>
 
+/*
+ *	Thread affinity and memory policy are Linux specific.
+ */
+#ifdef __linux__
+#  include <sched.h>
+#  include <sys/syscall.h>
+#  include <linux/mempolicy.h>
+#  define WITH_THREAD_AFFINITY (1)
+#endif
+
 /*
  *	Other OS's have sem_init, OS X doesn't.
  */
@@ -119,6 +130,16 @@ typedef struct {
 } fr_schedule_network_t;
 
 
+/** Where to run one class of threads (networks or workers)
+ *
+ */
+typedef struct {
+	unsigned int	*cpus;			//!< CPUs to pin threads to.  Thread N is pinned
+						///< to cpus[N % num_cpus].
+	unsigned int	num_cpus;		//!< Number of entries in cpus.  0 for no pinning.
+	int		numa_node;		//!< NUMA node to allocate memory from.  -1 for any.
+} fr_schedule_affinity_t;
+
 /**
  *  The scheduler
  */
@@ -146,6 +167,9 @@ struct fr_schedule_s {
 
 	fr_network_t	*single_network;	//!< for single-threaded mode
 	fr_worker_t	*single_worker;		//!< for single-threaded mode
+
+	fr_schedule_affinity_t	network_affinity;	//!< where to run network threads
+	fr_schedule_affinity_t	worker_affinity;	//!< where to run worker threads
 };
 
 static _Thread_local int worker_id;		//!< Internal ID of the current worker thread.
@@ -159,6 +183,197 @@ int fr_schedule_worker_id(void)
 	return worker_id;
 }
 
+#ifdef WITH_THREAD_AFFINITY
+/** Parse a list of CPUs, e.g. "0-3,8,10-11"
+ *
+ * @param[in] ctx	to allocate the array in.
+ * @param[out] out	array of CPU numbers.
+ * @param[in] str	to parse.
+ * @return
+ *	- > 0 the number of CPUs.
+ *	- -1 on error.
+ */
+static int fr_schedule_cpus_parse(TALLOC_CTX *ctx, unsigned int **out, char const *str)
+{
+	unsigned int	*cpus = NULL;
+	unsigned int	num = 0;
+	char const	*p = str;
+	char		*end;
+
+	while (*p) {
+		unsigned long	first, last, cpu;
+
+		while (isspace((uint8_t) *p)) p++;
+		if (!*p) break;
+
+		first = last = strtoul(p, &end, 10);
+		if (end == p) goto invalid;
+		p = end;
+
+		if (*p == '-') {
+			p++;
+			last = strtoul(p, &end, 10);
+			if ((end == p) || (last < first)) goto invalid;
+			p = end;
+		}
+
+		if (last >= CPU_SETSIZE) {
+			fr_strerror_printf("CPU %lu is too large in \"%s\"", last, str);
+			talloc_free(cpus);
+			return -1;
+		}
+
+		for (cpu = first; cpu <= last; cpu++) {
+			MEM(cpus = talloc_realloc(ctx, cpus, unsigned int, num + 1));
+			cpus[num++] = cpu;
+		}
+
+		while (isspace((uint8_t) *p)) p++;
+		if (*p == ',') {
+			p++;
+			continue;
+		}
+		if (*p) {
+		invalid:
+			fr_strerror_printf("Invalid CPU list \"%s\"", str);
+			talloc_free(cpus);
+			return -1;
+		}
+	}
+
+	if (!num) goto invalid;
+
+	*out = cpus;
+	return num;
+}
+#endif
+
+/** Work out which CPUs and NUMA node a class of threads should use
+ *
+ * If only a NUMA node is given, the threads are pinned to the CPUs
+ * which belong to that node.
+ *
+ * @param[in] sc	the scheduler.
+ * @param[out] aff	where the threads should run.
+ * @param[in] name	of the thread class, for error messages.
+ * @param[in] cpus	CPU list from the configuration, or NULL.
+ * @param[in] numa_node	from the configuration, or -1.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+static int fr_schedule_affinity_init(fr_schedule_t *sc, fr_schedule_affinity_t *aff, char const *name,
+				     char const *cpus, int numa_node)
+{
+	int	num;
+
+	aff->numa_node = numa_node;
+
+	if (!cpus && (numa_node < 0)) return 0;
+
+#ifndef WITH_THREAD_AFFINITY
+	WARN("Ignoring %s CPU and NUMA configuration - Not supported on this platform", name);
+	aff->numa_node = -1;
+	return 0;
+#else
+	if (!cpus) {
+		char	path[64];
+		char	buffer[1024];
+		FILE	*fp;
+
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", numa_node);
+
+		fp = fopen(path, "r");
+		if (!fp) {
+			fr_strerror_printf("Failed opening %s: %s", path, fr_syserror(errno));
+			return -1;
+		}
+
+		if (!fgets(buffer, sizeof(buffer), fp)) {
+			fr_strerror_printf("Failed reading %s", path);
+			fclose(fp);
+			return -1;
+		}
+		fclose(fp);
+
+		num = fr_schedule_cpus_parse(sc, &aff->cpus, buffer);
+	} else {
+		num = fr_schedule_cpus_parse(sc, &aff->cpus, cpus);
+	}
+	if (num < 0) {
+		fr_strerror_printf_push("Failed parsing %s CPUs", name);
+		return -1;
+	}
+	aff->num_cpus = num;
+
+	return 0;
+#endif
+}
+
+/** Pin the current thread to a CPU, and allocate its memory from a NUMA node
+ *
+ * This has to be done before the thread allocates anything.  Memory
+ * is then placed on the node of the thread which first touches it,
+ * so the event list and other thread local data live next to the CPU
+ * which uses them.
+ *
+ * Message sets are the exception.  They're written by one thread and
+ * read by another, so they're placed on the node of the reader when
+ * they're created.  See fr_message_set_numa_node_set().
+ *
+ * Failures are not fatal.  The thread just runs wherever the kernel
+ * puts it.
+ *
+ * @param[in] sc	the scheduler.  Only used for logging.
+ * @param[in] aff	where the thread should run.
+ * @param[in] name	of the thread, for log messages.
+ * @param[in] id	of the thread, used to pick a CPU.
+ */
+static void fr_schedule_affinity_set(fr_schedule_t const *sc, fr_schedule_affinity_t const *aff,
+				     char const *name, unsigned int id)
+{
+#ifdef WITH_THREAD_AFFINITY
+	if (aff->num_cpus) {
+		cpu_set_t	set;
+		unsigned int	cpu = aff->cpus[id % aff->num_cpus];
+		int		ret;
+
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+
+		ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if (ret != 0) {
+			WARN("%s - Failed pinning to CPU %u: %s", name, cpu, fr_syserror(ret));
+		} else {
+			DEBUG2("%s - Pinned to CPU %u", name, cpu);
+		}
+	}
+
+	if (aff->numa_node >= 0) {
+		unsigned long	nodemask;
+
+		if ((size_t) aff->numa_node >= (sizeof(nodemask) * 8)) {
+			WARN("%s - NUMA node %d is too large", name, aff->numa_node);
+			return;
+		}
+
+		nodemask = 1UL << aff->numa_node;
+
+		if (syscall(__NR_set_mempolicy, MPOL_PREFERRED, &nodemask, sizeof(nodemask) * 8) < 0) {
+			WARN("%s - Failed setting memory policy for NUMA node %d: %s",
+			     name, aff->numa_node, fr_syserror(errno));
+		} else {
+			DEBUG2("%s - Allocating memory from NUMA node %d", name, aff->numa_node);
+		}
+	}
+#else
+	UNUSED(sc);
+	UNUSED(aff);
+	UNUSED(name);
+	UNUSED(id);
+#endif
+}
+
 /** Entry point for worker threads
  *
  * @param[in] arg	the fr_schedule_worker_t
@@ -177,6 +392,8 @@ static void *fr_schedule_worker_thread(void *arg)
 
 	snprintf(worker_name, sizeof(worker_name), "Worker %d", sw->id);
 
+	fr_schedule_affinity_set(sc, &sc->worker_affinity, worker_name, sw->id);
+
 	sw->ctx = ctx = talloc_init("%s", worker_name);
 	if (!ctx) {
 		ERROR("%s - Failed allocating memory", worker_name);
@@ -298,6 +515,8 @@ static void *fr_schedule_network_thread(void *arg)
 
 	INFO("%s - Starting", network_name);
 
+	fr_schedule_affinity_set(sc, &sc->network_affinity, network_name, sn->id);
+
 	sn->ctx = ctx = talloc_init("%s", network_name);
 	if (!ctx) {
 		ERROR("%s - Failed allocating memory", network_name);
@@ -518,6 +737,33 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el,
 		if (sc->config->max_workers > 64) sc->config->max_workers = 64;
 	}
 
+	/*
+	 *	Work out where the threads should run before we
+	 *	start them.
+	 */
+	if ((fr_schedule_affinity_init(sc, &sc->network_affinity, "network", sc->config->network_cpus,
+				       sc->config->network_numa_node_is_set ? (int) sc->config->network_numa_node : -1) < 0) ||
+	    (fr_schedule_affinity_init(sc, &sc->worker_affinity, "worker", sc->config->worker_cpus,
+				       sc->config->worker_numa_node_is_set ? (int) sc->config->worker_numa_node : -1) < 0)) {
+		PERROR("Failed configuring thread affinity");
+		talloc_free(sc);
+		return NULL;
+	}
+
+	/*
+	 *	Networks write packets which workers read, and
+	 *	workers write replies which networks read.  Tell each
+	 *	side where its readers are.
+	 */
+	if (sc->worker_affinity.numa_node >= 0) {
+		sc->config->network.reader_numa_node = sc->worker_affinity.numa_node;
+		sc->config->network.reader_numa_node_is_set = true;
+	}
+	if (sc->network_affinity.numa_node >= 0) {
+		sc->config->worker.reader_numa_node = sc->network_affinity.numa_node;
+		sc->config->worker.reader_numa_node_is_set = true;
+	}
+
 	/*
 	 *	Create the lists which hold the workers and networks.
 	 */
@@ -815,7 +1061,23 @@ done:
 	return 0;
 }
 
+/** Return the number of network threads
+ *
+ * @param[in] sc the scheduler
+ * @return the number of network threads, which is 1 in single-threaded mode.
+ */
+unsigned int fr_schedule_num_networks(fr_schedule_t const *sc)
+{
+	if (sc->el) return 1;
+
+	return fr_dlist_num_elements(&sc->networks);
+}
+
 /** Add a fr_listen_t to a scheduler.
+ *
+ * Sockets which are sharded across the network threads (see
+ * #fr_listen_t.shard) are added to the network with the same index.
+ * All other sockets are added to the first network.
  *
  * @param[in] sc the scheduler
  * @param[in] li the ctx and callbacks for the transport.
@@ -833,12 +1095,17 @@ fr_network_t *fr_schedule_listen_add(fr_schedule_t *sc, fr_listen_t *li)
 		nr = sc->single_network;
 	} else {
 		fr_schedule_network_t *sn;
+		unsigned int i;
 
 		/*
-		 *	@todo - round robin it among the listeners?
-		 *	or maybe add it to the same parent thread?
+		 *	@todo - round robin unsharded sockets among the
+		 *	listeners?  or maybe add it to the same parent thread?
 		 */
 		sn = fr_dlist_head(&sc->networks);
+		for (i = 0; i < li->shard; i++) {
+			sn = fr_dlist_next(&sc->networks, sn);
+			if (!sn) sn = fr_dlist_head(&sc->networks);
+		}
 		nr = sn->nr;
 	}
 
@@ -68,6 +68,14 @@ typedef struct {
 	fr_network_config_t network;		//!< configuration for each network;
 
 	fr_time_delta_t	stats_interval;		//!< print channel statistics
+
+	char const	*network_cpus;		//!< CPUs to pin network threads to, e.g. "0-3,8".
+	char const	*worker_cpus;		//!< CPUs to pin worker threads to.
+
+	uint32_t	network_numa_node;	//!< NUMA node to allocate network thread memory from.
+	uint32_t	worker_numa_node;	//!< NUMA node to allocate worker thread memory from.
+	bool		network_numa_node_is_set;
+	bool		worker_numa_node_is_set;
 } fr_schedule_config_t;
 
 int			fr_schedule_worker_id(void);
@@ -80,6 +88,8 @@ fr_schedule_t		*fr_schedule_create(TALLOC_CTX *ctx, fr_event_list_t *el, fr_log_
 /* schedulers are async, so there's no fr_schedule_run() */
 int			fr_schedule_destroy(fr_schedule_t **sc);
 
+unsigned int		fr_schedule_num_networks(fr_schedule_t const *sc) CC_HINT(nonnull);
+
 fr_network_t		*fr_schedule_listen_add(fr_schedule_t *sc, fr_listen_t *li) CC_HINT(nonnull);
 fr_network_t		*fr_schedule_directory_add(fr_schedule_t *sc, fr_listen_t *li) CC_HINT(nonnull);
 #ifdef __cplusplus
@@ -54,6 +54,7 @@ RCSID("$Id$")
 #define LOG_PREFIX_ARGS worker->name
 #define LOG_DST worker->log
 
+#include <freeradius-devel/io/busy_poll.h>
 #include <freeradius-devel/io/time_tracking.h>
 #include <freeradius-devel/io/worker.h>
 #include <freeradius-devel/io/channel.h>
@@ -61,7 +62,10 @@ RCSID("$Id$")
 #include <freeradius-devel/io/listen.h>
 #include <freeradius-devel/unlang/interpret.h>
 #include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/oa_hash.h>
+#include <freeradius-devel/util/syserror.h>
 
+#include <fcntl.h>
 #include <stdalign.h>
 
 #ifdef WITH_VERIFY_PTR
@@ -73,6 +77,11 @@ static void worker_verify(fr_worker_t *worker);
 
 static _Thread_local fr_worker_t *thread_local_worker;
 
+/** How often unused requests are returned to the heap
+ *
+ */
+#define WORKER_TRIM_INTERVAL	(10)
+
 #define CACHE_LINE_SIZE	64
 static alignas(CACHE_LINE_SIZE) atomic_uint64_t request_number = 0;
 
@@ -98,7 +107,7 @@ struct fr_worker_s {
 
 	fr_heap_t      		*runnable;	//!< current runnable requests which we've spent time processing
 	fr_heap_t		*time_order;	//!< time ordered heap of requests
-	rbtree_t		*dedup;		//!< de-dup tree
+	fr_oa_hash_t		*dedup;		//!< de-dup table
 
 	fr_io_stats_t		stats;		//!< input / output stats
 	fr_time_elapsed_t	cpu_time;	//!< histogram of total CPU time per request
@@ -116,6 +125,15 @@ struct fr_worker_s {
 	fr_time_t		checked_timeout; //!< when we last checked the tails of the queues
 
 	fr_event_timer_t const	*ev_cleanup;	//!< timer for max_request_time
+	fr_event_timer_t const	*ev_trim;	//!< timer for trimming the request free list
+
+	request_free_list_stats_t const *free_list;	//!< counters for the request free list of this thread
+	fr_pair_list_index_stats_t const *pair_index;	//!< counters for the pair list indexes of this thread
+
+	fr_busy_poll_t		busy_poll;	//!< spin before sleeping
+
+	fr_trace_stats_t	trace_stats;	//!< per-stage latency histograms
+	int			trace_fd;	//!< where slow request timelines are written, or -1.
 
 	fr_channel_t		**channel;	//!< list of channels
 };
@@ -218,6 +236,15 @@ static void worker_channel_callback(void *ctx, void const *data, size_t data_siz
 						   sizeof(fr_channel_data_t),
 						   worker->config.ring_buffer_size);
 			fr_assert(ms != NULL);
+
+			/*
+			 *	Replies are read by the network, so the
+			 *	memory should live next to it.
+			 */
+			if (worker->config.reader_numa_node_is_set &&
+			    (fr_message_set_numa_node_set(ms, worker->config.reader_numa_node) < 0)) {
+				PWARN("Failed placing reply buffers");
+			}
 			fr_channel_responder_uctx_add(ch, ms);
 
 			worker->num_channels++;
@@ -358,6 +385,39 @@ static void worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t now
 
 static void worker_max_request_timer(fr_worker_t *worker);
 
+/** Finish the timeline for a request, and write it out if the request was slow
+ *
+ * @param[in] worker		This worker.
+ * @param[in] request		we're sending a reply for.
+ * @param[in] now		The current time
+ */
+static void worker_trace_done(fr_worker_t *worker, request_t *request, fr_time_t now)
+{
+	char	buffer[4096];
+	size_t	len;
+
+	fr_trace_add(request->trace, FR_TRACE_REPLY, NULL, now);
+	fr_trace_stats_update(&worker->trace_stats, request->trace);
+
+	if ((worker->trace_fd < 0) || !fr_trace_is_slow(request->trace, worker->config.trace_threshold)) return;
+
+	len = fr_trace_snprint(buffer, sizeof(buffer), request->trace, request->name);
+	if (write(worker->trace_fd, buffer, len) < 0) {
+		/*
+		 *	Whatever is reading the trace file can't keep
+		 *	up.  Drop the timeline rather than stalling the
+		 *	worker.
+		 */
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+			worker->trace_stats.skipped++;
+			return;
+		}
+
+		RERROR("Failed writing request timeline: %s", fr_syserror(errno));
+		return;
+	}
+	worker->trace_stats.dumped++;
+}
 
 /** Send a response packet to the network side
  *
@@ -472,6 +532,8 @@ static void worker_send_reply(fr_worker_t *worker, request_t *request, size_t si
 	fr_time_elapsed_update(&worker->cpu_time, now, now + reply->reply.processing_time);
 	fr_time_elapsed_update(&worker->wall_clock, reply->reply.request_time, now);
 
+	if (request->trace) worker_trace_done(worker, request, now);
+
 	RDEBUG("Finished request");
 
 	/*
@@ -548,7 +610,7 @@ static void worker_stop_request(fr_worker_t *worker, request_t *request, fr_time
 	 */
 	if (request->time_order_id >= 0) (void) fr_heap_extract(worker->time_order, request);
 	if (request->runnable_id >= 0) (void) fr_heap_extract(worker->runnable, request);
-	if (request->async->listen && request->async->listen->track_duplicates) rbtree_deletebydata(worker->dedup, request);
+	if (request->async->listen && request->async->listen->track_duplicates) fr_oa_hash_delete(worker->dedup, request);
 
 #ifndef NDEBUG
 	request->async->process = NULL;
@@ -719,6 +781,21 @@ static void worker_request_bootstrap(fr_worker_t *worker, fr_channel_data_t *cd,
 
 	request->packet->timestamp = cd->request.recv_time; /* Legacy - Remove once everything looks at request->async */
 
+	/*
+	 *	The time the packet spent in the channel is cheap
+	 *	to track, so we always do it.
+	 */
+	fr_time_elapsed_update(&worker->trace_stats.stage[FR_TRACE_STAGE_QUEUE], cd->m.when, now);
+
+	if (worker->config.trace) {
+		request->trace = talloc_zero(request, fr_trace_t);
+		if (request->trace) {
+			fr_trace_add(request->trace, FR_TRACE_RECV, NULL, cd->request.recv_time);
+			fr_trace_add(request->trace, FR_TRACE_ENQUEUE, NULL, cd->m.when);
+			fr_trace_add(request->trace, FR_TRACE_DEQUEUE, NULL, now);
+		}
+	}
+
 	/*
 	 *	Receive a message to the worker queue, and decode it
 	 *	to a request.
@@ -781,7 +858,7 @@ nak:
 	if (request->async->listen->track_duplicates) {
 		request_t *old;
 
-		old = rbtree_finddata(worker->dedup, request);
+		old = fr_oa_hash_find(worker->dedup, request);
 		if (!old) {
 			/*
 			 *	Ignore duplicate packets where we've
@@ -851,7 +928,7 @@ nak:
 		talloc_free(old);
 
 	insert_new:
-		(void) rbtree_insert(worker->dedup, request);
+		(void) fr_oa_hash_insert(worker->dedup, request);
 	}
 
 	worker_request_time_tracking_start(worker, request, now);
@@ -935,11 +1012,11 @@ static void worker_run_request(fr_worker_t *worker, fr_time_t start)
 			RDEBUG("Done request");
 
 			/*
-			 *	Only real packets are in the dedup tree.  And even
+			 *	Only real packets are in the dedup table.  And even
 			 *	then, only some of the time.
 			 */
 			if (request_is_external(request) && request->async->listen->track_duplicates) {
-				(void) rbtree_deletebydata(worker->dedup, request);
+				(void) fr_oa_hash_delete(worker->dedup, request);
 			}
 
 			now = fr_time();
@@ -975,8 +1052,17 @@ static int8_t worker_time_order_cmp(void const *one, void const *two)
 }
 
 /**
- *  Track a request_t in the "dedup" tree
+ *  Track a request_t in the "dedup" table
  */
+static uint32_t worker_dedup_hash(void const *data)
+{
+	request_t const *request = data;
+	uint32_t hash;
+
+	hash = fr_hash(&request->async->listen, sizeof(request->async->listen));
+	return fr_hash_update(&request->async->packet_ctx, sizeof(request->async->packet_ctx), hash);
+}
+
 static int worker_dedup_cmp(void const *one, void const *two)
 {
 	int ret;
@@ -1024,6 +1110,8 @@ void fr_worker_destroy(fr_worker_t *worker)
 	}
 	fr_assert(fr_heap_num_elements(worker->runnable) == 0);
 
+	if (worker->trace_fd >= 0) close(worker->trace_fd);
+
 	/*
 	 *	Signal the channels that we're closing.
 	 *
@@ -1044,6 +1132,26 @@ void fr_worker_destroy(fr_worker_t *worker)
 }
 
 
+/** Return requests which the worker hasn't needed recently to the heap
+ *
+ * @param[in] el	the event list.
+ * @param[in] now	the current time.
+ * @param[in] uctx	the fr_worker_t.
+ */
+static void worker_trim_free_list(fr_event_list_t *el, fr_time_t now, void *uctx)
+{
+	fr_worker_t	*worker = talloc_get_type_abort(uctx, fr_worker_t);
+	uint32_t	num;
+
+	num = request_free_list_trim();
+	if (num > 0) DEBUG3("Freed %u unused requests", num);
+
+	if (fr_event_timer_at(worker, el, &worker->ev_trim,
+			      now + fr_time_delta_from_sec(WORKER_TRIM_INTERVAL), worker_trim_free_list, worker) < 0) {
+		ERROR("Failed inserting request free list timer");
+	}
+}
+
 /** Create a worker
  *
  * @param[in] ctx the talloc context
@@ -1085,6 +1193,10 @@ nomem:
 	CHECK_CONFIG(ring_buffer_size, (1 << 17), (1 << 20));
 	CHECK_CONFIG(max_request_time, fr_time_delta_from_sec(30), fr_time_delta_from_sec(60));
 
+	if (!worker->config.max_free_requests) worker->config.max_free_requests = REQUEST_FREE_LIST_MAX;
+
+	fr_busy_poll_init(&worker->busy_poll, worker->config.busy_poll);
+
 	worker->channel = talloc_zero_array(worker, fr_channel_t *, worker->config.max_channels);
 	if (!worker->channel) {
 		talloc_free(worker);
@@ -1095,6 +1207,7 @@ nomem:
 	worker->el = el;
 	worker->log = logger;
 	worker->lvl = lvl;
+	worker->trace_fd = -1;
 
 	/*
 	 *	The worker thread starts now.  Manually initialize it,
@@ -1134,9 +1247,42 @@ nomem:
 		goto fail;
 	}
 
-	worker->dedup = rbtree_talloc_alloc(worker, request_t, dedup_node, worker_dedup_cmp, NULL, RBTREE_FLAG_NONE);
+	worker->dedup = fr_oa_hash_alloc(worker, worker_dedup_hash, worker_dedup_cmp, 0);
 	if (!worker->dedup) {
-		fr_strerror_const("Failed creating de_dup tree");
+		fr_strerror_const("Failed creating de_dup table");
+		goto fail;
+	}
+
+	/*
+	 *	All of the workers append to the same file.  Each
+	 *	timeline is written with one write(), so they don't
+	 *	get mixed up.
+	 *
+	 *	The file is non-blocking, so that a FIFO with a slow
+	 *	reader makes us drop timelines instead of blocking the
+	 *	worker.  Timelines are smaller than PIPE_BUF, so a
+	 *	write to a FIFO is either complete, or fails.
+	 */
+	if (worker->config.trace && worker->config.trace_threshold && worker->config.trace_file) {
+		worker->trace_fd = open(worker->config.trace_file, O_WRONLY | O_APPEND | O_CREAT | O_NONBLOCK, 0600);
+		if (worker->trace_fd < 0) {
+			fr_strerror_printf("Failed opening trace file %s: %s",
+					   worker->config.trace_file, fr_syserror(errno));
+			goto fail;
+		}
+	}
+
+	/*
+	 *	Requests are allocated and freed by this
+	 *	thread, so they're recycled through its
+	 *	free list.
+	 */
+	worker->free_list = request_free_list_init(worker->config.max_free_requests);
+	worker->pair_index = fr_pair_list_index_stats();
+
+	if (fr_event_timer_in(worker, el, &worker->ev_trim, fr_time_delta_from_sec(WORKER_TRIM_INTERVAL),
+			      worker_trim_free_list, worker) < 0) {
+		fr_strerror_const_push("Failed inserting request free list timer");
 		goto fail;
 	}
 
@@ -1146,6 +1292,25 @@ nomem:
 }
 
 
+/** Check for new requests, without waiting
+ *
+ * @param[in] uctx	the worker
+ * @return true if there are runnable requests.
+ */
+static bool worker_poll(void *uctx)
+{
+	int		i;
+	fr_worker_t	*worker = uctx;
+
+	for (i = 0; i < worker->config.max_channels; i++) {
+		if (!worker->channel[i]) continue;
+
+		while (fr_channel_recv_request(worker->channel[i]));
+	}
+
+	return (fr_heap_num_elements(worker->runnable) > 0);
+}
+
 /** The main loop and entry point of the worker thread.
  *
  * @param[in] worker the worker data structure to manage
@@ -1174,7 +1339,11 @@ void fr_worker(fr_worker_t *worker)
 		 *	(e.g. exit), we stop looping and clean up.
 		 */
 		DEBUG3("Gathering events - %s", wait_for_event ? "will wait" : "Will not wait");
-		num_events = fr_event_corral(worker->el, fr_time(), wait_for_event);
+		if (wait_for_event) {
+			num_events = fr_busy_poll_corral(&worker->busy_poll, worker->el, worker_poll, worker);
+		} else {
+			num_events = fr_event_corral(worker->el, fr_time(), false);
+		}
 		if (num_events < 0) {
 			PERROR("Failed retrieving events");
 			break;
@@ -1342,7 +1511,7 @@ static void worker_verify(fr_worker_t *worker)
 	(void) talloc_get_type_abort(worker->runnable, fr_heap_t);
 
 	fr_assert(worker->dedup != NULL);
-	(void) talloc_get_type_abort(worker->dedup, rbtree_t);
+	(void) talloc_get_type_abort(worker->dedup, fr_oa_hash_t);
 
 	for (i = 0; i < worker->config.max_channels; i++) {
 		if (!worker->channel[i]) continue;
@@ -1384,6 +1553,21 @@ static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_inf
 		fprintf(fp, "count.runnable\t\t\t%u\n", fr_heap_num_elements(worker->runnable));
 	}
 
+	if ((info->argc == 0) || (strcmp(info->argv[0], "requests") == 0)) {
+		fprintf(fp, "requests.alloced\t\t%" PRIu64 "\n", worker->free_list->alloced);
+		fprintf(fp, "requests.reused\t\t\t%" PRIu64 "\n", worker->free_list->reused);
+		fprintf(fp, "requests.freed\t\t\t%" PRIu64 "\n", worker->free_list->freed);
+		fprintf(fp, "requests.trimmed\t\t%" PRIu64 "\n", worker->free_list->trimmed);
+		fprintf(fp, "requests.free\t\t\t%u\n", worker->free_list->num);
+		fprintf(fp, "requests.max_free\t\t%u\n", worker->free_list->max);
+	}
+
+	if ((info->argc == 0) || (strcmp(info->argv[0], "pairs") == 0)) {
+		fprintf(fp, "pairs.index_lookups\t\t%" PRIu64 "\n", worker->pair_index->lookups);
+		fprintf(fp, "pairs.index_rebuilds\t\t%" PRIu64 "\n", worker->pair_index->rebuilds);
+		fprintf(fp, "pairs.index_saved\t\t%" PRIu64 "\n", worker->pair_index->pairs_saved);
+	}
+
 	if ((info->argc == 0) || (strcmp(info->argv[0], "cpu") == 0)) {
 		when = worker->predicted;
 		fprintf(fp, "cpu.request_time_rtt\t\t%u.%09" PRIu64 "\n", (unsigned int) (when / NSEC), when % NSEC);
@@ -1402,6 +1586,14 @@ static int cmd_stats_worker(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_inf
 		fr_time_elapsed_fprint(fp, &worker->wall_clock, "time.requests", 4);
 	}
 
+	if ((info->argc == 0) || (strcmp(info->argv[0], "trace") == 0)) {
+		fr_trace_stats_fprint(fp, &worker->trace_stats, "trace");
+	}
+
+	if ((info->argc == 0) || (strcmp(info->argv[0], "poll") == 0)) {
+		fr_busy_poll_stats_fprint(fp, &worker->busy_poll);
+	}
+
 	return 0;
 }
 
@@ -1417,7 +1609,7 @@ fr_cmd_table_t cmd_worker_table[] = {
 		.parent = "stats worker",
 		.add_name = true,
 		.name = "self",
-		.syntax = "[(count|cpu)]",
+		.syntax = "[(count|cpu|requests|pairs|poll|trace)]",
 		.func = cmd_stats_worker,
 		.help = "Show statistics for a specific worker thread.",
 		.read_only = true
@@ -57,6 +57,7 @@ extern fr_cmd_table_t cmd_worker_table[];
 
 typedef struct {
 	int		max_requests;		//!< max requests this worker will handle
+	uint32_t	max_free_requests;	//!< max freed requests this worker keeps for re-use
 
 	int		max_channels;		//!< maximum number of channels
 
@@ -64,6 +65,14 @@ typedef struct {
 	int             ring_buffer_size;	//!< default start size for the ring buffers
 
 	fr_time_delta_t	max_request_time;	//!< maximum time a request can be processed
+	fr_time_delta_t	busy_poll;		//!< maximum time to spin before sleeping.  0 disables.
+
+	bool		trace;			//!< record a timeline for each request.
+	fr_time_delta_t	trace_threshold;	//!< write out timelines for requests slower than this.
+	char const	*trace_file;		//!< where timelines are written.
+
+	uint32_t	reader_numa_node;	//!< NUMA node of the networks which read our replies.
+	bool		reader_numa_node_is_set;
 
 	size_t		talloc_pool_size;	//!< for each request
 } fr_worker_config_t;
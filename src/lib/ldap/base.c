@@ -506,8 +506,12 @@ fr_ldap_rcode_t fr_ldap_bind(request_t *request,
 		struct berval cred;
 
 		if (password) {
+			/*
+			 *	May be the value of a pair, which isn't
+			 *	necessarily a talloced buffer.
+			 */
 			memcpy(&cred.bv_val, &password, sizeof(cred.bv_val));
-			cred.bv_len = talloc_array_length(password) - 1;
+			cred.bv_len = strlen(password);
 		} else {
 			cred.bv_val = NULL;
 			cred.bv_len = 0;
@@ -178,9 +178,9 @@ int fr_ldap_control_add_session_tracking(fr_ldap_connection_t *conn, request_t *
 	int			ret;
 
 	char			ipaddress[INET6_ADDRSTRLEN];
-	char			*username = NULL;
-	char			*acctsessionid = NULL;
-	char			*acctmultisessionid = NULL;
+	fr_pair_t const		*username = NULL;
+	fr_pair_t const		*acctsessionid = NULL;
+	fr_pair_t const		*acctmultisessionid = NULL;
 	char			*hostname;
 
 	LDAPControl		*username_control = NULL;
@@ -205,22 +205,22 @@ int fr_ldap_control_add_session_tracking(fr_ldap_connection_t *conn, request_t *
 			break;
 
 		case FR_USER_NAME:
-			memcpy(&username, &vp->vp_strvalue, sizeof(username));
+			username = vp;
 			break;
 
 		case FR_ACCT_SESSION_ID:
-			memcpy(&acctsessionid, &vp->vp_strvalue, sizeof(acctsessionid));
+			acctsessionid = vp;
 			break;
 
 		case FR_ACCT_MULTI_SESSION_ID:
-			memcpy(&acctmultisessionid, &vp->vp_strvalue, sizeof(acctmultisessionid));
+			acctmultisessionid = vp;
 			break;
 		}
 	}
 
 	if (username) {
-		tracking_id.bv_val = username;
-		tracking_id.bv_len = talloc_array_length(username) - 1;
+		memcpy(&tracking_id.bv_val, &username->vp_strvalue, sizeof(tracking_id.bv_val));
+		tracking_id.bv_len = username->vp_length;
 
 		ret = ldap_create_session_tracking_control(conn->handle, ipaddress,
 							   hostname,
@@ -238,8 +238,8 @@ int fr_ldap_control_add_session_tracking(fr_ldap_connection_t *conn, request_t *
 	}
 
 	if (acctsessionid) {
-		tracking_id.bv_val = acctsessionid;
-		tracking_id.bv_len = talloc_array_length(acctsessionid) - 1;
+		memcpy(&tracking_id.bv_val, &acctsessionid->vp_strvalue, sizeof(tracking_id.bv_val));
+		tracking_id.bv_len = acctsessionid->vp_length;
 
 		ret = ldap_create_session_tracking_control(conn->handle, ipaddress,
 							   hostname,
@@ -253,8 +253,8 @@ int fr_ldap_control_add_session_tracking(fr_ldap_connection_t *conn, request_t *
 	}
 
 	if (acctmultisessionid) {
-		tracking_id.bv_val = acctmultisessionid;
-		tracking_id.bv_len = talloc_array_length(acctmultisessionid) - 1;
+		memcpy(&tracking_id.bv_val, &acctmultisessionid->vp_strvalue, sizeof(tracking_id.bv_val));
+		tracking_id.bv_len = acctmultisessionid->vp_length;
 
 		ret = ldap_create_session_tracking_control(conn->handle, ipaddress,
 							   hostname,
@@ -35,6 +35,7 @@ RCSID("$Id$")
 
 #include <freeradius-devel/util/debug.h>
 #include <freeradius-devel/util/hex.h>
+#include <freeradius-devel/util/lpm.h>
 #include <freeradius-devel/util/misc.h>
 #include <freeradius-devel/util/trie.h>
 
@@ -56,6 +57,9 @@ struct rad_client_list {
 	fr_trie_t	*v6_tcp;
 #else
 	rbtree_t	*tree[129];
+
+	fr_lpm_t	*v4[3];			//!< Read-only copies of "tree", indexed by client_lpm_index().
+	fr_lpm_t	*v6[3];			//!< Built by client_list_compile().
 #endif
 };
 
@@ -79,6 +83,53 @@ static int client_cmp(void const *one, void const *two)
 	return a->proto - b->proto;
 }
 
+/** Which of the compiled tables to use for a protocol
+ *
+ */
+static int client_lpm_index(int proto)
+{
+	switch (proto) {
+	case IPPROTO_UDP:
+		return 0;
+
+	case IPPROTO_TCP:
+		return 1;
+
+	case IPPROTO_IP:
+		return 2;
+
+	default:
+		return -1;
+	}
+}
+
+/** Free the compiled tables, so that lookups use the trees
+ *
+ */
+static void client_list_uncompile(RADCLIENT_LIST *clients)
+{
+	size_t i;
+
+	for (i = 0; i < NUM_ELEMENTS(clients->v4); i++) {
+		TALLOC_FREE(clients->v4[i]);
+		TALLOC_FREE(clients->v6[i]);
+	}
+}
+
+typedef struct {
+	RADCLIENT	**clients;
+	size_t		num;
+} client_list_collect_t;
+
+static int _client_list_collect(void *data, void *uctx)
+{
+	client_list_collect_t *collect = uctx;
+
+	collect->clients[collect->num++] = data;
+
+	return 0;
+}
+
 #endif
 
 void client_list_free(void)
@@ -328,6 +379,11 @@ bool client_add(RADCLIENT_LIST *clients, RADCLIENT *client)
 		client_free(client);
 		return false;
 	}
+
+	/*
+	 *	The compiled tables are now out of date.
+	 */
+	client_list_uncompile(clients);
 #endif
 
 	/*
@@ -363,7 +419,111 @@ void client_delete(RADCLIENT_LIST *clients, RADCLIENT *client)
 	if (!clients->tree[client->ipaddr.prefix]) return;
 
 	(void) rbtree_deletebydata(clients->tree[client->ipaddr.prefix], client);
+
+	client_list_uncompile(clients);
+#endif
+}
+
+#ifndef WITH_TRIE
+/** Build a read-only table of the clients for one address family and protocol
+ *
+ * Lookups for "proto = *" match any client.  Lookups for a particular
+ * protocol match clients for that protocol, and clients which accept
+ * any protocol.
+ */
+static fr_lpm_t *client_lpm_alloc(RADCLIENT_LIST *clients, client_list_collect_t const *collect,
+				  fr_lpm_entry_t *entries, int af, int proto)
+{
+	size_t i, num = 0;
+
+	for (i = 0; i < collect->num; i++) {
+		RADCLIENT *client = collect->clients[i];
+
+		if (client->ipaddr.af != af) continue;
+
+		if ((proto != IPPROTO_IP) && (client->proto != IPPROTO_IP) && (client->proto != proto)) continue;
+
+		memset(entries[num].key, 0, sizeof(entries[num].key));
+		if (af == AF_INET) {
+			memcpy(entries[num].key, &client->ipaddr.addr.v4, sizeof(client->ipaddr.addr.v4));
+		} else {
+			memcpy(entries[num].key, &client->ipaddr.addr.v6, sizeof(client->ipaddr.addr.v6));
+		}
+		entries[num].keylen = client->ipaddr.prefix;
+		entries[num].data = client;
+		num++;
+	}
+
+	return fr_lpm_alloc(clients, entries, num);
+}
+#endif
+
+/** Build read-only tables for fast client lookups
+ *
+ * This should be called once all of the clients have been added.
+ * Adding or deleting a client frees the tables, and lookups then
+ * search the list one prefix length at a time, until this function
+ * is called again.
+ *
+ * @param clients list to compile, may be NULL if global client list is being used.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.  Lookups still work, but are slower.
+ */
+int client_list_compile(RADCLIENT_LIST *clients)
+{
+#ifndef WITH_TRIE
+	client_list_collect_t	collect = { .clients = NULL, .num = 0 };
+	fr_lpm_t		*v4[NUM_ELEMENTS(clients->v4)] = { NULL }, *v6[NUM_ELEMENTS(clients->v6)] = { NULL };
+	fr_lpm_entry_t		*entries;
+	size_t			i, num = 0;
+	int			proto[] = { IPPROTO_UDP, IPPROTO_TCP, IPPROTO_IP };
+
+	if (!clients) clients = root_clients;
+	if (!clients) return 0;
+
+	for (i = 0; i < NUM_ELEMENTS(clients->tree); i++) {
+		if (clients->tree[i]) num += rbtree_num_elements(clients->tree[i]);
+	}
+
+	MEM(collect.clients = talloc_array(NULL, RADCLIENT *, num ? num : 1));
+	MEM(entries = talloc_array(collect.clients, fr_lpm_entry_t, num ? num : 1));
+
+	for (i = 0; i < NUM_ELEMENTS(clients->tree); i++) {
+		if (clients->tree[i]) (void) rbtree_walk(clients->tree[i], RBTREE_IN_ORDER,
+							 _client_list_collect, &collect);
+	}
+
+	for (i = 0; i < NUM_ELEMENTS(proto); i++) {
+		fr_assert(client_lpm_index(proto[i]) == (int) i);
+
+		v4[i] = client_lpm_alloc(clients, &collect, entries, AF_INET, proto[i]);
+		v6[i] = client_lpm_alloc(clients, &collect, entries, AF_INET6, proto[i]);
+		if (!v4[i] || !v6[i]) {
+			PERROR("Failed building client lookup tables for %s", clients->name);
+			for (num = 0; num <= i; num++) {
+				talloc_free(v4[num]);
+				talloc_free(v6[num]);
+			}
+			talloc_free(collect.clients);
+			return -1;
+		}
+	}
+
+	/*
+	 *	Only replace the old tables once all of the new ones
+	 *	have been built.
+	 */
+	client_list_uncompile(clients);
+	for (i = 0; i < NUM_ELEMENTS(proto); i++) {
+		clients->v4[i] = v4[i];
+		clients->v6[i] = v6[i];
+	}
+
+	talloc_free(collect.clients);
 #endif
+
+	return 0;
 }
 
 RADCLIENT *client_findbynumber(UNUSED const RADCLIENT_LIST *clients, UNUSED int number)
@@ -382,6 +542,7 @@ RADCLIENT *client_find(RADCLIENT_LIST const *clients, fr_ipaddr_t const *ipaddr,
 #else
 	int i, max;
 	RADCLIENT my_client, *client;
+	fr_lpm_t const *lpm = NULL;
 #endif
 
 	if (!clients) clients = root_clients;
@@ -394,6 +555,20 @@ RADCLIENT *client_find(RADCLIENT_LIST const *clients, fr_ipaddr_t const *ipaddr,
 	return fr_trie_lookup(trie, &ipaddr->addr, ipaddr->prefix);
 #else
 
+	/*
+	 *	Use the compiled tables if we have them.  They only
+	 *	work for full addresses.
+	 */
+	i = client_lpm_index(proto);
+	if (i >= 0) {
+		if ((ipaddr->af == AF_INET) && (ipaddr->prefix == 32)) {
+			lpm = clients->v4[i];
+		} else if ((ipaddr->af == AF_INET6) && (ipaddr->prefix == 128)) {
+			lpm = clients->v6[i];
+		}
+	}
+	if (lpm) return fr_lpm_lookup(lpm, &ipaddr->addr, ipaddr->prefix);
+
 	if (proto == AF_INET) {
 		max = 32;
 	} else {
@@ -572,6 +747,8 @@ RADCLIENT_LIST *client_list_parse_section(CONF_SECTION *section, int proto, TLS_
 
 	}
 
+	(void) client_list_compile(clients);
+
 	/*
 	 *	Associate the clients structure with the section.
 	 */
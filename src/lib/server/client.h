@@ -121,6 +121,8 @@ void		client_list_free(void);
 
 RADCLIENT_LIST	*client_list_parse_section(CONF_SECTION *section, int proto, bool tls_required);
 
+int		client_list_compile(RADCLIENT_LIST *clients);
+
 void		client_free(RADCLIENT *client);
 
 bool		client_add(RADCLIENT_LIST *clients, RADCLIENT *client);
@@ -37,6 +37,7 @@ SOURCES	:= \
 	stats.c \
 	tmpl_eval.c \
 	tmpl_tokenize.c \
+	trace.c \
 	trigger.c \
 	trunk.c \
 	users_file.c \
@@ -166,6 +166,20 @@ static const CONF_PARSER thread_config[] = {
 
 	{ FR_CONF_OFFSET("stats_interval | FR_TYPE_HIDDEN", FR_TYPE_TIME_DELTA, main_config_t, stats_interval), },
 
+	{ FR_CONF_OFFSET("steal_delay", FR_TYPE_TIME_DELTA, main_config_t, steal_delay), .dflt = "0" },
+	{ FR_CONF_OFFSET("network_busy_poll", FR_TYPE_TIME_DELTA, main_config_t, network_busy_poll), .dflt = "0" },
+	{ FR_CONF_OFFSET("worker_busy_poll", FR_TYPE_TIME_DELTA, main_config_t, worker_busy_poll), .dflt = "0" },
+	{ FR_CONF_OFFSET("worker_free_requests", FR_TYPE_UINT32, main_config_t, worker_free_requests), .dflt = "256" },
+
+	{ FR_CONF_OFFSET("trace", FR_TYPE_BOOL, main_config_t, trace), .dflt = "no" },
+	{ FR_CONF_OFFSET("trace_threshold", FR_TYPE_TIME_DELTA, main_config_t, trace_threshold), .dflt = "0" },
+	{ FR_CONF_OFFSET("trace_file", FR_TYPE_STRING, main_config_t, trace_file) },
+
+	{ FR_CONF_OFFSET("network_cpus", FR_TYPE_STRING, main_config_t, network_cpus) },
+	{ FR_CONF_OFFSET("worker_cpus", FR_TYPE_STRING, main_config_t, worker_cpus) },
+	{ FR_CONF_OFFSET_IS_SET("network_numa_node", FR_TYPE_UINT32, main_config_t, network_numa_node) },
+	{ FR_CONF_OFFSET_IS_SET("worker_numa_node", FR_TYPE_UINT32, main_config_t, worker_numa_node) },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -436,7 +450,8 @@ static int num_networks_parse(TALLOC_CTX *ctx, void *out, void *parent,
 
 	memcpy(&value, out, sizeof(value));
 
-	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, ==, 1);
+	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, >=, 1);
+	FR_INTEGER_BOUND_CHECK("thread.num_networks", value, <=, 64);
 
 	memcpy(out, &value, sizeof(value));
 
@@ -138,6 +138,21 @@ struct main_config_s {
 	uint32_t	max_networks;			//!< for the scheduler
 	uint32_t	max_workers;			//!< for the scheduler
 	fr_time_delta_t	stats_interval;			//!< for the scheduler
+	fr_time_delta_t	steal_delay;			//!< for the scheduler
+	fr_time_delta_t	network_busy_poll;		//!< for the scheduler
+	fr_time_delta_t	worker_busy_poll;		//!< for the scheduler
+	uint32_t	worker_free_requests;		//!< for the scheduler
+
+	bool		trace;				//!< for the scheduler
+	fr_time_delta_t	trace_threshold;		//!< for the scheduler
+	char const	*trace_file;			//!< for the scheduler
+
+	char const	*network_cpus;			//!< for the scheduler
+	char const	*worker_cpus;			//!< for the scheduler
+	uint32_t	network_numa_node;		//!< for the scheduler
+	uint32_t	worker_numa_node;		//!< for the scheduler
+	bool		network_numa_node_is_set;
+	bool		worker_numa_node_is_set;
 
 };
 
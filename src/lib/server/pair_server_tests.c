@@ -46,6 +46,7 @@ static void pair_tests_init(void);
 #include <freeradius-devel/util/dict.h>
 #include <freeradius-devel/util/pair.h>
 #include <freeradius-devel/util/talloc.h>
+#include <freeradius-devel/util/time.h>
 
 #include <freeradius-devel/server/pair.h>
 #include <freeradius-devel/server/request.h>
@@ -54,6 +55,8 @@ static void pair_tests_init(void);
 #	include <gperftools/profiler.h>
 #endif
 
+#include <sys/resource.h>
+
 static char const       *dict_dir  = "share/dictionary";
 
 /* Set by pair_tests_init()*/
@@ -467,6 +470,181 @@ static void test_pair_delete_session_state(void)
 	TEST_CHECK_RET(talloc_free(request), 0);
 }
 
+/** Fill the request list with a mix of leaf and nested pairs
+ *
+ */
+static void request_pool_fill(request_t *request, int num)
+{
+	fr_pair_t	*vp, *tlv;
+	int		i;
+
+	for (i = 0; i < num; i++) {
+		if ((i & 0x01) == 0) {
+			TEST_CHECK(fr_pair_add_by_da(request->request_ctx, &vp, &request->request_pairs,
+						     attr_test_string) == 0);
+			TEST_CHECK(fr_pair_value_bstrndup(vp, "user@example.org", 16, false) == 0);
+		} else {
+			TEST_CHECK(fr_pair_add_by_da(request->request_ctx, &vp, &request->request_pairs,
+						     attr_test_integer) == 0);
+			vp->vp_uint32 = i;
+		}
+	}
+
+	TEST_CHECK(fr_pair_add_by_da(request->request_ctx, &tlv, &request->request_pairs, attr_test_tlv_root) == 0);
+	TEST_CHECK(fr_pair_add_by_da(tlv, &vp, &tlv->vp_group, attr_test_tlv_string) == 0);
+	TEST_CHECK(fr_pair_value_strdup(vp, "nested") == 0);
+}
+
+static void test_pair_request_pool(void)
+{
+	request_t	*request;
+	fr_pair_t	*vp, *tlv;
+
+	TEST_CASE("Fill the request with more pairs than the pool has room for");
+	request = request_alloc(NULL, NULL);
+	TEST_CHECK(request != NULL);
+	request_pool_fill(request, REQUEST_POOL_PAIRS * 3);
+	TEST_CHECK(fr_pair_list_len(&request->request_pairs) == (REQUEST_POOL_PAIRS * 3) + 1);
+
+	TEST_CASE("Move a pair from the request list to the reply list");
+	vp = fr_pair_find_by_da(&request->request_pairs, attr_test_string);
+	TEST_CHECK(vp != NULL);
+	fr_pair_remove(&request->request_pairs, vp);
+	fr_pair_steal(request->reply_ctx, vp);
+	fr_pair_add(&request->reply_pairs, vp);
+	TEST_CHECK(fr_pair_find_by_da(&request->reply_pairs, attr_test_string) == vp);
+	TEST_CHECK(strcmp(vp->vp_strvalue, "user@example.org") == 0);
+
+	TEST_CASE("Nested pairs are intact");
+	tlv = fr_pair_find_by_da(&request->request_pairs, attr_test_tlv_root);
+	TEST_CHECK(tlv != NULL);
+	TEST_CHECK((vp = fr_pair_find_by_da(&tlv->vp_group, attr_test_tlv_string)) != NULL);
+	TEST_CHECK(vp && (strcmp(vp->vp_strvalue, "nested") == 0));
+
+	TEST_CASE("Recycled requests start with empty lists");
+	talloc_free(request);
+	request = request_alloc(NULL, NULL);
+	TEST_CHECK(request != NULL);
+	TEST_CHECK(fr_pair_list_empty(&request->request_pairs));
+	TEST_CHECK(fr_pair_list_empty(&request->reply_pairs));
+
+	request_pool_fill(request, REQUEST_POOL_PAIRS);
+	TEST_CHECK(fr_pair_list_len(&request->request_pairs) == REQUEST_POOL_PAIRS + 1);
+	talloc_free(request);
+}
+
+#define REQUEST_FREE_TEST_MAX	(4)
+
+static void test_pair_request_free_list(void)
+{
+	request_free_list_stats_t const	*stats;
+	request_t			*requests[REQUEST_FREE_TEST_MAX * 2];
+	uint64_t			alloced, reused, freed;
+	size_t				i;
+
+	stats = request_free_list_init(REQUEST_FREE_TEST_MAX);
+	TEST_CHECK(stats->max == REQUEST_FREE_TEST_MAX);
+	TEST_CHECK(stats->num <= REQUEST_FREE_TEST_MAX);
+
+	TEST_CASE("Requests past the limit are freed");
+	for (i = 0; i < NUM_ELEMENTS(requests); i++) {
+		requests[i] = request_alloc(NULL, NULL);
+		TEST_CHECK(requests[i] != NULL);
+	}
+	TEST_CHECK(stats->num == 0);
+
+	freed = stats->freed;
+	for (i = 0; i < NUM_ELEMENTS(requests); i++) talloc_free(requests[i]);
+	TEST_CHECK(stats->num == REQUEST_FREE_TEST_MAX);
+	TEST_CHECK(stats->freed == freed + REQUEST_FREE_TEST_MAX);
+
+	TEST_CASE("Freed requests are re-used");
+	alloced = stats->alloced;
+	reused = stats->reused;
+	requests[0] = request_alloc(NULL, NULL);
+	requests[1] = request_alloc(NULL, NULL);
+	TEST_CHECK(stats->reused == reused + 2);
+	TEST_CHECK(stats->alloced == alloced);
+	TEST_CHECK(stats->num == REQUEST_FREE_TEST_MAX - 2);
+
+	TEST_CASE("Re-used requests are initialised");
+	TEST_CHECK(fr_pair_list_empty(&requests[0]->request_pairs));
+	TEST_CHECK(fr_pair_list_empty(&requests[0]->session_state_pairs));
+	TEST_CHECK(requests[0]->stack != NULL);
+	TEST_CHECK(requests[0]->log.dst != NULL);
+	request_pool_fill(requests[0], REQUEST_POOL_PAIRS);
+	TEST_CHECK(fr_pair_list_len(&requests[0]->request_pairs) == REQUEST_POOL_PAIRS + 1);
+
+	talloc_free(requests[0]);
+	talloc_free(requests[1]);
+	TEST_CHECK(stats->num == REQUEST_FREE_TEST_MAX);
+
+	TEST_CASE("Trimming frees half of the requests which weren't needed");
+	request_free_list_trim();		/* Sets the low water mark to the length of the list */
+	TEST_CHECK(request_free_list_trim() == REQUEST_FREE_TEST_MAX / 2);
+	TEST_CHECK(stats->num == REQUEST_FREE_TEST_MAX / 2);
+
+	requests[0] = request_alloc(NULL, NULL);
+	requests[1] = request_alloc(NULL, NULL);
+	TEST_CHECK(stats->num == 0);
+	talloc_free(requests[0]);
+	talloc_free(requests[1]);
+	TEST_CHECK(request_free_list_trim() == 0);
+	TEST_CHECK(stats->num == 2);
+
+	TEST_CASE("Lowering the limit shrinks the list");
+	request_free_list_init(1);
+	TEST_CHECK(stats->num == 1);
+	request_free_list_init(0);
+	TEST_CHECK(stats->num == 0);
+
+	requests[0] = request_alloc(NULL, NULL);
+	talloc_free(requests[0]);
+	TEST_CHECK(stats->num == 0);
+
+	request_free_list_init(REQUEST_FREE_LIST_MAX);
+}
+
+#define REQUEST_BENCH_ACTIVE	(256)
+#define REQUEST_BENCH_ROUNDS	(20)
+#define REQUEST_BENCH_PAIRS	(80)
+
+/** Allocate, fill and free requests, as the worker would for an accounting packet
+ *
+ * Only run if FR_TEST_BENCHMARK is set.
+ */
+static void test_pair_request_pool_benchmark(void)
+{
+	request_t	*requests[REQUEST_BENCH_ACTIVE];
+	int		i, j;
+	size_t		blocks = 0;
+	fr_time_t	start;
+	fr_time_delta_t	elapsed;
+	struct rusage	usage;
+
+	TEST_BENCHMARK();
+
+	start = fr_time();
+	for (i = 0; i < REQUEST_BENCH_ROUNDS; i++) {
+		for (j = 0; j < REQUEST_BENCH_ACTIVE; j++) {
+			requests[j] = request_alloc(NULL, NULL);
+			request_pool_fill(requests[j], REQUEST_BENCH_PAIRS);
+		}
+
+		if (i == 0) blocks = talloc_total_blocks(requests[0]);
+
+		for (j = 0; j < REQUEST_BENCH_ACTIVE; j++) talloc_free(requests[j]);
+	}
+	elapsed = fr_time() - start;
+
+	getrusage(RUSAGE_SELF, &usage);
+
+	printf("\n%d pairs/request, %zu talloc chunks/request, %d pooled pairs\n",
+	       REQUEST_BENCH_PAIRS + 1, blocks, REQUEST_POOL_PAIRS);
+	printf("%" PRIu64 " ns/request, max rss %ld KiB\n",
+	       (uint64_t) elapsed / (REQUEST_BENCH_ROUNDS * REQUEST_BENCH_ACTIVE), usage.ru_maxrss);
+}
+
 TEST_LIST = {
 	/*
 	 *	Add pairs
@@ -492,5 +670,12 @@ TEST_LIST = {
 	{ "pair_delete_control",       test_pair_delete_control },
 	{ "pair_delete_session_state", test_pair_delete_session_state },
 
+	/*
+	 *	Request pools
+	 */
+	{ "pair_request_pool",         test_pair_request_pool },
+	{ "pair_request_free_list",    test_pair_request_free_list },
+	{ "pair_request_pool_bench",   test_pair_request_pool_benchmark },
+
 	{ NULL }
 };
@@ -240,19 +240,28 @@ int paircmp_pairs(UNUSED request_t *request, fr_pair_t *check, fr_pair_t *vp)
 
 		char *expr = NULL, *value = NULL;
 		char const *expr_p, *value_p;
+		size_t expr_len, value_len;
 
+		/*
+		 *	String values may be stored in the pair
+		 *	itself, so use the pair's length.
+		 */
 		if (check->vp_type == FR_TYPE_STRING) {
 			expr_p = check->vp_strvalue;
+			expr_len = check->vp_length;
 		} else {
 			fr_value_box_aprint(check, &expr, &check->data, NULL);
 			expr_p = expr;
+			expr_len = expr ? talloc_array_length(expr) - 1 : 0;
 		}
 
 		if (vp->vp_type == FR_TYPE_STRING) {
 			value_p = vp->vp_strvalue;
+			value_len = vp->vp_length;
 		} else {
 			fr_value_box_aprint(vp, &value, &vp->data, NULL);
 			value_p = value;
+			value_len = value ? talloc_array_length(value) - 1 : 0;
 		}
 
 		if (!expr_p || !value_p) {
@@ -268,7 +277,7 @@ int paircmp_pairs(UNUSED request_t *request, fr_pair_t *check, fr_pair_t *vp)
 		/*
 		 *	Include substring matches.
 		 */
-		slen = regex_compile(request, &preg, expr_p, talloc_array_length(expr_p) - 1,
+		slen = regex_compile(request, &preg, expr_p, expr_len,
 				     NULL, true, true);
 		if (slen <= 0) {
 			REMARKER(expr_p, -slen, "%s", fr_strerror());
@@ -283,7 +292,7 @@ int paircmp_pairs(UNUSED request_t *request, fr_pair_t *check, fr_pair_t *vp)
 		/*
 		 *	Evaluate the expression
 		 */
-		slen = regex_exec(preg, value_p, talloc_array_length(value_p) - 1, regmatch);
+		slen = regex_exec(preg, value_p, value_len, regmatch);
 		if (slen < 0) {
 			RPERROR("Invalid regex");
 
@@ -54,11 +54,20 @@ fr_dict_attr_autoload_t request_dict_attr[] = {
 	{ NULL }
 };
 
+/** Requests which have been freed, and are kept by a thread for re-use
+ *
+ */
+typedef struct {
+	fr_dlist_head_t			list;		//!< Requests waiting to be re-used.
+	uint32_t			low_water;	//!< Fewest requests in the list since the last trim.
+	request_free_list_stats_t	stats;		//!< Counters, and the maximum length of the list.
+} request_free_list_t;
+
 /** The thread local free list
  *
  * Any entries remaining in the list will be freed when the thread is joined
  */
-static _Thread_local fr_dlist_head_t *request_free_list; /* macro */
+static _Thread_local request_free_list_t *request_free_list; /* macro */
 
 #ifndef NDEBUG
 static int _state_ctx_free(fr_pair_t *state)
@@ -241,7 +250,8 @@ static inline CC_HINT(always_inline) int request_init(char const *file, int line
 #define list_init(_ctx, _list) \
 	do { \
 		vp = fr_pair_afrom_da(_ctx, request_attr_##_list); \
-		if (unlikely(!vp)) { \
+		if (unlikely(!vp || (fr_pair_list_index_enable(vp, &vp->children) < 0))) { \
+			talloc_free(vp); \
 			talloc_free(pair_root); \
 			memset(&request->pair_list, 0, sizeof(request->pair_list)); \
 			return -1; \
@@ -307,8 +317,9 @@ static int _request_free(request_t *request)
 	 *	We keep a buffer of <active> + N requests per
 	 *	thread, to avoid spurious allocations.
 	 */
-	if (fr_dlist_num_elements(request_free_list) <= 256) {
-		fr_dlist_head_t		*free_list;
+	if (request_free_list &&
+	    (fr_dlist_num_elements(&request_free_list->list) < request_free_list->stats.max)) {
+		request_free_list_t	*free_list;
 
 		if (request->session_state_ctx) {
 			fr_assert(talloc_parent(request->session_state_ctx) != request);	/* Should never be directly parented */
@@ -317,7 +328,9 @@ static int _request_free(request_t *request)
 		free_list = request_free_list;
 
 		/*
-		 *	Reinitialise the request
+		 *	Reinitialise the request.  Freeing the
+		 *	children resets the talloc pool, so the
+		 *	next user of the request gets all of it.
 		 */
 		talloc_free_children(request);
 
@@ -327,7 +340,8 @@ static int _request_free(request_t *request)
 		/*
 		 *	Reinsert into the free list
 		 */
-		fr_dlist_insert_head(free_list, request);
+		fr_dlist_insert_head(&free_list->list, request);
+		free_list->stats.num = fr_dlist_num_elements(&free_list->list);
 		request_free_list = free_list;
 
 		return -1;	/* Prevent free */
@@ -339,6 +353,8 @@ static int _request_free(request_t *request)
 	 */
 	talloc_free_children(request);
 
+	if (request_free_list) request_free_list->stats.freed++;
+
 really_free:
 	/*
 	 *	state_ctx is parented separately.
@@ -352,19 +368,104 @@ really_free:
 	return 0;
 }
 
+/** Free the oldest request in the free list
+ *
+ * Requests in the free list have already been cleared by #_request_free,
+ * so there's nothing left for the destructor to do.
+ */
+static inline CC_HINT(always_inline) void request_free_list_free_tail(request_free_list_t *free_list)
+{
+	request_t *request;
+
+	request = fr_dlist_pop_tail(&free_list->list);
+	if (!request) return;
+
+	talloc_set_destructor(request, NULL);
+	talloc_free(request);
+
+	free_list->stats.num = fr_dlist_num_elements(&free_list->list);
+	free_list->stats.freed++;
+}
+
 /** Free any free requests when the thread is joined
  *
  */
 static void _request_free_list_free_on_exit(void *arg)
 {
-	fr_dlist_head_t *list = talloc_get_type_abort(arg, fr_dlist_head_t);
+	request_free_list_t	*free_list = talloc_get_type_abort(arg, request_free_list_t);
 	request_t		*request;
 
 	/*
 	 *	See the destructor for why this works
 	 */
-	while ((request = fr_dlist_head(list))) talloc_free(request);
-	talloc_free(list);
+	while ((request = fr_dlist_head(&free_list->list))) talloc_free(request);
+	talloc_free(free_list);
+}
+
+/** Return the free list for this thread, creating it if necessary
+ *
+ */
+static inline CC_HINT(always_inline) request_free_list_t *request_free_list_get(void)
+{
+	request_free_list_t *free_list;
+
+	if (likely(request_free_list != NULL)) return request_free_list;
+
+	MEM(free_list = talloc_zero(NULL, request_free_list_t));
+	fr_dlist_init(&free_list->list, request_t, free_entry);
+	free_list->stats.max = REQUEST_FREE_LIST_MAX;
+	fr_thread_local_set_destructor(request_free_list, _request_free_list_free_on_exit, free_list);
+
+	return free_list;
+}
+
+/** Set how many freed requests this thread keeps for re-use
+ *
+ * Requests are taken from the free list of the thread which allocates
+ * them, and returned to the free list of the thread which frees them.
+ * The list is created by the first call to #request_alloc in a thread,
+ * with room for #REQUEST_FREE_LIST_MAX requests.  This function only
+ * needs to be called to change that.
+ *
+ * @param[in] max	Number of requests to keep.  Requests freed when
+ *			the list is full are returned to the heap.
+ * @return The counters for this thread's free list.  They're only
+ *	valid for the lifetime of the thread.
+ */
+request_free_list_stats_t const *request_free_list_init(uint32_t max)
+{
+	request_free_list_t *free_list = request_free_list_get();
+
+	free_list->stats.max = max;
+	while (fr_dlist_num_elements(&free_list->list) > max) request_free_list_free_tail(free_list);
+	if (free_list->low_water > max) free_list->low_water = max;
+
+	return &free_list->stats;
+}
+
+/** Return requests which haven't been needed recently to the heap
+ *
+ * Should be called periodically by long lived threads.  Any requests
+ * which stayed in the free list since the last call weren't needed to
+ * handle the load.  Half of them are freed, so that the list shrinks
+ * gradually after a burst of traffic, instead of all at once.
+ *
+ * @return The number of requests freed.
+ */
+uint32_t request_free_list_trim(void)
+{
+	request_free_list_t	*free_list = request_free_list;
+	uint32_t		i, num;
+
+	if (!free_list) return 0;
+
+	num = (free_list->low_water + 1) / 2;
+	for (i = 0; i < num; i++) request_free_list_free_tail(free_list);
+
+	free_list->low_water = fr_dlist_num_elements(&free_list->list);
+	free_list->stats.trimmed += num;
+
+	return num;
 }
 
 static inline CC_HINT(always_inline) request_t *request_alloc_pool(TALLOC_CTX *ctx)
@@ -379,14 +480,24 @@ static inline CC_HINT(always_inline) request_t *request_alloc_pool(TALLOC_CTX *c
 	 *	hierarchy means that child requests
 	 *	cannot be returned to a free list
 	 *	and would have to be freed.
+	 *
+	 *	The pool also has room for the pairs
+	 *	of a typical request, and their value
+	 *	buffers, so that decoding a packet
+	 *	doesn't go to the heap for every
+	 *	attribute.  They're all released
+	 *	together when the pool is reset.
 	 */
 	MEM(request = talloc_pooled_object(ctx, request_t,
 					   1 + 					/* Stack pool */
 					   UNLANG_STACK_MAX + 			/* Stack Frames */
 					   2 + 					/* packets */
+					   (REQUEST_POOL_PAIRS * 2) +		/* pairs and value buffers */
 					   10,					/* extra */
 					   (UNLANG_FRAME_PRE_ALLOC * UNLANG_STACK_MAX) +	/* Stack memory */
 					   (sizeof(fr_pair_t) * 5) +		/* pair lists and root*/
+					   (sizeof(fr_pair_t) * REQUEST_POOL_PAIRS) +	/* pairs */
+					   (REQUEST_POOL_PAIR_DATA * REQUEST_POOL_PAIRS) + /* value buffers */
 					   (sizeof(fr_radius_packet_t) * 2) +	/* packets */
 					   128					/* extra */
 					   ));
@@ -408,7 +519,8 @@ static inline CC_HINT(always_inline) request_t *request_alloc_pool(TALLOC_CTX *c
 request_t *_request_alloc(char const *file, int line, TALLOC_CTX *ctx, request_init_args_t const *args)
 {
 	request_t		*request;
-	fr_dlist_head_t		*free_list;
+	request_free_list_t	*free_list;
+	uint32_t		num;
 
 	if (!args) args = &default_args;
 
@@ -416,24 +528,24 @@ request_t *_request_alloc(char const *file, int line, TALLOC_CTX *ctx, request_i
 	 *	Setup the free list, or return the free
 	 *	list for this thread.
 	 */
-	if (unlikely(!request_free_list)) {
-		MEM(free_list = talloc(NULL, fr_dlist_head_t));
-		fr_dlist_init(free_list, request_t, free_entry);
-		fr_thread_local_set_destructor(request_free_list, _request_free_list_free_on_exit, free_list);
-	} else {
-		free_list = request_free_list;
-	}
+	free_list = request_free_list_get();
 
-	request = fr_dlist_head(free_list);
+	request = fr_dlist_head(&free_list->list);
 	if (!request) {
 		request = request_alloc_pool(ctx);
 		talloc_set_destructor(request, _request_free);
+		free_list->stats.alloced++;
 	} else {
 		/*
 		 *	Remove from the free list, as we're
 		 *	about to use it!
 		 */
-		fr_dlist_remove(free_list, request);
+		fr_dlist_remove(&free_list->list, request);
+		free_list->stats.reused++;
+
+		num = fr_dlist_num_elements(&free_list->list);
+		free_list->stats.num = num;
+		if (num < free_list->low_water) free_list->low_water = num;
 	}
 
 	if (request_init(file, line, request, args) < 0) {
@@ -46,6 +46,7 @@ typedef struct rad_client RADCLIENT;
 #include <freeradius-devel/server/main_config.h>
 #include <freeradius-devel/server/rcode.h>
 #include <freeradius-devel/server/signal.h>
+#include <freeradius-devel/server/trace.h>
 #include <freeradius-devel/util/event.h>
 #include <freeradius-devel/util/heap.h>
 #include <freeradius-devel/util/packet.h>
@@ -59,6 +60,37 @@ extern "C" {
 #  define REQUEST_MAGIC (0xdeadbeef)
 #endif
 
+/** How many pairs the pool of each request has room for
+ *
+ * Pairs allocated in the request's lists, and the string/octets
+ * buffers hanging off them, are carved out of the request's talloc
+ * pool.  They're released in bulk when the request is freed, or
+ * returned to the free list.  Anything past this spills over into
+ * normal heap allocations.
+ *
+ * The pair_request_pool_bench test in pair_server_tests.c shows
+ * the effect of changing this.
+ */
+#define REQUEST_POOL_PAIRS	(32)
+#define REQUEST_POOL_PAIR_DATA	(32)	//!< Average length of the value buffer of a pooled pair.
+
+/** How many freed requests each thread keeps for re-use, unless told otherwise
+ *
+ */
+#define REQUEST_FREE_LIST_MAX	(256)
+
+/** Counters for the request free list of a thread
+ *
+ */
+typedef struct {
+	uint64_t		alloced;	//!< Requests allocated because the free list was empty.
+	uint64_t		reused;		//!< Requests taken from the free list.
+	uint64_t		freed;		//!< Requests freed because the free list was full, or trimmed.
+	uint64_t		trimmed;	//!< Requests freed by request_free_list_trim().
+	uint32_t		num;		//!< Requests currently in the free list.
+	uint32_t		max;		//!< Maximum number of requests kept in the free list.
+} request_free_list_stats_t;
+
 typedef enum {
 	REQUEST_ACTIVE = 1,
 	REQUEST_STOP_PROCESSING,
@@ -206,7 +238,6 @@ struct request_s {
 
 	fr_event_timer_t const	*ev;		//!< Event in event loop tied to this request.
 
-	fr_rb_node_t		dedup_node;	//!< entry in the deduplication tree.
 	int32_t			runnable_id;	//!< entry in the queue / heap of runnable packets
 	int32_t			time_order_id;	//!< entry in the queue / heap of time ordered packets
 
@@ -216,6 +247,8 @@ struct request_s {
 
 	fr_async_t		*async;		//!< for new async listeners
 
+	fr_trace_t		*trace;		//!< Timeline of the request.  NULL unless tracing is enabled.
+
 	char const		*alloc_file;	//!< File the request was allocated in.
 
 	int			alloc_line;	//!< Line the request was allocated on.
@@ -278,6 +311,10 @@ request_t	*_request_local_alloc(char const *file, int line, TALLOC_CTX *ctx, req
 
 int		request_detach(request_t *child);
 
+request_free_list_stats_t const *request_free_list_init(uint32_t max);
+
+uint32_t	request_free_list_trim(void);
+
 int		request_global_init(void);
 void		request_global_free(void);
 
@@ -971,7 +971,7 @@ int fr_snmp_process(request_t *request)
 			switch (vp->vp_type) {
 			case FR_TYPE_OCTETS:
 			case FR_TYPE_STRING:
-				talloc_free(vp->data.datum.ptr);
+				fr_value_box_clear_value(&vp->data);
 
 			FALL_THROUGH;
 			default:
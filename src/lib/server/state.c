@@ -131,28 +131,73 @@ typedef struct {
 	request_t		*thawed;			//!< The request that thawed this entry.
 } state_child_entry_t;
 
-struct fr_state_tree_s {
-	uint64_t		id;				//!< Next ID to assign.
-	uint64_t		timed_out;			//!< Number of states that were cleaned up due to
-								//!< timeout.
-	uint32_t		max_sessions;			//!< Maximum number of sessions we track.
+/** Number of shards the state tree is split into, must be a power of 2
+ *
+ * Each shard has its own lock, tree and expiry list, so workers
+ * handling different sessions don't contend with each other.
+ */
+#define STATE_TREE_SHARDS		(16)
+
+/** Don't split the tree into shards holding fewer sessions than this
+ *
+ */
+#define STATE_SHARD_MIN_SESSIONS	(256)
+
+/** Maximum number of timed out entries to unlink in one go
+ *
+ * Limits how long a shard lock is held for.  Expiry runs every time an
+ * entry is inserted into the shard, so any backlog is still cleared.
+ */
+#define STATE_EXPIRE_MAX		(32)
+
+#define STATE_CACHE_LINE_SIZE		(64)
+
+/** A portion of the state tree, with its own lock
+ *
+ * Entries are assigned to shards based on a hash of their state value.
+ */
+typedef struct {
+	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
 	rbtree_t		*tree;				//!< rbtree used to lookup state value.
 	fr_dlist_head_t		to_expire;			//!< Linked list of entries to free.
 
+	uint32_t		max_sessions;			//!< Maximum number of sessions in this shard.
+	uint64_t		id;				//!< Number of entries created in this shard.
+	uint64_t		timed_out;			//!< Number of states that were cleaned up due to
+								//!< timeout.
+
+	fr_time_t		locked;				//!< When the lock was last acquired.
+	uint64_t		acquired;			//!< Number of times the lock was acquired.
+	uint64_t		contended;			//!< Number of times we had to wait for the lock.
+	fr_time_elapsed_t	wait;				//!< How long we waited, when the lock was contended.
+	fr_time_elapsed_t	hold;				//!< How long the lock was held for.
+} CC_HINT(aligned(STATE_CACHE_LINE_SIZE)) fr_state_shard_t;
+
+struct fr_state_tree_s {
+	uint32_t		max_sessions;			//!< Maximum number of sessions we track.
 	uint32_t		timeout;			//!< How long to wait before cleaning up state entires.
 
 	bool			thread_safe;			//!< Whether we lock the tree whilst modifying it.
-	pthread_mutex_t		mutex;				//!< Synchronisation mutex.
 
 	uint8_t			server_id;			//!< ID to use for load balancing.
 
 	fr_dict_attr_t const	*da;				//!< State attribute used.
+
+	uint32_t		num_shards;			//!< Number of shards, a power of 2.
+	fr_state_shard_t	*shard;				//!< Array of shards, aligned to a cache line.
+
+	fr_dlist_t		entry;				//!< Entry in the list of all state trees.
 };
 
-#define PTHREAD_MUTEX_LOCK if (state->thread_safe) pthread_mutex_lock
-#define PTHREAD_MUTEX_UNLOCK if (state->thread_safe) pthread_mutex_unlock
+/** All state trees, so they can be found by radmin
+ *
+ */
+static fr_dlist_head_t	state_trees;
+static pthread_mutex_t	state_trees_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static fr_cmd_table_t cmd_state_table[];
 
-static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry);
+static void state_entry_unlink(fr_state_shard_t *shard, fr_state_entry_t *entry);
 
 /** Compare two fr_state_entry_t based on their state value i.e. the value of the attribute
  *
@@ -164,27 +209,79 @@ static int state_entry_cmp(void const *one, void const *two)
 	return memcmp(a->state, b->state, sizeof(a->state));
 }
 
+/** Lock a shard, recording how long we waited, if we had to
+ *
+ */
+static inline CC_HINT(always_inline) void state_shard_lock(fr_state_tree_t *state, fr_state_shard_t *shard)
+{
+	fr_time_t	start;
+
+	if (!state->thread_safe) return;
+
+	if (pthread_mutex_trylock(&shard->mutex) != 0) {
+		start = fr_time();
+		pthread_mutex_lock(&shard->mutex);
+		shard->locked = fr_time();
+		shard->contended++;
+		fr_time_elapsed_update(&shard->wait, start, shard->locked);
+	} else {
+		shard->locked = fr_time();
+	}
+	shard->acquired++;
+}
+
+/** Unlock a shard, recording how long we held the lock for
+ *
+ */
+static inline CC_HINT(always_inline) void state_shard_unlock(fr_state_tree_t *state, fr_state_shard_t *shard)
+{
+	if (!state->thread_safe) return;
+
+	fr_time_elapsed_update(&shard->hold, shard->locked, fr_time());
+	pthread_mutex_unlock(&shard->mutex);
+}
+
+/** Return the shard a state value belongs in
+ *
+ */
+static inline CC_HINT(always_inline) fr_state_shard_t *state_entry_shard(fr_state_tree_t *state,
+									  fr_state_entry_t const *entry)
+{
+	return &state->shard[fr_hash(entry->state, sizeof(entry->state)) & (state->num_shards - 1)];
+}
+
 /** Free the state tree
  *
  */
 static int _state_tree_free(fr_state_tree_t *state)
 {
-	fr_state_entry_t *entry;
+	fr_state_entry_t	*entry;
+	uint32_t		i;
 
-	if (state->thread_safe) pthread_mutex_destroy(&state->mutex);
+	pthread_mutex_lock(&state_trees_mutex);
+	fr_dlist_remove(&state_trees, state);
+	pthread_mutex_unlock(&state_trees_mutex);
 
 	DEBUG4("Freeing state tree %p", state);
 
-	while ((entry = fr_dlist_head(&state->to_expire))) {
-		DEBUG4("Freeing state entry %p (%"PRIu64")", entry, entry->id);
-		state_entry_unlink(state, entry);
-		talloc_free(entry);
-	}
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shard[i];
 
-	/*
-	 *	Free the rbtree
-	 */
-	talloc_free(state->tree);
+		if (!shard->tree) continue;
+
+		if (state->thread_safe) pthread_mutex_destroy(&shard->mutex);
+
+		while ((entry = fr_dlist_head(&shard->to_expire))) {
+			DEBUG4("Freeing state entry %p (%"PRIu64")", entry, entry->id);
+			state_entry_unlink(shard, entry);
+			talloc_free(entry);
+		}
+
+		/*
+		 *	Free the rbtree
+		 */
+		talloc_free(shard->tree);
+	}
 
 	return 0;
 }
@@ -194,7 +291,7 @@ static int _state_tree_free(fr_state_tree_t *state)
  * @param[in] ctx		to link the lifecycle of the state tree to.
  * @param[in] da		Attribute used to store and retrieve state from.
  * @param[in] thread_safe		Whether we should mutex protect the state tree.
- * @param[in] max_sessions	we track state for.
+ * @param[in] max_sessions	we track state for.  Enforced per shard, see state_entry_create().
  * @param[in] timeout		How long to wait before cleaning up entries.
  * @param[in] server_id		ID byte to use in load-balancing operations.
  * @return
@@ -205,6 +302,7 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, b
 				    uint32_t max_sessions, uint32_t timeout, uint8_t server_id)
 {
 	fr_state_tree_t *state;
+	uint32_t	i;
 
 	state = talloc_zero(NULL, fr_state_tree_t);
 	if (!state) return 0;
@@ -221,46 +319,92 @@ fr_state_tree_t *fr_state_tree_init(TALLOC_CTX *ctx, fr_dict_attr_t const *da, b
 	 */
 	talloc_link_ctx(ctx, state);
 
-	if (thread_safe && (pthread_mutex_init(&state->mutex, NULL) != 0)) {
-		talloc_free(state);
-		return NULL;
-	}
-
-	fr_dlist_talloc_init(&state->to_expire, fr_state_entry_t, list);
-
 	/*
-	 *	We need to do controlled freeing of the
-	 *	rbtree, so that all the state entries
-	 *	are freed before it's destroyed.  Hence
-	 *	it being parented from the NULL ctx.
+	 *	There's no point in splitting the tree if
+	 *	there's only one thread, or if the shards
+	 *	would be too small to be useful.
 	 */
-	state->tree = rbtree_talloc_alloc(NULL, fr_state_entry_t, node, state_entry_cmp, NULL, 0);
-	if (!state->tree) {
+	state->num_shards = thread_safe ? STATE_TREE_SHARDS : 1;
+	while ((state->num_shards > 1) && ((max_sessions / state->num_shards) < STATE_SHARD_MIN_SESSIONS)) {
+		state->num_shards >>= 1;
+	}
+
+	if (!talloc_aligned_array(state, (void **)&state->shard, STATE_CACHE_LINE_SIZE,
+				  sizeof(state->shard[0]) * state->num_shards)) {
 		talloc_free(state);
 		return NULL;
 	}
-	talloc_set_destructor(state, _state_tree_free);
+	memset(state->shard, 0, sizeof(state->shard[0]) * state->num_shards);
 
 	state->da = da;		/* Remember which attribute we use to load/store state */
 	state->server_id = server_id;
 	state->thread_safe = thread_safe;
 
+	fr_dlist_entry_init(&state->entry);
+	talloc_set_destructor(state, _state_tree_free);
+
+	for (i = 0; i < state->num_shards; i++) {
+		fr_state_shard_t *shard = &state->shard[i];
+
+		/*
+		 *	Round up, so that the shards can hold at
+		 *	least max_sessions between them.
+		 */
+		shard->max_sessions = (max_sessions + state->num_shards - 1) / state->num_shards;
+
+		fr_dlist_talloc_init(&shard->to_expire, fr_state_entry_t, list);
+
+		/*
+		 *	We need to do controlled freeing of the
+		 *	rbtree, so that all the state entries
+		 *	are freed before it's destroyed.  Hence
+		 *	it being parented from the NULL ctx.
+		 */
+		shard->tree = rbtree_talloc_alloc(NULL, fr_state_entry_t, node, state_entry_cmp, NULL, 0);
+		if (!shard->tree) {
+		error:
+			talloc_free(state);
+			return NULL;
+		}
+
+		if (thread_safe && (pthread_mutex_init(&shard->mutex, NULL) != 0)) {
+			talloc_free(shard->tree);
+			shard->tree = NULL;
+			goto error;
+		}
+	}
+
+	/*
+	 *	Register the stats command the first time
+	 *	a state tree is created.
+	 */
+	pthread_mutex_lock(&state_trees_mutex);
+	if (!state_trees.entry.next) {
+		fr_dlist_init(&state_trees, fr_state_tree_t, entry);
+
+		if (fr_command_register_hook(NULL, NULL, NULL, cmd_state_table) < 0) {
+			PWARN("Failed registering radmin commands for state trees");
+		}
+	}
+	fr_dlist_insert_tail(&state_trees, state);
+	pthread_mutex_unlock(&state_trees_mutex);
+
 	return state;
 }
 
 /** Unlink an entry and remove if from the tree
  *
  */
-static void state_entry_unlink(fr_state_tree_t *state, fr_state_entry_t *entry)
+static void state_entry_unlink(fr_state_shard_t *shard, fr_state_entry_t *entry)
 {
 	/*
 	 *	Check the memory is still valid
 	 */
 	(void) talloc_get_type_abort(entry, fr_state_entry_t);
 
-	fr_dlist_remove(&state->to_expire, entry);
+	fr_dlist_remove(&shard->to_expire, entry);
 
-	rbtree_deletebydata(state->tree, entry);
+	rbtree_deletebydata(shard->tree, entry);
 
 	DEBUG4("State ID %" PRIu64 " unlinked", entry->id);
 }
@@ -303,104 +447,167 @@ static int _state_entry_free(fr_state_entry_t *entry)
 	return 0;
 }
 
-/** Create a new state entry
+/** Turn a State value into the key used to find its entry
  *
- * @note Called with the mutex held.
+ * @param[out] key	Entry to write the key to.  Only the state value is set.
+ * @param[in] request	The current request.
+ * @param[in] vb	State value, as received from the client.
  */
-static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *request,
-					    fr_pair_list_t *reply_list, fr_state_entry_t *old)
+static void state_entry_key(fr_state_entry_t *key, request_t *request, fr_value_box_t const *vb)
 {
-	size_t			i;
-	uint32_t		x;
-	time_t			now = time(NULL);
-	fr_pair_t		*vp;
-	fr_state_entry_t	*entry, *next;
+	/*
+	 *	Assume our own State first.
+	 */
+	if (vb->vb_length == sizeof(key->state)) {
+		memcpy(key->state, vb->vb_octets, sizeof(key->state));
 
-	uint8_t			old_state[sizeof(old->state)];
-	int			old_tries = 0;
-	uint64_t		timed_out = 0;
-	bool			too_many = false;
-	fr_dlist_head_t		to_free;
+		/*
+		 *	Too big?  Get the MD5 hash, in order
+		 *	to depend on the entire contents of State.
+		 */
+	} else if (vb->vb_length > sizeof(key->state)) {
+		fr_md5_calc(key->state, vb->vb_octets, vb->vb_length);
 
-	fr_dlist_init(&to_free, fr_state_entry_t, list);
+		/*
+		 *	Too small?  Use the whole thing, and
+		 *	set the rest of key.state to zero.
+		 */
+	} else {
+		memcpy(key->state, vb->vb_octets, vb->vb_length);
+		memset(&key->state[vb->vb_length], 0, sizeof(key->state) - vb->vb_length);
+	}
 
 	/*
-	 *	Clean up old entries.
+	 *	Make it unique for different virtual servers handling the same request
 	 */
-	for (entry = fr_dlist_head(&state->to_expire);
-	     entry != NULL;
-	     entry = next) {
-		(void)talloc_get_type_abort(entry, fr_state_entry_t);	/* Allow examination */
-		next = fr_dlist_next(&state->to_expire, entry);		/* Advance *before* potential unlinking */
+	key->state_comp.server_hash ^= fr_hash_string(cf_section_name2(request->server_cs));
+}
 
-		if (entry == old) continue;
+/** Find the entry, based on the State attribute
+ *
+ * @note Called with the shard mutex held.
+ */
+static fr_state_entry_t *state_entry_find(fr_state_shard_t *shard, fr_state_entry_t const *key)
+{
+	fr_state_entry_t *entry;
 
-		/*
-		 *	Too old, we can delete it.
-		 */
-		if (entry->cleanup < now) {
-			state_entry_unlink(state, entry);
-			fr_dlist_insert_tail(&to_free, entry);
-			timed_out++;
-			continue;
-		}
+	entry = rbtree_finddata(shard->tree, key);
 
-		break;
-	}
+	if (entry) (void) talloc_get_type_abort(entry, fr_state_entry_t);
 
-	state->timed_out += timed_out;
+	return entry;
+}
 
-	if (!old && (rbtree_num_elements(state->tree) >= (uint32_t) state->max_sessions)) too_many = true;
+/** Unlink timed out entries from a shard
+ *
+ * @note Called with the shard mutex held.
+ *
+ * @param[in] shard	to clean up.
+ * @param[out] to_free	where to put the entries that were unlinked.
+ * @param[in] now	The current time.
+ * @return the number of entries unlinked.
+ */
+static uint64_t state_shard_expire(fr_state_shard_t *shard, fr_dlist_head_t *to_free, time_t now)
+{
+	fr_state_entry_t	*entry;
+	uint64_t		timed_out = 0;
 
 	/*
-	 *	Record the information from the old state, we may base the
-	 *	new state off the old one.
-	 *
-	 *	Once we release the mutex, the state of old becomes indeterminate
-	 *	so we have to grab the values now.
+	 *	The list is ordered by cleanup time,
+	 *	so we can stop at the first entry
+	 *	that's still valid.
 	 */
-	if (old) {
-		old_tries = old->tries;
+	while ((timed_out < STATE_EXPIRE_MAX) && (entry = fr_dlist_head(&shard->to_expire))) {
+		(void)talloc_get_type_abort(entry, fr_state_entry_t);	/* Allow examination */
 
-		memcpy(old_state, old->state, sizeof(old_state));
+		if (entry->cleanup >= now) break;
 
-		/*
-		 *	The old one isn't used any more, so we can free it.
-		 */
-		if (fr_dlist_empty(&old->data)) {
-			state_entry_unlink(state, old);
-			fr_dlist_insert_tail(&to_free, old);
-		}
+		state_entry_unlink(shard, entry);
+		fr_dlist_insert_tail(to_free, entry);
+		timed_out++;
 	}
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
 
-	if (timed_out > 0) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
+	shard->timed_out += timed_out;
+
+	return timed_out;
+}
+
+/** Free entries which have been unlinked from the tree
+ *
+ * This is done with the mutex released, as freeing may involve
+ * significantly more work than just freeing the data.
+ *
+ * If there's request data that was persisted it will now be freed
+ * also, and it may have complex destructors associated with it.
+ */
+static void state_entries_free(fr_dlist_head_t *to_free)
+{
+	fr_state_entry_t *entry;
+
+	while ((entry = fr_dlist_pop_head(to_free)) != NULL) talloc_free(entry);
+}
+
+/** Create a new state entry, and insert it into the tree
+ *
+ * The entry takes ownership of the session-state list and persistable
+ * request data of the request.
+ *
+ * @note Called with the mutex free.
+ *
+ * @param[in] state	tree to insert the entry into.
+ * @param[in] request	the entry is being created for.
+ * @param[in] reply_list	to add the State attribute to.
+ * @param[in] old_vb	State value received from the client, if any.
+ * @param[in] data	Persistable request data to move into the entry.
+ * @return
+ *	- The new entry.
+ *	- NULL on error.  The request data is left in data.
+ */
+static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *request,
+					    fr_pair_list_t *reply_list, fr_value_box_t const *old_vb,
+					    fr_dlist_head_t *data)
+{
+	size_t			i;
+	uint32_t		x;
+	time_t			now = time(NULL);
+	fr_pair_t		*vp;
+	fr_state_entry_t	*entry, *old = NULL, key;
+	fr_state_shard_t	*shard;
+
+	uint8_t			old_state[sizeof(key.state)];
+	int			old_tries = 0;
+	uint64_t		timed_out;
+	fr_dlist_head_t		to_free;
+
+	fr_dlist_init(&to_free, fr_state_entry_t, list);
 
 	/*
-	 *	Now free the unlinked entries.
-	 *
-	 *	We do it here as freeing may involve significantly more
-	 *	work than just freeing the data.
+	 *	Record the information from the old state, we may base the
+	 *	new state off the old one.
 	 *
-	 *	If there's request data that was persisted it will now
-	 *	be freed also, and it may have complex destructors associated
-	 *	with it.
+	 *	Once we release the mutex, the state of old becomes indeterminate
+	 *	so we have to grab the values now.
 	 */
-	while ((entry = fr_dlist_head(&to_free)) != NULL) {
-		fr_dlist_remove(&to_free, entry);
-		talloc_free(entry);
-	}
+	if (old_vb) {
+		state_entry_key(&key, request, old_vb);
+		shard = state_entry_shard(state, &key);
 
-	/*
-	 *	Have to do this post-cleanup, else we end up returning with
-	 *	a list full of entries to free with none of them being
-	 *	freed which is bad...
-	 */
-	if (too_many) {
-		RERROR("Failed inserting state entry - At maximum ongoing session limit (%u)",
-		       state->max_sessions);
-		PTHREAD_MUTEX_LOCK(&state->mutex);	/* Caller expects this to be locked */
-		return NULL;
+		state_shard_lock(state, shard);
+		old = state_entry_find(shard, &key);
+		if (old) {
+			old_tries = old->tries;
+
+			memcpy(old_state, old->state, sizeof(old_state));
+
+			/*
+			 *	The old one isn't used any more, so we can free it.
+			 */
+			if (fr_dlist_empty(&old->data)) {
+				state_entry_unlink(shard, old);
+				fr_dlist_insert_tail(&to_free, old);
+			}
+		}
+		state_shard_unlock(state, shard);
 	}
 
 	/*
@@ -411,7 +618,6 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 
 	request_data_list_init(&entry->data);
 	talloc_set_destructor(entry, _state_entry_free);
-	entry->id = state->id++;
 
 	/*
 	 *	Limit the lifetime of this entry based on how long the
@@ -495,11 +701,6 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 		fr_pair_add(reply_list, vp);
 	}
 
-	DEBUG4("State ID %" PRIu64 " created, value 0x%pH, expires %" PRIu64 "s",
-	       entry->id, fr_box_octets(entry->state, sizeof(entry->state)), (uint64_t)entry->cleanup - now);
-
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-
 	/*
 	 *	XOR the server hash with four bytes of random data.
 	 *	We XOR is again before resolving, to ensure state lookups
@@ -508,59 +709,71 @@ static fr_state_entry_t *state_entry_create(fr_state_tree_t *state, request_t *r
 	 */
 	*((uint32_t *)(&entry->state_comp.server_hash)) ^= fr_hash_string(cf_section_name2(request->server_cs));
 
-	if (!rbtree_insert(state->tree, entry)) {
-		RERROR("Failed inserting state entry - Insertion into state tree failed");
-		fr_pair_delete_by_da(reply_list, state->da);
-		talloc_free(entry);
-		return NULL;
-	}
-
 	/*
-	 *	Link it to the end of the list, which is implicitely
-	 *	ordered by cleanup time.
+	 *	Fill in everything before the entry is visible
+	 *	to other threads.
 	 */
-	fr_dlist_insert_tail(&state->to_expire, entry);
-
-	return entry;
-}
+	entry->seq_start = request->seq_start;
+	entry->ctx = request->session_state_ctx;
+	fr_dlist_move(&entry->data, data);
 
-/** Find the entry, based on the State attribute
- *
- */
-static fr_state_entry_t *state_entry_find(fr_state_tree_t *state, request_t *request, fr_value_box_t const *vb)
-{
-	fr_state_entry_t *entry, my_entry;
+	shard = state_entry_shard(state, entry);
+	state_shard_lock(state, shard);
 
 	/*
-	 *	Assume our own State first.
+	 *	Clean up old entries.
 	 */
-	if (vb->vb_length == sizeof(my_entry.state)) {
-		memcpy(my_entry.state, vb->vb_octets, sizeof(my_entry.state));
+	timed_out = state_shard_expire(shard, &to_free, now);
 
-		/*
-		 *	Too big?  Get the MD5 hash, in order
-		 *	to depend on the entire contents of State.
-		 */
-	} else if (vb->vb_length > sizeof(my_entry.state)) {
-		fr_md5_calc(my_entry.state, vb->vb_octets, vb->vb_length);
+	/*
+	 *	The limit is per shard, so we don't need to lock
+	 *	all of them to check it.  Each shard holds
+	 *	ceil(max_sessions / num_shards) entries, so the
+	 *	limit may be hit for one shard when there are
+	 *	fewer than max_sessions entries in total.  With
+	 *	the keys being random, that's unlikely until
+	 *	we're close to the limit anyway.
+	 */
+	if (!old && (rbtree_num_elements(shard->tree) >= shard->max_sessions)) {
+		state_shard_unlock(state, shard);
+		RERROR("Failed inserting state entry - At maximum ongoing session limit "
+		       "(%u per shard, %u total)", shard->max_sessions, state->max_sessions);
+	error:
+		fr_pair_delete_by_da(reply_list, state->da);
+		fr_dlist_move(data, &entry->data);	/* Give the data back */
+		entry->ctx = NULL;			/* Still owned by the request */
+		fr_dlist_insert_tail(&to_free, entry);
+		state_entries_free(&to_free);
+		return NULL;
+	}
 
-		/*
-		 *	Too small?  Use the whole thing, and
-		 *	set the rest of my_entry.state to zero.
-		 */
-	} else {
-		memcpy(my_entry.state, vb->vb_octets, vb->vb_length);
-		memset(&my_entry.state[vb->vb_length], 0, sizeof(my_entry.state) - vb->vb_length);
+	if (!rbtree_insert(shard->tree, entry)) {
+		state_shard_unlock(state, shard);
+		RERROR("Failed inserting state entry - Insertion into state tree failed");
+		goto error;
 	}
 
 	/*
-	 *	Make it unique for different virtual servers handling the same request
+	 *	IDs are unique across all the shards.
+	 */
+	entry->id = (shard->id++ * state->num_shards) + (shard - state->shard);
+
+	/*
+	 *	Link it to the end of the list, which is implicitely
+	 *	ordered by cleanup time.
 	 */
-	my_entry.state_comp.server_hash ^= fr_hash_string(cf_section_name2(request->server_cs));
+	fr_dlist_insert_tail(&shard->to_expire, entry);
+	state_shard_unlock(state, shard);
 
-	entry = rbtree_finddata(state->tree, &my_entry);
+	if (timed_out > 0) RWDEBUG("Cleaning up %"PRIu64" timed out state entries", timed_out);
 
-	if (entry) (void) talloc_get_type_abort(entry, fr_state_entry_t);
+	DEBUG4("State ID %" PRIu64 " created, value 0x%pH, expires %" PRIu64 "s",
+	       entry->id, fr_box_octets(entry->state, sizeof(entry->state)), (uint64_t)entry->cleanup - now);
+
+	/*
+	 *	Now free the unlinked entries.
+	 */
+	state_entries_free(&to_free);
 
 	return entry;
 }
@@ -570,20 +783,24 @@ static fr_state_entry_t *state_entry_find(fr_state_tree_t *state, request_t *req
  */
 void fr_state_discard(fr_state_tree_t *state, request_t *request)
 {
-	fr_state_entry_t	*entry;
+	fr_state_entry_t	*entry, key;
+	fr_state_shard_t	*shard;
 	fr_pair_t		*vp;
 
 	vp = fr_pair_find_by_da(&request->request_pairs, state->da);
 	if (!vp) return;
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	entry = state_entry_find(state, request, &vp->data);
+	state_entry_key(&key, request, &vp->data);
+	shard = state_entry_shard(state, &key);
+
+	state_shard_lock(state, shard);
+	entry = state_entry_find(shard, &key);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
+		state_shard_unlock(state, shard);
 		return;
 	}
-	state_entry_unlink(state, entry);
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	state_entry_unlink(shard, entry);
+	state_shard_unlock(state, shard);
 
 	/*
 	 *	If fr_state_to_request was never called, this ensures
@@ -619,7 +836,8 @@ void fr_state_discard(fr_state_tree_t *state, request_t *request)
  */
 void fr_state_to_request(fr_state_tree_t *state, request_t *request)
 {
-	fr_state_entry_t	*entry;
+	fr_state_entry_t	*entry, key;
+	fr_state_shard_t	*shard;
 	TALLOC_CTX		*old_ctx = NULL;
 	fr_pair_t		*vp;
 
@@ -633,13 +851,16 @@ void fr_state_to_request(fr_state_tree_t *state, request_t *request)
 		return;
 	}
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	entry = state_entry_find(state, request, &vp->data);
+	state_entry_key(&key, request, &vp->data);
+	shard = state_entry_shard(state, &key);
+
+	state_shard_lock(state, shard);
+	entry = state_entry_find(shard, &key);
 	if (entry) {
 		(void)talloc_get_type_abort(entry, fr_state_entry_t);
 		if (entry->thawed) {
 			REDEBUG("State entry has already been thawed by a request %"PRIu64, entry->thawed->number);
-			PTHREAD_MUTEX_UNLOCK(&state->mutex);
+			state_shard_unlock(state, shard);
 			return;
 		}
 		if (request->session_state_ctx) old_ctx = request->session_state_ctx;	/* Store for later freeing */
@@ -653,7 +874,7 @@ void fr_state_to_request(fr_state_tree_t *state, request_t *request)
 		entry->ctx = NULL;
 		entry->thawed = request;
 	}
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
+	state_shard_unlock(state, shard);
 
 	if (!fr_pair_list_empty(&request->session_state_pairs)) {
 		RDEBUG2("Restored &session-state");
@@ -681,7 +902,7 @@ void fr_state_to_request(fr_state_tree_t *state, request_t *request)
  */
 int fr_request_to_state(fr_state_tree_t *state, request_t *request)
 {
-	fr_state_entry_t	*entry, *old = NULL;
+	fr_state_entry_t	*entry;
 	fr_dlist_head_t		data;
 	fr_pair_t		*vp;
 
@@ -695,28 +916,17 @@ int fr_request_to_state(fr_state_tree_t *state, request_t *request)
 		log_request_pair_list(L_DBG_LVL_2, request, NULL, &request->session_state_pairs, "&session-state.");
 	}
 
-	vp = fr_pair_find_by_da(&request->request_pairs, state->da);
+	fr_assert(request->session_state_ctx);
 
-	PTHREAD_MUTEX_LOCK(&state->mutex);
-	if (vp) old = state_entry_find(state, request, &vp->data);
+	vp = fr_pair_find_by_da(&request->request_pairs, state->da);
 
-	entry = state_entry_create(state, request, &request->reply_pairs, old);
+	entry = state_entry_create(state, request, &request->reply_pairs, vp ? &vp->data : NULL, &data);
 	if (!entry) {
-		PTHREAD_MUTEX_UNLOCK(&state->mutex);
 		RERROR("Creating state entry failed");
 		request_data_restore(request, &data);	/* Put it back again */
 		return -1;
 	}
 
-	fr_assert(entry->ctx == NULL);
-	fr_assert(request->session_state_ctx);
-
-	entry->seq_start = request->seq_start;
-	entry->ctx = request->session_state_ctx;
-	fr_dlist_move(&entry->data, &data);
-
-	PTHREAD_MUTEX_UNLOCK(&state->mutex);
-
 	MEM(request->session_state_ctx = fr_pair_afrom_da(NULL, request_attr_state));	/* fixme - should use a pool */
 
 	RDEBUG3("%s - saved", state->da->name);
@@ -841,7 +1051,12 @@ void fr_state_restore_to_child(request_t *child, void const *unique_ptr, int uni
  */
 uint64_t fr_state_entries_created(fr_state_tree_t *state)
 {
-	return state->id;
+	uint64_t	created = 0;
+	uint32_t	i;
+
+	for (i = 0; i < state->num_shards; i++) created += state->shard[i].id;
+
+	return created;
 }
 
 /** Return number of entries that timed out
@@ -849,7 +1064,12 @@ uint64_t fr_state_entries_created(fr_state_tree_t *state)
  */
 uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
 {
-	return state->timed_out;
+	uint64_t	timed_out = 0;
+	uint32_t	i;
+
+	for (i = 0; i < state->num_shards; i++) timed_out += state->shard[i].timed_out;
+
+	return timed_out;
 }
 
 /** Return number of entries we're currently tracking
@@ -857,5 +1077,110 @@ uint64_t fr_state_entries_timeout(fr_state_tree_t *state)
  */
 uint32_t fr_state_entries_tracked(fr_state_tree_t *state)
 {
-	return (uint32_t)rbtree_num_elements(state->tree);
+	uint32_t	tracked = 0;
+	uint32_t	i;
+
+	for (i = 0; i < state->num_shards; i++) tracked += (uint32_t)rbtree_num_elements(state->shard[i].tree);
+
+	return tracked;
+}
+
+/** Print the statistics for one, or all of the shards of a state tree
+ *
+ * The counters are read without taking the shard locks, so they may
+ * be slightly inconsistent with each other.
+ */
+static void state_shard_stats_fprint(FILE *fp, fr_state_tree_t *state, char const *prefix, int shard_idx)
+{
+	fr_time_elapsed_t	wait, hold;
+	uint64_t		acquired = 0, contended = 0;
+	uint32_t		i, j, start, end;
+	char			buffer[64];
+
+	memset(&wait, 0, sizeof(wait));
+	memset(&hold, 0, sizeof(hold));
+
+	if (shard_idx < 0) {
+		start = 0;
+		end = state->num_shards;
+	} else {
+		start = shard_idx;
+		end = start + 1;
+	}
+
+	for (i = start; i < end; i++) {
+		fr_state_shard_t const *shard = &state->shard[i];
+
+		acquired += shard->acquired;
+		contended += shard->contended;
+
+		for (j = 0; j < NUM_ELEMENTS(wait.array); j++) {
+			wait.array[j] += shard->wait.array[j];
+			hold.array[j] += shard->hold.array[j];
+		}
+	}
+
+	if (shard_idx >= 0) {
+		fr_state_shard_t const *shard = &state->shard[shard_idx];
+
+		fprintf(fp, "%s.tracked\t\t\t%u\n", prefix, rbtree_num_elements(shard->tree));
+		fprintf(fp, "%s.created\t\t\t%" PRIu64 "\n", prefix, shard->id);
+		fprintf(fp, "%s.timed_out\t\t%" PRIu64 "\n", prefix, shard->timed_out);
+	}
+
+	fprintf(fp, "%s.lock.acquired\t\t%" PRIu64 "\n", prefix, acquired);
+	fprintf(fp, "%s.lock.contended\t\t%" PRIu64 "\n", prefix, contended);
+
+	snprintf(buffer, sizeof(buffer), "%s.lock.wait", prefix);
+	fr_time_elapsed_fprint(fp, &wait, buffer, 4);
+
+	snprintf(buffer, sizeof(buffer), "%s.lock.hold", prefix);
+	fr_time_elapsed_fprint(fp, &hold, buffer, 4);
+}
+
+static int cmd_stats_state(FILE *fp, UNUSED FILE *fp_err, UNUSED void *ctx, fr_cmd_info_t const *info)
+{
+	fr_state_tree_t	*state = NULL;
+	unsigned int	idx = 0;
+	uint32_t	i;
+	bool		shards = (info->argc > 0) && (strcmp(info->argv[0], "shards") == 0);
+	char		prefix[64];
+
+	pthread_mutex_lock(&state_trees_mutex);
+	while ((state = fr_dlist_next(&state_trees, state))) {
+		fprintf(fp, "state.%u.attribute\t\t%s.%s\n", idx, fr_dict_root(state->da->dict)->name, state->da->name);
+		fprintf(fp, "state.%u.shards\t\t\t%u\n", idx, state->num_shards);
+		fprintf(fp, "state.%u.max_sessions\t\t%u\n", idx, state->max_sessions);
+		fprintf(fp, "state.%u.tracked\t\t\t%u\n", idx, fr_state_entries_tracked(state));
+		fprintf(fp, "state.%u.created\t\t\t%" PRIu64 "\n", idx, fr_state_entries_created(state));
+		fprintf(fp, "state.%u.timed_out\t\t%" PRIu64 "\n", idx, fr_state_entries_timeout(state));
+
+		snprintf(prefix, sizeof(prefix), "state.%u", idx);
+		state_shard_stats_fprint(fp, state, prefix, -1);
+
+		if (shards) {
+			for (i = 0; i < state->num_shards; i++) {
+				snprintf(prefix, sizeof(prefix), "state.%u.shard.%u", idx, i);
+				state_shard_stats_fprint(fp, state, prefix, i);
+			}
+		}
+
+		idx++;
+	}
+	pthread_mutex_unlock(&state_trees_mutex);
+
+	return 0;
 }
+
+static fr_cmd_table_t cmd_state_table[] = {
+	{
+		.parent = "stats",
+		.name = "state",
+		.syntax = "[shards]",
+		.func = cmd_stats_state,
+		.help = "Show statistics for the session state trees.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
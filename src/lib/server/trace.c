@@ -0,0 +1,177 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @brief Per-request timelines, and per-stage latency histograms
+ * @file lib/server/trace.c
+ *
+ * A timeline is a fixed size array of timestamped events, allocated
+ * with the request.  Adding an event is one clock read and a store,
+ * so it's cheap enough to leave on.
+ *
+ * When the request is done, the timeline is folded into the
+ * histograms for the module, yield and worker stages.  The queue
+ * stage doesn't need a timeline, and is updated by the worker for
+ * every request.
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/server/trace.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/table.h>
+
+static fr_table_num_ordered_t const trace_event_table[] = {
+	{ L("recv"),		FR_TRACE_RECV		},
+	{ L("enqueue"),		FR_TRACE_ENQUEUE	},
+	{ L("dequeue"),		FR_TRACE_DEQUEUE	},
+	{ L("call"),		FR_TRACE_MODULE_CALL	},
+	{ L("return"),		FR_TRACE_MODULE_RETURN	},
+	{ L("yield"),		FR_TRACE_YIELD		},
+	{ L("resume"),		FR_TRACE_RESUME		},
+	{ L("reply"),		FR_TRACE_REPLY		},
+};
+static size_t trace_event_table_len = NUM_ELEMENTS(trace_event_table);
+
+static char const *trace_stage_names[FR_TRACE_STAGE_MAX] = {
+	[FR_TRACE_STAGE_QUEUE]	= "queue",
+	[FR_TRACE_STAGE_MODULE]	= "module",
+	[FR_TRACE_STAGE_YIELD]	= "yield",
+	[FR_TRACE_STAGE_WORKER]	= "worker",
+};
+
+/** Fold a request timeline into the per-stage histograms
+ *
+ * Module time is the time between a call or resume, and the
+ * following return or yield.  Yield time is the time between a
+ * yield and the following resume.  Both are summed over the
+ * request.  Worker time is the time between dequeue and reply.
+ *
+ * @param[in] stats	to update.
+ * @param[in] trace	of a finished request.
+ */
+void fr_trace_stats_update(fr_trace_stats_t *stats, fr_trace_t const *trace)
+{
+	uint32_t		i;
+	fr_time_delta_t		module = 0, yield = 0;
+	fr_time_t		start = 0, dequeued = 0;
+	fr_trace_event_t	state = FR_TRACE_EVENT_MAX;
+
+	for (i = 0; i < trace->num; i++) {
+		fr_trace_entry_t const *e = &trace->entry[i];
+
+		switch (e->event) {
+		case FR_TRACE_DEQUEUE:
+			dequeued = e->when;
+			break;
+
+		case FR_TRACE_REPLY:
+			if (dequeued) fr_time_elapsed_update(&stats->stage[FR_TRACE_STAGE_WORKER], dequeued, e->when);
+			break;
+
+		case FR_TRACE_MODULE_CALL:
+		case FR_TRACE_RESUME:
+			if (state == FR_TRACE_YIELD) yield += e->when - start;
+			state = FR_TRACE_MODULE_CALL;
+			start = e->when;
+			break;
+
+		case FR_TRACE_MODULE_RETURN:
+		case FR_TRACE_YIELD:
+			if (state == FR_TRACE_MODULE_CALL) module += e->when - start;
+			state = e->event;
+			start = e->when;
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	fr_time_elapsed_update(&stats->stage[FR_TRACE_STAGE_MODULE], 0, module);
+	fr_time_elapsed_update(&stats->stage[FR_TRACE_STAGE_YIELD], 0, yield);
+	stats->traced++;
+}
+
+/** Print the per-stage histograms
+ *
+ * @param[in] fp	to print to.
+ * @param[in] stats	to print.
+ * @param[in] prefix	for each line.
+ */
+void fr_trace_stats_fprint(FILE *fp, fr_trace_stats_t const *stats, char const *prefix)
+{
+	int	i;
+	char	buffer[64];
+
+	for (i = 0; i < FR_TRACE_STAGE_MAX; i++) {
+		snprintf(buffer, sizeof(buffer), "%s.%s", prefix, trace_stage_names[i]);
+		fr_time_elapsed_fprint(fp, &stats->stage[i], buffer, 4);
+	}
+
+	fprintf(fp, "%s.traced\t\t\t%" PRIu64 "\n", prefix, stats->traced);
+	fprintf(fp, "%s.dumped\t\t\t%" PRIu64 "\n", prefix, stats->dumped);
+	fprintf(fp, "%s.skipped\t\t\t%" PRIu64 "\n", prefix, stats->skipped);
+}
+
+/** Print a request timeline to a buffer
+ *
+ * Each event is printed on its own line, with the time in
+ * microseconds since the packet was received.  The output is
+ * truncated if the buffer is too small.
+ *
+ * @param[out] out	where to write the timeline.
+ * @param[in] outlen	size of the output buffer.
+ * @param[in] trace	to print.
+ * @param[in] name	of the request.
+ * @return the number of bytes written, not including the trailing '\\0'.
+ */
+size_t fr_trace_snprint(char *out, size_t outlen, fr_trace_t const *trace, char const *name)
+{
+	uint32_t	i;
+	fr_time_t	start;
+	char		*p = out, *end = out + outlen;
+	int		len;
+
+	if (!outlen) return 0;
+	*out = '\0';
+	if (!trace->num) return 0;
+
+	start = trace->entry[0].when;
+
+#define TRACE_PRINT(_fmt, ...) do { \
+		len = snprintf(p, end - p, _fmt, ## __VA_ARGS__); \
+		if ((len < 0) || (len >= (end - p))) return outlen - 1; \
+		p += len; \
+	} while (0)
+
+	TRACE_PRINT("%s total %" PRIu64 "us", name, (uint64_t) (trace->entry[trace->num - 1].when - start) / 1000);
+	if (trace->dropped) TRACE_PRINT(" dropped %u", trace->dropped);
+	TRACE_PRINT("\n");
+
+	for (i = 0; i < trace->num; i++) {
+		fr_trace_entry_t const *e = &trace->entry[i];
+
+		TRACE_PRINT("\t+%" PRIu64 "us %s%s%s\n", (uint64_t) (e->when - start) / 1000,
+			    fr_table_str_by_value(trace_event_table, e->event, "<INVALID>"),
+			    e->name ? " " : "", e->name ? e->name : "");
+	}
+
+	return p - out;
+}
@@ -0,0 +1,134 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ *
+ * @file lib/server/trace.h
+ * @brief Per-request timelines, and per-stage latency histograms.
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSIDH(trace_h, "$Id$")
+
+#include <stdio.h>
+#include <freeradius-devel/util/time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Events recorded in a request timeline
+ *
+ */
+typedef enum {
+	FR_TRACE_RECV = 0,			//!< packet was read from the socket.
+	FR_TRACE_ENQUEUE,			//!< packet was sent to the worker.
+	FR_TRACE_DEQUEUE,			//!< worker started the request.
+	FR_TRACE_MODULE_CALL,			//!< a module method was called.
+	FR_TRACE_MODULE_RETURN,			//!< a module method returned.
+	FR_TRACE_YIELD,				//!< a module yielded.
+	FR_TRACE_RESUME,			//!< a module was resumed.
+	FR_TRACE_REPLY,				//!< worker sent the reply to the network.
+	FR_TRACE_EVENT_MAX
+} fr_trace_event_t;
+
+/** Stages which we keep latency histograms for
+ *
+ */
+typedef enum {
+	FR_TRACE_STAGE_QUEUE = 0,		//!< enqueued by the network, to started by the worker.
+						///< Recorded for all requests, even when not tracing.
+	FR_TRACE_STAGE_MODULE,			//!< running module code.
+	FR_TRACE_STAGE_YIELD,			//!< waiting for yielded modules to be resumed.
+	FR_TRACE_STAGE_WORKER,			//!< started by the worker, to reply sent.
+	FR_TRACE_STAGE_MAX
+} fr_trace_stage_t;
+
+#define FR_TRACE_MAX_ENTRIES	(64)
+
+typedef struct {
+	fr_time_t		when;		//!< the event happened.
+	char const		*name;		//!< of the module, or NULL.
+	fr_trace_event_t	event;
+} fr_trace_entry_t;
+
+/** The timeline of a single request
+ *
+ * Entries past the end of the array are counted, but not recorded.
+ * The exception is the reply, which replaces the last entry so that
+ * the timeline always shows when the request finished.
+ */
+typedef struct {
+	uint32_t		num;		//!< number of entries used.
+	uint32_t		dropped;	//!< number of entries which didn't fit.
+	fr_trace_entry_t	entry[FR_TRACE_MAX_ENTRIES];
+} fr_trace_t;
+
+typedef struct {
+	fr_time_elapsed_t	stage[FR_TRACE_STAGE_MAX];	//!< histogram of time spent in each stage.
+	uint64_t		traced;				//!< number of requests with a timeline.
+	uint64_t		dumped;				//!< number of timelines written out.
+	uint64_t		skipped;			//!< number of timelines not written out, because
+								///< the trace file wasn't ready.
+} fr_trace_stats_t;
+
+/** Add an event to a request timeline
+ *
+ * @param[in] trace	to add the event to.
+ * @param[in] event	which happened.
+ * @param[in] name	of the module, or NULL.
+ * @param[in] when	the event happened.
+ */
+static inline void fr_trace_add(fr_trace_t *trace, fr_trace_event_t event, char const *name, fr_time_t when)
+{
+	if (trace->num >= FR_TRACE_MAX_ENTRIES) {
+		trace->dropped++;
+		if (event != FR_TRACE_REPLY) return;
+		trace->num--;
+	}
+
+	trace->entry[trace->num++] = (fr_trace_entry_t) {
+		.when = when,
+		.name = name,
+		.event = event
+	};
+}
+
+/** Check whether a finished request took longer than a threshold
+ *
+ * @param[in] trace	of a finished request.
+ * @param[in] threshold	to compare the time from the first to the last event against.
+ *			0 means no request is slow.
+ * @return true if the request was slow, else false.
+ */
+static inline bool fr_trace_is_slow(fr_trace_t const *trace, fr_time_delta_t threshold)
+{
+	if (!threshold || !trace->num) return false;
+
+	return (trace->entry[trace->num - 1].when - trace->entry[0].when) >= threshold;
+}
+
+void		fr_trace_stats_update(fr_trace_stats_t *stats, fr_trace_t const *trace) CC_HINT(nonnull);
+
+void		fr_trace_stats_fprint(FILE *fp, fr_trace_stats_t const *stats, char const *prefix) CC_HINT(nonnull);
+
+size_t		fr_trace_snprint(char *out, size_t outlen, fr_trace_t const *trace, char const *name) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
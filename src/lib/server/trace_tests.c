@@ -0,0 +1,172 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for request timelines, and the per-stage histograms
+ *
+ * @file src/lib/server/trace_tests.c
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+#include <freeradius-devel/util/acutest.h>
+
+#include <freeradius-devel/server/trace.h>
+
+#define T_USEC(_x)	((fr_time_t) (_x) * 1000)
+
+/** Histogram buckets, by their upper bound
+ *
+ * The buckets are decades, starting at < 1us.
+ */
+#define BUCKET_10US	(1)
+#define BUCKET_100US	(2)
+#define BUCKET_1MS	(3)
+#define BUCKET_10MS	(4)
+
+/** A request which calls one module, which yields once
+ *
+ *	+0	recv
+ *	+10	enqueue
+ *	+20	dequeue
+ *	+25	call
+ *	+30	yield		(5us in the module)
+ *	+530	resume	(500us yielded)
+ *	+537	return	(7us in the module)
+ *	+2020	reply	(2000us from dequeue to reply)
+ */
+static void trace_fill(fr_trace_t *trace)
+{
+	fr_trace_add(trace, FR_TRACE_RECV, NULL, T_USEC(1000));
+	fr_trace_add(trace, FR_TRACE_ENQUEUE, NULL, T_USEC(1010));
+	fr_trace_add(trace, FR_TRACE_DEQUEUE, NULL, T_USEC(1020));
+	fr_trace_add(trace, FR_TRACE_MODULE_CALL, "test", T_USEC(1025));
+	fr_trace_add(trace, FR_TRACE_YIELD, "test", T_USEC(1030));
+	fr_trace_add(trace, FR_TRACE_RESUME, "test", T_USEC(1530));
+	fr_trace_add(trace, FR_TRACE_MODULE_RETURN, "test", T_USEC(1537));
+	fr_trace_add(trace, FR_TRACE_REPLY, NULL, T_USEC(3020));
+}
+
+static void test_trace_timeline(void)
+{
+	fr_trace_t	trace = {};
+	uint32_t	i;
+
+	TEST_CASE("Events are recorded in order");
+	trace_fill(&trace);
+	TEST_CHECK(trace.num == 8);
+	TEST_CHECK(trace.dropped == 0);
+	TEST_CHECK(trace.entry[0].event == FR_TRACE_RECV);
+	TEST_CHECK(trace.entry[3].event == FR_TRACE_MODULE_CALL);
+	TEST_CHECK(strcmp(trace.entry[3].name, "test") == 0);
+	TEST_CHECK(trace.entry[7].event == FR_TRACE_REPLY);
+
+	TEST_CASE("Events past the end are dropped, but the reply is always recorded");
+	memset(&trace, 0, sizeof(trace));
+	for (i = 0; i < FR_TRACE_MAX_ENTRIES + 10; i++) {
+		fr_trace_add(&trace, FR_TRACE_MODULE_CALL, "test", T_USEC(i));
+	}
+	TEST_CHECK(trace.num == FR_TRACE_MAX_ENTRIES);
+	TEST_CHECK(trace.dropped == 10);
+
+	fr_trace_add(&trace, FR_TRACE_REPLY, NULL, T_USEC(1000));
+	TEST_CHECK(trace.num == FR_TRACE_MAX_ENTRIES);
+	TEST_CHECK(trace.dropped == 11);
+	TEST_CHECK(trace.entry[FR_TRACE_MAX_ENTRIES - 1].event == FR_TRACE_REPLY);
+	TEST_CHECK(trace.entry[FR_TRACE_MAX_ENTRIES - 1].when == T_USEC(1000));
+}
+
+static void test_trace_stats(void)
+{
+	fr_trace_t		trace = {};
+	fr_trace_stats_t	stats = {};
+	int			i;
+
+	trace_fill(&trace);
+	fr_trace_stats_update(&stats, &trace);
+
+	TEST_CHECK(stats.traced == 1);
+
+	TEST_CASE("Module time is summed over the call and the resume");
+	TEST_CHECK(stats.stage[FR_TRACE_STAGE_MODULE].array[BUCKET_100US] == 1);
+	TEST_MSG("Module time was 12us");
+
+	TEST_CASE("Yield time is from yield to resume");
+	TEST_CHECK(stats.stage[FR_TRACE_STAGE_YIELD].array[BUCKET_1MS] == 1);
+	TEST_MSG("Yield time was 500us");
+
+	TEST_CASE("Worker time is from dequeue to reply");
+	TEST_CHECK(stats.stage[FR_TRACE_STAGE_WORKER].array[BUCKET_10MS] == 1);
+	TEST_MSG("Worker time was 2000us");
+
+	TEST_CASE("The queue stage isn't updated from the timeline");
+	for (i = 0; i < 8; i++) TEST_CHECK(stats.stage[FR_TRACE_STAGE_QUEUE].array[i] == 0);
+
+	TEST_CASE("A timeline with no modules records zero module time");
+	memset(&trace, 0, sizeof(trace));
+	fr_trace_add(&trace, FR_TRACE_DEQUEUE, NULL, T_USEC(100));
+	fr_trace_add(&trace, FR_TRACE_REPLY, NULL, T_USEC(105));
+	fr_trace_stats_update(&stats, &trace);
+	TEST_CHECK(stats.traced == 2);
+	TEST_CHECK(stats.stage[FR_TRACE_STAGE_MODULE].array[0] == 1);
+	TEST_CHECK(stats.stage[FR_TRACE_STAGE_WORKER].array[BUCKET_10US] == 1);
+}
+
+static void test_trace_threshold(void)
+{
+	fr_trace_t	trace = {};
+
+	TEST_CASE("An empty timeline is never slow");
+	TEST_CHECK(!fr_trace_is_slow(&trace, T_USEC(1)));
+
+	trace_fill(&trace);
+
+	TEST_CASE("A threshold of zero disables dumping");
+	TEST_CHECK(!fr_trace_is_slow(&trace, 0));
+
+	TEST_CASE("The threshold is compared against recv to reply");
+	TEST_CHECK(fr_trace_is_slow(&trace, T_USEC(2019)));
+	TEST_CHECK(fr_trace_is_slow(&trace, T_USEC(2020)));
+	TEST_CHECK(!fr_trace_is_slow(&trace, T_USEC(2021)));
+}
+
+static void test_trace_snprint(void)
+{
+	fr_trace_t	trace = {};
+	char		buffer[1024];
+	size_t		len;
+
+	trace_fill(&trace);
+
+	TEST_CASE("Timelines are printed relative to the first event");
+	len = fr_trace_snprint(buffer, sizeof(buffer), &trace, "(0)");
+	TEST_CHECK(len == strlen(buffer));
+	TEST_CHECK(strncmp(buffer, "(0) total 2020us\n", 17) == 0);
+	TEST_MSG("Got %s", buffer);
+	TEST_CHECK(strstr(buffer, "\t+530us resume test\n") != NULL);
+	TEST_CHECK(strstr(buffer, "\t+2020us reply\n") != NULL);
+
+	TEST_CASE("Output is truncated to the buffer");
+	len = fr_trace_snprint(buffer, 20, &trace, "(0)");
+	TEST_CHECK(len == 19);
+}
+
+TEST_LIST = {
+	{ "trace_timeline",	test_trace_timeline },
+	{ "trace_stats",	test_trace_stats },
+	{ "trace_threshold",	test_trace_threshold },
+	{ "trace_snprint",	test_trace_snprint },
+
+	{ NULL }
+};
@@ -0,0 +1,7 @@
+TARGET      := trace_tests
+SOURCES     := trace_tests.c
+
+TGT_PREREQS += libfreeradius-server.a libfreeradius-util.a
+
+TGT_LDLIBS  := $(LIBS)
+TGT_LDFLAGS := $(LDFLAGS)
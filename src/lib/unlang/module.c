@@ -670,6 +670,8 @@ static unlang_action_t unlang_module_resume(rlm_rcode_t *p_result, request_t *re
 	caller = request->module;
 	request->module = mc->instance->name;
 
+	if (request->trace) fr_trace_add(request->trace, FR_TRACE_RESUME, mc->instance->name, fr_time());
+
 	safe_lock(mc->instance);
 	ua = state->resume(&rcode,
 			   &(module_ctx_t){
@@ -678,6 +680,10 @@ static unlang_action_t unlang_module_resume(rlm_rcode_t *p_result, request_t *re
 			   }, request, state->rctx);
 	safe_unlock(mc->instance);
 
+	if (request->trace) fr_trace_add(request->trace,
+					 (ua == UNLANG_ACTION_YIELD) ? FR_TRACE_YIELD : FR_TRACE_MODULE_RETURN,
+					 mc->instance->name, fr_time());
+
 	request->rcode = rcode;
 	request->module = caller;
 
@@ -822,6 +828,8 @@ static unlang_action_t unlang_module(rlm_rcode_t *p_result, request_t *request)
 
 	caller = request->module;
 	request->module = mc->instance->name;
+	if (request->trace) fr_trace_add(request->trace, FR_TRACE_MODULE_CALL, mc->instance->name, fr_time());
+
 	safe_lock(mc->instance);	/* Noop unless instance->mutex set */
 	ua = mc->method(&rcode,
 			&(module_ctx_t){
@@ -832,6 +840,10 @@ static unlang_action_t unlang_module(rlm_rcode_t *p_result, request_t *request)
 	safe_unlock(mc->instance);
 	request->module = caller;
 
+	if (request->trace) fr_trace_add(request->trace,
+					 (ua == UNLANG_ACTION_YIELD) ? FR_TRACE_YIELD : FR_TRACE_MODULE_RETURN,
+					 mc->instance->name, fr_time());
+
 	/*
 	 *	It is now marked as "stop" when it wasn't before, we
 	 *	must have been blocked.
@@ -21,7 +21,7 @@
  *
  * @copyright 2020 Arran Cudbard-Bell
  */
-RCSIDH(ascend_h, "$Id$")
+RCSIDH(acutest_helpers_h, "$Id$")
 
 #ifdef __cplusplus
 extern "C" {
@@ -58,6 +58,17 @@ do { \
 	TEST_MSG("Got      : \"%s\"", _our_got); \
 } while(0)
 
+/** Skip the rest of a benchmark, unless benchmarks were asked for
+ *
+ * Benchmarks are slow, and their output is only interesting when
+ * comparing implementations.  Set FR_TEST_BENCHMARK in the environment
+ * to run them.
+ */
+#define TEST_BENCHMARK() \
+do { \
+	if (!getenv("FR_TEST_BENCHMARK")) return; \
+} while(0)
+
 #ifdef __cplusplus
 }
 #endif
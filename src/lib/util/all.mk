@@ -2,8 +2,12 @@ SUBMAKEFILES := \
 	cursor_tests.mk \
 	dbuff_tests.mk \
 	dcursor_tests.mk \
+	event_tests.mk \
+	hash_tests.mk \
 	heap_tests.mk \
 	libfreeradius-util.mk \
+	lpm_tests.mk \
+	oa_hash_tests.mk \
 	pair_tests.mk \
 	pair_legacy_tests.mk \
 	sbuff_tests.mk \
@@ -49,7 +49,11 @@ struct fr_dlist_s {
  * like at which offset the next/prev pointers can be found.
  */
 typedef struct {
-	size_t		offset;		//!< Positive offset from start of structure to #fr_dlist_t.
+	unsigned int	offset;		//!< Positive offset from start of structure to #fr_dlist_t.
+	uint32_t	generation;	//!< Incremented whenever an item is added or removed.
+					///< Lets users keep data derived from the list, and
+					///< notice when it's out of date.  Shares a word with
+					///< offset, so that list heads don't grow.
 	char const	*type;		//!< of items contained within the list.  Used for talloc
 					///< validation.
 	fr_dlist_t	entry;		//!< Struct holding the head and tail of the list.
@@ -143,6 +147,7 @@ static inline void _fr_dlist_init(fr_dlist_head_t *list_head, size_t offset, cha
 	list_head->offset = offset;
 	list_head->type = type;
 	list_head->num_elements = 0;
+	list_head->generation = 0;
 }
 
 /** Efficiently remove all elements in a dlist
@@ -153,6 +158,7 @@ static inline void fr_dlist_clear(fr_dlist_head_t *list_head)
 {
 	fr_dlist_entry_init(&list_head->entry);
 	list_head->num_elements = 0;
+	list_head->generation++;
 }
 
 /** Insert an item into the head of a list
@@ -186,6 +192,7 @@ static inline CC_HINT(nonnull(1)) void fr_dlist_insert_head(fr_dlist_head_t *lis
 	head->next = entry;
 
 	list_head->num_elements++;
+	list_head->generation++;
 }
 
 /** Insert an item into the tail of a list
@@ -219,6 +226,7 @@ static inline CC_HINT(nonnull(1)) void fr_dlist_insert_tail(fr_dlist_head_t *lis
 	head->prev = entry;
 
 	list_head->num_elements++;
+	list_head->generation++;
 }
 
 /** Insert an item after an item already in the list
@@ -256,6 +264,7 @@ static inline CC_HINT(nonnull(1)) void fr_dlist_insert_after(fr_dlist_head_t *li
 	pos_entry->next = entry;
 
 	list_head->num_elements++;
+	list_head->generation++;
 }
 
 /** Insert an item before an item already in the list
@@ -293,6 +302,7 @@ static inline CC_HINT(nonnull(1)) void fr_dlist_insert_before(fr_dlist_head_t *l
 	pos_entry->prev = entry;
 
 	list_head->num_elements++;
+	list_head->generation++;
 }
 
 /** Return the HEAD item of a list or NULL if the list is empty
@@ -478,6 +488,7 @@ static inline CC_HINT(nonnull(1)) void *fr_dlist_remove(fr_dlist_head_t *list_he
 	entry->prev = entry->next = entry;
 
 	list_head->num_elements--;
+	list_head->generation++;
 
 	if (prev == head) return NULL;	/* Works with fr_dlist_next so that the next item is the list HEAD */
 
@@ -549,6 +560,9 @@ static inline void *fr_dlist_replace(fr_dlist_head_t *list_head, void *item, voi
 
 	/* Reset links on replaced item */
 	item_entry->prev = item_entry->next = item_entry;
+
+	list_head->generation++;
+
 	return item;
 }
 
@@ -608,9 +622,11 @@ static inline CC_HINT(nonnull) void fr_dlist_move(fr_dlist_head_t *list_dst, fr_
 	dst->prev = src->prev;
 
 	list_dst->num_elements += list_src->num_elements;
+	list_dst->generation++;
 
 	fr_dlist_entry_init(src);
 	list_src->num_elements = 0;
+	list_src->generation++;
 }
 
 /** Free the first item in the list
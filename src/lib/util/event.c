@@ -45,6 +45,21 @@ RCSID("$Id$")
 #include <sys/wait.h>
 #include <pthread.h>
 
+/*
+ *	On Linux, I/O filters and timers are serviced directly
+ *	with epoll and a timerfd, instead of going through the
+ *	libkqueue emulation layer.  The kqueue is still used for
+ *	the filters epoll can't provide (vnode and user events),
+ *	and is itself polled via the epoll instance.
+ *
+ *	Build with -DWITH_EVENT_KQUEUE to use kqueue for everything.
+ */
+#if defined(__linux__) && !defined(WITH_EVENT_KQUEUE)
+#  define WITH_EVENT_EPOLL (1)
+#  include <sys/epoll.h>
+#  include <sys/timerfd.h>
+#endif
+
 #ifdef NDEBUG
 /*
  *	Turn off documentation warnings as file/line
@@ -107,6 +122,10 @@ struct fr_event_timer {
 	int32_t			heap_id;	       	//!< Where to store opaque heap data.
 	fr_dlist_t		entry;			//!< in linked list of event timers
 
+	fr_dlist_t		wheel_entry;		//!< in a timer wheel slot.
+	uint8_t			wheel_level;		//!< which level of the timer wheel we're in.
+	uint8_t			wheel_slot;		//!< which slot of that level we're in.
+
 #ifndef NDEBUG
 	char const		*file;			//!< Source file this event was last updated in.
 	int			line;			//!< Line this event was last updated on.
@@ -276,6 +295,12 @@ struct fr_event_fd {
 							///< kevent.  Mostly for debugging.
 	bool			in_fd_to_free;		//!< Whether this event is in the fd_to_free list.
 
+#ifdef WITH_EVENT_EPOLL
+	bool			use_epoll;		//!< Filters for this FD are in the epoll instance,
+							///< not the kqueue.
+	uint32_t		epoll_events;		//!< Events currently registered with epoll.
+#endif
+
 	void			*uctx;			//!< Context pointer to pass to each file descriptor callback.
 	TALLOC_CTX		*linked_ctx;		//!< talloc ctx this event was bound to.
 
@@ -342,11 +367,46 @@ typedef struct {
 } fr_event_user_t;
 
 
+/*
+ *	Timer wheel geometry.  A tick is 2^20ns, or just over 1ms.
+ *	Each level has 64 slots, each covering 64 times the time
+ *	of a slot in the level below.  Six levels cover about
+ *	2 years.  Timers further out than that go into the heap.
+ */
+#define FR_EVENT_WHEEL_TICK_SHIFT	(20)
+#define FR_EVENT_WHEEL_SLOT_BITS	(6)
+#define FR_EVENT_WHEEL_SLOTS		(1 << FR_EVENT_WHEEL_SLOT_BITS)
+#define FR_EVENT_WHEEL_LEVELS		(6)
+
+/** A hierarchical timer wheel
+ *
+ * Most timers are deleted or moved before they fire, e.g. request
+ * cleanup timers.  Inserting into, and deleting from, the heap is
+ * O(log n), which adds up with hundreds of thousands of timers.
+ *
+ * So timers which are due more than a tick in the future go into
+ * the wheel instead, which is O(1) for both.  As time advances,
+ * slots of the wheel are emptied, and their timers are either
+ * moved down a level, or into the heap once they're due in the
+ * next tick.  All of the timers in a slot are moved together.
+ *
+ * Timers are only ever run from the heap, so they still fire at
+ * exactly the time they were set for, and in order.
+ */
+typedef struct {
+	uint64_t		tick;			//!< the last tick processed.  All timers due within
+							///< a tick of this one are in the heap.
+	uint32_t		num_elements;		//!< number of timers in the wheel.
+	uint64_t		occupied[FR_EVENT_WHEEL_LEVELS];	//!< bitmap of non-empty slots.
+	fr_dlist_head_t		slot[FR_EVENT_WHEEL_LEVELS][FR_EVENT_WHEEL_SLOTS];
+} fr_event_wheel_t;
+
 /** Stores all information relating to an event list
  *
  */
 struct fr_event_list {
 	fr_heap_t		*times;			//!< of timer events to be executed.
+	fr_event_wheel_t	wheel;			//!< of timer events which are further out.
 	rbtree_t		*fds;			//!< Tree used to track FDs with filters in kqueue.
 #ifdef LOCAL_PID
 	fr_heap_t		*pids;			//!< PIDs to wait for
@@ -365,6 +425,14 @@ struct fr_event_list {
 
 	int			kq;			//!< instance associated with this event list.
 
+#ifdef WITH_EVENT_EPOLL
+	int			epfd;			//!< epoll instance for I/O filters.  -1 if we fell
+							///< back to using the kqueue for everything.
+	int			timer_fd;		//!< timerfd used to wake up for the next timer event.
+	fr_time_t		timer_armed;		//!< When timer_fd is set to fire.  0 if unarmed.
+	struct epoll_event	ep_events[FR_EV_BATCH_FDS / 2];	//!< epoll results, translated into #events.
+#endif
+
 	fr_dlist_head_t		pre_callbacks;		//!< callbacks when we may be idle...
 	fr_dlist_head_t		user_callbacks;		//!< EVFILT_USER callbacks
 	fr_dlist_head_t		post_callbacks;		//!< post-processing callbacks
@@ -398,6 +466,182 @@ static int8_t fr_event_timer_cmp(void const *a, void const *b)
 	return fr_time_cmp(ev_a->when, ev_b->when);
 }
 
+/** Which tick a timer has to be moved into the heap
+ *
+ * @return the tick, or 0 if the timer should go straight into the heap.
+ */
+static inline CC_HINT(always_inline) uint64_t event_wheel_key(fr_time_t when)
+{
+	if (when < (2 << FR_EVENT_WHEEL_TICK_SHIFT)) return 0;
+
+	return ((uint64_t) when >> FR_EVENT_WHEEL_TICK_SHIFT) - 1;
+}
+
+/** Insert a timer into the timer wheel, or if it's due soon, the heap
+ *
+ * @param[in] el	to insert the timer into.
+ * @param[in] ev	to insert.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int event_timer_insert(fr_event_list_t *el, fr_event_timer_t *ev)
+{
+	fr_event_wheel_t	*wheel = &el->wheel;
+	uint64_t		key = event_wheel_key(ev->when);
+	unsigned int		level, slot;
+
+	if (key <= wheel->tick) return fr_heap_insert(el->times, ev);
+
+	level = (63 - __builtin_clzll(key - wheel->tick)) / FR_EVENT_WHEEL_SLOT_BITS;
+	if (level >= FR_EVENT_WHEEL_LEVELS) return fr_heap_insert(el->times, ev);
+
+	slot = (key >> (level * FR_EVENT_WHEEL_SLOT_BITS)) & (FR_EVENT_WHEEL_SLOTS - 1);
+
+	fr_dlist_insert_tail(&wheel->slot[level][slot], ev);
+	wheel->occupied[level] |= ((uint64_t) 1) << slot;
+	wheel->num_elements++;
+
+	ev->wheel_level = level;
+	ev->wheel_slot = slot;
+
+	return 0;
+}
+
+/** Remove a timer from the timer wheel or the heap
+ *
+ * @param[in] el	to remove the timer from.
+ * @param[in] ev	to remove.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the timer wasn't in the wheel or the heap.
+ */
+static int event_timer_extract(fr_event_list_t *el, fr_event_timer_t *ev)
+{
+	fr_event_wheel_t	*wheel = &el->wheel;
+	fr_dlist_head_t		*head;
+
+	if (!fr_dlist_entry_in_list(&ev->wheel_entry)) return fr_heap_extract(el->times, ev);
+
+	head = &wheel->slot[ev->wheel_level][ev->wheel_slot];
+	(void) fr_dlist_remove(head, ev);
+	if (fr_dlist_empty(head)) wheel->occupied[ev->wheel_level] &= ~(((uint64_t) 1) << ev->wheel_slot);
+	wheel->num_elements--;
+
+	return 0;
+}
+
+/** Return the next tick at which the wheel has timers to move
+ *
+ * @return the tick, or 0 if the wheel is empty.
+ */
+static uint64_t event_wheel_next(fr_event_wheel_t const *wheel)
+{
+	uint64_t	next = 0;
+	unsigned int	level;
+
+	for (level = 0; level < FR_EVENT_WHEEL_LEVELS; level++) {
+		unsigned int	shift = level * FR_EVENT_WHEEL_SLOT_BITS;
+		uint64_t	block = wheel->tick >> shift;
+		unsigned int	start = (block + 1) & (FR_EVENT_WHEEL_SLOTS - 1);
+		uint64_t	bits = wheel->occupied[level];
+		uint64_t	tick;
+
+		if (!bits) continue;
+
+		/*
+		 *	Rotate so that the slot after the current
+		 *	one is bit 0.
+		 */
+		if (start) bits = (bits >> start) | (bits << (FR_EVENT_WHEEL_SLOTS - start));
+
+		tick = (block + 1 + __builtin_ctzll(bits)) << shift;
+		if (!next || (tick < next)) next = tick;
+	}
+
+	return next;
+}
+
+/** Empty the slots of the wheel which are due at this tick
+ *
+ * Timers in higher levels are moved down a level, or into the heap
+ * if they're due soon.  Timers in level 0 always go into the heap.
+ */
+static void event_wheel_process(fr_event_list_t *el, uint64_t tick)
+{
+	fr_event_wheel_t	*wheel = &el->wheel;
+	int			level;
+
+	wheel->tick = tick;
+
+	for (level = FR_EVENT_WHEEL_LEVELS - 1; level >= 0; level--) {
+		unsigned int		shift = level * FR_EVENT_WHEEL_SLOT_BITS;
+		unsigned int		slot;
+		fr_dlist_head_t		*head;
+		fr_event_timer_t	*ev;
+
+		if (tick & ((((uint64_t) 1) << shift) - 1)) continue;
+
+		slot = (tick >> shift) & (FR_EVENT_WHEEL_SLOTS - 1);
+		if (!(wheel->occupied[level] & (((uint64_t) 1) << slot))) continue;
+
+		wheel->occupied[level] &= ~(((uint64_t) 1) << slot);
+
+		head = &wheel->slot[level][slot];
+		while ((ev = fr_dlist_pop_head(head)) != NULL) {
+			wheel->num_elements--;
+
+			if (unlikely(event_timer_insert(el, ev) < 0)) {
+				talloc_free(ev);
+				fr_assert_msg(0, "failed inserting heap event: %s", fr_strerror());	/* Die in debug builds */
+			}
+		}
+	}
+}
+
+/** Move timers out of the wheel, until it's caught up with the current time
+ *
+ * Ticks where there's nothing to do are skipped.
+ *
+ * @param[in] el	containing the timer wheel.
+ * @param[in] now	the current time.
+ */
+static inline CC_HINT(always_inline) void event_wheel_advance(fr_event_list_t *el, fr_time_t now)
+{
+	fr_event_wheel_t	*wheel = &el->wheel;
+	uint64_t		target, next;
+
+	if (now <= 0) return;
+
+	target = (uint64_t) now >> FR_EVENT_WHEEL_TICK_SHIFT;
+
+	while (wheel->tick < target) {
+		if (!wheel->num_elements) {
+			wheel->tick = target;
+			break;
+		}
+
+		next = event_wheel_next(wheel);
+		if (next > target) {
+			wheel->tick = target;
+			break;
+		}
+
+		event_wheel_process(el, next);
+	}
+}
+
+/** When the wheel next needs to be serviced
+ *
+ * @return the time, or 0 if the wheel is empty.
+ */
+static inline CC_HINT(always_inline) fr_time_t event_wheel_when(fr_event_list_t const *el)
+{
+	if (!el->wheel.num_elements) return 0;
+
+	return (fr_time_t) (event_wheel_next(&el->wheel) << FR_EVENT_WHEEL_TICK_SHIFT);
+}
+
 /** Compare two file descriptor handles
  *
  * @param[in] a the first file descriptor handle.
@@ -446,7 +690,7 @@ int fr_event_list_num_timers(fr_event_list_t *el)
 {
 	if (unlikely(!el)) return -1;
 
-	return fr_heap_num_elements(el->times);
+	return fr_heap_num_elements(el->times) + el->wheel.num_elements;
 }
 
 /** Return the kq associated with an event list.
@@ -683,6 +927,100 @@ static int fr_event_fd_type_set(fr_event_fd_t *ef, int fd)
 	return 0;
 }
 
+#ifdef WITH_EVENT_EPOLL
+/** Apply a set of kevent changes to an FD registered with epoll
+ *
+ * The read and write filters for an FD are merged into a single
+ * epoll registration, so we work out the new event mask from the
+ * changes, and then add, modify or delete the registration.
+ *
+ * @param[in] el	the FD is registered with.
+ * @param[in] ef	to update.
+ * @param[in] evset	changes produced by #fr_event_build_evset.
+ * @param[in] count	number of changes in evset.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure, with errno set.
+ */
+static int fr_event_epoll_update(fr_event_list_t *el, fr_event_fd_t *ef, struct kevent const evset[], int count)
+{
+	struct epoll_event	ev;
+	uint32_t		events = ef->epoll_events;
+	int			i, op;
+
+	for (i = 0; i < count; i++) {
+		uint32_t bits;
+
+		switch (evset[i].filter) {
+		case EVFILT_READ:
+			bits = EPOLLIN | EPOLLRDHUP;
+			break;
+
+		case EVFILT_WRITE:
+			bits = EPOLLOUT;
+			break;
+
+		default:
+			errno = EINVAL;
+			return -1;
+		}
+
+		if (evset[i].flags & EV_DELETE) {
+			events &= ~bits;
+		} else {
+			events |= bits;
+		}
+	}
+
+	if (events == ef->epoll_events) return 0;
+
+	if (!ef->epoll_events) {
+		op = EPOLL_CTL_ADD;
+	} else if (!events) {
+		op = EPOLL_CTL_DEL;
+	} else {
+		op = EPOLL_CTL_MOD;
+	}
+
+	ev = (struct epoll_event){ .events = events, .data = { .ptr = ef } };
+	if (epoll_ctl(el->epfd, op, ef->fd, &ev) < 0) return -1;
+
+	ef->epoll_events = events;
+
+	return 0;
+}
+#endif
+
+/** Apply a set of kevent changes for an FD to whichever backend it's registered with
+ *
+ * @param[in] el	the FD is registered with.
+ * @param[in] ef	to update.
+ * @param[in] evset	changes produced by #fr_event_build_evset.
+ * @param[in] count	number of changes in evset.
+ * @return
+ *	- >= 0 on success.
+ *	- -1 on failure, with errno set.
+ */
+static int fr_event_fd_apply(fr_event_list_t *el, fr_event_fd_t *ef, struct kevent const evset[], int count)
+{
+#ifdef WITH_EVENT_EPOLL
+	if (ef->use_epoll) {
+		if (fr_event_epoll_update(el, ef, evset, count) == 0) return 0;
+
+		/*
+		 *	epoll refuses regular files and some
+		 *	character devices.  The kqueue deals with
+		 *	those, so register the FD there instead.
+		 */
+		if ((errno != EPERM) || ef->epoll_events) return -1;
+
+		ef->use_epoll = false;
+	}
+#endif
+
+	return kevent(el->kq, evset, count, NULL, 0, NULL);
+}
+
 /** Remove a file descriptor from the event loop and rbtree but don't explicitly free it
  *
  *
@@ -717,7 +1055,7 @@ static int _event_fd_delete(fr_event_fd_t *ef)
 			/*
 			 *	If this fails, assert on debug builds.
 			 */
-			ret = kevent(el->kq, evset, count, NULL, 0, NULL);
+			ret = fr_event_fd_apply(el, ef, evset, count);
 			if (!fr_cond_assert_msg(ret >= 0,
 						"FD %i was closed without being removed from the KQ: %s",
 						ef->fd, fr_syserror(errno))) {
@@ -881,7 +1219,7 @@ int _fr_event_filter_update(NDEBUG_LOCATION_ARGS
 		return -1;
 	}
 
-	if (count && unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0)) {
+	if (count && unlikely(fr_event_fd_apply(el, ef, evset, count) < 0)) {
 		fr_strerror_printf("Failed updating filters for FD %i: %s", ef->fd, fr_syserror(errno));
 		goto error;
 	}
@@ -988,9 +1326,13 @@ int _fr_event_filter_insert(NDEBUG_LOCATION_ARGS
 			goto free;
 		}
 
+#ifdef WITH_EVENT_EPOLL
+		ef->use_epoll = (el->epfd >= 0) && (filter == FR_EVENT_FILTER_IO);
+#endif
+
 		count = fr_event_build_evset(evset, sizeof(evset)/sizeof(*evset), &ef->active, ef, funcs, &ef->active);
 		if (count < 0) goto free;
-		if (count && (unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0))) {
+		if (count && (unlikely(fr_event_fd_apply(el, ef, evset, count) < 0))) {
 			fr_strerror_printf("Failed inserting filters for FD %i: %s", fd, fr_syserror(errno));
 			goto free;
 		}
@@ -1021,7 +1363,7 @@ int _fr_event_filter_insert(NDEBUG_LOCATION_ARGS
 			memcpy(&ef->active, &active, sizeof(ef->active));
 			return -1;
 		}
-		if (count && (unlikely(kevent(el->kq, evset, count, NULL, 0, NULL) < 0))) {
+		if (count && (unlikely(fr_event_fd_apply(el, ef, evset, count) < 0))) {
 			fr_strerror_printf("Failed modifying filters for FD %i: %s", fd, fr_syserror(errno));
 			goto error;
 		}
@@ -1184,7 +1526,7 @@ static int _event_timer_free(fr_event_timer_t *ev)
 	if (fr_dlist_entry_in_list(&ev->entry)) {
 		(void) fr_dlist_remove(&el->ev_to_add, ev);
 	} else {
-		int		ret = fr_heap_extract(el->times, ev);
+		int		ret = event_timer_extract(el, ev);
 		char const	*err_file = "not-available";
 		int		err_line = 0;
 
@@ -1272,6 +1614,7 @@ int _fr_event_timer_at(NDEBUG_LOCATION_ARGS
 
 		talloc_set_destructor(ev, _event_timer_free);
 		ev->heap_id = -1;
+		fr_dlist_entry_init(&ev->wheel_entry);
 
 	} else {
 		memcpy(&ev, ev_p, sizeof(ev));	/* Not const to us */
@@ -1301,7 +1644,7 @@ int _fr_event_timer_at(NDEBUG_LOCATION_ARGS
 			char const	*err_file = "not-available";
 			int		err_line = 0;
 
-			ret = fr_heap_extract(el->times, ev);
+			ret = event_timer_extract(el, ev);
 
 #ifndef NDEBUG
 			err_file = ev->file;
@@ -1336,7 +1679,7 @@ int _fr_event_timer_at(NDEBUG_LOCATION_ARGS
 		 *	multiple times.
 		 */
 		if (!fr_dlist_entry_in_list(&ev->entry)) fr_dlist_insert_head(&el->ev_to_add, ev);
-	} else if (unlikely(fr_heap_insert(el->times, ev) < 0)) {
+	} else if (unlikely(event_timer_insert(el, ev) < 0)) {
 		fr_strerror_const_push("Failed inserting event");
 		talloc_set_destructor(ev, NULL);
 		*ev_p = NULL;
@@ -1692,14 +2035,11 @@ int fr_event_timer_run(fr_event_list_t *el, fr_time_t *when)
 
 	if (unlikely(!el)) return 0;
 
-	if (fr_heap_num_elements(el->times) == 0) {
-		*when = 0;
-		return 0;
-	}
+	event_wheel_advance(el, *when);
 
 	ev = fr_heap_peek(el->times);
 	if (!ev) {
-		*when = 0;
+		*when = event_wheel_when(el);
 		return 0;
 	}
 
@@ -1726,6 +2066,136 @@ int fr_event_timer_run(fr_event_list_t *el, fr_time_t *when)
 	return 1;
 }
 
+#ifdef WITH_EVENT_EPOLL
+/** Wait for I/O events using epoll, and translate them into kevents
+ *
+ * Timers are serviced with a timerfd rather than the epoll_wait()
+ * timeout, as the latter only has millisecond resolution.  The
+ * timerfd is only re-armed when the wake up time changes.
+ *
+ * If the kqueue is readable, any vnode or user events it has are
+ * appended to the translated events.
+ *
+ * @param[in] el	to wait for events on.
+ * @param[out] events	where to write the kevents.
+ * @param[in] nevents	size of the events array.
+ * @param[in] ts_wake	how long to wait for.  NULL to wait forever.
+ * @return
+ *	- >= 0 the number of events written.
+ *	- -1 on error, with errno set.
+ */
+static int fr_event_epoll_wait(fr_event_list_t *el, struct kevent events[], int nevents, struct timespec const *ts_wake)
+{
+	int	i, num, count = 0;
+	int	timeout = -1;
+	int	max_events = nevents / 2;
+	bool	kq_ready = false;
+
+	if (ts_wake) {
+		fr_time_delta_t delay = fr_time_delta_from_timespec(ts_wake);
+
+		if (delay == 0) {
+			timeout = 0;
+
+		} else if (el->timer_armed != (el->now + delay)) {
+			struct itimerspec its = { .it_value = *ts_wake };
+
+			if (timerfd_settime(el->timer_fd, 0, &its, NULL) < 0) return -1;
+			el->timer_armed = el->now + delay;
+		}
+	}
+
+	/*
+	 *	Each epoll event can expand into a read
+	 *	and a write kevent.
+	 */
+	if (max_events > (int)NUM_ELEMENTS(el->ep_events)) max_events = NUM_ELEMENTS(el->ep_events);
+
+	num = epoll_wait(el->epfd, el->ep_events, max_events, timeout);
+	if (num < 0) return -1;
+
+	for (i = 0; i < num; i++) {
+		struct epoll_event	*ep = &el->ep_events[i];
+		fr_event_fd_t		*ef;
+		uint16_t		flags = 0;
+		int			fd_errno = 0;
+
+		if (ep->data.ptr == &el->timer_fd) {
+			uint64_t	expirations;
+			ssize_t		slen;
+
+			slen = read(el->timer_fd, &expirations, sizeof(expirations));	/* Clears the timerfd */
+			if (slen > 0) el->timer_armed = 0;
+			continue;
+		}
+
+		if (ep->data.ptr == &el->kq) {
+			kq_ready = true;
+			continue;
+		}
+
+		ef = ep->data.ptr;
+
+		/*
+		 *	Errors are delivered as readiness, so that
+		 *	the handler picks them up from the next
+		 *	read or write, the same as with kqueue.
+		 */
+		if (ep->events & (EPOLLHUP | EPOLLRDHUP)) {
+			flags |= EV_EOF;
+
+			/*
+			 *	kqueue passes the socket error in
+			 *	fflags along with EV_EOF.
+			 */
+			if ((ep->events & EPOLLERR) && (ef->type == FR_EVENT_FD_SOCKET)) {
+				socklen_t len = sizeof(fd_errno);
+
+				(void) getsockopt(ef->fd, SOL_SOCKET, SO_ERROR, &fd_errno, &len);
+			}
+		}
+
+		if ((ef->epoll_events & EPOLLIN) && (ep->events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+			EV_SET(&events[count++], ef->fd, EVFILT_READ, flags, fd_errno, 0, ef);
+		}
+
+		if ((ef->epoll_events & EPOLLOUT) && (ep->events & (EPOLLOUT | EPOLLHUP | EPOLLERR))) {
+			EV_SET(&events[count++], ef->fd, EVFILT_WRITE, flags, fd_errno, 0, ef);
+		}
+	}
+
+	if (kq_ready && (count < nevents)) {
+		struct timespec	ts_zero = { 0, 0 };
+		int		ret;
+
+		ret = kevent(el->kq, NULL, 0, &events[count], nevents - count, &ts_zero);
+		if (ret > 0) count += ret;
+	}
+
+	return count;
+}
+#endif
+
+/** Wait for events from whichever backend the event list is using
+ *
+ * @param[in] el	to wait for events on.
+ * @param[out] events	where to write the kevents.
+ * @param[in] nevents	size of the events array.
+ * @param[in] ts_wake	how long to wait for.  NULL to wait forever.
+ * @return
+ *	- >= 0 the number of events written.
+ *	- -1 on error, with errno set.
+ */
+static inline CC_HINT(always_inline) int fr_event_wait(fr_event_list_t *el, struct kevent events[], int nevents,
+						       struct timespec const *ts_wake)
+{
+#ifdef WITH_EVENT_EPOLL
+	if (el->epfd >= 0) return fr_event_epoll_wait(el, events, nevents, ts_wake);
+#endif
+
+	return kevent(el->kq, NULL, 0, events, nevents, ts_wake);
+}
+
 /** Gather outstanding timer and file descriptor events
  *
  * @param[in] el	to process events for.
@@ -1772,13 +2242,19 @@ int fr_event_corral(fr_event_list_t *el, fr_time_t now, bool wait)
 	 *	events are in the past.  Or, we wait for a future
 	 *	timer event.
 	 */
+	event_wheel_advance(el, el->now);
+
 	ev = fr_heap_peek(el->times);
-	if (ev) {
-		if (ev->when <= el->now) {
+	if (ev || el->wheel.num_elements) {
+		fr_time_t next = event_wheel_when(el);
+
+		if (ev && (!next || (ev->when < next))) next = ev->when;
+
+		if (ev && (ev->when <= el->now)) {
 			timer_event_ready = true;
 
 		} else if (wait) {
-			when = ev->when - el->now;
+			when = next - el->now;
 
 		} /* else we're not waiting, leave "when == 0" */
 
@@ -1827,7 +2303,7 @@ int fr_event_corral(fr_event_list_t *el, fr_time_t now, bool wait)
 	 *	or wait for the next timer event.
 	 */
 #ifndef LOCAL_PID
-	num_fd_events = kevent(el->kq, NULL, 0, el->events, FR_EV_BATCH_FDS, ts_wake);
+	num_fd_events = fr_event_wait(el, el->events, FR_EV_BATCH_FDS, ts_wake);
 
 	/*
 	 *	Interrupt is different from timeout / FD events.
@@ -1836,7 +2312,7 @@ int fr_event_corral(fr_event_list_t *el, fr_time_t now, bool wait)
 		if (errno == EINTR) {
 			return 0;
 		} else {
-			fr_strerror_printf("Failed calling kevent: %s", fr_syserror(errno));
+			fr_strerror_printf("Failed waiting for events: %s", fr_syserror(errno));
 			return -1;
 		}
 	}
@@ -1885,14 +2361,14 @@ int fr_event_corral(fr_event_list_t *el, fr_time_t now, bool wait)
 		ts_wake = &ts_when;
 	}
 
-	num_fd_events = kevent(el->kq, NULL, 0, &el->events[num_pid_events], FR_EV_BATCH_FDS - num_pid_events, ts_wake);
+	num_fd_events = fr_event_wait(el, &el->events[num_pid_events], FR_EV_BATCH_FDS - num_pid_events, ts_wake);
 
 	/*
 	 *	Interrupt is different from timeout / FD events.
 	 */
 	if (unlikely(num_fd_events < 0)) {
 		if (errno != EINTR) {
-			fr_strerror_printf("Failed calling kevent: %s", fr_syserror(errno));
+			fr_strerror_printf("Failed waiting for events: %s", fr_syserror(errno));
 			return -1;
 		}
 
@@ -2151,7 +2627,7 @@ service:
 	 *	Run all of the timer events.  Note that these can add
 	 *	new timers!
 	 */
-	if (fr_heap_num_elements(el->times) > 0) {
+	if ((fr_heap_num_elements(el->times) > 0) || (el->wheel.num_elements > 0)) {
 		do {
 			when = el->now;
 		} while (fr_event_timer_run(el, &when) == 1);
@@ -2173,7 +2649,7 @@ service:
 	 */
 	while ((ev = fr_dlist_head(&el->ev_to_add)) != NULL) {
 		(void)fr_dlist_remove(&el->ev_to_add, ev);
-		if (unlikely(fr_heap_insert(el->times, ev) < 0)) {
+		if (unlikely(event_timer_insert(el, ev) < 0)) {
 			talloc_free(ev);
 			fr_assert_msg(0, "failed inserting heap event: %s", fr_strerror());	/* Die in debug builds */
 		}
@@ -2244,15 +2720,75 @@ CC_HINT(flatten) int fr_event_loop(fr_event_list_t *el)
 static int _event_list_free(fr_event_list_t *el)
 {
 	fr_event_timer_t const *ev;
+	unsigned int		level, slot;
 
 	while ((ev = fr_heap_peek(el->times)) != NULL) fr_event_timer_delete(&ev);
 
+	for (level = 0; level < FR_EVENT_WHEEL_LEVELS; level++) {
+		for (slot = 0; slot < FR_EVENT_WHEEL_SLOTS; slot++) {
+			while ((ev = fr_dlist_head(&el->wheel.slot[level][slot])) != NULL) fr_event_timer_delete(&ev);
+		}
+	}
+
 	talloc_free_children(el);
 
 	if (el->kq >= 0) close(el->kq);
+#ifdef WITH_EVENT_EPOLL
+	if (el->epfd >= 0) close(el->epfd);
+	if (el->timer_fd >= 0) close(el->timer_fd);
+#endif
+
+	return 0;
+}
+
+#ifdef WITH_EVENT_EPOLL
+/** Create the epoll instance and timerfd for an event list
+ *
+ * The kqueue is registered with the epoll instance, so that we wake
+ * up for vnode and user events.  If that isn't possible (the kqueue
+ * descriptor can't be polled), the event list uses the kqueue for
+ * everything.
+ *
+ * @param[in] el	to initialise.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int fr_event_epoll_init(fr_event_list_t *el)
+{
+	struct epoll_event ev;
+
+	el->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (el->epfd < 0) {
+		fr_strerror_printf("Failed allocating epoll instance: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	el->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (el->timer_fd < 0) {
+		fr_strerror_printf("Failed allocating timerfd: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	ev = (struct epoll_event){ .events = EPOLLIN, .data = { .ptr = &el->timer_fd } };
+	if (epoll_ctl(el->epfd, EPOLL_CTL_ADD, el->timer_fd, &ev) < 0) {
+		fr_strerror_printf("Failed adding timerfd to epoll instance: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	ev = (struct epoll_event){ .events = EPOLLIN, .data = { .ptr = &el->kq } };
+	if (epoll_ctl(el->epfd, EPOLL_CTL_ADD, el->kq, &ev) < 0) {
+		EVENT_DEBUG("Can't poll kqueue with epoll (%s), using kqueue for all filters", fr_syserror(errno));
+
+		close(el->epfd);
+		el->epfd = -1;
+		close(el->timer_fd);
+		el->timer_fd = -1;
+	}
 
 	return 0;
 }
+#endif
 
 /** Initialise a new event list
  *
@@ -2275,6 +2811,10 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 	}
 	el->time = fr_time;
 	el->kq = -1;	/* So destructor can be used before kqueue() provides us with fd */
+#ifdef WITH_EVENT_EPOLL
+	el->epfd = -1;
+	el->timer_fd = -1;
+#endif
 	talloc_set_destructor(el, _event_list_free);
 
 	el->times = fr_heap_talloc_alloc(el, fr_event_timer_cmp, fr_event_timer_t, heap_id);
@@ -2285,6 +2825,17 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 		return NULL;
 	}
 
+	{
+		unsigned int level, slot;
+
+		for (level = 0; level < FR_EVENT_WHEEL_LEVELS; level++) {
+			for (slot = 0; slot < FR_EVENT_WHEEL_SLOTS; slot++) {
+				fr_dlist_talloc_init(&el->wheel.slot[level][slot], fr_event_timer_t, wheel_entry);
+			}
+		}
+		el->wheel.tick = event_wheel_key(el->time());
+	}
+
 	el->fds = rbtree_talloc_alloc(el, fr_event_fd_t, node, fr_event_fd_cmp, NULL, 0);
 	if (!el->fds) {
 		fr_strerror_const("Failed allocating FD tree");
@@ -2320,6 +2871,10 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
 		goto error;
 	}
 
+#ifdef WITH_EVENT_EPOLL
+	if (fr_event_epoll_init(el) < 0) goto error;
+#endif
+
 #ifdef WITH_EVENT_DEBUG
 	fr_event_timer_in(el, el, &el->report, fr_time_delta_from_sec(EVENT_REPORT_FREQ), fr_event_report, NULL);
 #endif
@@ -2334,7 +2889,29 @@ fr_event_list_t *fr_event_list_alloc(TALLOC_CTX *ctx, fr_event_status_cb_t statu
  */
 void fr_event_list_set_time_func(fr_event_list_t *el, fr_event_time_source_t func)
 {
+	unsigned int		level, slot;
+	fr_event_timer_t	*ev;
+
 	el->time = func;
+
+	/*
+	 *	The wheel's idea of the current time may be
+	 *	completely wrong now, so move everything in it to
+	 *	the heap, and start again.
+	 */
+	for (level = 0; level < FR_EVENT_WHEEL_LEVELS; level++) {
+		for (slot = 0; slot < FR_EVENT_WHEEL_SLOTS; slot++) {
+			while ((ev = fr_dlist_pop_head(&el->wheel.slot[level][slot])) != NULL) {
+				if (unlikely(fr_heap_insert(el->times, ev) < 0)) {
+					talloc_free(ev);
+					fr_assert_msg(0, "failed inserting heap event: %s", fr_strerror());
+				}
+			}
+		}
+		el->wheel.occupied[level] = 0;
+	}
+	el->wheel.num_elements = 0;
+	el->wheel.tick = event_wheel_key(func());
 }
 
 /** Return whether the event loop has any active events
@@ -2342,7 +2919,7 @@ void fr_event_list_set_time_func(fr_event_list_t *el, fr_event_time_source_t fun
  */
 bool fr_event_list_empty(fr_event_list_t *el)
 {
-	return !fr_heap_num_elements(el->times) && !rbtree_num_elements(el->fds);
+	return !fr_heap_num_elements(el->times) && !el->wheel.num_elements && !rbtree_num_elements(el->fds);
 }
 
 #ifdef WITH_EVENT_DEBUG
@@ -2391,6 +2968,39 @@ static int event_timer_print_location(void *node, UNUSED void *uctx)
 	return 0;
 }
 
+/** Count a timer in the report
+ *
+ */
+static int event_report_timer(fr_event_timer_t const *ev, fr_time_t now, size_t *array, rbtree_t **locations)
+{
+	fr_time_delta_t diff = ev->when - now;
+	size_t		i;
+
+	for (i = 0; i < NUM_ELEMENTS(decades); i++) {
+		if ((diff <= decades[i]) || (i == NUM_ELEMENTS(decades) - 1)) {
+			fr_event_counter_t find = { .file = ev->file, .line = ev->line };
+			fr_event_counter_t *counter;
+
+			counter = rbtree_finddata(locations[i], &find);
+			if (!counter) {
+				counter = talloc(locations[i], fr_event_counter_t);
+				if (!counter) return -1;
+				counter->file = ev->file;
+				counter->line = ev->line;
+				counter->count = 1;
+				rbtree_insert(locations[i], counter);
+			} else {
+				counter->count++;
+			}
+
+			array[i]++;
+			break;
+		}
+	}
+
+	return 0;
+}
+
 /** Print out information about the number of events in the event loop
  *
  */
@@ -2399,6 +3009,7 @@ void fr_event_report(fr_event_list_t *el, fr_time_t now, void *uctx)
 	fr_heap_iter_t		iter;
 	fr_event_timer_t const	*ev;
 	size_t			i;
+	unsigned int		level, slot;
 
 	size_t			array[NUM_ELEMENTS(decades)] = { 0 };
 	rbtree_t		*locations[NUM_ELEMENTS(decades)];
@@ -2425,27 +3036,15 @@ void fr_event_report(fr_event_list_t *el, fr_time_t now, void *uctx)
 	for (ev = fr_heap_iter_init(el->times, &iter);
 	     ev != NULL;
 	     ev = fr_heap_iter_next(el->times, &iter)) {
-		fr_time_delta_t diff = ev->when - now;
-
-		for (i = 0; i < NUM_ELEMENTS(decades); i++) {
-			if ((diff <= decades[i]) || (i == NUM_ELEMENTS(decades) - 1)) {
-				fr_event_counter_t find = { .file = ev->file, .line = ev->line };
-				fr_event_counter_t *counter;
-
-				counter = rbtree_finddata(locations[i], &find);
-				if (!counter) {
-					counter = talloc(locations[i], fr_event_counter_t);
-					if (!counter) goto oom;
-					counter->file = ev->file;
-					counter->line = ev->line;
-					counter->count = 1;
-					rbtree_insert(locations[i], counter);
-				} else {
-					counter->count++;
-				}
+		if (event_report_timer(ev, now, array, locations) < 0) goto oom;
+	}
 
-				array[i]++;
-				break;
+	for (level = 0; level < FR_EVENT_WHEEL_LEVELS; level++) {
+		for (slot = 0; slot < FR_EVENT_WHEEL_SLOTS; slot++) {
+			fr_dlist_head_t *head = &el->wheel.slot[level][slot];
+
+			for (ev = fr_dlist_head(head); ev != NULL; ev = fr_dlist_next(head, ev)) {
+				if (event_report_timer(ev, now, array, locations) < 0) goto oom;
 			}
 		}
 	}
@@ -2481,6 +3080,7 @@ void fr_event_timer_dump(fr_event_list_t *el)
 	fr_heap_iter_t		iter;
 	fr_event_timer_t 	*ev;
 	fr_time_t		now;
+	unsigned int		level, slot;
 
 	now = el->time();
 
@@ -2493,6 +3093,19 @@ void fr_event_timer_dump(fr_event_list_t *el)
 		EVENT_DEBUG("%s[%u]: %p time=%" PRId64 " (%c), callback=%p",
 			    ev->file, ev->line, ev, ev->when, now > ev->when ? '<' : '>', ev->callback);
 	}
+
+	for (level = 0; level < FR_EVENT_WHEEL_LEVELS; level++) {
+		for (slot = 0; slot < FR_EVENT_WHEEL_SLOTS; slot++) {
+			fr_dlist_head_t *head = &el->wheel.slot[level][slot];
+
+			for (ev = fr_dlist_head(head); ev; ev = fr_dlist_next(head, ev)) {
+				(void)talloc_get_type_abort(ev, fr_event_timer_t);
+				EVENT_DEBUG("%s[%u]: %p time=%" PRId64 " (%c), callback=%p, wheel level %u slot %u",
+					    ev->file, ev->line, ev, ev->when, now > ev->when ? '<' : '>', ev->callback,
+					    level, slot);
+			}
+		}
+	}
 }
 #endif
 #endif
@@ -0,0 +1,469 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests and benchmarks for the event loop
+ *
+ * The benchmarks approximate the network and worker loops, and print the
+ * per-event overhead of whichever backend (epoll or kqueue) event.c was
+ * built with.  They're only run if FR_TEST_BENCHMARK is set.
+ *
+ * @file src/lib/util/event_tests.c
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/event.h>
+#include <freeradius-devel/util/time.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define NUM_SOCKETS	(64)
+#define NUM_LOOPS	(10000)
+#define NUM_TIMERS	(200000)
+
+typedef struct {
+	int		reads;
+	int		writes;
+	int		errors;
+	int		timers;
+} event_test_ctx_t;
+
+static void test_read(UNUSED fr_event_list_t *el, int fd, UNUSED int flags, void *uctx)
+{
+	event_test_ctx_t	*ctx = uctx;
+	uint8_t			buffer[64];
+
+	if (read(fd, buffer, sizeof(buffer)) > 0) ctx->reads++;
+}
+
+static void test_write(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, void *uctx)
+{
+	event_test_ctx_t	*ctx = uctx;
+
+	ctx->writes++;
+}
+
+static void test_error(UNUSED fr_event_list_t *el, UNUSED int fd, UNUSED int flags, UNUSED int fd_errno, void *uctx)
+{
+	event_test_ctx_t	*ctx = uctx;
+
+	ctx->errors++;
+}
+
+static void test_timer(UNUSED fr_event_list_t *el, UNUSED fr_time_t now, void *uctx)
+{
+	event_test_ctx_t	*ctx = uctx;
+
+	ctx->timers++;
+}
+
+/** Run one pass of the event loop
+ *
+ */
+static int event_test_pass(fr_event_list_t *el, bool wait)
+{
+	int ret;
+
+	ret = fr_event_corral(el, fr_time(), wait);
+	if (ret > 0) fr_event_service(el);
+
+	return ret;
+}
+
+static void event_pipe_read(void)
+{
+	fr_event_list_t		*el;
+	event_test_ctx_t	ctx = { 0 };
+	int			fds[2];
+
+	el = fr_event_list_alloc(NULL, NULL, NULL);
+	TEST_CHECK(el != NULL);
+	TEST_CHECK(pipe(fds) == 0);
+
+	TEST_CHECK(fr_event_fd_insert(el, el, fds[0], test_read, NULL, test_error, &ctx) == 0);
+
+	TEST_CASE("No events before data is written");
+	TEST_CHECK(event_test_pass(el, false) == 0);
+	TEST_CHECK(ctx.reads == 0);
+
+	TEST_CASE("Read callback runs when data is available");
+	TEST_CHECK(write(fds[1], "a", 1) == 1);
+	TEST_CHECK(event_test_pass(el, false) == 1);
+	TEST_CHECK(ctx.reads == 1);
+
+	TEST_CASE("No events after data is drained");
+	TEST_CHECK(event_test_pass(el, false) == 0);
+	TEST_CHECK(ctx.reads == 1);
+
+	TEST_CHECK(fr_event_fd_delete(el, fds[0], FR_EVENT_FILTER_IO) == 0);
+	TEST_CHECK(fr_event_list_num_fds(el) == 0);
+
+	talloc_free(el);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+static void event_read_write(void)
+{
+	fr_event_list_t		*el;
+	event_test_ctx_t	ctx = { 0 };
+	int			fds[2];
+
+	el = fr_event_list_alloc(NULL, NULL, NULL);
+	TEST_CHECK(el != NULL);
+	TEST_CHECK(socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) == 0);
+
+	TEST_CASE("Write callback runs on a writable socket");
+	TEST_CHECK(fr_event_fd_insert(el, el, fds[0], test_read, test_write, test_error, &ctx) == 0);
+	TEST_CHECK(event_test_pass(el, false) == 1);
+	TEST_CHECK(ctx.writes == 1);
+	TEST_CHECK(ctx.reads == 0);
+
+	TEST_CASE("Read and write callbacks both run");
+	TEST_CHECK(write(fds[1], "a", 1) == 1);
+	TEST_CHECK(event_test_pass(el, false) == 2);
+	TEST_CHECK(ctx.writes == 2);
+	TEST_CHECK(ctx.reads == 1);
+
+	TEST_CASE("Removing the write callback leaves the read callback");
+	TEST_CHECK(fr_event_fd_insert(el, el, fds[0], test_read, NULL, test_error, &ctx) == 0);
+	TEST_CHECK(event_test_pass(el, false) == 0);
+	TEST_CHECK(ctx.writes == 2);
+
+	talloc_free(el);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+static void event_suspend_resume(void)
+{
+	fr_event_list_t		*el;
+	event_test_ctx_t	ctx = { 0 };
+	int			fds[2];
+
+	static fr_event_update_t pause_read[] = {
+		FR_EVENT_SUSPEND(fr_event_io_func_t, read),
+		{ 0 }
+	};
+	static fr_event_update_t resume_read[] = {
+		FR_EVENT_RESUME(fr_event_io_func_t, read),
+		{ 0 }
+	};
+
+	el = fr_event_list_alloc(NULL, NULL, NULL);
+	TEST_CHECK(el != NULL);
+	TEST_CHECK(pipe(fds) == 0);
+
+	TEST_CHECK(fr_event_fd_insert(el, el, fds[0], test_read, NULL, test_error, &ctx) == 0);
+
+	TEST_CASE("Suspended filter doesn't fire");
+	TEST_CHECK(fr_event_filter_update(el, fds[0], FR_EVENT_FILTER_IO, pause_read) == 0);
+	TEST_CHECK(write(fds[1], "a", 1) == 1);
+	TEST_CHECK(event_test_pass(el, false) == 0);
+	TEST_CHECK(ctx.reads == 0);
+
+	TEST_CASE("Resumed filter fires for pending data");
+	TEST_CHECK(fr_event_filter_update(el, fds[0], FR_EVENT_FILTER_IO, resume_read) == 0);
+	TEST_CHECK(event_test_pass(el, false) == 1);
+	TEST_CHECK(ctx.reads == 1);
+
+	talloc_free(el);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+static void event_eof(void)
+{
+	fr_event_list_t		*el;
+	event_test_ctx_t	ctx = { 0 };
+	int			fds[2];
+
+	el = fr_event_list_alloc(NULL, NULL, NULL);
+	TEST_CHECK(el != NULL);
+	TEST_CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+	TEST_CHECK(fr_event_fd_insert(el, el, fds[0], test_read, NULL, test_error, &ctx) == 0);
+
+	TEST_CASE("Closing the peer calls the error callback, and removes the FD");
+	close(fds[1]);
+	TEST_CHECK(event_test_pass(el, false) == 1);
+	TEST_CHECK(ctx.errors == 1);
+	TEST_CHECK(fr_event_list_num_fds(el) == 0);
+
+	talloc_free(el);
+	close(fds[0]);
+}
+
+static void event_timer(void)
+{
+	fr_event_list_t		*el;
+	event_test_ctx_t	ctx = { 0 };
+	fr_event_timer_t const	*ev = NULL;
+	fr_time_t		start;
+
+	el = fr_event_list_alloc(NULL, NULL, NULL);
+	TEST_CHECK(el != NULL);
+
+	TEST_CASE("Timer wakes up a waiting event loop");
+	start = fr_time();
+	TEST_CHECK(fr_event_timer_in(el, el, &ev, fr_time_delta_from_usec(500), test_timer, &ctx) == 0);
+	while (!ctx.timers) TEST_CHECK(event_test_pass(el, true) >= 0);
+	TEST_CHECK(ctx.timers == 1);
+	TEST_CHECK((fr_time() - start) >= fr_time_delta_from_usec(500));
+	TEST_MSG("Timer fired after %" PRId64 "ns", fr_time() - start);
+
+	TEST_CASE("Re-inserted timer fires once");
+	TEST_CHECK(fr_event_timer_in(el, el, &ev, fr_time_delta_from_msec(1), test_timer, &ctx) == 0);
+	TEST_CHECK(fr_event_timer_in(el, el, &ev, fr_time_delta_from_usec(100), test_timer, &ctx) == 0);
+	while (ctx.timers < 2) TEST_CHECK(event_test_pass(el, true) >= 0);
+	TEST_CHECK(fr_event_list_num_timers(el) == 0);
+
+	talloc_free(el);
+}
+
+/** Time source for tests which need to control the time
+ *
+ */
+static fr_time_t test_now;
+
+static fr_time_t test_time(void)
+{
+	return test_now;
+}
+
+typedef struct {
+	fr_event_timer_t const	*ev;
+	fr_time_t		when;
+	fr_time_t		fired;
+} test_wheel_timer_t;
+
+static fr_time_t test_last_fired;
+static bool test_in_order;
+
+static void test_wheel_timer(UNUSED fr_event_list_t *el, fr_time_t now, void *uctx)
+{
+	test_wheel_timer_t	*t = uctx;
+
+	if (now < test_last_fired) test_in_order = false;
+	test_last_fired = now;
+	t->fired = now;
+}
+
+static void event_timer_wheel(void)
+{
+	fr_event_list_t		*el;
+	test_wheel_timer_t	*timers;
+	int			i, num = 1000, fired;
+
+	test_now = fr_time_delta_from_sec(1000);
+	test_last_fired = 0;
+	test_in_order = true;
+
+	el = fr_event_list_alloc(NULL, NULL, NULL);
+	TEST_CHECK(el != NULL);
+	fr_event_list_set_time_func(el, test_time);
+
+	timers = talloc_zero_array(NULL, test_wheel_timer_t, num);
+
+	/*
+	 *	From sub-millisecond to about 20 minutes out, so
+	 *	that every level of the wheel is used.
+	 */
+	for (i = 0; i < num; i++) {
+		timers[i].when = test_now + (((fr_time_delta_t) rand() << 20) % fr_time_delta_from_sec(1200)) + i;
+		TEST_CHECK(fr_event_timer_at(el, el, &timers[i].ev, timers[i].when, test_wheel_timer, &timers[i]) == 0);
+	}
+	TEST_CHECK(fr_event_list_num_timers(el) == num);
+
+	TEST_CASE("Deleting timers");
+	for (i = 0; i < num; i += 4) TEST_CHECK(fr_event_timer_delete(&timers[i].ev) == 0);
+	TEST_CHECK(fr_event_list_num_timers(el) == (num - (num / 4)));
+
+	TEST_CASE("Timers fire in order, and never early");
+	while (fr_event_list_num_timers(el) > 0) {
+		test_now += fr_time_delta_from_usec(700);
+		if (fr_event_corral(el, test_now, false) > 0) fr_event_service(el);
+	}
+
+	for (i = 0, fired = 0; i < num; i++) {
+		if ((i % 4) == 0) {
+			TEST_CHECK(timers[i].fired == 0);
+			continue;
+		}
+
+		TEST_CHECK(timers[i].fired >= timers[i].when);
+		TEST_MSG("timer %i fired at %" PRId64 ", wanted %" PRId64, i, timers[i].fired, timers[i].when);
+		TEST_CHECK((timers[i].fired - timers[i].when) < fr_time_delta_from_usec(700));
+		TEST_MSG("timer %i fired %" PRId64 "ns late", i, timers[i].fired - timers[i].when);
+		fired++;
+	}
+	TEST_CHECK(fired == (num - (num / 4)));
+	TEST_CHECK(test_in_order);
+
+	talloc_free(el);
+	talloc_free(timers);
+}
+
+/** Approximates request timers
+ *
+ * Many timers are set, and then deleted before they fire.
+ */
+static void event_timer_benchmark(void)
+{
+	fr_event_list_t		*el;
+	event_test_ctx_t	ctx = { 0 };
+	fr_event_timer_t const	**ev;
+	int			i;
+	fr_time_t		start, insert, delete;
+
+	TEST_BENCHMARK();
+
+	el = fr_event_list_alloc(NULL, NULL, NULL);
+	TEST_CHECK(el != NULL);
+
+	ev = talloc_zero_array(NULL, fr_event_timer_t const *, NUM_TIMERS);
+
+	start = fr_time();
+	for (i = 0; i < NUM_TIMERS; i++) {
+		(void) fr_event_timer_in(el, el, &ev[i], fr_time_delta_from_sec(5) + (rand() % NSEC), test_timer, &ctx);
+	}
+	insert = fr_time() - start;
+	TEST_CHECK(fr_event_list_num_timers(el) == NUM_TIMERS);
+
+	start = fr_time();
+	for (i = 0; i < NUM_TIMERS; i++) (void) fr_event_timer_delete(&ev[i]);
+	delete = fr_time() - start;
+	TEST_CHECK(fr_event_list_num_timers(el) == 0);
+
+	printf("%d timers, insert %" PRIu64 "ns, delete %" PRIu64 "ns per timer\n",
+	       NUM_TIMERS, (uint64_t) insert / NUM_TIMERS, (uint64_t) delete / NUM_TIMERS);
+
+	talloc_free(el);
+	talloc_free(ev);
+}
+
+/** Approximates the network thread
+ *
+ * Many sockets, each with a packet waiting to be read.
+ */
+static void event_network_benchmark(void)
+{
+	fr_event_list_t		*el;
+	event_test_ctx_t	ctx = { 0 };
+	int			fds[NUM_SOCKETS][2];
+	int			i, j;
+	fr_time_t		start, elapsed = 0;
+	uint64_t		per_event;
+
+	TEST_BENCHMARK();
+
+	el = fr_event_list_alloc(NULL, NULL, NULL);
+	TEST_CHECK(el != NULL);
+
+	for (i = 0; i < NUM_SOCKETS; i++) {
+		TEST_CHECK(socketpair(AF_UNIX, SOCK_DGRAM, 0, fds[i]) == 0);
+		TEST_CHECK(fr_event_fd_insert(el, el, fds[i][0], test_read, NULL, test_error, &ctx) == 0);
+	}
+
+	for (i = 0; i < (NUM_LOOPS / 10); i++) {
+		for (j = 0; j < NUM_SOCKETS; j++) TEST_CHECK(write(fds[j][1], "a", 1) == 1);
+
+		start = fr_time();
+		while (event_test_pass(el, false) > 0);
+		elapsed += fr_time() - start;
+	}
+
+	TEST_CHECK(ctx.reads == ((NUM_LOOPS / 10) * NUM_SOCKETS));
+
+	per_event = elapsed / ctx.reads;
+	printf("network loop %" PRIu64 "ns per read event\n", per_event);
+
+	talloc_free(el);
+	for (i = 0; i < NUM_SOCKETS; i++) {
+		close(fds[i][0]);
+		close(fds[i][1]);
+	}
+}
+
+/** Approximates a worker thread
+ *
+ * A single control pipe, with a timer being moved each time a message
+ * arrives, and the read callback being suspended and resumed.
+ */
+static void event_worker_benchmark(void)
+{
+	fr_event_list_t		*el;
+	event_test_ctx_t	ctx = { 0 };
+	fr_event_timer_t const	*ev = NULL;
+	int			fds[2];
+	int			i;
+	fr_time_t		start, elapsed = 0;
+	uint64_t		per_event;
+
+	static fr_event_update_t pause_read[] = {
+		FR_EVENT_SUSPEND(fr_event_io_func_t, read),
+		{ 0 }
+	};
+	static fr_event_update_t resume_read[] = {
+		FR_EVENT_RESUME(fr_event_io_func_t, read),
+		{ 0 }
+	};
+
+	TEST_BENCHMARK();
+
+	el = fr_event_list_alloc(NULL, NULL, NULL);
+	TEST_CHECK(el != NULL);
+	TEST_CHECK(pipe(fds) == 0);
+	TEST_CHECK(fr_event_fd_insert(el, el, fds[0], test_read, NULL, test_error, &ctx) == 0);
+
+	for (i = 0; i < NUM_LOOPS; i++) {
+		TEST_CHECK(write(fds[1], "a", 1) == 1);
+
+		start = fr_time();
+		(void) fr_event_timer_in(el, el, &ev, fr_time_delta_from_sec(30), test_timer, &ctx);
+		(void) fr_event_corral(el, fr_time(), true);
+		fr_event_service(el);
+		(void) fr_event_filter_update(el, fds[0], FR_EVENT_FILTER_IO, pause_read);
+		(void) fr_event_filter_update(el, fds[0], FR_EVENT_FILTER_IO, resume_read);
+		elapsed += fr_time() - start;
+	}
+
+	TEST_CHECK(ctx.reads == NUM_LOOPS);
+
+	per_event = elapsed / ctx.reads;
+	printf("worker loop %" PRIu64 "ns per iteration\n", per_event);
+
+	talloc_free(el);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+TEST_LIST = {
+	{ "event_pipe_read",		event_pipe_read },
+	{ "event_read_write",		event_read_write },
+	{ "event_suspend_resume",	event_suspend_resume },
+	{ "event_eof",			event_eof },
+	{ "event_timer",		event_timer },
+	{ "event_timer_wheel",		event_timer_wheel },
+
+	{ "event_timer_benchmark",	event_timer_benchmark },
+	{ "event_network_benchmark",	event_network_benchmark },
+	{ "event_worker_benchmark",	event_worker_benchmark },
+
+	{ NULL }
+};
@@ -16,15 +16,20 @@
 
 /** Resizable hash tables
  *
- * The weird "reverse" function is based on an idea from
- * "Split-Ordered Lists - Lock-free Resizable Hash Tables", with
- * modifications so that they're not lock-free. :(
+ * The table is a "Swiss table".  Entries are stored inline, in one
+ * array of pointers, and searched by open addressing.  Alongside it
+ * is an array of control bytes, one per slot.  A control byte says
+ * whether the slot is empty, deleted, or full.  For full slots, it
+ * also holds 7 bits of the hash of the entry.
  *
- * However, the split-order idea allows a fast & easy splitting of the
- * hash bucket chain when the hash table is resized.  Without it, we'd
- * have to check & update the pointers for every node in the buck chain,
- * rather than being able to move 1/2 of the entries in the chain with
- * one update.
+ * Slots are searched a group of 16 at a time.  With SSE2, a single
+ * instruction compares all 16 control bytes in a group against the
+ * hash bits we're looking for.  The comparison function is then
+ * only called for slots which are very likely to match.  A search
+ * stops at the first group which has an empty slot.
+ *
+ * There's no per-entry allocation, and no per-entry overhead other
+ * than the control byte.
  *
  * @file src/lib/util/hash.c
  *
@@ -35,239 +40,248 @@ RCSID("$Id$")
 #include <freeradius-devel/util/hash.h>
 #include <freeradius-devel/util/talloc.h>
 
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
 /*
- *	A reasonable number of buckets to start off with.
- *	Should be a power of two.
+ *	A reasonable number of slots to start off with.
+ *	Must be a power of two, and a multiple of the
+ *	group size.
  */
-#define FR_HASH_NUM_BUCKETS (64)
+#define FR_HASH_NUM_SLOTS	(64)
 
-struct fr_hash_entry_s {
-	fr_hash_entry_t *next;
-	uint32_t	reversed;
-	uint32_t	key;
-	void 		*data;
-};
+#define FR_HASH_GROUP_SIZE	(16)
+
+/*
+ *	Control bytes.  Full slots have the top bit clear, and
+ *	hold 7 bits of the hash.
+ */
+#define CTRL_EMPTY		((int8_t) -128)
+#define CTRL_DELETED		((int8_t) -2)
+
+#define CTRL_IS_FULL(_c)	((_c) >= 0)
 
 struct fr_hash_table_s {
 	int			num_elements;
-	int			num_buckets; /* power of 2 */
-	int			next_grow;
-	int			mask;
+	int			num_deleted;	//!< slots which are marked deleted.
+	int			max_used;	//!< grow when full + deleted slots reaches this.
+	uint32_t		mask;		//!< number of slots - 1.
+	int			walking;	//!< how many walks are in progress.
 
 	fr_hash_table_free_t	free;
 	fr_hash_table_hash_t	hash;
 	fr_hash_table_cmp_t	cmp;
 
-	fr_hash_entry_t		null;
-
-	fr_hash_entry_t		**buckets;
+	int8_t			*ctrl;		//!< one control byte per slot.
+	void			**slots;	//!< the data.
 };
 
-#ifdef TESTING
-static int grow = 0;
+/** Bitmask of which slots in a group have the given control byte
+ *
+ */
+static inline CC_HINT(always_inline) uint32_t group_match(int8_t const *ctrl, int8_t c)
+{
+#ifdef __SSE2__
+	return (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(c),
+							   _mm_loadu_si128((__m128i const *) ctrl)));
+#else
+	uint32_t	bits = 0;
+	int		i;
+
+	for (i = 0; i < FR_HASH_GROUP_SIZE; i++) if (ctrl[i] == c) bits |= (1U << i);
+
+	return bits;
 #endif
+}
 
-/*
- * perl -e 'foreach $i (0..255) {$r = 0; foreach $j (0 .. 7 ) { if (($i & ( 1<< $j)) != 0) { $r |= (1 << (7 - $j));}} print $r, ", ";if (($i & 7) == 7) {print "\n";}}'
+/** Bitmask of which slots in a group are empty or deleted
+ *
  */
-static const uint8_t reversed_byte[256] = {
-	0,  128, 64, 192, 32, 160, 96,  224,
-	16, 144, 80, 208, 48, 176, 112, 240,
-	8,  136, 72, 200, 40, 168, 104, 232,
-	24, 152, 88, 216, 56, 184, 120, 248,
-	4,  132, 68, 196, 36, 164, 100, 228,
-	20, 148, 84, 212, 52, 180, 116, 244,
-	12, 140, 76, 204, 44, 172, 108, 236,
-	28, 156, 92, 220, 60, 188, 124, 252,
-	2,  130, 66, 194, 34, 162, 98,  226,
-	18, 146, 82, 210, 50, 178, 114, 242,
-	10, 138, 74, 202, 42, 170, 106, 234,
-	26, 154, 90, 218, 58, 186, 122, 250,
-	6,  134, 70, 198, 38, 166, 102, 230,
-	22, 150, 86, 214, 54, 182, 118, 246,
-	14, 142, 78, 206, 46, 174, 110, 238,
-	30, 158, 94, 222, 62, 190, 126, 254,
-	1,  129, 65, 193, 33, 161, 97,  225,
-	17, 145, 81, 209, 49, 177, 113, 241,
-	9,  137, 73, 201, 41, 169, 105, 233,
-	25, 153, 89, 217, 57, 185, 121, 249,
-	5,  133, 69, 197, 37, 165, 101, 229,
-	21, 149, 85, 213, 53, 181, 117, 245,
-	13, 141, 77, 205, 45, 173, 109, 237,
-	29, 157, 93, 221, 61, 189, 125, 253,
-	3,  131, 67, 195, 35, 163, 99,  227,
-	19, 147, 83, 211, 51, 179, 115, 243,
-	11, 139, 75, 203, 43, 171, 107, 235,
-	27, 155, 91, 219, 59, 187, 123, 251,
-	7,  135, 71, 199, 39, 167, 103, 231,
-	23, 151, 87, 215, 55, 183, 119, 247,
-	15, 143, 79, 207, 47, 175, 111, 239,
-	31, 159, 95, 223, 63, 191, 127, 255
-};
+static inline CC_HINT(always_inline) uint32_t group_match_free(int8_t const *ctrl)
+{
+#ifdef __SSE2__
+	return (uint32_t) _mm_movemask_epi8(_mm_loadu_si128((__m128i const *) ctrl));
+#else
+	uint32_t	bits = 0;
+	int		i;
 
+	for (i = 0; i < FR_HASH_GROUP_SIZE; i++) if (!CTRL_IS_FULL(ctrl[i])) bits |= (1U << i);
 
-/*
- * perl -e 'foreach $i (0..255) {$r = 0;foreach $j (0 .. 7) { $r = $i & (1 << (7 - $j)); last if ($r)} print $i & ~($r), ", ";if (($i & 7) == 7) {print "\n";}}'
+	return bits;
+#endif
+}
+
+/** Spread the bits of the caller's hash across the whole word
+ *
+ * The low 7 bits go into the control byte, and the rest pick the
+ * group, so they should be independent.
  */
-static uint8_t parent_byte[256] = {
-	0, 0, 0, 1, 0, 1, 2, 3,
-	0, 1, 2, 3, 4, 5, 6, 7,
-	0, 1, 2, 3, 4, 5, 6, 7,
-	8, 9, 10, 11, 12, 13, 14, 15,
-	0, 1, 2, 3, 4, 5, 6, 7,
-	8, 9, 10, 11, 12, 13, 14, 15,
-	16, 17, 18, 19, 20, 21, 22, 23,
-	24, 25, 26, 27, 28, 29, 30, 31,
-	0, 1, 2, 3, 4, 5, 6, 7,
-	8, 9, 10, 11, 12, 13, 14, 15,
-	16, 17, 18, 19, 20, 21, 22, 23,
-	24, 25, 26, 27, 28, 29, 30, 31,
-	32, 33, 34, 35, 36, 37, 38, 39,
-	40, 41, 42, 43, 44, 45, 46, 47,
-	48, 49, 50, 51, 52, 53, 54, 55,
-	56, 57, 58, 59, 60, 61, 62, 63,
-	0, 1, 2, 3, 4, 5, 6, 7,
-	8, 9, 10, 11, 12, 13, 14, 15,
-	16, 17, 18, 19, 20, 21, 22, 23,
-	24, 25, 26, 27, 28, 29, 30, 31,
-	32, 33, 34, 35, 36, 37, 38, 39,
-	40, 41, 42, 43, 44, 45, 46, 47,
-	48, 49, 50, 51, 52, 53, 54, 55,
-	56, 57, 58, 59, 60, 61, 62, 63,
-	64, 65, 66, 67, 68, 69, 70, 71,
-	72, 73, 74, 75, 76, 77, 78, 79,
-	80, 81, 82, 83, 84, 85, 86, 87,
-	88, 89, 90, 91, 92, 93, 94, 95,
-	96, 97, 98, 99, 100, 101, 102, 103,
-	104, 105, 106, 107, 108, 109, 110, 111,
-	112, 113, 114, 115, 116, 117, 118, 119,
-	120, 121, 122, 123, 124, 125, 126, 127
-};
+static inline CC_HINT(always_inline) uint32_t hash_mix(uint32_t key)
+{
+	key ^= key >> 16;
+	key *= 0x45d9f3b;
+	key ^= key >> 16;
 
+	return key;
+}
+
+#define H1(_mixed)	((_mixed) >> 7)
+#define H2(_mixed)	((int8_t) ((_mixed) & 0x7f))
 
 /*
- *	Reverse a key.
+ *	Triangular probing over groups visits every group, as the
+ *	number of groups is a power of two.
+ */
+#define PROBE_NEXT(_ht, _group, _probe)	(((_group) + (_probe)) & ((_ht)->mask / FR_HASH_GROUP_SIZE))
+
+/** Find the slot holding the data
+ *
+ * @return
+ *	- The slot number.
+ *	- -1 if the data isn't in the table.
  */
-static uint32_t reverse(uint32_t key)
+static inline CC_HINT(always_inline) int64_t hash_table_find_slot(fr_hash_table_t const *ht,
+								   uint32_t key, void const *data)
 {
-	/*
-	 *	Cast to uint32_t is required because the
-	 *	default type of of the expression is an
-	 *	int and ubsan correctly complains that
-	 *	the result of 0xff << 24 won't fit in a
-	 *	signed 32bit integer.
-	 */
-	return (((uint32_t)reversed_byte[key & 0xff] << 24) |
-		((uint32_t)reversed_byte[(key >> 8) & 0xff] << 16) |
-		((uint32_t)reversed_byte[(key >> 16) & 0xff] << 8) |
-		((uint32_t)reversed_byte[(key >> 24) & 0xff]));
+	uint32_t	mixed = hash_mix(key);
+	uint32_t	group = H1(mixed) & (ht->mask / FR_HASH_GROUP_SIZE);
+	uint32_t	probe = 0;
+	int8_t		h2 = H2(mixed);
+
+	for (;;) {
+		int8_t const	*ctrl = ht->ctrl + (group * FR_HASH_GROUP_SIZE);
+		uint32_t	bits;
+
+		for (bits = group_match(ctrl, h2); bits; bits &= (bits - 1)) {
+			uint32_t slot = (group * FR_HASH_GROUP_SIZE) + __builtin_ctz(bits);
+
+			/*
+			 *	No comparison function means that
+			 *	entries with the same hash are the same.
+			 */
+			if (ht->cmp) {
+				if (ht->cmp(data, ht->slots[slot]) == 0) return slot;
+			} else {
+				if (ht->hash(ht->slots[slot]) == key) return slot;
+			}
+		}
+
+		if (group_match(ctrl, CTRL_EMPTY)) return -1;
+
+		group = PROBE_NEXT(ht, group, ++probe);
+	}
 }
 
-/*
- *	Take the parent by discarding the highest bit that is set.
+/** Find the first empty or deleted slot in the probe sequence for a key
+ *
  */
-static uint32_t parent_of(uint32_t key)
+static inline CC_HINT(always_inline) uint32_t hash_table_free_slot(fr_hash_table_t const *ht, uint32_t mixed)
 {
-	if (key > 0x00ffffff)
-		return (key & 0x00ffffff) | (parent_byte[key >> 24] << 24);
-
-	if (key > 0x0000ffff)
-		return (key & 0x0000ffff) | (parent_byte[key >> 16] << 16);
+	uint32_t	group = H1(mixed) & (ht->mask / FR_HASH_GROUP_SIZE);
+	uint32_t	probe = 0;
+	uint32_t	bits;
 
-	if (key > 0x000000ff)
-		return (key & 0x000000ff) | (parent_byte[key >> 8] << 8);
+	while (!(bits = group_match_free(ht->ctrl + (group * FR_HASH_GROUP_SIZE)))) {
+		group = PROBE_NEXT(ht, group, ++probe);
+	}
 
-	return parent_byte[key];
+	return (group * FR_HASH_GROUP_SIZE) + __builtin_ctz(bits);
 }
 
-
-static fr_hash_entry_t *list_find(fr_hash_table_t *ht,
-				  fr_hash_entry_t *head, uint32_t reversed, void const *data)
+/** Allocate the arrays for a table with the given number of slots
+ *
+ */
+static int hash_table_alloc_slots(fr_hash_table_t *ht, uint32_t num_slots)
 {
-	fr_hash_entry_t *cur;
+	int8_t	*ctrl;
+	void	**slots;
 
-	for (cur = head; cur != &ht->null; cur = cur->next) {
-		if (cur->reversed == reversed) {
-			if (ht->cmp) {
-				int cmp = ht->cmp(data, cur->data);
-				if (cmp > 0) break;
-				if (cmp < 0) continue;
-			}
-			return cur;
-		}
-		if (cur->reversed > reversed) break;
+	ctrl = talloc_array(ht, int8_t, num_slots);
+	if (!ctrl) return -1;
+
+	slots = talloc_zero_array(ht, void *, num_slots);
+	if (!slots) {
+		talloc_free(ctrl);
+		return -1;
 	}
+	memset(ctrl, CTRL_EMPTY, num_slots);
 
-	return NULL;
-}
+	ht->ctrl = ctrl;
+	ht->slots = slots;
+	ht->mask = num_slots - 1;
+	ht->num_deleted = 0;
 
+	/*
+	 *	Grow when 7/8 of the slots are used.
+	 */
+	ht->max_used = num_slots - (num_slots / 8);
+
+	return 0;
+}
 
 /*
- *	Inserts a new entry into the list, in order.
+ *	Grow the hash table, or if it's mostly deleted slots,
+ *	rehash it at the same size.
  */
-static int list_insert(fr_hash_table_t *ht,
-		       fr_hash_entry_t **head, fr_hash_entry_t *node)
+static int hash_table_grow(fr_hash_table_t *ht)
 {
-	fr_hash_entry_t **last, *cur;
+	int8_t		*old_ctrl = ht->ctrl;
+	void		**old_slots = ht->slots;
+	uint32_t	old_size = ht->mask + 1;
+	uint32_t	num_slots = old_size;
+	uint32_t	i;
 
-	last = head;
+	if (ht->num_elements >= (ht->max_used / 2)) num_slots *= 2;
 
-	for (cur = *head; cur != &ht->null; cur = cur->next) {
-		if (cur->reversed > node->reversed) break;
-		last = &(cur->next);
+	if (hash_table_alloc_slots(ht, num_slots) < 0) return -1;
 
-		if (cur->reversed == node->reversed) {
-			if (ht->cmp) {
-				int cmp = ht->cmp(node->data, cur->data);
-				if (cmp > 0) break;
-				if (cmp < 0) continue;
-			}
-			return 0;
-		}
+	for (i = 0; i < old_size; i++) {
+		uint32_t mixed, slot;
+
+		if (!CTRL_IS_FULL(old_ctrl[i])) continue;
+
+		mixed = hash_mix(ht->hash(old_slots[i]));
+		slot = hash_table_free_slot(ht, mixed);
+
+		ht->ctrl[slot] = H2(mixed);
+		ht->slots[slot] = old_slots[i];
 	}
 
-	node->next = *last;
-	*last = node;
+	talloc_free(old_ctrl);
+	talloc_free(old_slots);
 
-	return 1;
+	return 0;
 }
 
-
 /*
- *	Delete an entry from the list.
+ *	Remove the data in a slot.
  */
-static int list_delete(fr_hash_table_t *ht,
-		       fr_hash_entry_t **head, fr_hash_entry_t *node)
+static void hash_table_clear_slot(fr_hash_table_t *ht, uint32_t slot)
 {
-	fr_hash_entry_t **last, *cur;
-
-	last = head;
-
-	for (cur = *head; cur != &ht->null; cur = cur->next) {
-		if (cur == node) break;
-		last = &(cur->next);
+	/*
+	 *	Searches stop at the first group with an empty slot.
+	 *	If this group already has one, then no search goes
+	 *	past it, and the slot can just be emptied.
+	 */
+	if (group_match(ht->ctrl + (slot & ~(FR_HASH_GROUP_SIZE - 1)), CTRL_EMPTY)) {
+		ht->ctrl[slot] = CTRL_EMPTY;
+	} else {
+		ht->ctrl[slot] = CTRL_DELETED;
+		ht->num_deleted++;
 	}
 
-	*last = node->next;
-	return 1;
+	ht->slots[slot] = NULL;
+	ht->num_elements--;
 }
 
-
 static int _fr_hash_table_free(fr_hash_table_t *ht)
 {
-	int i;
-	fr_hash_entry_t *node, *next;
+	uint32_t i;
 
 	if (ht->free) {
-		for (i = 0; i < ht->num_buckets; i++) {
-			if (ht->buckets[i]) for (node = ht->buckets[i];
-						 node != &ht->null;
-						 node = next) {
-				next = node->next;
-				if (!node->data) continue; /* dummy entry */
-
-				ht->free(node->data);
-			}
+		for (i = 0; i <= ht->mask; i++) {
+			if (CTRL_IS_FULL(ht->ctrl[i])) ht->free(ht->slots[i]);
 		}
 	}
 
@@ -277,7 +291,8 @@ static int _fr_hash_table_free(fr_hash_table_t *ht)
 /*
  *	Create the table.
  *
- *	Memory usage in bytes is (20/3) * number of entries.
+ *	Memory usage in bytes is 9 per slot, with between 7/16
+ *	and 7/8 of the slots used.
  */
 fr_hash_table_t *fr_hash_table_create(TALLOC_CTX *ctx,
 				      fr_hash_table_hash_t hash_func,
@@ -290,218 +305,94 @@ fr_hash_table_t *fr_hash_table_create(TALLOC_CTX *ctx,
 
 	ht = talloc_zero(ctx, fr_hash_table_t);
 	if (!ht) return NULL;
-	talloc_set_destructor(ht, _fr_hash_table_free);
 
 	ht->free = free_func;
 	ht->hash = hash_func;
 	ht->cmp = cmp_func;
-	ht->num_buckets = FR_HASH_NUM_BUCKETS;
-	ht->mask = ht->num_buckets - 1;
-
-	/*
-	 *	Have a default load factor of 2.5.  In practice this
-	 *	means that the average load will hit 3 before the
-	 *	table grows.
-	 */
-	ht->next_grow = (ht->num_buckets << 1) + (ht->num_buckets >> 1);
 
-	ht->buckets = talloc_zero_array(ht, fr_hash_entry_t *, ht->num_buckets);
-	if (!ht->buckets) {
+	if (hash_table_alloc_slots(ht, FR_HASH_NUM_SLOTS) < 0) {
 		talloc_free(ht);
 		return NULL;
 	}
-
-	ht->null.reversed = ~0;
-	ht->null.key = ~0;
-	ht->null.next = &ht->null;
-	ht->buckets[0] = &ht->null;
+	talloc_set_destructor(ht, _fr_hash_table_free);
 
 	return ht;
 }
 
-
-/*
- *	If the current bucket is uninitialized, initialize it
- *	by recursively copying information from the parent.
- *
- *	We may have a situation where entry E is a parent to 2 other
- *	entries E' and E".  If we split E into E and E', then the
- *	nodes meant for E" end up in E or E', either of which is
- *	wrong.  To solve that problem, we walk down the whole chain,
- *	inserting the elements into the correct place.
- */
-static void fr_hash_table_fixup(fr_hash_table_t *ht, uint32_t entry)
-{
-	uint32_t parent_entry;
-	fr_hash_entry_t **last, *cur;
-	uint32_t this;
-
-	parent_entry = parent_of(entry);
-
-	/* parent_entry == entry if and only if entry == 0 */
-
-	if (!ht->buckets[parent_entry]) {
-		fr_hash_table_fixup(ht, parent_entry);
-	}
-
-	/*
-	 *	Keep walking down cur, trying to find entries that
-	 *	don't belong here any more.  There may be multiple
-	 *	ones, so we can't have a naive algorithm...
-	 */
-	last = &ht->buckets[parent_entry];
-	this = parent_entry;
-
-	for (cur = *last; cur != &ht->null; cur = cur->next) {
-		uint32_t real_entry;
-
-		real_entry = cur->key & ht->mask;
-		if (real_entry != this) { /* ht->buckets[real_entry] == NULL */
-			*last = &ht->null;
-			ht->buckets[real_entry] = cur;
-			this = real_entry;
-		}
-
-		last = &(cur->next);
-	}
-
-	/*
-	 *	We may NOT have initialized this bucket, so do it now.
-	 */
-	if (!ht->buckets[entry]) ht->buckets[entry] = &ht->null;
-}
-
-/*
- *	This should be a power of two.  Changing it to 4 doesn't seem
- *	to make any difference.
- */
-#define GROW_FACTOR (2)
-
-/*
- *	Grow the hash table.
- */
-static void fr_hash_table_grow(fr_hash_table_t *ht)
-{
-	fr_hash_entry_t **buckets;
-	size_t existing = talloc_get_size(ht->buckets);
-
-	buckets = talloc_realloc(ht, ht->buckets, fr_hash_entry_t *, GROW_FACTOR * ht->num_buckets);
-	if (!buckets) return;
-
-	memset(((uint8_t *)buckets) + existing, 0, talloc_get_size(buckets) - existing);
-
-	ht->buckets = buckets;
-	ht->num_buckets *= GROW_FACTOR;
-	ht->next_grow *= GROW_FACTOR;
-	ht->mask = ht->num_buckets - 1;
-#ifdef TESTING
-	grow = 1;
-	fprintf(stderr, "GROW TO %d\n", ht->num_buckets);
-#endif
-}
-
-
 /*
  *	Insert data.
  */
 int fr_hash_table_insert(fr_hash_table_t *ht, void const *data)
 {
-	uint32_t key;
-	uint32_t entry;
-	uint32_t reversed;
-	fr_hash_entry_t *node;
+	uint32_t	key, mixed, slot;
 
 	if (!ht || !data) return 0;
 
 	key = ht->hash(data);
-	entry = key & ht->mask;
-	reversed = reverse(key);
 
-	if (!ht->buckets[entry]) fr_hash_table_fixup(ht, entry);
+	/* already in the table, can't insert it */
+	if (hash_table_find_slot(ht, key, data) >= 0) return 0;
+
+	mixed = hash_mix(key);
+	slot = hash_table_free_slot(ht, mixed);
 
 	/*
-	 *	If we try to do our own memory allocation here, the
-	 *	speedup is only ~15% or so, which isn't worth it.
+	 *	Using up an empty slot.  Check the load factor,
+	 *	and grow the table if necessary.
+	 *
+	 *	While walking over the table, entries can't be
+	 *	moved.  So we keep filling the table, and only grow
+	 *	it if we're about to use the last empty slot.
 	 */
-	node = talloc_zero(ht, fr_hash_entry_t);
-	if (!node) return 0;
+	if ((ht->ctrl[slot] == CTRL_EMPTY) &&
+	    ((ht->num_elements + ht->num_deleted) >= ht->max_used) &&
+	    (!ht->walking || ((uint32_t) (ht->num_elements + ht->num_deleted) >= ht->mask))) {
+		if (hash_table_grow(ht) < 0) return 0;
 
-	node->next = &ht->null;
-	node->reversed = reversed;
-	node->key = key;
-	memcpy(&node->data, &data, sizeof(node->data));
-
-	/* already in the table, can't insert it */
-	if (!list_insert(ht, &ht->buckets[entry], node)) {
-		talloc_free(node);
-		return 0;
+		slot = hash_table_free_slot(ht, mixed);
 	}
 
-	/*
-	 *	Check the load factor, and grow the table if
-	 *	necessary.
-	 */
+	if (ht->ctrl[slot] == CTRL_DELETED) ht->num_deleted--;
+
+	ht->ctrl[slot] = H2(mixed);
+	memcpy(&ht->slots[slot], &data, sizeof(ht->slots[slot]));
 	ht->num_elements++;
-	if (ht->num_elements >= ht->next_grow) fr_hash_table_grow(ht);
 
 	return 1;
 }
 
-
-/*
- *	Internal find a node routine.
- */
-static inline CC_HINT(always_inline) fr_hash_entry_t *fr_hash_table_find(fr_hash_table_t *ht,
-									 uint32_t key, void const *data)
-{
-	uint32_t entry;
-	uint32_t reversed;
-
-	if (!ht) return NULL;
-
-	entry = key & ht->mask;
-	reversed = reverse(key);
-
-	if (!ht->buckets[entry]) fr_hash_table_fixup(ht, entry);
-
-	return list_find(ht, ht->buckets[entry], reversed, data);
-}
-
-
 /*
  *	Replace old data with new data, OR insert if there is no old.
  */
 int fr_hash_table_replace(fr_hash_table_t *ht, void const *data)
 {
-	fr_hash_entry_t *node;
+	int64_t slot;
 
 	if (!ht || !data) return 0;
 
-	node = fr_hash_table_find(ht, ht->hash(data), data);
-	if (!node) return fr_hash_table_insert(ht, data);
+	slot = hash_table_find_slot(ht, ht->hash(data), data);
+	if (slot < 0) return fr_hash_table_insert(ht, data);
 
-	if (ht->free) ht->free(node->data);
+	if (ht->free) ht->free(ht->slots[slot]);
 
-	memcpy(&node->data, &data, sizeof(node->data));
+	memcpy(&ht->slots[slot], &data, sizeof(ht->slots[slot]));
 
 	return 1;
 }
 
-
 /** Find data from a template
  *
  */
 void *fr_hash_table_find_by_data(fr_hash_table_t *ht, void const *data)
 {
-	fr_hash_entry_t *node;
-	void *out;
+	int64_t slot;
 
-	node = fr_hash_table_find(ht, ht->hash(data), data);
-	if (!node) return NULL;
+	if (!ht) return NULL;
 
-	memcpy(&out, &node->data, sizeof(out));
+	slot = hash_table_find_slot(ht, ht->hash(data), data);
+	if (slot < 0) return NULL;
 
-	return out;
+	return ht->slots[slot];
 }
 
 /** Hash table lookup with pre-computed key
@@ -509,15 +400,14 @@ void *fr_hash_table_find_by_data(fr_hash_table_t *ht, void const *data)
  */
 void *fr_hash_table_find_by_key(fr_hash_table_t *ht, uint32_t key, void const *data)
 {
-	fr_hash_entry_t *node;
-	void *out;
+	int64_t slot;
 
-	node = fr_hash_table_find(ht, key, data);
-	if (!node) return NULL;
+	if (!ht) return NULL;
 
-	memcpy(&out, &node->data, sizeof(out));
+	slot = hash_table_find_slot(ht, key, data);
+	if (slot < 0) return NULL;
 
-	return out;
+	return ht->slots[slot];
 }
 
 /*
@@ -525,32 +415,20 @@ void *fr_hash_table_find_by_key(fr_hash_table_t *ht, uint32_t key, void const *d
  */
 void *fr_hash_table_yank(fr_hash_table_t *ht, void const *data)
 {
-	uint32_t key;
-	uint32_t entry;
-	uint32_t reversed;
-	void *old;
-	fr_hash_entry_t *node;
+	int64_t	slot;
+	void	*old;
 
 	if (!ht) return NULL;
 
-	key = ht->hash(data);
-	entry = key & ht->mask;
-	reversed = reverse(key);
+	slot = hash_table_find_slot(ht, ht->hash(data), data);
+	if (slot < 0) return NULL;
 
-	if (!ht->buckets[entry]) fr_hash_table_fixup(ht, entry);
-
-	node = list_find(ht, ht->buckets[entry], reversed, data);
-	if (!node) return NULL;
-
-	list_delete(ht, &ht->buckets[entry], node);
-	ht->num_elements--;
+	old = ht->slots[slot];
+	hash_table_clear_slot(ht, slot);
 
-	old = node->data;
-	talloc_free(node);
 	return old;
 }
 
-
 /*
  *	Delete a piece of data from the hash table.
  */
@@ -576,36 +454,42 @@ int fr_hash_table_num_elements(fr_hash_table_t *ht)
 	return ht->num_elements;
 }
 
-
 /*
  *	Walk over the nodes, allowing deletes & inserts to happen.
+ *
+ *	Entries inserted during the walk may or may not be seen.
  */
 int fr_hash_table_walk(fr_hash_table_t *ht,
 		       fr_hash_table_walk_t callback,
 		       void *uctx)
 {
-	int i, ret;
+	int8_t	*ctrl;
+	int64_t	i;
+	int	ret = 0;
 
 	if (!ht || !callback) return 0;
 
-	for (i = ht->num_buckets - 1; i >= 0; i--) {
-		fr_hash_entry_t *node, *next;
+	ctrl = ht->ctrl;
 
-		/*
-		 *	Ensure that the current bucket is filled.
-		 */
-		if (!ht->buckets[i]) fr_hash_table_fixup(ht, i);
+	ht->walking++;
 
-		for (node = ht->buckets[i]; node != &ht->null; node = next) {
-			next = node->next;
+	for (i = ht->mask; i >= 0; i--) {
+		if (!CTRL_IS_FULL(ht->ctrl[i])) continue;
 
-			ret = callback(node->data, uctx);
+		ret = callback(ht->slots[i], uctx);
+		if (ret != 0) break;
 
-			if (ret != 0) return ret;
-		}
+		/*
+		 *	The callback filled the table, and it
+		 *	had to be grown.  Entries have moved, so
+		 *	we can't continue.
+		 */
+		if (ht->ctrl != ctrl) break;
 	}
 
-	return 0;
+	ht->walking--;
+
+	return ret;
 }
 
 /** Iterate over entries in a hash table
@@ -621,33 +505,12 @@ int fr_hash_table_walk(fr_hash_table_t *ht,
  */
 void *fr_hash_table_iter_next(fr_hash_table_t *ht, fr_hash_iter_t *iter)
 {
-	fr_hash_entry_t *node;
-
 	if (unlikely(!ht)) return NULL;
 
-	/*
-	 *	Return the next element in the bucket
-	 */
-	if (iter->node != &ht->null) {
-		node = iter->node;
-		iter->node = node->next;
-
-		return node->data;
-	}
-
-	/*
-	 *	We might have to go through multiple empty
-	 *	buckets to find one that contains something
-	 *	we should return
-	 */
-	while ((--iter->bucket) >= 0) {
-		if (!ht->buckets[iter->bucket]) fr_hash_table_fixup(ht, iter->bucket);
+	while (iter->slot > 0) {
+		iter->slot--;
 
-		node = ht->buckets[iter->bucket];
-		if (node == &ht->null) continue;	/* This bucket was empty too... */
-
-		iter->node = node->next;		/* Store the next one to examine */
-		return node->data;
+		if (CTRL_IS_FULL(ht->ctrl[iter->slot])) return ht->slots[iter->slot];
 	}
 
 	return NULL;
@@ -667,99 +530,22 @@ void *fr_hash_table_iter_init(fr_hash_table_t *ht, fr_hash_iter_t *iter)
 {
 	if (unlikely(!ht)) return NULL;
 
-	iter->bucket = ht->num_buckets;
-	iter->node = &ht->null;
+	iter->slot = ht->mask + 1;
 
 	return fr_hash_table_iter_next(ht, iter);
 }
 
 /** Ensure all buckets are filled
  *
- * This must be called if the table will be read by multiple threads without
- * synchronisation.  Synchronisation is still required for updates.
+ * Lookups never modify the table, so there's nothing to do.  This
+ * is kept so that callers which share a table between threads
+ * don't need to change.  Synchronisation is still required for updates.
  *
  * @param[in] ht	to fill.
  */
-void fr_hash_table_fill(fr_hash_table_t *ht)
-{
-	int i;
-
-	for (i = ht->num_buckets - 1; i >= 0; i--) if (!ht->buckets[i]) fr_hash_table_fixup(ht, i);
-}
-
-#ifdef TESTING
-/*
- *	Show what the hash table is doing.
- */
-int fr_hash_table_info(fr_hash_table_t *ht)
+void fr_hash_table_fill(UNUSED fr_hash_table_t *ht)
 {
-	int i, a, collisions, uninitialized;
-	int array[256];
-
-	if (!ht) return 0;
-
-	uninitialized = collisions = 0;
-	memset(array, 0, sizeof(array));
-
-	for (i = 0; i < ht->num_buckets; i++) {
-		uint32_t key;
-		int load;
-		fr_hash_entry_t *node, *next;
-
-		/*
-		 *	If we haven't inserted or looked up an entry
-		 *	in a bucket, it's uninitialized.
-		 */
-		if (!ht->buckets[i]) {
-			uninitialized++;
-			continue;
-		}
-
-		load = 0;
-		key = ~0;
-		for (node = ht->buckets[i]; node != &ht->null; node = next) {
-			if (node->reversed == key) {
-				collisions++;
-			} else {
-				key = node->reversed;
-			}
-			next = node->next;
-			load++;
-		}
-
-		if (load > 255) load = 255;
-		array[load]++;
-	}
-
-	printf("HASH TABLE %p\tbuckets: %d\t(%d uninitialized)\n", ht,
-		ht->num_buckets, uninitialized);
-	printf("\tnum entries %d\thash collisions %d\n",
-		ht->num_elements, collisions);
-
-	a = 0;
-	for (i = 1; i < 256; i++) {
-		if (!array[i]) continue;
-		printf("%d\t%d\n", i, array[i]);
-
-		/*
-		 *	Since the entries are ordered, the lookup cost
-		 *	for any one element in a chain is (on average)
-		 *	the cost of walking half of the chain.
-		 */
-		if (i > 1) {
-			a += array[i] * i;
-		}
-	}
-	a /= 2;
-	a += array[1];
-
-	printf("\texpected lookup cost = %d/%d or %f\n\n",
-	       ht->num_elements, a,
-	       (float) ht->num_elements / (float) a);
-
-	return 0;
 }
-#endif
 
 
 #define FNV_MAGIC_INIT (0x811c9dc5)
@@ -852,84 +638,3 @@ uint32_t fr_hash_case_string(char const *p)
 
 	return hash;
 }
-
-#ifdef TESTING
-/*
- *  cc -g -DTESTING -I ../include hash.c -o hash
- *
- *  ./hash
- */
-static uint32_t hash_int(void const *data)
-{
-	return fr_hash((int *) data, sizeof(int));
-}
-
-#define MAX 1024*1024
-int main(int argc, char **argv)
-{
-	int i, *p, *q, k;
-	fr_hash_table_t *ht;
-	int *array;
-
-	ht = fr_hash_table_create(NULL, hash_int, NULL, NULL);
-	if (!ht) {
-		fprintf(stderr, "Hash create failed\n");
-		fr_exit(1);
-	}
-
-	array = talloc_zero_array(NULL, int, MAX);
-	if (!array) fr_exit(1);
-
-	for (i = 0; i < MAX; i++) {
-		p = array + i;
-		*p = i;
-
-		if (!fr_hash_table_insert(ht, p)) {
-			fprintf(stderr, "Failed insert %08x\n", i);
-			fr_exit(1);
-		}
-#ifdef TEST_INSERT
-		q = fr_hash_table_find_by_data(ht, p);
-		if (q != p) {
-			fprintf(stderr, "Bad data %d\n", i);
-			fr_exit(1);
-		}
-#endif
-	}
-
-	fr_hash_table_info(ht);
-
-	/*
-	 *	Build this to see how lookups result in shortening
-	 *	of the hash chains.
-	 */
-	if (1) {
-		for (i = 0; i < MAX ; i++) {
-			q = fr_hash_table_find_by_data(ht, &i);
-			if (!q || *q != i) {
-				fprintf(stderr, "Failed finding %d\n", i);
-				fr_exit(1);
-			}
-
-#if 0
-			if (!fr_hash_table_delete(ht, &i)) {
-				fprintf(stderr, "Failed deleting %d\n", i);
-				fr_exit(1);
-			}
-			q = fr_hash_table_find_by_data(ht, &i);
-			if (q) {
-				fprintf(stderr, "Failed to delete %08x\n", i);
-				fr_exit(1);
-			}
-#endif
-		}
-
-		fr_hash_table_info(ht);
-	}
-
-	fr_hash_table_free(ht);
-	talloc_free(array);
-
-	return EXIT_SUCCESS;
-}
-#endif
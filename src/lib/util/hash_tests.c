@@ -0,0 +1,572 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests and benchmarks for hash tables
+ *
+ * The benchmark compares the hash table with the chained table it
+ * replaced, which is kept here for that purpose.  It's only run if
+ * FR_TEST_BENCHMARK is set.
+ *
+ * @file src/lib/util/hash_tests.c
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/misc.h>
+#include <freeradius-devel/util/time.h>
+
+#define HASH_TEST_SIZE	(4096)
+#define HASH_BENCH_SIZE	(1000000)
+
+static uint32_t hash_int(void const *data)
+{
+	return fr_hash(data, sizeof(int));
+}
+
+static int hash_int_cmp(void const *one, void const *two)
+{
+	int const *a = one, *b = two;
+
+	return (*a > *b) - (*a < *b);
+}
+
+static int *hash_ints_alloc(int num)
+{
+	int	*array;
+	int	i;
+
+	array = talloc_array(NULL, int, num);
+	for (i = 0; i < num; i++) array[i] = i;
+
+	return array;
+}
+
+static void hash_basic(void)
+{
+	fr_hash_table_t	*ht;
+	int		*array, key, i;
+
+	ht = fr_hash_table_create(NULL, hash_int, hash_int_cmp, NULL);
+	TEST_CHECK(ht != NULL);
+
+	array = hash_ints_alloc(HASH_TEST_SIZE);
+
+	TEST_CASE("Insertions, with the table growing");
+	for (i = 0; i < HASH_TEST_SIZE; i++) TEST_CHECK(fr_hash_table_insert(ht, &array[i]) == 1);
+	TEST_CHECK(fr_hash_table_num_elements(ht) == HASH_TEST_SIZE);
+
+	TEST_CASE("Duplicate insertions fail");
+	key = 10;
+	TEST_CHECK(fr_hash_table_insert(ht, &key) == 0);
+	TEST_CHECK(fr_hash_table_num_elements(ht) == HASH_TEST_SIZE);
+
+	TEST_CASE("Find by key returns the stored entry");
+	for (i = 0; i < HASH_TEST_SIZE; i++) {
+		key = i;
+		TEST_CHECK(fr_hash_table_find_by_data(ht, &key) == &array[i]);
+		TEST_CHECK(fr_hash_table_find_by_key(ht, hash_int(&key), &key) == &array[i]);
+	}
+
+	TEST_CASE("Missing keys aren't found");
+	key = HASH_TEST_SIZE;
+	TEST_CHECK(fr_hash_table_find_by_data(ht, &key) == NULL);
+	TEST_CHECK(fr_hash_table_delete(ht, &key) == 0);
+	TEST_CHECK(fr_hash_table_yank(ht, &key) == NULL);
+
+	TEST_CASE("Replace swaps the stored pointer");
+	key = 20;
+	TEST_CHECK(fr_hash_table_replace(ht, &key) == 1);
+	TEST_CHECK(fr_hash_table_find_by_data(ht, &array[20]) == &key);
+	TEST_CHECK(fr_hash_table_replace(ht, &array[20]) == 1);
+	TEST_CHECK(fr_hash_table_num_elements(ht) == HASH_TEST_SIZE);
+
+	TEST_CASE("Deleting every other entry leaves the rest findable");
+	for (i = 0; i < HASH_TEST_SIZE; i += 2) TEST_CHECK(fr_hash_table_yank(ht, &array[i]) == &array[i]);
+	TEST_CHECK(fr_hash_table_num_elements(ht) == (HASH_TEST_SIZE / 2));
+
+	for (i = 0; i < HASH_TEST_SIZE; i++) {
+		TEST_CHECK(fr_hash_table_find_by_data(ht, &array[i]) == ((i & 0x01) ? &array[i] : NULL));
+		TEST_MSG("entry %i", i);
+	}
+
+	TEST_CASE("Re-inserting deleted entries");
+	for (i = 0; i < HASH_TEST_SIZE; i += 2) TEST_CHECK(fr_hash_table_insert(ht, &array[i]) == 1);
+	for (i = 0; i < HASH_TEST_SIZE; i++) TEST_CHECK(fr_hash_table_find_by_data(ht, &array[i]) == &array[i]);
+
+	talloc_free(ht);
+	talloc_free(array);
+}
+
+/** Entries with colliding hashes are told apart by the comparison function
+ *
+ */
+static uint32_t hash_bad(UNUSED void const *data)
+{
+	return 42;
+}
+
+static void hash_collisions(void)
+{
+	fr_hash_table_t	*ht;
+	int		*array, i, j;
+
+	ht = fr_hash_table_create(NULL, hash_bad, hash_int_cmp, NULL);
+	TEST_CHECK(ht != NULL);
+
+	array = hash_ints_alloc(64);
+	for (i = 0; i < 64; i++) TEST_CHECK(fr_hash_table_insert(ht, &array[i]) == 1);
+
+	for (i = 0; i < 64; i++) {
+		TEST_CHECK(fr_hash_table_delete(ht, &array[i]) == 1);
+
+		for (j = i + 1; j < 64; j++) {
+			TEST_CHECK(fr_hash_table_find_by_data(ht, &array[j]) == &array[j]);
+			TEST_MSG("entry %i missing after deleting %i", j, i);
+		}
+	}
+
+	talloc_free(ht);
+	talloc_free(array);
+}
+
+/** Without a comparison function, equal hashes mean equal data
+ *
+ */
+static void hash_no_cmp(void)
+{
+	fr_hash_table_t	*ht;
+	int		a = 1, b = 1;
+
+	ht = fr_hash_table_create(NULL, hash_int, NULL, NULL);
+	TEST_CHECK(ht != NULL);
+
+	TEST_CHECK(fr_hash_table_insert(ht, &a) == 1);
+	TEST_CHECK(fr_hash_table_insert(ht, &b) == 0);
+	TEST_CHECK(fr_hash_table_find_by_data(ht, &b) == &a);
+
+	talloc_free(ht);
+}
+
+static int hash_walk_delete(void *data, void *uctx)
+{
+	fr_hash_table_t	*ht = uctx;
+	int		*p = data;
+
+	if ((*p & 0x01) != 0) TEST_CHECK(fr_hash_table_delete(ht, p) == 1);
+
+	return 0;
+}
+
+static int hash_walk_count(UNUSED void *data, void *uctx)
+{
+	int *count = uctx;
+
+	(*count)++;
+
+	return 0;
+}
+
+static void hash_free_int(void *data)
+{
+	*((int *) data) = -1;
+}
+
+static void hash_walk(void)
+{
+	fr_hash_table_t	*ht;
+	fr_hash_iter_t	iter;
+	int		*array, *p, i, count = 0;
+
+	ht = fr_hash_table_create(NULL, hash_int, hash_int_cmp, hash_free_int);
+	TEST_CHECK(ht != NULL);
+
+	array = hash_ints_alloc(HASH_TEST_SIZE);
+	for (i = 0; i < HASH_TEST_SIZE; i++) TEST_CHECK(fr_hash_table_insert(ht, &array[i]) == 1);
+
+	TEST_CASE("Deleting entries while walking over the table");
+	TEST_CHECK(fr_hash_table_walk(ht, hash_walk_delete, ht) == 0);
+	TEST_CHECK(fr_hash_table_num_elements(ht) == (HASH_TEST_SIZE / 2));
+	for (i = 0; i < HASH_TEST_SIZE; i++) {
+		TEST_CHECK(array[i] == ((i & 0x01) ? -1 : i));
+		TEST_MSG("entry %i", i);
+	}
+
+	TEST_CASE("Walking over what's left");
+	TEST_CHECK(fr_hash_table_walk(ht, hash_walk_count, &count) == 0);
+	TEST_CHECK(count == (HASH_TEST_SIZE / 2));
+
+	TEST_CASE("Iterating over what's left");
+	count = 0;
+	for (p = fr_hash_table_iter_init(ht, &iter);
+	     p;
+	     p = fr_hash_table_iter_next(ht, &iter)) {
+		TEST_CHECK((*p & 0x01) == 0);
+		count++;
+	}
+	TEST_CHECK(count == (HASH_TEST_SIZE / 2));
+
+	TEST_CASE("Freeing the table frees the entries");
+	talloc_free(ht);
+	for (i = 0; i < HASH_TEST_SIZE; i++) TEST_CHECK(array[i] == -1);
+
+	talloc_free(array);
+}
+
+/** Shuffle the entries, so that entries which are next to each other in memory aren't used one after the other
+ *
+ */
+static int **hash_ptrs_shuffle(int *array, int num)
+{
+	int	**ptrs;
+	int	i;
+
+	ptrs = talloc_array(NULL, int *, num);
+	for (i = 0; i < num; i++) ptrs[i] = &array[i];
+
+	for (i = num - 1; i > 0; i--) {
+		int	j = rand() % (i + 1);
+		int	*tmp = ptrs[i];
+
+		ptrs[i] = ptrs[j];
+		ptrs[j] = tmp;
+	}
+
+	return ptrs;
+}
+
+/*
+ *	The chained table which fr_hash_table_t replaced, so that the
+ *	benchmark can compare the two.  Entries are allocated
+ *	individually, and kept in split-ordered lists.
+ */
+typedef struct chained_entry_s chained_entry_t;
+
+struct chained_entry_s {
+	chained_entry_t		*next;
+	uint32_t		reversed;
+	uint32_t		key;
+	void const		*data;
+};
+
+typedef struct {
+	int			num_elements;
+	int			num_buckets;
+	int			next_grow;
+	uint32_t		mask;
+
+	fr_hash_table_hash_t	hash;
+	fr_hash_table_cmp_t	cmp;
+
+	chained_entry_t		null;
+
+	chained_entry_t		**buckets;
+} chained_table_t;
+
+static uint32_t chained_reverse(uint32_t key)
+{
+	uint32_t	reversed = 0;
+	int		i;
+
+	for (i = 0; i < 32; i++) {
+		reversed = (reversed << 1) | (key & 0x01);
+		key >>= 1;
+	}
+
+	return reversed;
+}
+
+/*
+ *	Take the parent by discarding the highest bit that is set.
+ */
+static uint32_t chained_parent_of(uint32_t key)
+{
+	if (!key) return 0;
+
+	return key & ~((uint32_t) 1 << (fr_high_bit_pos(key) - 1));
+}
+
+static chained_entry_t *chained_list_find(chained_table_t *ht, chained_entry_t *head,
+					  uint32_t reversed, void const *data)
+{
+	chained_entry_t *cur;
+
+	for (cur = head; cur != &ht->null; cur = cur->next) {
+		if (cur->reversed == reversed) {
+			int cmp = ht->cmp(data, cur->data);
+			if (cmp > 0) break;
+			if (cmp < 0) continue;
+			return cur;
+		}
+		if (cur->reversed > reversed) break;
+	}
+
+	return NULL;
+}
+
+static bool chained_list_insert(chained_table_t *ht, chained_entry_t **head, chained_entry_t *node)
+{
+	chained_entry_t **last, *cur;
+
+	last = head;
+
+	for (cur = *head; cur != &ht->null; cur = cur->next) {
+		if (cur->reversed > node->reversed) break;
+		last = &(cur->next);
+
+		if (cur->reversed == node->reversed) {
+			int cmp = ht->cmp(node->data, cur->data);
+			if (cmp > 0) break;
+			if (cmp < 0) continue;
+			return false;
+		}
+	}
+
+	node->next = *last;
+	*last = node;
+
+	return true;
+}
+
+static void chained_list_delete(chained_table_t *ht, chained_entry_t **head, chained_entry_t *node)
+{
+	chained_entry_t **last, *cur;
+
+	last = head;
+
+	for (cur = *head; cur != &ht->null; cur = cur->next) {
+		if (cur == node) break;
+		last = &(cur->next);
+	}
+
+	*last = node->next;
+}
+
+static chained_table_t *chained_create(TALLOC_CTX *ctx, fr_hash_table_hash_t hash, fr_hash_table_cmp_t cmp)
+{
+	chained_table_t *ht;
+
+	ht = talloc_zero(ctx, chained_table_t);
+	if (!ht) return NULL;
+
+	ht->hash = hash;
+	ht->cmp = cmp;
+	ht->num_buckets = 64;
+	ht->mask = ht->num_buckets - 1;
+	ht->next_grow = (ht->num_buckets << 1) + (ht->num_buckets >> 1);
+
+	ht->buckets = talloc_zero_array(ht, chained_entry_t *, ht->num_buckets);
+	if (!ht->buckets) {
+		talloc_free(ht);
+		return NULL;
+	}
+
+	ht->null.reversed = ~0;
+	ht->null.key = ~0;
+	ht->null.next = &ht->null;
+	ht->buckets[0] = &ht->null;
+
+	return ht;
+}
+
+/*
+ *	Initialise an empty bucket by splitting its parent.
+ */
+static void chained_fixup(chained_table_t *ht, uint32_t entry)
+{
+	uint32_t	parent_entry, this;
+	chained_entry_t	**last, *cur;
+
+	parent_entry = chained_parent_of(entry);
+	if (!ht->buckets[parent_entry]) chained_fixup(ht, parent_entry);
+
+	last = &ht->buckets[parent_entry];
+	this = parent_entry;
+
+	for (cur = *last; cur != &ht->null; cur = cur->next) {
+		uint32_t real_entry;
+
+		real_entry = cur->key & ht->mask;
+		if (real_entry != this) {
+			*last = &ht->null;
+			ht->buckets[real_entry] = cur;
+			this = real_entry;
+		}
+
+		last = &(cur->next);
+	}
+
+	if (!ht->buckets[entry]) ht->buckets[entry] = &ht->null;
+}
+
+static void chained_grow(chained_table_t *ht)
+{
+	chained_entry_t	**buckets;
+
+	buckets = talloc_realloc(ht, ht->buckets, chained_entry_t *, ht->num_buckets * 2);
+	if (!buckets) return;
+
+	memset(buckets + ht->num_buckets, 0, sizeof(*buckets) * ht->num_buckets);
+
+	ht->buckets = buckets;
+	ht->num_buckets *= 2;
+	ht->next_grow *= 2;
+	ht->mask = ht->num_buckets - 1;
+}
+
+static bool chained_insert(chained_table_t *ht, void const *data)
+{
+	uint32_t	key, entry;
+	chained_entry_t	*node;
+
+	key = ht->hash(data);
+	entry = key & ht->mask;
+
+	if (!ht->buckets[entry]) chained_fixup(ht, entry);
+
+	node = talloc_zero(ht, chained_entry_t);
+	if (!node) return false;
+
+	node->next = &ht->null;
+	node->reversed = chained_reverse(key);
+	node->key = key;
+	node->data = data;
+
+	if (!chained_list_insert(ht, &ht->buckets[entry], node)) {
+		talloc_free(node);
+		return false;
+	}
+
+	if (++ht->num_elements >= ht->next_grow) chained_grow(ht);
+
+	return true;
+}
+
+static chained_entry_t *chained_find(chained_table_t *ht, void const *data, uint32_t *entry)
+{
+	uint32_t	key;
+
+	key = ht->hash(data);
+	*entry = key & ht->mask;
+
+	if (!ht->buckets[*entry]) chained_fixup(ht, *entry);
+
+	return chained_list_find(ht, ht->buckets[*entry], chained_reverse(key), data);
+}
+
+static bool chained_delete(chained_table_t *ht, void const *data)
+{
+	uint32_t	entry;
+	chained_entry_t	*node;
+
+	node = chained_find(ht, data, &entry);
+	if (!node) return false;
+
+	chained_list_delete(ht, &ht->buckets[entry], node);
+	ht->num_elements--;
+	talloc_free(node);
+
+	return true;
+}
+
+static void hash_benchmark(void)
+{
+	fr_hash_table_t	*ht;
+	chained_table_t	*ct;
+	int		*array, **ptrs, i;
+	uint32_t	entry;
+	fr_time_t	start;
+	fr_time_delta_t	ht_insert, ht_find, ht_delete, ct_insert, ct_find, ct_delete;
+	size_t		ht_size, ht_blocks, ct_size, ct_blocks;
+
+	TEST_BENCHMARK();
+
+	array = hash_ints_alloc(HASH_BENCH_SIZE);
+	ptrs = hash_ptrs_shuffle(array, HASH_BENCH_SIZE);
+
+	ht = fr_hash_table_create(NULL, hash_int, hash_int_cmp, NULL);
+	TEST_CHECK(ht != NULL);
+
+	start = fr_time();
+	for (i = 0; i < HASH_BENCH_SIZE; i++) (void) fr_hash_table_insert(ht, ptrs[i]);
+	ht_insert = fr_time() - start;
+	TEST_CHECK(fr_hash_table_num_elements(ht) == HASH_BENCH_SIZE);
+
+	/*
+	 *	talloc_total_size() doesn't count the talloc
+	 *	headers, so we also print the number of
+	 *	allocations.
+	 */
+	ht_size = talloc_total_size(ht);
+	ht_blocks = talloc_total_blocks(ht);
+
+	start = fr_time();
+	for (i = HASH_BENCH_SIZE - 1; i >= 0; i--) (void) fr_hash_table_find_by_data(ht, ptrs[i]);
+	ht_find = fr_time() - start;
+
+	start = fr_time();
+	for (i = 0; i < HASH_BENCH_SIZE; i++) (void) fr_hash_table_delete(ht, ptrs[i]);
+	ht_delete = fr_time() - start;
+	TEST_CHECK(fr_hash_table_num_elements(ht) == 0);
+
+	ct = chained_create(NULL, hash_int, hash_int_cmp);
+	TEST_CHECK(ct != NULL);
+
+	start = fr_time();
+	for (i = 0; i < HASH_BENCH_SIZE; i++) (void) chained_insert(ct, ptrs[i]);
+	ct_insert = fr_time() - start;
+	TEST_CHECK(ct->num_elements == HASH_BENCH_SIZE);
+
+	ct_size = talloc_total_size(ct);
+	ct_blocks = talloc_total_blocks(ct);
+
+	start = fr_time();
+	for (i = HASH_BENCH_SIZE - 1; i >= 0; i--) (void) chained_find(ct, ptrs[i], &entry);
+	ct_find = fr_time() - start;
+
+	start = fr_time();
+	for (i = 0; i < HASH_BENCH_SIZE; i++) (void) chained_delete(ct, ptrs[i]);
+	ct_delete = fr_time() - start;
+	TEST_CHECK(ct->num_elements == 0);
+
+	printf("\n%d entries, ns per operation\n", HASH_BENCH_SIZE);
+	printf("          insert  find  delete  bytes/entry  allocs/entry\n");
+	printf("hash      %6" PRIu64 "  %4" PRIu64 "  %6" PRIu64 "  %11.1f  %12.2f\n",
+	       (uint64_t) ht_insert / HASH_BENCH_SIZE, (uint64_t) ht_find / HASH_BENCH_SIZE,
+	       (uint64_t) ht_delete / HASH_BENCH_SIZE,
+	       (double) ht_size / HASH_BENCH_SIZE, (double) ht_blocks / HASH_BENCH_SIZE);
+	printf("chained   %6" PRIu64 "  %4" PRIu64 "  %6" PRIu64 "  %11.1f  %12.2f\n",
+	       (uint64_t) ct_insert / HASH_BENCH_SIZE, (uint64_t) ct_find / HASH_BENCH_SIZE,
+	       (uint64_t) ct_delete / HASH_BENCH_SIZE,
+	       (double) ct_size / HASH_BENCH_SIZE, (double) ct_blocks / HASH_BENCH_SIZE);
+
+	talloc_free(ct);
+	talloc_free(ht);
+	talloc_free(ptrs);
+	talloc_free(array);
+}
+
+TEST_LIST = {
+	{ "hash_basic",		hash_basic },
+	{ "hash_collisions",	hash_collisions },
+	{ "hash_no_cmp",	hash_no_cmp },
+	{ "hash_walk",		hash_walk },
+
+	{ "hash_benchmark",	hash_benchmark },
+
+	{ NULL }
+};
@@ -0,0 +1,399 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Minimal wrapper around the Linux io_uring system calls
+ *
+ * This provides just enough of an io_uring implementation to post
+ * multishot receives into a ring of provided buffers, and to submit
+ * batches of writes, without depending on liburing.
+ *
+ * Rings are single threaded.  The submission and completion queues
+ * must only be used from the thread that owns the ring.
+ *
+ * @file src/lib/util/io_uring.c
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/io_uring.h>
+
+#ifdef WITH_IO_URING
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/strerror.h>
+#include <freeradius-devel/util/syserror.h>
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+struct fr_io_uring_s {
+	int			fd;		//!< Returned by io_uring_setup().
+	int			event_fd;	//!< Signalled when completions are posted.  -1 if unused.
+
+	void			*sq_ring;	//!< mmapped submission queue ring.
+	size_t			sq_ring_size;
+	struct io_uring_sqe	*sqes;		//!< mmapped submission queue entries.
+	size_t			sqes_size;
+	void			*cq_ring;	//!< mmapped completion queue ring.  May be the same as sq_ring.
+	size_t			cq_ring_size;
+
+	unsigned int		*sq_khead;	//!< Consumed by the kernel.
+	unsigned int		*sq_ktail;	//!< Produced by us.
+	unsigned int		sq_mask;
+	unsigned int		sq_entries;
+	unsigned int		*sq_array;	//!< Indexes into sqes.
+	unsigned int		*sq_kflags;	//!< Set by the kernel, e.g. when the completion queue overflows.
+	unsigned int		sqe_head;	//!< First SQE not yet passed to the kernel.
+	unsigned int		sqe_tail;	//!< Next SQE to hand out.
+
+	unsigned int		*cq_khead;	//!< Consumed by us.
+	unsigned int		*cq_ktail;	//!< Produced by the kernel.
+	unsigned int		cq_mask;
+	struct io_uring_cqe	*cqes;
+
+	struct io_uring_buf_ring *buf_ring;	//!< Provided buffers for receives.
+	size_t			buf_ring_size;
+	unsigned int		buf_mask;
+	size_t			buf_size;	//!< Size of each provided buffer.
+	uint8_t			*bufs;		//!< Memory backing the provided buffers.
+};
+
+static int _io_uring_free(fr_io_uring_t *ring)
+{
+	if (ring->buf_ring) munmap(ring->buf_ring, ring->buf_ring_size);
+	if (ring->sqes) munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring && (ring->cq_ring != ring->sq_ring)) munmap(ring->cq_ring, ring->cq_ring_size);
+	if (ring->sq_ring) munmap(ring->sq_ring, ring->sq_ring_size);
+	if (ring->event_fd >= 0) close(ring->event_fd);
+	if (ring->fd >= 0) close(ring->fd);
+
+	return 0;
+}
+
+/** Allocate a new io_uring
+ *
+ * Fails on kernels which don't support io_uring, or where it has been
+ * disabled.  Callers should fall back to normal system calls.
+ *
+ * @param[in] ctx		to allocate the ring in.
+ * @param[in] sq_entries	size of the submission queue.
+ * @param[in] cq_entries	size of the completion queue.  0 for the kernel default
+ *				(twice the submission queue).
+ * @return
+ *	- A new ring on success.
+ *	- NULL on failure.
+ */
+fr_io_uring_t *fr_io_uring_alloc(TALLOC_CTX *ctx, unsigned int sq_entries, unsigned int cq_entries)
+{
+	fr_io_uring_t		*ring;
+	struct io_uring_params	params;
+
+	ring = talloc_zero(ctx, fr_io_uring_t);
+	if (!ring) {
+		fr_strerror_const("Out of memory");
+		return NULL;
+	}
+	ring->event_fd = -1;
+
+	memset(&params, 0, sizeof(params));
+	if (cq_entries) {
+		params.flags |= IORING_SETUP_CQSIZE;
+		params.cq_entries = cq_entries;
+	}
+
+	ring->fd = syscall(__NR_io_uring_setup, sq_entries, &params);
+	if (ring->fd < 0) {
+		fr_strerror_printf("Failed creating io_uring: %s", fr_syserror(errno));
+		talloc_free(ring);
+		return NULL;
+	}
+	talloc_set_destructor(ring, _io_uring_free);
+
+	ring->sq_ring_size = params.sq_off.array + (params.sq_entries * sizeof(unsigned int));
+	ring->cq_ring_size = params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+
+	/*
+	 *	Newer kernels map both rings with a single mmap.
+	 */
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			     ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED) {
+		ring->sq_ring = NULL;
+	error:
+		fr_strerror_printf("Failed mapping io_uring: %s", fr_syserror(errno));
+		talloc_free(ring);
+		return NULL;
+	}
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ring = ring->sq_ring;
+	} else {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				     ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED) {
+			ring->cq_ring = NULL;
+			goto error;
+		}
+	}
+
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			  ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		goto error;
+	}
+
+	ring->sq_khead = (unsigned int *)((uint8_t *)ring->sq_ring + params.sq_off.head);
+	ring->sq_ktail = (unsigned int *)((uint8_t *)ring->sq_ring + params.sq_off.tail);
+	ring->sq_mask = *(unsigned int *)((uint8_t *)ring->sq_ring + params.sq_off.ring_mask);
+	ring->sq_entries = params.sq_entries;
+	ring->sq_array = (unsigned int *)((uint8_t *)ring->sq_ring + params.sq_off.array);
+	ring->sq_kflags = (unsigned int *)((uint8_t *)ring->sq_ring + params.sq_off.flags);
+
+	ring->cq_khead = (unsigned int *)((uint8_t *)ring->cq_ring + params.cq_off.head);
+	ring->cq_ktail = (unsigned int *)((uint8_t *)ring->cq_ring + params.cq_off.tail);
+	ring->cq_mask = *(unsigned int *)((uint8_t *)ring->cq_ring + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)((uint8_t *)ring->cq_ring + params.cq_off.cqes);
+
+	return ring;
+}
+
+/** Return an eventfd which becomes readable when completions are posted
+ *
+ * The eventfd is owned by the ring, and is closed when the ring is freed.
+ *
+ * @param[in] ring	to get the eventfd for.
+ * @return
+ *	- >= 0 the eventfd.
+ *	- -1 on failure.
+ */
+int fr_io_uring_eventfd(fr_io_uring_t *ring)
+{
+	if (ring->event_fd >= 0) return ring->event_fd;
+
+	ring->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (ring->event_fd < 0) {
+		fr_strerror_printf("Failed creating eventfd: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_EVENTFD, &ring->event_fd, 1) < 0) {
+		fr_strerror_printf("Failed registering eventfd with io_uring: %s", fr_syserror(errno));
+		close(ring->event_fd);
+		ring->event_fd = -1;
+		return -1;
+	}
+
+	return ring->event_fd;
+}
+
+/** Register a ring of buffers for the kernel to receive data into
+ *
+ * SQEs using IOSQE_BUFFER_SELECT with the same bgid will pick a buffer
+ * from this ring.  Buffers must be given back with #fr_io_uring_buf_recycle
+ * once the data they contain has been consumed.
+ *
+ * @param[in] ring	to register the buffers with.
+ * @param[in] bgid	buffer group ID.
+ * @param[in] num	number of buffers.  Must be a power of 2.
+ * @param[in] size	of each buffer.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_io_uring_buf_ring_alloc(fr_io_uring_t *ring, uint16_t bgid, unsigned int num, size_t size)
+{
+	struct io_uring_buf_reg	reg;
+	unsigned int		i;
+
+	fr_assert(!ring->buf_ring);
+
+	if (!num || (num & (num - 1)) || (num > 32768)) {
+		fr_strerror_printf("Number of buffers (%u) must be a power of 2, and no more than 32768", num);
+		return -1;
+	}
+
+	ring->bufs = talloc_array(ring, uint8_t, num * size);
+	if (!ring->bufs) {
+		fr_strerror_const("Out of memory");
+		return -1;
+	}
+
+	/*
+	 *	The buffer ring must be page aligned.
+	 */
+	ring->buf_ring_size = num * sizeof(struct io_uring_buf);
+	ring->buf_ring = mmap(NULL, ring->buf_ring_size, PROT_READ | PROT_WRITE,
+			      MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+	if (ring->buf_ring == MAP_FAILED) {
+		ring->buf_ring = NULL;
+		fr_strerror_printf("Failed allocating buffer ring: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uintptr_t)ring->buf_ring;
+	reg.ring_entries = num;
+	reg.bgid = bgid;
+
+	if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		fr_strerror_printf("Failed registering buffer ring: %s", fr_syserror(errno));
+		munmap(ring->buf_ring, ring->buf_ring_size);
+		ring->buf_ring = NULL;
+		return -1;
+	}
+
+	ring->buf_mask = num - 1;
+	ring->buf_size = size;
+
+	for (i = 0; i < num; i++) {
+		struct io_uring_buf *buf = &ring->buf_ring->bufs[i];
+
+		buf->addr = (uintptr_t)(ring->bufs + (i * size));
+		buf->len = size;
+		buf->bid = i;
+	}
+	__atomic_store_n(&ring->buf_ring->tail, (uint16_t)num, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/** Return the memory for a provided buffer
+ *
+ * @param[in] ring	the buffer was registered with.
+ * @param[in] bid	buffer ID, from the CQE flags.
+ */
+uint8_t *fr_io_uring_buf(fr_io_uring_t *ring, uint16_t bid)
+{
+	fr_assert(bid <= ring->buf_mask);
+
+	return ring->bufs + (bid * ring->buf_size);
+}
+
+/** Give a provided buffer back to the kernel
+ *
+ * @param[in] ring	the buffer was registered with.
+ * @param[in] bid	buffer ID, from the CQE flags.
+ */
+void fr_io_uring_buf_recycle(fr_io_uring_t *ring, uint16_t bid)
+{
+	uint16_t		tail = ring->buf_ring->tail;
+	struct io_uring_buf	*buf = &ring->buf_ring->bufs[tail & ring->buf_mask];
+
+	buf->addr = (uintptr_t)fr_io_uring_buf(ring, bid);
+	buf->len = ring->buf_size;
+	buf->bid = bid;
+
+	__atomic_store_n(&ring->buf_ring->tail, (uint16_t)(tail + 1), __ATOMIC_RELEASE);
+}
+
+/** Get a zeroed SQE to fill in
+ *
+ * @param[in] ring	to get an SQE from.
+ * @return
+ *	- An SQE.
+ *	- NULL if the submission queue is full.
+ */
+struct io_uring_sqe *fr_io_uring_sqe_get(fr_io_uring_t *ring)
+{
+	unsigned int		head = __atomic_load_n(ring->sq_khead, __ATOMIC_ACQUIRE);
+	struct io_uring_sqe	*sqe;
+
+	if ((ring->sqe_tail - head) >= ring->sq_entries) return NULL;
+
+	sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+	ring->sqe_tail++;
+
+	memset(sqe, 0, sizeof(*sqe));
+
+	return sqe;
+}
+
+/** Pass any new SQEs to the kernel, and optionally wait for completions
+ *
+ * If the completion queue has overflowed, the kernel is also asked
+ * to move the overflowed completions back into the completion queue.
+ *
+ * @param[in] ring	to submit SQEs for.
+ * @param[in] wait_nr	Minimum number of completions to wait for.
+ * @return
+ *	- >= 0 the number of SQEs consumed by the kernel.
+ *	- -1 on error.
+ */
+int fr_io_uring_submit(fr_io_uring_t *ring, unsigned int wait_nr)
+{
+	unsigned int	tail = *ring->sq_ktail;
+	unsigned int	to_submit = ring->sqe_tail - ring->sqe_head;
+	unsigned int	flags = 0;
+	int		ret;
+
+	while (ring->sqe_head != ring->sqe_tail) {
+		ring->sq_array[tail & ring->sq_mask] = ring->sqe_head & ring->sq_mask;
+		tail++;
+		ring->sqe_head++;
+	}
+	__atomic_store_n(ring->sq_ktail, tail, __ATOMIC_RELEASE);
+
+	if (wait_nr || (__atomic_load_n(ring->sq_kflags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW)) {
+		flags |= IORING_ENTER_GETEVENTS;
+	}
+
+	if (!to_submit && !flags) return 0;
+
+	do {
+		ret = syscall(__NR_io_uring_enter, ring->fd, to_submit, wait_nr, flags, NULL, 0);
+	} while ((ret < 0) && (errno == EINTR));
+
+	if (ret < 0) {
+		fr_strerror_printf("Failed submitting to io_uring: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	return ret;
+}
+
+/** Return the next completion, without consuming it
+ *
+ * @param[in] ring	to check for completions.
+ * @return
+ *	- The next CQE.  Call #fr_io_uring_cqe_seen when done with it.
+ *	- NULL if there are no completions.
+ */
+struct io_uring_cqe *fr_io_uring_cqe_peek(fr_io_uring_t const *ring)
+{
+	unsigned int head = *ring->cq_khead;
+
+	if (head == __atomic_load_n(ring->cq_ktail, __ATOMIC_ACQUIRE)) return NULL;
+
+	return &ring->cqes[head & ring->cq_mask];
+}
+
+/** Mark the CQE returned by #fr_io_uring_cqe_peek as consumed
+ *
+ * @param[in] ring	the CQE came from.
+ */
+void fr_io_uring_cqe_seen(fr_io_uring_t *ring)
+{
+	__atomic_store_n(ring->cq_khead, *ring->cq_khead + 1, __ATOMIC_RELEASE);
+}
+#endif
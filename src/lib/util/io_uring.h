@@ -0,0 +1,75 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Minimal wrapper around the Linux io_uring system calls
+ *
+ * @file src/lib/util/io_uring.h
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSIDH(io_uring_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/missing.h>
+
+#include <talloc.h>
+
+/*
+ *	We talk to the kernel directly, so all we need are the
+ *	system call numbers, and headers new enough to describe
+ *	multishot receives and provided buffer rings.
+ */
+#ifdef __linux__
+#  include <sys/syscall.h>
+#  ifdef __NR_io_uring_setup
+#    include <linux/io_uring.h>
+#    ifdef IORING_RECV_MULTISHOT
+#      define WITH_IO_URING (1)
+#    endif
+#  endif
+#endif
+
+#ifdef WITH_IO_URING
+typedef struct fr_io_uring_s fr_io_uring_t;
+
+fr_io_uring_t		*fr_io_uring_alloc(TALLOC_CTX *ctx, unsigned int sq_entries, unsigned int cq_entries);
+
+int			fr_io_uring_eventfd(fr_io_uring_t *ring);
+
+int			fr_io_uring_buf_ring_alloc(fr_io_uring_t *ring, uint16_t bgid,
+						   unsigned int num, size_t size);
+
+uint8_t			*fr_io_uring_buf(fr_io_uring_t *ring, uint16_t bid);
+
+void			fr_io_uring_buf_recycle(fr_io_uring_t *ring, uint16_t bid);
+
+struct io_uring_sqe	*fr_io_uring_sqe_get(fr_io_uring_t *ring);
+
+int			fr_io_uring_submit(fr_io_uring_t *ring, unsigned int wait_nr);
+
+struct io_uring_cqe	*fr_io_uring_cqe_peek(fr_io_uring_t const *ring);
+
+void			fr_io_uring_cqe_seen(fr_io_uring_t *ring);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -35,13 +35,16 @@ SOURCES		:= \
 		   hmac_sha1.c \
 		   hw.c \
 		   inet.c \
+		   io_uring.c \
 		   isaac.c \
 		   log.c \
+		   lpm.c \
 		   md4.c \
 		   md5.c \
 		   misc.c \
 		   missing.c \
 		   net.c \
+		   oa_hash.c \
 		   packet.c \
 		   pair.c \
 		   pair_legacy.c \
@@ -0,0 +1,422 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Immutable longest prefix match tables
+ *
+ * This is a "poptrie".  See "Poptrie: A Compressed Trie with Population
+ * Count for Fast and Scalable Software IP Routing Table Lookup", Asai &
+ * Ohara, SIGCOMM 2015.
+ *
+ * Each node of the trie covers 6 bits of the key, and so has 64
+ * children.  Children are either internal nodes, or leaves.  A leaf
+ * holds the result of the lookup.  Instead of storing pointers to
+ * the children, each node has two 64-bit bitmaps, and the index of
+ * its first child node and first leaf.  The children of a node are
+ * stored next to each other, so the position of a child is found by
+ * counting the bits set in the bitmap before it.
+ *
+ * Runs of leaves with the same result are stored once, so the trie
+ * is small, and a lookup is usually one cache miss per 6 bits of
+ * the longest matching prefix.
+ *
+ * The trie can't be modified once it's built.  Callers which need to
+ * change it build a new one, and swap it in.
+ *
+ * @file src/lib/util/lpm.c
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/lpm.h>
+#include <freeradius-devel/util/strerror.h>
+#include <freeradius-devel/util/talloc.h>
+
+#define LPM_STRIDE	(6)
+
+typedef struct {
+	uint64_t		vector;		//!< bit N is set if child N is an internal node.
+	uint64_t		leafvec;	//!< bit N is set if a run of leaves starts at child N.
+	uint32_t		base0;		//!< index of our first leaf.
+	uint32_t		base1;		//!< index of our first child node.
+} fr_lpm_node_t;
+
+struct fr_lpm_s {
+	fr_lpm_node_t		*nodes;		//!< nodes[0] is the root.
+	uint32_t		num_nodes;
+
+	void const		**leaves;	//!< results of lookups.  NULL for "no match".
+	uint32_t		num_leaves;
+
+	size_t			num_entries;	//!< number of prefixes in the trie.
+};
+
+/** Get 6 bits of the key, starting at depth
+ *
+ * Bits past the end of the key are zero.
+ */
+static inline CC_HINT(always_inline) unsigned int lpm_chunk(uint8_t const *key, size_t keybytes, size_t depth)
+{
+	size_t		byte = depth >> 3;
+	unsigned int	v = 0;
+
+	if (byte < keybytes) v = key[byte] << 8;
+	if ((byte + 1) < keybytes) v |= key[byte + 1];
+
+	return (v >> (10 - (depth & 0x07))) & 0x3f;
+}
+
+static int lpm_entry_cmp(void const *one, void const *two)
+{
+	fr_lpm_entry_t const *a = *(fr_lpm_entry_t const * const *) one;
+	fr_lpm_entry_t const *b = *(fr_lpm_entry_t const * const *) two;
+	int ret;
+
+	ret = memcmp(a->key, b->key, sizeof(a->key));
+	if (ret != 0) return ret;
+
+	ret = (a->keylen > b->keylen) - (a->keylen < b->keylen);
+	if (ret != 0) return ret;
+
+	/*
+	 *	Keep the original order of duplicates, so that the
+	 *	first one wins.
+	 */
+	return (a > b) - (a < b);
+}
+
+static int lpm_grow_nodes(fr_lpm_t *lpm, uint32_t num)
+{
+	size_t		len = talloc_array_length(lpm->nodes);
+	fr_lpm_node_t	*nodes;
+
+	if ((lpm->num_nodes + num) <= len) return 0;
+
+	while (len < (lpm->num_nodes + num)) len *= 2;
+
+	nodes = talloc_realloc(lpm, lpm->nodes, fr_lpm_node_t, len);
+	if (!nodes) return -1;
+
+	lpm->nodes = nodes;
+	return 0;
+}
+
+static int lpm_grow_leaves(fr_lpm_t *lpm, uint32_t num)
+{
+	size_t		len = talloc_array_length(lpm->leaves);
+	void const	**leaves;
+
+	if ((lpm->num_leaves + num) <= len) return 0;
+
+	while (len < (lpm->num_leaves + num)) len *= 2;
+
+	leaves = talloc_realloc(lpm, lpm->leaves, void const *, len);
+	if (!leaves) return -1;
+
+	lpm->leaves = leaves;
+	return 0;
+}
+
+/** Fill in a node, and then its children
+ *
+ * @param[in] lpm	being built.
+ * @param[in] idx	of the node to fill in.
+ * @param[in] depth	of the node, in bits.
+ * @param[in] dflt	the longest prefix which covers the whole node.
+ * @param[in] entries	sorted prefixes which are in this node, and longer than depth.
+ * @param[in] num	number of entries.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int lpm_node_build(fr_lpm_t *lpm, uint32_t idx, size_t depth, void const *dflt,
+			  fr_lpm_entry_t const **entries, size_t num)
+{
+	void const	*value[1 << LPM_STRIDE];
+	size_t		start[1 << LPM_STRIDE];
+	size_t		count[1 << LPM_STRIDE] = { 0 };
+	uint64_t	vector = 0, leafvec = 0;
+	void const	*last = NULL;
+	uint32_t	base0, base1, num_leaves = 0;
+	size_t		i, len;
+	unsigned int	c, child;
+
+	for (c = 0; c < (1 << LPM_STRIDE); c++) value[c] = dflt;
+
+	/*
+	 *	Prefixes which end in this node cover a range of
+	 *	children.  Apply them shortest first, so that longer
+	 *	prefixes win.
+	 */
+	for (len = depth + 1; len <= depth + LPM_STRIDE; len++) {
+		for (i = 0; i < num; i++) {
+			unsigned int shift;
+
+			if (entries[i]->keylen != len) continue;
+
+			shift = depth + LPM_STRIDE - len;
+			c = (lpm_chunk(entries[i]->key, FR_LPM_MAX_KEY_BYTES, depth) >> shift) << shift;
+
+			for (child = c; child < c + (1U << shift); child++) value[child] = entries[i]->data;
+		}
+	}
+
+	/*
+	 *	Longer prefixes go into child nodes.  The entries are
+	 *	sorted, so the ones for each child are together.
+	 */
+	for (i = 0; i < num; i++) {
+		if (entries[i]->keylen <= (depth + LPM_STRIDE)) continue;
+
+		c = lpm_chunk(entries[i]->key, FR_LPM_MAX_KEY_BYTES, depth);
+		if (!count[c]) start[c] = i;
+		count[c]++;
+	}
+
+	for (c = 0; c < (1 << LPM_STRIDE); c++) {
+		if (count[c]) {
+			vector |= ((uint64_t) 1) << c;
+			continue;
+		}
+
+		if (!num_leaves || (value[c] != last)) {
+			leafvec |= ((uint64_t) 1) << c;
+			last = value[c];
+			num_leaves++;
+		}
+	}
+
+	if ((lpm_grow_leaves(lpm, num_leaves) < 0) ||
+	    (lpm_grow_nodes(lpm, __builtin_popcountll(vector)) < 0)) {
+		fr_strerror_const("Out of memory");
+		return -1;
+	}
+
+	base0 = lpm->num_leaves;
+	for (c = 0; c < (1 << LPM_STRIDE); c++) {
+		if (leafvec & (((uint64_t) 1) << c)) lpm->leaves[lpm->num_leaves++] = value[c];
+	}
+
+	base1 = lpm->num_nodes;
+	lpm->num_nodes += __builtin_popcountll(vector);
+
+	lpm->nodes[idx] = (fr_lpm_node_t) {
+		.vector = vector,
+		.leafvec = leafvec,
+		.base0 = base0,
+		.base1 = base1
+	};
+
+	for (c = 0, child = base1; c < (1 << LPM_STRIDE); c++) {
+		if (!count[c]) continue;
+
+		if (lpm_node_build(lpm, child++, depth + LPM_STRIDE, value[c], entries + start[c], count[c]) < 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/** Build a longest prefix match table
+ *
+ * @param[in] ctx	to allocate the table in.
+ * @param[in] entries	prefixes to put into the table.  If the same
+ *			prefix is given more than once, the first
+ *			one wins.
+ * @param[in] num	number of entries.
+ * @return
+ *	- A new table.
+ *	- NULL on error.
+ */
+fr_lpm_t *fr_lpm_alloc(TALLOC_CTX *ctx, fr_lpm_entry_t const *entries, size_t num)
+{
+	fr_lpm_t		*lpm;
+	fr_lpm_entry_t		*masked = NULL;
+	fr_lpm_entry_t const	**sorted = NULL;
+	size_t			i, j;
+
+	lpm = talloc_zero(ctx, fr_lpm_t);
+	if (!lpm) {
+	oom:
+		fr_strerror_const("Out of memory");
+	error:
+		talloc_free(masked);
+		talloc_free(sorted);
+		talloc_free(lpm);
+		return NULL;
+	}
+
+	lpm->nodes = talloc_array(lpm, fr_lpm_node_t, 16);
+	lpm->leaves = talloc_array(lpm, void const *, 64);
+	if (!lpm->nodes || !lpm->leaves) goto oom;
+
+	/*
+	 *	Zero the bits after the end of each prefix, so that
+	 *	sorting puts prefixes in the same subtree together.
+	 */
+	if (num) {
+		masked = talloc_array(NULL, fr_lpm_entry_t, num);
+		sorted = talloc_array(NULL, fr_lpm_entry_t const *, num);
+		if (!masked || !sorted) goto oom;
+	}
+
+	for (i = 0; i < num; i++) {
+		if (entries[i].keylen > (FR_LPM_MAX_KEY_BYTES * 8)) {
+			fr_strerror_printf("Prefix length %zu is too long", entries[i].keylen);
+			goto error;
+		}
+
+		masked[i] = entries[i];
+		if (entries[i].keylen & 0x07) {
+			masked[i].key[entries[i].keylen >> 3] &= (uint8_t) (0xff << (8 - (entries[i].keylen & 0x07)));
+		}
+		for (j = (entries[i].keylen + 7) >> 3; j < FR_LPM_MAX_KEY_BYTES; j++) masked[i].key[j] = 0;
+
+		sorted[i] = &masked[i];
+	}
+
+	if (num) qsort(sorted, num, sizeof(sorted[0]), lpm_entry_cmp);
+
+	/*
+	 *	Remove duplicates.
+	 */
+	for (i = 0, j = 0; i < num; i++) {
+		if (j &&
+		    (sorted[i]->keylen == sorted[j - 1]->keylen) &&
+		    (memcmp(sorted[i]->key, sorted[j - 1]->key, sizeof(sorted[i]->key)) == 0)) continue;
+
+		sorted[j++] = sorted[i];
+	}
+	num = j;
+	lpm->num_entries = num;
+
+	/*
+	 *	A zero length prefix matches everything, and is the
+	 *	default for the root.  After sorting, it can only be
+	 *	the first entry.
+	 */
+	lpm->num_nodes = 1;
+	if (num && (sorted[0]->keylen == 0)) {
+		if (lpm_node_build(lpm, 0, 0, sorted[0]->data, sorted + 1, num - 1) < 0) goto error;
+	} else {
+		if (lpm_node_build(lpm, 0, 0, NULL, sorted, num) < 0) goto error;
+	}
+
+	talloc_free(masked);
+	talloc_free(sorted);
+
+	return lpm;
+}
+
+typedef struct {
+	fr_lpm_entry_t		*entries;
+	size_t			num;
+} lpm_trie_walk_t;
+
+static int _lpm_trie_walk(void *ctx, uint8_t const *key, size_t keylen, void *data)
+{
+	lpm_trie_walk_t		*walk = ctx;
+	fr_lpm_entry_t		*entry;
+
+	if (keylen > (FR_LPM_MAX_KEY_BYTES * 8)) {
+		fr_strerror_printf("Prefix length %zu is too long", keylen);
+		return -1;
+	}
+
+	if (walk->num >= talloc_array_length(walk->entries)) {
+		fr_lpm_entry_t *entries;
+
+		entries = talloc_realloc(NULL, walk->entries, fr_lpm_entry_t, (walk->num + 1) * 2);
+		if (!entries) {
+			fr_strerror_const("Out of memory");
+			return -1;
+		}
+		walk->entries = entries;
+	}
+
+	entry = &walk->entries[walk->num++];
+	memset(entry, 0, sizeof(*entry));
+	memcpy(entry->key, key, (keylen + 7) >> 3);
+	entry->keylen = keylen;
+	entry->data = data;
+
+	return 0;
+}
+
+/** Build a longest prefix match table from a trie
+ *
+ * @param[in] ctx	to allocate the table in.
+ * @param[in] trie	to copy the prefixes from.  The table doesn't
+ *			change if the trie does.
+ * @return
+ *	- A new table.
+ *	- NULL on error.
+ */
+fr_lpm_t *fr_lpm_alloc_from_trie(TALLOC_CTX *ctx, fr_trie_t const *trie)
+{
+	lpm_trie_walk_t	walk = { .entries = NULL, .num = 0 };
+	fr_lpm_t	*lpm;
+
+	if (fr_trie_walk(UNCONST(fr_trie_t *, trie), &walk, _lpm_trie_walk) < 0) {
+		talloc_free(walk.entries);
+		return NULL;
+	}
+
+	lpm = fr_lpm_alloc(ctx, walk.entries, walk.num);
+	talloc_free(walk.entries);
+
+	return lpm;
+}
+
+/** Find the data for the longest prefix which matches the key
+ *
+ * @param[in] lpm	to search.
+ * @param[in] key	to look up.
+ * @param[in] keylen	in bits.  This should be the full length of
+ *			the address, e.g. 32 for IPv4.  Any prefixes in
+ *			the table which are longer than the key are
+ *			matched as if the key had trailing zero bits.
+ * @return
+ *	- The data for the longest matching prefix.
+ *	- NULL if no prefix matches.
+ */
+void *fr_lpm_lookup(fr_lpm_t const *lpm, void const *key, size_t keylen)
+{
+	fr_lpm_node_t const	*node = lpm->nodes;
+	size_t			keybytes = (keylen + 7) >> 3;
+	size_t			depth = 0;
+
+	for (;;) {
+		unsigned int	c = lpm_chunk(key, keybytes, depth);
+		uint64_t	mask = (((uint64_t) 2) << c) - 1;	/* bits 0..c */
+
+		if (!(node->vector & (((uint64_t) 1) << c))) {
+			return UNCONST(void *, lpm->leaves[node->base0 + __builtin_popcountll(node->leafvec & mask) - 1]);
+		}
+
+		node = &lpm->nodes[node->base1 + __builtin_popcountll(node->vector & mask) - 1];
+		depth += LPM_STRIDE;
+	}
+}
+
+/** The number of prefixes in the table
+ *
+ */
+size_t fr_lpm_num_entries(fr_lpm_t const *lpm)
+{
+	return lpm->num_entries;
+}
@@ -0,0 +1,60 @@
+#pragma once
+/*
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Immutable longest prefix match tables
+ *
+ * @file src/lib/util/lpm.h
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSIDH(lpm_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/build.h>
+#include <freeradius-devel/missing.h>
+#include <freeradius-devel/util/trie.h>
+
+#include <stdint.h>
+#include <talloc.h>
+
+#define FR_LPM_MAX_KEY_BYTES	(16)
+
+/** A prefix to add to a longest prefix match table
+ *
+ */
+typedef struct {
+	uint8_t		key[FR_LPM_MAX_KEY_BYTES];	//!< bits after keylen are ignored.
+	size_t		keylen;				//!< in bits.
+	void const	*data;				//!< returned by lookups which match the prefix.
+} fr_lpm_entry_t;
+
+typedef struct fr_lpm_s fr_lpm_t;
+
+fr_lpm_t	*fr_lpm_alloc(TALLOC_CTX *ctx, fr_lpm_entry_t const *entries, size_t num);
+
+fr_lpm_t	*fr_lpm_alloc_from_trie(TALLOC_CTX *ctx, fr_trie_t const *trie) CC_HINT(nonnull(2));
+
+void		*fr_lpm_lookup(fr_lpm_t const *lpm, void const *key, size_t keylen) CC_HINT(nonnull);
+
+size_t		fr_lpm_num_entries(fr_lpm_t const *lpm) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
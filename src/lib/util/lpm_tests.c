@@ -0,0 +1,215 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests and benchmarks for longest prefix match tables
+ *
+ * The benchmark compares lookups against the trie.  It's only run if
+ * FR_TEST_BENCHMARK is set.
+ *
+ * @file src/lib/util/lpm_tests.c
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/lpm.h>
+#include <freeradius-devel/util/time.h>
+
+#define LPM_TEST_PREFIXES	(2000)
+#define LPM_TEST_LOOKUPS	(100000)
+#define LPM_BENCH_PREFIXES	(50000)
+#define LPM_BENCH_LOOKUPS	(1000000)
+
+static void lpm_key_random(uint8_t *key, size_t keybytes)
+{
+	size_t i;
+
+	for (i = 0; i < keybytes; i++) key[i] = rand();
+}
+
+static void lpm_basic(void)
+{
+	fr_lpm_t	*lpm;
+	fr_lpm_entry_t	entries[] = {
+		{ .key = { 10 },		.keylen = 8,	.data = "10/8" },
+		{ .key = { 10, 1 },		.keylen = 16,	.data = "10.1/16" },
+		{ .key = { 10, 1, 2, 3 },	.keylen = 32,	.data = "10.1.2.3/32" },
+		{ .key = { 192, 168, 0, 255 },	.keylen = 23,	.data = "192.168.0/23" },
+		{ .key = { 10, 1 },		.keylen = 16,	.data = "duplicate" },
+	};
+	uint8_t		key[4];
+
+	TEST_CASE("Empty tables match nothing");
+	lpm = fr_lpm_alloc(NULL, NULL, 0);
+	TEST_CHECK(lpm != NULL);
+	TEST_CHECK(fr_lpm_lookup(lpm, (uint8_t[]){ 10, 1, 2, 3 }, 32) == NULL);
+	talloc_free(lpm);
+
+	lpm = fr_lpm_alloc(NULL, entries, NUM_ELEMENTS(entries));
+	TEST_CHECK(lpm != NULL);
+
+	TEST_CASE("Duplicate prefixes are only added once");
+	TEST_CHECK(fr_lpm_num_entries(lpm) == 4);
+
+	TEST_CASE("The longest prefix wins");
+	memcpy(key, (uint8_t[]){ 10, 1, 2, 3 }, 4);
+	TEST_CHECK(strcmp(fr_lpm_lookup(lpm, key, 32), "10.1.2.3/32") == 0);
+
+	memcpy(key, (uint8_t[]){ 10, 1, 2, 4 }, 4);
+	TEST_CHECK(strcmp(fr_lpm_lookup(lpm, key, 32), "10.1/16") == 0);
+
+	memcpy(key, (uint8_t[]){ 10, 2, 2, 3 }, 4);
+	TEST_CHECK(strcmp(fr_lpm_lookup(lpm, key, 32), "10/8") == 0);
+
+	TEST_CASE("Bits after the prefix length are ignored");
+	memcpy(key, (uint8_t[]){ 192, 168, 1, 1 }, 4);
+	TEST_CHECK(strcmp(fr_lpm_lookup(lpm, key, 32), "192.168.0/23") == 0);
+
+	memcpy(key, (uint8_t[]){ 192, 168, 2, 1 }, 4);
+	TEST_CHECK(fr_lpm_lookup(lpm, key, 32) == NULL);
+
+	talloc_free(lpm);
+
+	TEST_CASE("Zero length prefixes match everything");
+	entries[0].keylen = 0;
+	lpm = fr_lpm_alloc(NULL, entries, NUM_ELEMENTS(entries));
+	TEST_CHECK(lpm != NULL);
+	TEST_CHECK(strcmp(fr_lpm_lookup(lpm, key, 32), "10/8") == 0);
+	talloc_free(lpm);
+}
+
+/** Compare lookups against the trie, which is known to work
+ *
+ */
+static void lpm_trie_compare(size_t keybytes, size_t minlen)
+{
+	fr_trie_t	*trie;
+	fr_lpm_t	*lpm;
+	uint8_t		key[FR_LPM_MAX_KEY_BYTES];
+	int		*values;
+	int		i, errors = 0;
+
+	trie = fr_trie_alloc(NULL);
+	TEST_CHECK(trie != NULL);
+
+	values = talloc_array(NULL, int, LPM_TEST_PREFIXES);
+
+	/*
+	 *	Use a few fixed leading bytes, so that there are lots
+	 *	of nested prefixes.
+	 */
+	for (i = 0; i < LPM_TEST_PREFIXES; i++) {
+		size_t keylen = minlen + (rand() % ((keybytes * 8) - minlen + 1));
+
+		lpm_key_random(key, keybytes);
+		key[0] = rand() & 0x03;
+		values[i] = i;
+
+		(void) fr_trie_insert(trie, key, keylen, &values[i]);
+	}
+
+	lpm = fr_lpm_alloc_from_trie(NULL, trie);
+	TEST_CHECK(lpm != NULL);
+
+	for (i = 0; i < LPM_TEST_LOOKUPS; i++) {
+		lpm_key_random(key, keybytes);
+		key[0] = rand() & 0x03;
+
+		if (fr_lpm_lookup(lpm, key, keybytes * 8) != fr_trie_lookup(trie, key, keybytes * 8)) errors++;
+	}
+	TEST_CHECK(errors == 0);
+	TEST_MSG("%d lookups differ from the trie", errors);
+
+	talloc_free(lpm);
+	talloc_free(trie);
+	talloc_free(values);
+}
+
+static void lpm_ipv4(void)
+{
+	lpm_trie_compare(4, 8);
+}
+
+static void lpm_ipv6(void)
+{
+	lpm_trie_compare(16, 16);
+}
+
+static void lpm_benchmark(void)
+{
+	fr_trie_t	*trie;
+	fr_lpm_t	*lpm;
+	uint8_t		*keys;
+	int		*values;
+	int		i, found = 0;
+	fr_time_t	start;
+	fr_time_delta_t	trie_time, lpm_time, build;
+
+	TEST_BENCHMARK();
+
+	trie = fr_trie_alloc(NULL);
+	TEST_CHECK(trie != NULL);
+
+	values = talloc_array(NULL, int, LPM_BENCH_PREFIXES);
+
+	for (i = 0; i < LPM_BENCH_PREFIXES; i++) {
+		uint8_t key[4];
+
+		lpm_key_random(key, sizeof(key));
+		values[i] = i;
+
+		(void) fr_trie_insert(trie, key, 16 + (rand() % 17), &values[i]);
+	}
+
+	start = fr_time();
+	lpm = fr_lpm_alloc_from_trie(NULL, trie);
+	build = fr_time() - start;
+	TEST_CHECK(lpm != NULL);
+
+	keys = talloc_array(NULL, uint8_t, LPM_BENCH_LOOKUPS * 4);
+	lpm_key_random(keys, LPM_BENCH_LOOKUPS * 4);
+
+	start = fr_time();
+	for (i = 0; i < LPM_BENCH_LOOKUPS; i++) if (fr_trie_lookup(trie, keys + (i * 4), 32)) found++;
+	trie_time = fr_time() - start;
+
+	start = fr_time();
+	for (i = 0; i < LPM_BENCH_LOOKUPS; i++) if (fr_lpm_lookup(lpm, keys + (i * 4), 32)) found--;
+	lpm_time = fr_time() - start;
+
+	TEST_CHECK(found == 0);
+
+	printf("\n%zu prefixes, %d lookups, built in %" PRIu64 " ms\n",
+	       fr_lpm_num_entries(lpm), LPM_BENCH_LOOKUPS, (uint64_t) build / 1000000);
+	printf("trie %" PRIu64 " ns/lookup\n", (uint64_t) trie_time / LPM_BENCH_LOOKUPS);
+	printf("lpm  %" PRIu64 " ns/lookup, %zu bytes\n",
+	       (uint64_t) lpm_time / LPM_BENCH_LOOKUPS, talloc_total_size(lpm));
+
+	talloc_free(keys);
+	talloc_free(lpm);
+	talloc_free(trie);
+	talloc_free(values);
+}
+
+TEST_LIST = {
+	{ "lpm_basic",		lpm_basic },
+	{ "lpm_ipv4",		lpm_ipv4 },
+	{ "lpm_ipv6",		lpm_ipv6 },
+
+	{ "lpm_benchmark",	lpm_benchmark },
+
+	{ NULL }
+};
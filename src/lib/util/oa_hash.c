@@ -0,0 +1,245 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Open addressing hash tables
+ *
+ * The table is a single array of (hash, pointer) slots, searched by
+ * linear probing.  A lookup is usually one cache line, and the
+ * stored hash means that the comparison function is only called
+ * for entries which are very likely to match.
+ *
+ * Deleted entries don't leave tombstones.  Instead, the entries
+ * after them in the probe sequence are shifted back, so lookups
+ * don't slow down as entries come and go.
+ *
+ * The table doubles in size when it is 3/4 full.  It never shrinks.
+ *
+ * @file src/lib/util/oa_hash.c
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/util/oa_hash.h>
+#include <freeradius-devel/util/strerror.h>
+#include <freeradius-devel/util/talloc.h>
+
+#define OA_HASH_MIN_SIZE	(16)
+
+typedef struct {
+	uint32_t		hash;		//!< of the data, so we don't need to call the hash function again.
+	void			*data;		//!< NULL for empty slots.
+} fr_oa_hash_slot_t;
+
+struct fr_oa_hash_s {
+	uint32_t		num_elements;
+	uint32_t		mask;		//!< number of slots - 1.  The number of slots is a power of 2.
+
+	fr_hash_table_hash_t	hash;
+	fr_hash_table_cmp_t	cmp;
+
+	fr_oa_hash_slot_t	*slots;
+};
+
+/** Spread the bits of the caller's hash across the whole word
+ *
+ * We use the low bits to pick a slot, so weak hashes (e.g. of
+ * pointers) would otherwise cluster.
+ */
+static inline CC_HINT(always_inline) uint32_t oa_hash_mix(uint32_t hash)
+{
+	hash ^= hash >> 16;
+	hash *= 0x45d9f3b;
+	hash ^= hash >> 16;
+
+	return hash;
+}
+
+/** Find the slot holding data, or the empty slot where it would go
+ *
+ */
+static inline CC_HINT(always_inline) uint32_t oa_hash_slot(fr_oa_hash_t const *oa, uint32_t hash, void const *data)
+{
+	uint32_t i = hash & oa->mask;
+
+	while (oa->slots[i].data) {
+		if ((oa->slots[i].hash == hash) && (oa->cmp(oa->slots[i].data, data) == 0)) break;
+		i = (i + 1) & oa->mask;
+	}
+
+	return i;
+}
+
+static int oa_hash_grow(fr_oa_hash_t *oa)
+{
+	fr_oa_hash_slot_t	*old = oa->slots;
+	uint32_t		old_size = oa->mask + 1;
+	uint32_t		i, j;
+
+	oa->slots = talloc_zero_array(oa, fr_oa_hash_slot_t, old_size * 2);
+	if (!oa->slots) {
+		oa->slots = old;
+		fr_strerror_const("Out of memory");
+		return -1;
+	}
+	oa->mask = (old_size * 2) - 1;
+
+	for (i = 0; i < old_size; i++) {
+		if (!old[i].data) continue;
+
+		j = old[i].hash & oa->mask;
+		while (oa->slots[j].data) j = (j + 1) & oa->mask;
+		oa->slots[j] = old[i];
+	}
+
+	talloc_free(old);
+	return 0;
+}
+
+/** Allocate an open addressing hash table
+ *
+ * @param[in] ctx	to allocate the table in.
+ * @param[in] hash	function for the data.
+ * @param[in] cmp	function for the data.  Only has to
+ *			return 0 for "equal", and !0 otherwise.
+ * @param[in] size_hint	the number of entries we expect to hold.
+ *			The table is sized so that it doesn't have
+ *			to grow until it holds this many.  0 for
+ *			a small default.
+ * @return
+ *	- A new table.
+ *	- NULL on error.
+ */
+fr_oa_hash_t *fr_oa_hash_alloc(TALLOC_CTX *ctx, fr_hash_table_hash_t hash, fr_hash_table_cmp_t cmp,
+			       uint32_t size_hint)
+{
+	fr_oa_hash_t	*oa;
+	uint32_t	size = OA_HASH_MIN_SIZE;
+
+	while (((size / 4) * 3) < size_hint) {
+		if (size >= (1U << 31)) {
+			fr_strerror_printf("Hash table size %u is too large", size_hint);
+			return NULL;
+		}
+		size <<= 1;
+	}
+
+	oa = talloc_zero(ctx, fr_oa_hash_t);
+	if (!oa) return NULL;
+
+	oa->slots = talloc_zero_array(oa, fr_oa_hash_slot_t, size);
+	if (!oa->slots) {
+		talloc_free(oa);
+		return NULL;
+	}
+
+	oa->mask = size - 1;
+	oa->hash = hash;
+	oa->cmp = cmp;
+
+	return oa;
+}
+
+/** Insert data into the table
+ *
+ * @param[in] oa	to insert into.
+ * @param[in] data	to insert.
+ * @return
+ *	- 1 on success.
+ *	- 0 if matching data is already in the table, or
+ *	  we failed growing the table.
+ */
+int fr_oa_hash_insert(fr_oa_hash_t *oa, void const *data)
+{
+	uint32_t	hash, i;
+
+	if ((oa->num_elements + 1) > (((oa->mask + 1) / 4) * 3)) {
+		if (oa_hash_grow(oa) < 0) return 0;
+	}
+
+	hash = oa_hash_mix(oa->hash(data));
+	i = oa_hash_slot(oa, hash, data);
+	if (oa->slots[i].data) return 0;
+
+	oa->slots[i].hash = hash;
+	memcpy(&oa->slots[i].data, &data, sizeof(oa->slots[i].data));	/* const issues */
+	oa->num_elements++;
+
+	return 1;
+}
+
+/** Find data matching the given data
+ *
+ * @param[in] oa	to search.
+ * @param[in] data	containing the fields used by the hash
+ *			and cmp functions.
+ * @return
+ *	- The matching data.
+ *	- NULL if there isn't any.
+ */
+void *fr_oa_hash_find(fr_oa_hash_t const *oa, void const *data)
+{
+	return oa->slots[oa_hash_slot(oa, oa_hash_mix(oa->hash(data)), data)].data;
+}
+
+/** Delete the entry matching the given data
+ *
+ * @param[in] oa	to delete from.
+ * @param[in] data	containing the fields used by the hash
+ *			and cmp functions.
+ * @return
+ *	- 1 if an entry was deleted.
+ *	- 0 if there was no matching entry.
+ */
+int fr_oa_hash_delete(fr_oa_hash_t *oa, void const *data)
+{
+	uint32_t	i, j, home;
+
+	i = oa_hash_slot(oa, oa_hash_mix(oa->hash(data)), data);
+	if (!oa->slots[i].data) return 0;
+
+	oa->slots[i].data = NULL;
+	oa->num_elements--;
+
+	/*
+	 *	Shift back any following entries which can't be
+	 *	found any more, now that there's a hole in front of
+	 *	them.  An entry can stay where it is if its home
+	 *	slot is (cyclically) after the hole.
+	 */
+	j = i;
+	for (;;) {
+		j = (j + 1) & oa->mask;
+		if (!oa->slots[j].data) break;
+
+		home = oa->slots[j].hash & oa->mask;
+		if (((j - home) & oa->mask) < ((j - i) & oa->mask)) continue;
+
+		oa->slots[i] = oa->slots[j];
+		oa->slots[j].data = NULL;
+		i = j;
+	}
+
+	return 1;
+}
+
+/** The number of entries in the table
+ *
+ */
+uint32_t fr_oa_hash_num_elements(fr_oa_hash_t const *oa)
+{
+	return oa->num_elements;
+}
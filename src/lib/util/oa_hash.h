@@ -0,0 +1,47 @@
+#pragma once
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Open addressing hash tables
+ *
+ * @file src/lib/util/oa_hash.h
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+RCSIDH(oa_hash_h, "$Id$")
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <freeradius-devel/util/hash.h>
+
+typedef struct fr_oa_hash_s fr_oa_hash_t;
+
+fr_oa_hash_t	*fr_oa_hash_alloc(TALLOC_CTX *ctx, fr_hash_table_hash_t hash, fr_hash_table_cmp_t cmp,
+				  uint32_t size_hint) CC_HINT(nonnull(2,3));
+
+int		fr_oa_hash_insert(fr_oa_hash_t *oa, void const *data) CC_HINT(nonnull);
+
+void		*fr_oa_hash_find(fr_oa_hash_t const *oa, void const *data) CC_HINT(nonnull);
+
+int		fr_oa_hash_delete(fr_oa_hash_t *oa, void const *data) CC_HINT(nonnull);
+
+uint32_t	fr_oa_hash_num_elements(fr_oa_hash_t const *oa) CC_HINT(nonnull);
+
+#ifdef __cplusplus
+}
+#endif
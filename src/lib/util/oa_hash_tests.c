@@ -0,0 +1,264 @@
+/*
+ *   This library is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU Lesser General Public
+ *   License as published by the Free Software Foundation; either
+ *   version 2.1 of the License, or (at your option) any later version.
+ *
+ *   This library is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ *   Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Lesser General Public
+ *   License along with this library; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests and benchmarks for open addressing hash tables
+ *
+ * The benchmark compares the hash table with the rbtree, using keys
+ * which look like the ones used to track outstanding packets.  It's
+ * only run if FR_TEST_BENCHMARK is set.
+ *
+ * @file src/lib/util/oa_hash_tests.c
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/oa_hash.h>
+#include <freeradius-devel/util/rbtree.h>
+#include <freeradius-devel/util/time.h>
+
+#define OA_TEST_SIZE	(4096)
+#define OA_BENCH_SIZE	(1000000)
+
+/** Looks like a packet tracking entry
+ *
+ */
+typedef struct {
+	uint32_t	src_ip;
+	uint16_t	src_port;
+	uint16_t	dst_port;
+	uint8_t		code;
+	uint8_t		id;
+
+	fr_rb_node_t	node;
+} oa_thing_t;
+
+static uint32_t oa_thing_hash(void const *data)
+{
+	oa_thing_t const *a = data;
+	uint32_t hash;
+
+	hash = fr_hash(&a->src_ip, sizeof(a->src_ip));
+	hash = fr_hash_update(&a->src_port, sizeof(a->src_port), hash);
+	hash = fr_hash_update(&a->dst_port, sizeof(a->dst_port), hash);
+	hash = fr_hash_update(&a->code, sizeof(a->code), hash);
+	return fr_hash_update(&a->id, sizeof(a->id), hash);
+}
+
+static int oa_thing_cmp(void const *one, void const *two)
+{
+	oa_thing_t const *a = one, *b = two;
+	int ret;
+
+	ret = STABLE_COMPARE(a->src_ip, b->src_ip);
+	if (ret != 0) return ret;
+
+	ret = STABLE_COMPARE(a->src_port, b->src_port);
+	if (ret != 0) return ret;
+
+	ret = STABLE_COMPARE(a->dst_port, b->dst_port);
+	if (ret != 0) return ret;
+
+	ret = STABLE_COMPARE(a->id, b->id);
+	if (ret != 0) return ret;
+
+	return STABLE_COMPARE(a->code, b->code);
+}
+
+/** Unique keys: a few thousand NASes, each with 256 IDs outstanding
+ *
+ */
+static oa_thing_t *oa_things_alloc(int num)
+{
+	oa_thing_t	*array;
+	int		i;
+
+	array = calloc(num, sizeof(*array));
+	for (i = 0; i < num; i++) {
+		array[i].src_ip = 0x0a000000 + (i >> 8);
+		array[i].src_port = 1024 + ((i >> 8) & 0x0f);
+		array[i].dst_port = 1812;
+		array[i].code = 1;
+		array[i].id = i & 0xff;
+	}
+
+	/*
+	 *	Shuffle so that we don't insert in key order.
+	 */
+	for (i = num - 1; i > 0; i--) {
+		int		j = rand() % (i + 1);
+		oa_thing_t	tmp = array[i];
+
+		array[i] = array[j];
+		array[j] = tmp;
+	}
+
+	return array;
+}
+
+static void oa_hash_basic(void)
+{
+	fr_oa_hash_t	*oa;
+	oa_thing_t	*array, key;
+	int		i;
+
+	oa = fr_oa_hash_alloc(NULL, oa_thing_hash, oa_thing_cmp, 0);
+	TEST_CHECK(oa != NULL);
+
+	array = oa_things_alloc(OA_TEST_SIZE);
+
+	TEST_CASE("Insertions, with the table growing");
+	for (i = 0; i < OA_TEST_SIZE; i++) TEST_CHECK(fr_oa_hash_insert(oa, &array[i]) == 1);
+	TEST_CHECK(fr_oa_hash_num_elements(oa) == OA_TEST_SIZE);
+
+	TEST_CASE("Duplicate insertions fail");
+	key = array[10];
+	TEST_CHECK(fr_oa_hash_insert(oa, &key) == 0);
+	TEST_CHECK(fr_oa_hash_num_elements(oa) == OA_TEST_SIZE);
+
+	TEST_CASE("Find by key returns the stored entry");
+	for (i = 0; i < OA_TEST_SIZE; i++) {
+		key = array[i];
+		TEST_CHECK(fr_oa_hash_find(oa, &key) == &array[i]);
+	}
+
+	TEST_CASE("Missing keys aren't found");
+	key.src_ip = 0x0b000000;
+	TEST_CHECK(fr_oa_hash_find(oa, &key) == NULL);
+	TEST_CHECK(fr_oa_hash_delete(oa, &key) == 0);
+
+	TEST_CASE("Deleting every other entry leaves the rest findable");
+	for (i = 0; i < OA_TEST_SIZE; i += 2) TEST_CHECK(fr_oa_hash_delete(oa, &array[i]) == 1);
+	TEST_CHECK(fr_oa_hash_num_elements(oa) == (OA_TEST_SIZE / 2));
+
+	for (i = 0; i < OA_TEST_SIZE; i++) {
+		TEST_CHECK(fr_oa_hash_find(oa, &array[i]) == ((i & 0x01) ? &array[i] : NULL));
+		TEST_MSG("entry %i", i);
+	}
+
+	TEST_CASE("Re-inserting deleted entries");
+	for (i = 0; i < OA_TEST_SIZE; i += 2) TEST_CHECK(fr_oa_hash_insert(oa, &array[i]) == 1);
+	for (i = 0; i < OA_TEST_SIZE; i++) TEST_CHECK(fr_oa_hash_find(oa, &array[i]) == &array[i]);
+
+	TEST_CASE("Deleting everything");
+	for (i = 0; i < OA_TEST_SIZE; i++) TEST_CHECK(fr_oa_hash_delete(oa, &array[i]) == 1);
+	TEST_CHECK(fr_oa_hash_num_elements(oa) == 0);
+
+	talloc_free(oa);
+	free(array);
+}
+
+/** Entries with colliding hashes must still be found after deletions
+ *
+ */
+static uint32_t oa_bad_hash(UNUSED void const *data)
+{
+	return 42;
+}
+
+static void oa_hash_collisions(void)
+{
+	fr_oa_hash_t	*oa;
+	oa_thing_t	*array;
+	int		i, j;
+
+	oa = fr_oa_hash_alloc(NULL, oa_bad_hash, oa_thing_cmp, 64);
+	TEST_CHECK(oa != NULL);
+
+	array = oa_things_alloc(64);
+	for (i = 0; i < 64; i++) TEST_CHECK(fr_oa_hash_insert(oa, &array[i]) == 1);
+
+	for (i = 0; i < 64; i++) {
+		TEST_CHECK(fr_oa_hash_delete(oa, &array[i]) == 1);
+
+		for (j = i + 1; j < 64; j++) {
+			TEST_CHECK(fr_oa_hash_find(oa, &array[j]) == &array[j]);
+			TEST_MSG("entry %i missing after deleting %i", j, i);
+		}
+	}
+
+	talloc_free(oa);
+	free(array);
+}
+
+static void oa_hash_benchmark(void)
+{
+	fr_oa_hash_t	*oa;
+	rbtree_t	*tree;
+	oa_thing_t	*array;
+	int		i;
+	fr_time_t	start;
+	fr_time_delta_t	oa_insert, oa_find, oa_delete, rb_insert, rb_find, rb_delete;
+
+	TEST_BENCHMARK();
+
+	array = oa_things_alloc(OA_BENCH_SIZE);
+
+	oa = fr_oa_hash_alloc(NULL, oa_thing_hash, oa_thing_cmp, 0);
+	TEST_CHECK(oa != NULL);
+
+	start = fr_time();
+	for (i = 0; i < OA_BENCH_SIZE; i++) (void) fr_oa_hash_insert(oa, &array[i]);
+	oa_insert = fr_time() - start;
+	TEST_CHECK(fr_oa_hash_num_elements(oa) == OA_BENCH_SIZE);
+
+	start = fr_time();
+	for (i = OA_BENCH_SIZE - 1; i >= 0; i--) (void) fr_oa_hash_find(oa, &array[i]);
+	oa_find = fr_time() - start;
+
+	start = fr_time();
+	for (i = 0; i < OA_BENCH_SIZE; i++) (void) fr_oa_hash_delete(oa, &array[i]);
+	oa_delete = fr_time() - start;
+	TEST_CHECK(fr_oa_hash_num_elements(oa) == 0);
+
+	tree = rbtree_alloc(NULL, oa_thing_t, node, oa_thing_cmp, NULL, RBTREE_FLAG_NONE);
+	TEST_CHECK(tree != NULL);
+
+	start = fr_time();
+	for (i = 0; i < OA_BENCH_SIZE; i++) (void) rbtree_insert(tree, &array[i]);
+	rb_insert = fr_time() - start;
+	TEST_CHECK(rbtree_num_elements(tree) == OA_BENCH_SIZE);
+
+	start = fr_time();
+	for (i = OA_BENCH_SIZE - 1; i >= 0; i--) (void) rbtree_finddata(tree, &array[i]);
+	rb_find = fr_time() - start;
+
+	start = fr_time();
+	for (i = 0; i < OA_BENCH_SIZE; i++) (void) rbtree_deletebydata(tree, &array[i]);
+	rb_delete = fr_time() - start;
+
+	printf("\n%d entries, ns per operation\n", OA_BENCH_SIZE);
+	printf("          insert  find  delete\n");
+	printf("oa_hash   %6" PRIu64 "  %4" PRIu64 "  %6" PRIu64 "\n",
+	       (uint64_t) oa_insert / OA_BENCH_SIZE, (uint64_t) oa_find / OA_BENCH_SIZE,
+	       (uint64_t) oa_delete / OA_BENCH_SIZE);
+	printf("rbtree    %6" PRIu64 "  %4" PRIu64 "  %6" PRIu64 "\n",
+	       (uint64_t) rb_insert / OA_BENCH_SIZE, (uint64_t) rb_find / OA_BENCH_SIZE,
+	       (uint64_t) rb_delete / OA_BENCH_SIZE);
+
+	talloc_free(tree);
+	talloc_free(oa);
+	free(array);
+}
+
+TEST_LIST = {
+	{ "oa_hash_basic",		oa_hash_basic },
+	{ "oa_hash_collisions",		oa_hash_collisions },
+
+	{ "oa_hash_benchmark",		oa_hash_benchmark },
+
+	{ NULL }
+};
@@ -44,6 +44,296 @@ RCSID("$Id$")
 inline void fr_pair_list_init(fr_pair_list_t *list)
 {
 	fr_dlist_talloc_init(&list->head, fr_pair_t, entry);
+	list->index = NULL;
+}
+
+/*
+ *	Lists shorter than this are searched linearly, as that's
+ *	as fast as hashing.
+ */
+#define PAIR_INDEX_MIN_PAIRS	(16)
+
+typedef struct {
+	fr_dict_attr_t const	*da;		//!< NULL if the slot is free.
+	fr_pair_t		*first;		//!< First pair with this da, or NULL if there are none.
+	uint32_t		pos;		//!< of "first" in the list when it was indexed.
+} pair_index_slot_t;
+
+/** Map of #fr_dict_attr_t to the first pair in the list with that da
+ *
+ * The index is kept up to date by the functions in this file which
+ * add or remove pairs.  Anything else which changes the list (cursors,
+ * or the dlist functions) changes the list's generation, and the index
+ * is rebuilt the next time it's needed.
+ */
+struct fr_pair_list_index_s {
+	fr_pair_list_t const	*list;		//!< The index is for.
+	uint32_t		generation;	//!< of the list which the index matches.
+	uint32_t		stale;		//!< generation of the list when we last found the index
+						///< was out of date.
+	bool			valid;		//!< Whether the slots have been filled in.
+
+	uint32_t		num_slots;	//!< Always a power of 2.
+	uint32_t		num_used;
+	pair_index_slot_t	*slots;
+};
+
+static _Thread_local fr_pair_list_index_stats_t pair_index_stats;
+
+/** Add an index to a pair list
+ *
+ * The index is built the first time the list is searched, and only
+ * for long lists.  It's most useful for lists like the request and
+ * reply, which are searched many times.
+ *
+ * @param[in] ctx	to allocate the index in.  Must not be freed
+ *			before the list.
+ * @param[in] list	to index.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_pair_list_index_enable(TALLOC_CTX *ctx, fr_pair_list_t *list)
+{
+	fr_pair_list_index_t *index;
+
+	if (list->index) return 0;
+
+	index = talloc_zero(ctx, fr_pair_list_index_t);
+	if (unlikely(!index)) {
+		fr_strerror_const("Out of memory");
+		return -1;
+	}
+	index->list = list;
+	list->index = index;
+
+	return 0;
+}
+
+/** Get the index counters for this thread
+ *
+ * The counters are updated by this thread for as long as it runs.
+ *
+ * @return the counters.
+ */
+fr_pair_list_index_stats_t const *fr_pair_list_index_stats(void)
+{
+	return &pair_index_stats;
+}
+
+static inline CC_HINT(always_inline) pair_index_slot_t *pair_index_slot(fr_pair_list_index_t *index,
+									 fr_dict_attr_t const *da)
+{
+	uint32_t mask = index->num_slots - 1;
+	uint32_t i = (((uint64_t) (uintptr_t) da) * 0x9e3779b97f4a7c15ULL) >> 32;
+
+	for (i &= mask; ; i = (i + 1) & mask) {
+		if (!index->slots[i].da || (index->slots[i].da == da)) return &index->slots[i];
+	}
+}
+
+static int pair_index_grow(fr_pair_list_index_t *index, uint32_t num_slots)
+{
+	pair_index_slot_t	*old = index->slots;
+	uint32_t		i, old_num = index->num_slots;
+
+	index->slots = talloc_zero_array(index, pair_index_slot_t, num_slots);
+	if (unlikely(!index->slots)) {
+		index->slots = old;
+		return -1;
+	}
+	index->num_slots = num_slots;
+
+	for (i = 0; i < old_num; i++) {
+		if (old[i].da) *pair_index_slot(index, old[i].da) = old[i];
+	}
+	talloc_free(old);
+
+	return 0;
+}
+
+/** Record the first pair for a da
+ *
+ */
+static int pair_index_set(fr_pair_list_index_t *index, fr_dict_attr_t const *da, fr_pair_t *vp, uint32_t pos)
+{
+	pair_index_slot_t *slot;
+
+	slot = pair_index_slot(index, da);
+	if (!slot->da) {
+		/*
+		 *	Keep the table no more than 3/4 full, so
+		 *	that probe sequences stay short.
+		 */
+		if (((index->num_used + 1) * 4) > (index->num_slots * 3)) {
+			if (pair_index_grow(index, index->num_slots * 2) < 0) return -1;
+			slot = pair_index_slot(index, da);
+		}
+		slot->da = da;
+		index->num_used++;
+	}
+	slot->first = vp;
+	slot->pos = pos;
+
+	return 0;
+}
+
+/** Fill in the index from the list
+ *
+ */
+static int pair_index_build(fr_pair_list_index_t *index)
+{
+	fr_pair_list_t const	*list = index->list;
+	fr_pair_t		*vp;
+	uint32_t		num_slots = 16, pos = 0;
+
+	index->valid = false;
+
+	while (num_slots < (fr_dlist_num_elements(&list->head) * 2)) num_slots *= 2;
+
+	if (num_slots > index->num_slots) {
+		talloc_free(index->slots);
+		index->num_slots = 0;
+		index->slots = talloc_array(index, pair_index_slot_t, num_slots);
+		if (unlikely(!index->slots)) return -1;
+		index->num_slots = num_slots;
+	}
+	memset(index->slots, 0, sizeof(index->slots[0]) * index->num_slots);
+	index->num_used = 0;
+
+	for (vp = fr_dlist_head(&list->head); vp; vp = fr_dlist_next(&list->head, vp), pos++) {
+		pair_index_slot_t *slot = pair_index_slot(index, vp->da);
+
+		if (slot->da) continue;
+
+		if (pair_index_set(index, vp->da, vp, pos) < 0) return -1;
+	}
+
+	index->generation = list->head.generation;
+	index->valid = true;
+	pair_index_stats.rebuilds++;
+
+	return 0;
+}
+
+/** Return the index if it matches the list
+ *
+ * Call before modifying the list, and then call pair_index_sync() after.
+ */
+static inline CC_HINT(always_inline) fr_pair_list_index_t *pair_index_current(fr_pair_list_t const *list)
+{
+	fr_pair_list_index_t *index = list->index;
+
+	if (!index || !index->valid || (index->list != list) ||
+	    (index->generation != list->head.generation)) return NULL;
+
+	return index;
+}
+
+/** Mark the index as matching the list, after the caller has updated it
+ *
+ */
+static inline CC_HINT(always_inline) void pair_index_sync(fr_pair_list_index_t *index)
+{
+	index->generation = index->list->head.generation;
+}
+
+/** Find the first pair with a da using the index
+ *
+ * @param[out] out	The first pair, or NULL if there are none.
+ * @param[in] list	to search.
+ * @param[in] da	to search for.
+ * @return
+ *	- 0 if the index was used.
+ *	- -1 if the caller should search the list.
+ */
+static int pair_index_find(fr_pair_t **out, fr_pair_list_t const *list, fr_dict_attr_t const *da)
+{
+	fr_pair_list_index_t	*index = list->index;
+	pair_index_slot_t	*slot;
+
+	if (!index || (index->list != list) ||
+	    (fr_dlist_num_elements(&list->head) < PAIR_INDEX_MIN_PAIRS)) return -1;
+
+	if (!index->valid || (index->generation != list->head.generation)) {
+		/*
+		 *	Only rebuild the index if the list hasn't
+		 *	changed since the last search.  Otherwise
+		 *	something is adding pairs one at a time,
+		 *	and searching after each one, and it's
+		 *	cheaper to search the list.
+		 */
+		if (index->stale != list->head.generation) {
+			index->stale = list->head.generation;
+			return -1;
+		}
+
+		if (pair_index_build(index) < 0) return -1;
+	}
+
+	again:
+	slot = pair_index_slot(index, da);
+	if (!slot->da || !slot->first) {
+		pair_index_stats.lookups++;
+		pair_index_stats.pairs_saved += fr_dlist_num_elements(&list->head);
+		*out = NULL;
+		return 0;
+	}
+
+	/*
+	 *	Something changed the da of the pair.
+	 */
+	if (unlikely(slot->first->da != da)) {
+		if (pair_index_build(index) < 0) return -1;
+		goto again;
+	}
+
+	pair_index_stats.lookups++;
+	pair_index_stats.pairs_saved += slot->pos + 1;
+	*out = slot->first;
+
+	return 0;
+}
+
+/** Update the index after adding a pair to the start or end of the list
+ *
+ */
+static inline void pair_index_add(fr_pair_list_index_t *index, fr_pair_t *vp, bool prepend)
+{
+	pair_index_slot_t *slot;
+
+	if (prepend) {
+		if (pair_index_set(index, vp->da, vp, 0) < 0) goto error;
+	} else {
+		slot = pair_index_slot(index, vp->da);
+		if (!slot->da || !slot->first) {
+			if (pair_index_set(index, vp->da, vp, fr_dlist_num_elements(&index->list->head) - 1) < 0) {
+			error:
+				index->valid = false;
+				return;
+			}
+		}
+	}
+
+	pair_index_sync(index);
+}
+
+/** Update the index before removing a pair from the list
+ *
+ */
+static inline void pair_index_remove(fr_pair_list_index_t *index, fr_pair_t *vp)
+{
+	pair_index_slot_t	*slot;
+	fr_pair_t		*next;
+
+	slot = pair_index_slot(index, vp->da);
+	if (slot->first != vp) return;
+
+	for (next = fr_dlist_next(&index->list->head, vp);
+	     next && (next->da != vp->da);
+	     next = fr_dlist_next(&index->list->head, next));
+
+	slot->first = next;
 }
 
 /** Free a fr_pair_t
@@ -434,6 +724,18 @@ void *fr_pair_iter_next_by_da(fr_dlist_head_t *list, void *to_eval, void *uctx)
 
 	if (!to_eval) return NULL;
 
+	/*
+	 *	Starting from the head of the list, so we can jump
+	 *	straight to the first match.  Cursors over pairs
+	 *	are always initialised with the head of a
+	 *	fr_pair_list_t.
+	 */
+	if (to_eval == fr_dlist_head(list)) {
+		fr_pair_list_t const *pair_list = (fr_pair_list_t const *) (((uint8_t *) list) - offsetof(fr_pair_list_t, head));
+
+		if (pair_index_find(&c, pair_list, da) == 0) return c;
+	}
+
 	for (c = to_eval; c; c = fr_dlist_next(list, c)) {
 		VP_VERIFY(c);
 		if (c->da == da) break;
@@ -487,6 +789,8 @@ fr_pair_t *fr_pair_find_by_da(fr_pair_list_t const *list, fr_dict_attr_t const *
 
 	if (!da) return NULL;
 
+	if (pair_index_find(&vp, list, da) == 0) return vp;
+
 	for (vp = fr_pair_list_head(list); vp != NULL; vp = fr_pair_list_next(list, vp)) if (da == vp->da) return vp;
 	return NULL;
 }
@@ -541,7 +845,6 @@ fr_pair_t *fr_pair_find_by_num(fr_pair_list_t *list, unsigned int vendor, unsign
 fr_pair_t *fr_pair_find_by_child_num(fr_pair_list_t *list, fr_dict_attr_t const *parent, unsigned int attr)
 {
 	fr_dict_attr_t const	*da;
-	fr_pair_t		*vp;
 
 	/* List head may be NULL if it contains no VPs */
 	if (fr_dlist_empty(&list->head)) return NULL;
@@ -551,9 +854,7 @@ fr_pair_t *fr_pair_find_by_child_num(fr_pair_list_t *list, fr_dict_attr_t const
 	da = fr_dict_attr_child_by_num(parent, attr);
 	if (!da) return NULL;
 
-	for (vp = fr_pair_list_head(list); vp != NULL; vp = fr_pair_list_next(list, vp)) if (da == vp->da) return vp;
-
-	return NULL;
+	return fr_pair_find_by_da(list, da);
 }
 
 static inline CC_HINT(always_inline) fr_pair_list_t *pair_children(fr_pair_t *vp)
@@ -646,6 +947,7 @@ inline void *fr_pair_list_tail(fr_pair_list_t const *list)
  */
 void _fr_pair_add(fr_pair_list_t *list, fr_pair_t *add, bool prepend)
 {
+	fr_pair_list_index_t *index;
 #ifdef WITH_VERIFY_PTR
 	fr_pair_t *i;
 #endif
@@ -664,12 +966,15 @@ void _fr_pair_add(fr_pair_list_t *list, fr_pair_t *add, bool prepend)
 		(void)fr_cond_assert(i != add);
 	}
 #endif
+	index = pair_index_current(list);
+
 	if (prepend) {
 		fr_dlist_insert_head(&list->head, add);
 	} else {
 		fr_dlist_insert_tail(&list->head, add);
 	}
 
+	if (index) pair_index_add(index, add, prepend);
 }
 
 /** Replace first matching VP
@@ -699,19 +1004,19 @@ void fr_pair_replace(fr_pair_list_t *list, fr_pair_t *replace)
 	 *	replace it. Note, we always replace the head one, and
 	 *	we ignore any others that might exist.
 	 */
-	for(i = fr_pair_list_head(list); i; i = fr_pair_list_next(list, i)) {
+	i = fr_pair_find_by_da(list, replace->da);
+	if (i) {
+		fr_pair_list_index_t *index = pair_index_current(list);
+
 		VP_VERIFY(i);
 
-		/*
-		 *	Found the head attribute, replace it,
-		 *	and return.
-		 */
-		if (i->da == replace->da) {
-			i = fr_dlist_replace(&list->head, i, replace);
-			talloc_free(i);
-			return;
+		i = fr_dlist_replace(&list->head, i, replace);
+		if (index) {
+			pair_index_slot(index, replace->da)->first = replace;
+			pair_index_sync(index);
 		}
-
+		talloc_free(i);
+		return;
 	}
 
 	/*
@@ -737,7 +1042,7 @@ void fr_pair_delete_by_child_num(fr_pair_list_t *list, fr_dict_attr_t const *par
 	da = fr_dict_attr_child_by_num(parent, attr);
 	if (!da) return;
 
-	for (i = fr_pair_list_head(list); i; i = next) {
+	for (i = fr_pair_find_by_da(list, da); i; i = next) {
 		next = fr_pair_list_next(list, i);
 		VP_VERIFY(i);
 		if (i->da == da) {
@@ -789,9 +1094,7 @@ int fr_pair_update_by_da(TALLOC_CTX *ctx, fr_pair_t **out, fr_pair_list_t *list,
 {
 	fr_pair_t	*vp;
 
-	for (vp = fr_pair_list_head(list); vp; vp = fr_pair_list_next(list, vp)) {
-		if (da == vp->da) break;
-	}
+	vp = fr_pair_find_by_da(list, da);
 	if (vp) {
 		VP_VERIFY(vp);
 		if (out) *out = vp;
@@ -823,7 +1126,7 @@ int fr_pair_delete_by_da(fr_pair_list_t *list, fr_dict_attr_t const *da)
 	fr_pair_t	*vp, *next;
 	int		cnt = 0;
 
-	for (vp = fr_pair_list_head(list); vp; vp = next) {
+	for (vp = fr_pair_find_by_da(list, da); vp; vp = next) {
 		next = fr_pair_list_next(list, vp);
 		if (da == vp->da) {
 			cnt++;
@@ -841,7 +1144,13 @@ int fr_pair_delete_by_da(fr_pair_list_t *list, fr_dict_attr_t const *da)
  */
 void fr_pair_remove(fr_pair_list_t *list, fr_pair_t *vp)
 {
+	fr_pair_list_index_t *index = pair_index_current(list);
+
+	if (index) pair_index_remove(index, vp);
+
 	fr_dlist_remove(&list->head, vp);
+
+	if (index) pair_index_sync(index);
 }
 
 /** Remove fr_pair_t from a list and free
@@ -857,7 +1166,7 @@ fr_pair_t *fr_pair_delete(fr_pair_list_t *list, fr_pair_t const *vp)
 	memcpy(&my_vp, &vp, sizeof(my_vp)); /* const hack */
 
 	prev = fr_pair_list_prev(list, vp);
-	fr_dlist_remove(&list->head, my_vp);
+	fr_pair_remove(list, my_vp);
 	talloc_free(my_vp);
 
 	return prev;
@@ -1225,6 +1534,12 @@ void fr_pair_list_sort(fr_pair_list_t *list, fr_cmp_t cmp)
 		}
 		head = fr_pair_list_next(list, head);
 	}
+
+	/*
+	 *	We changed the links directly, so tell anything which
+	 *	depends on the order of the list that it changed.
+	 */
+	list->head.generation++;
 }
 
 /** Write an error to the library errorbuff detailing the mismatch
@@ -2317,7 +2632,11 @@ void fr_pair_verify(char const *file, int line, fr_pair_t const *vp)
 	fr_dict_verify(file, line, vp->da);
 	if (vp->data.enumv) fr_dict_verify(file, line, vp->data.enumv);
 
-	if (vp->vp_ptr) switch (vp->vp_type) {
+	/*
+	 *	Borrowed buffers belong to someone else, so
+	 *	there's no talloc chunk to check.
+	 */
+	if (vp->vp_ptr && !vp->data.borrowed) switch (vp->vp_type) {
 	case FR_TYPE_OCTETS:
 	{
 		size_t len;
@@ -2575,7 +2894,7 @@ fr_pair_list_t *fr_pair_list_afrom_box(TALLOC_CTX *ctx, fr_dict_t const *dict, f
 	 *	getting discarded immediately after this modification.
 	 */
 	memcpy(&p, &box->vb_strvalue, sizeof(p)); /* const issues */
-	end = p + talloc_array_length(box->vb_strvalue) - 1;
+	end = p + box->vb_length;
 
 	while (p < end) {
 		/*
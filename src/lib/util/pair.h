@@ -62,10 +62,23 @@ typedef enum value_type {
 
 typedef struct value_pair_s fr_pair_t;
 
+typedef struct fr_pair_list_index_s fr_pair_list_index_t;
+
 typedef struct {
-        fr_dlist_head_t head;
+        fr_dlist_head_t		head;
+	fr_pair_list_index_t	*index;		//!< Optional index of the first pair for each attribute.
 } fr_pair_list_t;
 
+/** Counters for pair list indexes in this thread
+ *
+ */
+typedef struct {
+	uint64_t		lookups;	//!< Searches answered from an index.
+	uint64_t		rebuilds;	//!< Times an index was built from the list.
+	uint64_t		pairs_saved;	//!< Approximate number of pairs which linear searches
+						///< would have looked at, for the lookups.
+} fr_pair_list_index_stats_t;
+
 /** Stores an attribute, a value and various bits of other data
  *
  * fr_pair_ts are the main data structure used in the server
@@ -156,6 +169,10 @@ void		fr_pair_list_verify(char const *file, int line, TALLOC_CTX const *expected
 /* Initialisation */
 void fr_pair_list_init(fr_pair_list_t *head);
 
+int		fr_pair_list_index_enable(TALLOC_CTX *ctx, fr_pair_list_t *list) CC_HINT(nonnull(2));
+
+fr_pair_list_index_stats_t const *fr_pair_list_index_stats(void);
+
 /*
  *  Temporary macro to point the head of a pair_list to a specific vp
  */
@@ -495,6 +495,101 @@ static void test_fr_pair_delete(void)
 	TEST_CHECK(fr_pair_add_by_da(autofree, NULL, &sample_pairs, attr_test_string) == 0);
 }
 
+static fr_pair_t *pair_find_linear(fr_pair_list_t *list, fr_dict_attr_t const *da)
+{
+	fr_pair_t *vp;
+
+	for (vp = fr_pair_list_head(list); vp; vp = fr_pair_list_next(list, vp)) if (vp->da == da) return vp;
+
+	return NULL;
+}
+
+static bool pair_index_check(fr_pair_list_t *list)
+{
+	fr_dict_attr_t const	*das[] = { attr_test_integer, attr_test_octets, attr_test_string, attr_test_date,
+					   attr_test_ipv4_addr, attr_test_values, attr_test_tlv_root };
+	size_t			i;
+	int			pass;
+
+	/*
+	 *	Twice, as the first search after the list changes
+	 *	doesn't rebuild the index.
+	 */
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; i < NUM_ELEMENTS(das); i++) {
+			if (fr_pair_find_by_da(list, das[i]) != pair_find_linear(list, das[i])) return false;
+		}
+	}
+
+	return true;
+}
+
+static void test_fr_pair_list_index(void)
+{
+	fr_dict_attr_t const		*das[] = { attr_test_integer, attr_test_octets, attr_test_string,
+						   attr_test_date, attr_test_ipv4_addr, attr_test_values };
+	fr_pair_list_t			local_pairs;
+	fr_pair_list_index_stats_t	before, after;
+	fr_dcursor_t			cursor;
+	fr_pair_t			*vp;
+	int				i;
+
+	fr_pair_list_init(&local_pairs);
+	TEST_CHECK(fr_pair_list_index_enable(autofree, &local_pairs) == 0);
+
+	for (i = 0; i < 48; i++) fr_pair_add(&local_pairs, fr_pair_afrom_da(autofree, das[i % NUM_ELEMENTS(das)]));
+
+	before = *fr_pair_list_index_stats();
+
+	TEST_CASE("Searches match a linear search");
+	TEST_CHECK(pair_index_check(&local_pairs));
+
+	after = *fr_pair_list_index_stats();
+	TEST_CHECK(after.lookups > before.lookups);
+	TEST_CHECK(after.rebuilds == (before.rebuilds + 1));
+	TEST_CHECK(after.pairs_saved > before.pairs_saved);
+
+	TEST_CASE("Deleting the first of an attribute");
+	fr_pair_delete(&local_pairs, fr_pair_find_by_da(&local_pairs, attr_test_integer));
+	TEST_CHECK(pair_index_check(&local_pairs));
+
+	TEST_CASE("Prepending and appending");
+	fr_pair_prepend(&local_pairs, fr_pair_afrom_da(autofree, attr_test_string));
+	fr_pair_add(&local_pairs, fr_pair_afrom_da(autofree, attr_test_tlv_root));
+	TEST_CHECK(pair_index_check(&local_pairs));
+
+	before = *fr_pair_list_index_stats();
+	TEST_CHECK(before.rebuilds == after.rebuilds);
+	TEST_MSG("Changes made with the pair functions shouldn't need a rebuild");
+
+	TEST_CASE("Replacing the first of an attribute");
+	fr_pair_replace(&local_pairs, fr_pair_afrom_da(autofree, attr_test_octets));
+	TEST_CHECK(pair_index_check(&local_pairs));
+
+	TEST_CASE("Changes made with a cursor");
+	fr_dcursor_init(&cursor, &local_pairs);
+	fr_dcursor_prepend(&cursor, fr_pair_afrom_da(autofree, attr_test_ipv4_addr));
+	talloc_free(fr_dcursor_remove(&cursor));
+	TEST_CHECK(pair_index_check(&local_pairs));
+
+	TEST_CASE("Deleting all of an attribute");
+	TEST_CHECK(fr_pair_delete_by_da(&local_pairs, attr_test_date) == 8);
+	TEST_CHECK(fr_pair_find_by_da(&local_pairs, attr_test_date) == NULL);
+	TEST_CHECK(pair_index_check(&local_pairs));
+
+	TEST_CASE("Sorting");
+	fr_pair_list_sort(&local_pairs, fr_pair_cmp_by_da);
+	TEST_CHECK(pair_index_check(&local_pairs));
+
+	TEST_CASE("Cursors start at the first match");
+	vp = fr_dcursor_iter_by_da_init(&cursor, &local_pairs, attr_test_values);
+	TEST_CHECK(vp == pair_find_linear(&local_pairs, attr_test_values));
+	for (i = 0; vp; vp = fr_dcursor_next(&cursor), i++) TEST_CHECK(vp->da == attr_test_values);
+	TEST_CHECK(i == 8);
+
+	fr_pair_list_free(&local_pairs);
+}
+
 static void test_fr_pair_cmp(void)
 {
 	fr_pair_t *vp1, *vp2;
@@ -995,6 +1090,68 @@ static void test_fr_pair_value_bstr_append_buffer(void)
 	talloc_free(copy_sample_string);
 }
 
+static void test_fr_pair_value_inline(void)
+{
+	fr_pair_t	*vp, *copy;
+	char		long_string[sizeof(vp->data.datum.inline_buf) * 2];
+
+	memset(long_string, 'x', sizeof(long_string) - 1);
+	long_string[sizeof(long_string) - 1] = '\0';
+
+	TEST_CASE("Allocate 'Test-String'");
+	TEST_CHECK((vp = fr_pair_afrom_da(autofree, attr_test_string)) != NULL);
+
+	TEST_CASE("Short strings are stored inline");
+	TEST_CHECK(fr_pair_value_strdup(vp, "foo") == 0);
+	TEST_CHECK(fr_value_box_is_inline(&vp->data));
+	TEST_CHECK(vp && strcmp(vp->vp_strvalue, "foo") == 0);
+	TEST_CHECK(vp && vp->vp_length == 3);
+
+	TEST_CASE("Validating VP_VERIFY()");
+	VP_VERIFY(vp);
+
+	TEST_CASE("Appending in place while the value still fits");
+	TEST_CHECK(fr_pair_value_bstrn_append(vp, "bar", 3, false) == 0);
+	TEST_CHECK(fr_value_box_is_inline(&vp->data));
+	TEST_CHECK(vp && strcmp(vp->vp_strvalue, "foobar") == 0);
+
+	TEST_CASE("Copies of inline values are independent");
+	TEST_CHECK((copy = fr_pair_copy(autofree, vp)) != NULL);
+	TEST_CHECK(copy && fr_value_box_is_inline(&copy->data));
+	TEST_CHECK(copy && copy->vp_strvalue != vp->vp_strvalue);
+	TEST_CHECK(copy && strcmp(copy->vp_strvalue, "foobar") == 0);
+
+	TEST_CASE("Values which outgrow the inline buffer move to the heap");
+	TEST_CHECK(fr_pair_value_bstrn_append(vp, long_string, sizeof(long_string) - 1, false) == 0);
+	TEST_CHECK(!fr_value_box_is_inline(&vp->data));
+	TEST_CHECK(vp && talloc_get_size(vp->vp_strvalue) == (sizeof(long_string) + 6));
+	TEST_CHECK(vp && strncmp(vp->vp_strvalue, "foobar", 6) == 0);
+	TEST_CHECK(vp && strcmp(vp->vp_strvalue + 6, long_string) == 0);
+	TEST_CHECK(copy && strcmp(copy->vp_strvalue, "foobar") == 0);
+
+	TEST_CASE("Validating VP_VERIFY()");
+	VP_VERIFY(vp);
+	VP_VERIFY(copy);
+
+	talloc_free(vp);
+	talloc_free(copy);
+
+	TEST_CASE("Allocate 'Test-Octets'");
+	TEST_CHECK((vp = fr_pair_afrom_da(autofree, attr_test_octets)) != NULL);
+
+	TEST_CASE("Short octet strings are stored inline");
+	TEST_CHECK(fr_pair_value_memdup(vp, (uint8_t const *)"\x01\x02\x03", 3, false) == 0);
+	TEST_CHECK(fr_value_box_is_inline(&vp->data));
+	TEST_CHECK(vp && memcmp(vp->vp_octets, "\x01\x02\x03", 3) == 0);
+
+	TEST_CASE("Long octet strings are not");
+	TEST_CHECK(fr_pair_value_memdup(vp, (uint8_t const *)long_string, sizeof(long_string), false) == 0);
+	TEST_CHECK(!fr_value_box_is_inline(&vp->data));
+	TEST_CHECK(vp && memcmp(vp->vp_octets, long_string, sizeof(long_string)) == 0);
+
+	talloc_free(vp);
+}
+
 static void test_fr_pair_value_mem_alloc(void)
 {
 	fr_pair_t *vp;
@@ -1264,6 +1421,7 @@ TEST_LIST = {
 	{ "fr_pair_update_by_da",                 test_fr_pair_update_by_da },
 	{ "fr_pair_delete",                       test_fr_pair_delete },
 	{ "fr_pair_delete_by_da",                 test_fr_pair_delete_by_da },
+	{ "fr_pair_list_index",                   test_fr_pair_list_index },
 
 	/* Compare */
 	{ "fr_pair_cmp",                          test_fr_pair_cmp },
@@ -1294,6 +1452,7 @@ TEST_LIST = {
 	{ "fr_pair_value_bstrdup_buffer_shallow", test_fr_pair_value_bstrdup_buffer_shallow },
 	{ "fr_pair_value_bstrn_append",           test_fr_pair_value_bstrn_append },
 	{ "fr_pair_value_bstr_append_buffer",     test_fr_pair_value_bstr_append_buffer },
+	{ "fr_pair_value_inline",                 test_fr_pair_value_inline },
 
 	/* Assign and manipulate octets strings */
 	{ "fr_pair_value_mem_alloc",              test_fr_pair_value_mem_alloc },
@@ -44,6 +44,10 @@
 
 #include <ifaddrs.h>
 
+#ifdef __linux__
+#  include <linux/filter.h>
+#endif
+
 /** Resolve a named service to a port
  *
  * @param[in] proto	The protocol. Either IPPROTO_TCP or IPPROTO_UDP.
@@ -1046,3 +1050,55 @@ done:
 #endif
 	return 0;
 }
+
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+/** Steer packets to the SO_REUSEPORT socket for the CPU which received them
+ *
+ * By default, the kernel picks a socket from the SO_REUSEPORT group
+ * using a hash of the packet's addresses and ports.  This function
+ * instead attaches a classic BPF program which picks socket number
+ * "cpu % num", where "cpu" is the CPU which received the packet.
+ * With receive side scaling, the NIC has already spread packets
+ * across CPUs by the same hash, so each packet is handled by the
+ * socket (and thread) nearest to the CPU which received it.
+ *
+ * The program applies to the whole group, so it only needs to be
+ * attached to one socket, after that socket has been bound.
+ *
+ * @param[in] sockfd	a bound socket with SO_REUSEPORT set.
+ * @param[in] num	number of sockets in the group.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_socket_reuseport_cpu_steer(int sockfd, unsigned int num)
+{
+	struct sock_filter code[] = {
+		{ BPF_LD | BPF_W | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU },	/* A = current CPU */
+		{ BPF_ALU | BPF_MOD | BPF_K, 0, 0, num },			/* A = A % num */
+		{ BPF_RET | BPF_A, 0, 0, 0 }					/* return A */
+	};
+	struct sock_fprog prog = {
+		.len = NUM_ELEMENTS(code),
+		.filter = code
+	};
+
+	if (!num) {
+		fr_strerror_const("Invalid number of sockets");
+		return -1;
+	}
+
+	if (setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+		fr_strerror_printf("Failed attaching reuseport CPU steering program: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+#else
+int fr_socket_reuseport_cpu_steer(UNUSED int sockfd, UNUSED unsigned int num)
+{
+	fr_strerror_const("Reuseport CPU steering is not supported on this platform");
+	return -1;
+}
+#endif
@@ -312,6 +312,8 @@ int		fr_socket_server_tcp(fr_ipaddr_t const *ipaddr, uint16_t *port, char const
 
 int		fr_socket_bind(int sockfd, fr_ipaddr_t const *ipaddr, uint16_t *port, char const *interface);
 
+int		fr_socket_reuseport_cpu_steer(int sockfd, unsigned int num);
+
 #ifdef __cplusplus
 }
 #endif
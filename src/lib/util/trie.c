@@ -424,7 +424,7 @@ static void write_chunk(uint8_t *out, int start_bit, int num_bits, uint16_t chun
 	 *	Special-case 1-bit writes.
 	 */
 	if (num_bits == 1) {
-		out[0] &= ~((1 << (7 - start_bit)) - 1);
+		out[0] &= ~((1 << (8 - start_bit)) - 1);
 		out[0] |= chunk << (7 - start_bit);
 		return;
 	}
@@ -22,6 +22,8 @@
  */
 RCSID("$Id$")
 
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/io_uring.h>
 #include <freeradius-devel/util/log.h>
 #include <freeradius-devel/util/socket.h>
 #include <freeradius-devel/util/strerror.h>
@@ -213,3 +215,756 @@ done:
 
 	return slen;
 }
+
+/** A set of buffers for reading or writing multiple datagrams in one system call
+ *
+ * When reading, datagrams are read into the batch with recvmmsg(), and
+ * then handed back to the caller one at a time by udp_batch_recv().
+ *
+ * When writing, datagrams are copied into the batch by udp_batch_send(),
+ * and then written with sendmmsg() by udp_batch_flush().
+ *
+ * A batch should only be used for one direction.
+ */
+struct udp_batch_s {
+	unsigned int		num;		//!< Maximum number of packets to read or write at once.
+	unsigned int		received;	//!< Number of packets read by the last system call,
+						///< or number of packets queued for writing.
+	unsigned int		next;		//!< The next packet to return to the caller.
+	int			sockfd;		//!< Socket the queued packets will be written to.
+
+	size_t			packet_size;	//!< Size of each packet buffer.
+	uint8_t			*packets;	//!< Contiguous array of packet buffers.
+
+	struct mmsghdr		*msgvec;	//!< Headers passed to recvmmsg() / sendmmsg().
+	struct iovec		*iov;		//!< One per packet buffer.
+	struct sockaddr_storage	*remote;	//!< Address of the other end, for each packet.
+	struct sockaddr_storage	*local;		//!< Our address, for each packet.
+	socklen_t		*local_len;	//!< Length of each local address.
+	int			*ifindex;	//!< Interface each packet was received or sent on.
+	fr_time_t		*when;		//!< When each packet was received.
+	uint8_t			*cbuf;		//!< Control buffers for the packet info.
+
+#ifdef WITH_IO_URING
+	fr_io_uring_t		*uring;		//!< If set, receives are multishot, and sends are asynchronous.
+	struct msghdr		uring_msg;	//!< Template for the multishot receive.
+	bool			uring_rearm;	//!< The multishot receive needs to be posted again.
+	unsigned int		in_flight;	//!< Sends submitted, but not yet completed.
+	struct sockaddr_storage	sockname;	//!< Address the socket is bound to.
+	socklen_t		sockname_len;
+#endif
+};
+
+#define UDP_BATCH_CBUF_SIZE	(256)
+
+/** Allocate a batch for use with udp_batch_recv() or udp_batch_send()
+ *
+ * @param[in] ctx		to allocate the batch in.
+ * @param[in] num		maximum number of packets to read or write per system call.
+ * @param[in] packet_size	maximum size of a packet.  Larger packets are truncated.
+ * @return
+ *	- NULL on allocation error.
+ *	- A new batch.
+ */
+udp_batch_t *udp_batch_alloc(TALLOC_CTX *ctx, unsigned int num, size_t packet_size)
+{
+	udp_batch_t	*batch;
+	unsigned int	i;
+
+	if (!num) num = 1;
+
+	batch = talloc_zero(ctx, udp_batch_t);
+	if (!batch) return NULL;
+
+	batch->num = num;
+	batch->packet_size = packet_size;
+
+	batch->packets = talloc_array(batch, uint8_t, num * packet_size);
+	if (!batch->packets) {
+	oom:
+		fr_strerror_const("Out of memory");
+		talloc_free(batch);
+		return NULL;
+	}
+
+	batch->msgvec = talloc_zero_array(batch, struct mmsghdr, num);
+	batch->iov = talloc_zero_array(batch, struct iovec, num);
+	batch->remote = talloc_zero_array(batch, struct sockaddr_storage, num);
+	batch->local = talloc_zero_array(batch, struct sockaddr_storage, num);
+	batch->local_len = talloc_zero_array(batch, socklen_t, num);
+	batch->ifindex = talloc_zero_array(batch, int, num);
+	batch->when = talloc_zero_array(batch, fr_time_t, num);
+	batch->cbuf = talloc_zero_array(batch, uint8_t, num * UDP_BATCH_CBUF_SIZE);
+
+	if (!batch->msgvec || !batch->iov || !batch->remote || !batch->local || !batch->local_len ||
+	    !batch->ifindex || !batch->when || !batch->cbuf) goto oom;
+
+	/*
+	 *	The iovecs always point to the same packet
+	 *	buffers, so we only need to set them up once.
+	 */
+	for (i = 0; i < num; i++) {
+		batch->iov[i].iov_base = batch->packets + (i * packet_size);
+		batch->iov[i].iov_len = packet_size;
+
+		batch->msgvec[i].msg_hdr.msg_iov = &batch->iov[i];
+		batch->msgvec[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	return batch;
+}
+
+/** Whether there are packets in the batch which have not yet been returned
+ *
+ * @param[in] batch	to check.
+ * @return
+ *	- true if the next call to udp_batch_recv() will not read the socket.
+ *	- false if the batch is empty.
+ */
+bool udp_batch_pending(udp_batch_t const *batch)
+{
+#ifdef WITH_IO_URING
+	if (batch->uring) return (fr_io_uring_cqe_peek(batch->uring) != NULL);
+#endif
+
+	return (batch->next < batch->received);
+}
+
+#ifdef WITH_IO_URING
+#define UDP_BATCH_BGID		(0)
+
+/** Minimum number of receive buffers given to the kernel
+ *
+ * The kernel needs a free buffer for every packet which arrives before we
+ * get around to processing it.  If it runs out, the multishot receive is
+ * terminated, and has to be re-armed.  So the number of buffers is
+ * independent of how many packets the caller processes at once.
+ */
+#define UDP_BATCH_URING_BUFS_MIN	(64)
+
+/** Round up to the next power of 2, as io_uring requires for buffer rings
+ *
+ */
+static unsigned int udp_batch_uring_size(unsigned int num)
+{
+	unsigned int size = 1;
+
+	while (size < num) size <<= 1;
+
+	return size;
+}
+
+/** Post the multishot receive
+ *
+ * One SQE gives us a completion for every packet which arrives,
+ * until the kernel runs out of buffers, or the socket errors out.
+ */
+static int udp_batch_uring_post(udp_batch_t *batch)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = fr_io_uring_sqe_get(batch->uring);
+	if (!sqe) {
+		fr_strerror_const("io_uring submission queue is full");
+		return -1;
+	}
+
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = batch->sockfd;
+	sqe->addr = (uintptr_t) &batch->uring_msg;
+	sqe->len = 1;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = UDP_BATCH_BGID;
+
+	batch->uring_rearm = false;
+
+	return (fr_io_uring_submit(batch->uring, 0) < 0) ? -1 : 0;
+}
+#endif
+
+/** Receive packets with a multishot io_uring receive
+ *
+ * The kernel writes packets into the batch's buffers as they arrive,
+ * without any system calls from us.  udp_batch_recv() then returns
+ * packets directly from those buffers.
+ *
+ * The socket no longer becomes readable when packets arrive.  The
+ * caller MUST instead wait on the returned eventfd.
+ *
+ * @param[in] batch	allocated with udp_batch_alloc().
+ * @param[in] sockfd	unconnected socket to read packets from.
+ * @return
+ *	- >= 0 the eventfd to wait on.
+ *	- -1 if io_uring is unavailable.  The batch can still be used
+ *	  with recvmmsg() by waiting on the socket as normal.
+ */
+int udp_batch_io_uring_recv(udp_batch_t *batch, int sockfd)
+{
+#ifdef WITH_IO_URING
+	unsigned int		num;
+	struct io_uring_cqe	*cqe;
+	int			fd;
+
+	num = udp_batch_uring_size(batch->num > UDP_BATCH_URING_BUFS_MIN ? batch->num : UDP_BATCH_URING_BUFS_MIN);
+
+	batch->uring = fr_io_uring_alloc(batch, 4, num * 2);
+	if (!batch->uring) return -1;
+
+	/*
+	 *	The packet info doesn't include the port, so we
+	 *	use the port the socket is bound to.
+	 */
+	batch->sockfd = sockfd;
+	batch->sockname_len = sizeof(batch->sockname);
+	if (getsockname(sockfd, (struct sockaddr *) &batch->sockname, &batch->sockname_len) < 0) {
+		fr_strerror_printf("Failed getting socket name: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	/*
+	 *	Each buffer holds the recvmsg header, the source
+	 *	address, the control messages, and the packet.
+	 */
+	batch->uring_msg.msg_namelen = sizeof(struct sockaddr_storage);
+	batch->uring_msg.msg_controllen = UDP_BATCH_CBUF_SIZE;
+
+	if (fr_io_uring_buf_ring_alloc(batch->uring, UDP_BATCH_BGID, num,
+				       sizeof(struct io_uring_recvmsg_out) + batch->uring_msg.msg_namelen +
+				       batch->uring_msg.msg_controllen + batch->packet_size) < 0) goto error;
+
+	fd = fr_io_uring_eventfd(batch->uring);
+	if (fd < 0) goto error;
+
+	if (udp_batch_uring_post(batch) < 0) goto error;
+
+	/*
+	 *	Kernels without multishot receives fail the
+	 *	request as soon as it's submitted.
+	 */
+	cqe = fr_io_uring_cqe_peek(batch->uring);
+	if (cqe && (cqe->res < 0) && !(cqe->flags & IORING_CQE_F_MORE)) {
+		fr_strerror_printf("Multishot receive failed: %s", fr_syserror(-cqe->res));
+	error:
+		TALLOC_FREE(batch->uring);
+		return -1;
+	}
+
+	return fd;
+#else
+	UNUSED(batch);
+	UNUSED(sockfd);
+
+	fr_strerror_const("io_uring is not supported on this platform");
+	return -1;
+#endif
+}
+
+#ifdef WITH_IO_URING
+static int udp_batch_uring_reap(udp_batch_t *batch, bool wait);
+
+/** Wait for outstanding sends, so the kernel doesn't read freed buffers
+ *
+ */
+static int _udp_batch_free(udp_batch_t *batch)
+{
+	if (batch->in_flight) (void) udp_batch_uring_reap(batch, true);
+
+	return 0;
+}
+#endif
+
+/** Write packets with asynchronous io_uring sends
+ *
+ * udp_batch_flush() submits all of the queued packets with one system
+ * call, and doesn't wait for the writes to complete.  The completions
+ * are reaped the next time the batch is used.
+ *
+ * @param[in] batch	allocated with udp_batch_alloc().
+ * @return
+ *	- 0 on success.
+ *	- -1 if io_uring is unavailable.  The batch will use sendmmsg().
+ */
+int udp_batch_io_uring_send(udp_batch_t *batch)
+{
+#ifdef WITH_IO_URING
+	batch->uring = fr_io_uring_alloc(batch, udp_batch_uring_size(batch->num), 0);
+	if (!batch->uring) return -1;
+
+	talloc_set_destructor(batch, _udp_batch_free);
+
+	return 0;
+#else
+	UNUSED(batch);
+
+	fr_strerror_const("io_uring is not supported on this platform");
+	return -1;
+#endif
+}
+
+#ifdef HAVE_RECVMMSG
+/** Fill the batch from the socket
+ *
+ * @return
+ *	- > 0 the number of packets read.
+ *	- 0 no packets were available.
+ *	- < 0 on error.
+ */
+static int udp_batch_fill(udp_batch_t *batch, int sockfd, int flags)
+{
+	unsigned int	i;
+	int		ret;
+
+	batch->next = batch->received = 0;
+
+	/*
+	 *	Connected sockets already know src/dst IP/port, so
+	 *	they're handled by the normal udp_recv() path.
+	 */
+	fr_assert((flags & UDP_FLAGS_CONNECTED) == 0);
+
+	/*
+	 *	recvmmsg() overwrites the lengths, so reset them
+	 *	before every call.
+	 */
+	for (i = 0; i < batch->num; i++) {
+		struct msghdr *msgh = &batch->msgvec[i].msg_hdr;
+
+		batch->iov[i].iov_len = batch->packet_size;
+
+		msgh->msg_name = &batch->remote[i];
+		msgh->msg_namelen = sizeof(batch->remote[i]);
+		msgh->msg_control = batch->cbuf + (i * UDP_BATCH_CBUF_SIZE);
+		msgh->msg_controllen = UDP_BATCH_CBUF_SIZE;
+		msgh->msg_flags = 0;
+	}
+
+	ret = recvmmsgfromto(sockfd, batch->msgvec, batch->num,
+			     ((flags & UDP_FLAGS_PEEK) != 0) ? MSG_PEEK : 0,
+			     batch->ifindex, batch->local, batch->local_len, batch->when);
+	if (ret < 0) {
+		if ((errno == EWOULDBLOCK) || (errno == EAGAIN)) return 0;
+
+		fr_strerror_printf("Failed reading socket: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	batch->received = ret;
+	return ret;
+}
+#endif
+
+#ifdef WITH_IO_URING
+/** Copy a packet out of a provided buffer
+ *
+ */
+static ssize_t udp_batch_uring_packet(udp_batch_t *batch, uint8_t *buf, size_t len,
+				      fr_socket_t *socket_out, void *data, size_t data_len, fr_time_t *when)
+{
+	struct io_uring_recvmsg_out	*out = (struct io_uring_recvmsg_out *) buf;
+	uint8_t				*name, *control, *payload;
+	struct msghdr			msgh;
+	struct sockaddr_storage		local;
+	socklen_t			local_len, remote_len;
+	fr_time_t			rx_when = 0;
+	size_t				packet_len;
+
+	if (len < (sizeof(*out) + batch->uring_msg.msg_namelen + batch->uring_msg.msg_controllen)) {
+		fr_strerror_printf("Truncated io_uring receive (%zu bytes)", len);
+		return -1;
+	}
+
+	name = (uint8_t *)(out + 1);
+	control = name + batch->uring_msg.msg_namelen;
+	payload = control + batch->uring_msg.msg_controllen;
+
+	*socket_out = (fr_socket_t){
+		.fd = batch->sockfd,
+		.proto = IPPROTO_UDP
+	};
+
+	/*
+	 *	Start with the bound address.  It may be
+	 *	INADDR_ANY, in which case the packet info
+	 *	gives us the more specific address.
+	 */
+	memcpy(&local, &batch->sockname, sizeof(local));
+	local_len = batch->sockname_len;
+
+	memset(&msgh, 0, sizeof(msgh));
+	msgh.msg_control = control;
+	msgh.msg_controllen = out->controllen;
+
+	udpfromto_cmsg_process(&msgh, &socket_out->inet.ifindex, (struct sockaddr *) &local, &local_len, &rx_when);
+
+	remote_len = out->namelen;
+	if (remote_len > batch->uring_msg.msg_namelen) remote_len = batch->uring_msg.msg_namelen;
+
+	if (fr_ipaddr_from_sockaddr(&socket_out->inet.src_ipaddr, &socket_out->inet.src_port,
+				    (struct sockaddr_storage *) name, remote_len) < 0) {
+		fr_strerror_const_push("Failed converting src sockaddr to ipaddr");
+		return -1;
+	}
+	if (fr_ipaddr_from_sockaddr(&socket_out->inet.dst_ipaddr, &socket_out->inet.dst_port,
+				    &local, local_len) < 0) {
+		fr_strerror_const_push("Failed converting dst sockaddr to ipaddr");
+		return -1;
+	}
+
+	if (when) *when = rx_when ? rx_when : fr_time();
+
+	/*
+	 *	The kernel has already discarded any data after
+	 *	"packet_size" bytes, so we do the same here.
+	 */
+	packet_len = len - (payload - buf);
+	if (packet_len > out->payloadlen) packet_len = out->payloadlen;
+	if (packet_len > data_len) packet_len = data_len;
+
+	memcpy(data, payload, packet_len);
+
+	return packet_len;
+}
+
+/** Return the next packet received by the multishot receive
+ *
+ */
+static ssize_t udp_batch_uring_recv(udp_batch_t *batch,
+				    fr_socket_t *socket_out, void *data, size_t data_len, fr_time_t *when)
+{
+	struct io_uring_cqe	*cqe;
+	ssize_t			ret = 0;
+
+	cqe = fr_io_uring_cqe_peek(batch->uring);
+	if (!cqe) {
+		uint64_t	count;
+
+		/*
+		 *	Clear the eventfd, and then check again.
+		 *	Any completions posted after the check
+		 *	will signal the eventfd again, so we
+		 *	can't miss a wakeup.
+		 */
+		if (read(fr_io_uring_eventfd(batch->uring), &count, sizeof(count)) < 0) {
+			if ((errno != EWOULDBLOCK) && (errno != EAGAIN)) {
+				fr_strerror_printf("Failed reading eventfd: %s", fr_syserror(errno));
+				return -1;
+			}
+		}
+
+		/*
+		 *	Pick up any completions which didn't fit
+		 *	in the completion queue.
+		 */
+		if (fr_io_uring_submit(batch->uring, 0) < 0) return -1;
+
+		cqe = fr_io_uring_cqe_peek(batch->uring);
+	}
+
+	while (cqe) {
+		int32_t		res = cqe->res;
+		uint32_t	cqe_flags = cqe->flags;
+		uint16_t	bid;
+
+		fr_io_uring_cqe_seen(batch->uring);
+
+		/*
+		 *	The multishot receive has stopped, usually
+		 *	because we ran out of buffers.
+		 */
+		if (!(cqe_flags & IORING_CQE_F_MORE)) batch->uring_rearm = true;
+
+		if (res < 0) {
+			if (res != -ENOBUFS) {
+				fr_strerror_printf("Failed reading socket: %s", fr_syserror(-res));
+				ret = -1;
+				break;
+			}
+
+			cqe = fr_io_uring_cqe_peek(batch->uring);
+			continue;
+		}
+
+		if (!(cqe_flags & IORING_CQE_F_BUFFER)) {
+			cqe = fr_io_uring_cqe_peek(batch->uring);
+			continue;
+		}
+
+		bid = cqe_flags >> IORING_CQE_BUFFER_SHIFT;
+		ret = udp_batch_uring_packet(batch, fr_io_uring_buf(batch->uring, bid), res,
+					     socket_out, data, data_len, when);
+		fr_io_uring_buf_recycle(batch->uring, bid);
+		break;
+	}
+
+	if (batch->uring_rearm && (udp_batch_uring_post(batch) < 0)) return -1;
+
+	return ret;
+}
+
+/** Reap completed sends, optionally waiting for all of them
+ *
+ */
+static int udp_batch_uring_reap(udp_batch_t *batch, bool wait)
+{
+	struct io_uring_cqe	*cqe;
+	int			res, failed = 0, error = 0;
+
+	if (wait && batch->in_flight && (fr_io_uring_submit(batch->uring, batch->in_flight) < 0)) return -1;
+
+	while ((cqe = fr_io_uring_cqe_peek(batch->uring))) {
+		res = cqe->res;
+		fr_io_uring_cqe_seen(batch->uring);
+
+		if (batch->in_flight) batch->in_flight--;
+
+		if (res < 0) {
+			failed++;
+			error = -res;
+		}
+	}
+
+	if (failed) {
+		fr_strerror_printf("udp_batch_flush failed writing %d packets: %s", failed, fr_syserror(error));
+		return -1;
+	}
+
+	return 0;
+}
+#endif
+
+/** Read a UDP packet, using a batch to amortise the cost of the system call
+ *
+ * If the batch is empty, it is filled with as many packets as the
+ * socket has available (up to the size of the batch), with a single
+ * system call.  The next packet from the batch is then copied to the
+ * caller's buffer.
+ *
+ * The caller MUST use udp_batch_pending() to determine whether it
+ * needs to call this function again before waiting on the socket.
+ * Packets in the batch will not cause the socket to become readable.
+ *
+ * @param[in] batch		to read packets into.
+ * @param[in] sockfd		we're reading from.
+ * @param[in] flags		for things.
+ * @param[out] socket_out	Information about the src/dst address of the packet
+ *				and the interface it was received on.
+ * @param[out] data		pointer where data will be written
+ * @param[in] data_len		length of data to read
+ * @param[out] when		the packet was received.
+ * @return
+ *	- > 0 on success (number of bytes read).
+ *	- 0 no data was available.
+ *	- < 0 on failure.
+ */
+ssize_t udp_batch_recv(udp_batch_t *batch, int sockfd, int flags,
+		       fr_socket_t *socket_out, void *data, size_t data_len, fr_time_t *when)
+{
+#ifdef HAVE_RECVMMSG
+	unsigned int	i;
+	size_t		packet_len;
+	int		ret;
+
+#ifdef WITH_IO_URING
+	if (batch->uring) return udp_batch_uring_recv(batch, socket_out, data, data_len, when);
+#endif
+
+	if (!udp_batch_pending(batch)) {
+		ret = udp_batch_fill(batch, sockfd, flags);
+		if (ret <= 0) return ret;
+	}
+
+	i = batch->next++;
+
+	*socket_out = (fr_socket_t){
+		.fd = sockfd,
+		.proto = IPPROTO_UDP,
+		.inet = {
+			.ifindex = batch->ifindex[i]
+		}
+	};
+
+	if (fr_ipaddr_from_sockaddr(&socket_out->inet.src_ipaddr, &socket_out->inet.src_port,
+				    &batch->remote[i], batch->msgvec[i].msg_hdr.msg_namelen) < 0) {
+		fr_strerror_const_push("Failed converting src sockaddr to ipaddr");
+		return -1;
+	}
+	if (fr_ipaddr_from_sockaddr(&socket_out->inet.dst_ipaddr, &socket_out->inet.dst_port,
+				    &batch->local[i], batch->local_len[i]) < 0) {
+		fr_strerror_const_push("Failed converting dst sockaddr to ipaddr");
+		return -1;
+	}
+
+	if (when) *when = batch->when[i];
+
+	/*
+	 *	The OS has already discarded any data after
+	 *	"packet_size" bytes, so we do the same here.
+	 */
+	packet_len = batch->msgvec[i].msg_len;
+	if (packet_len > data_len) packet_len = data_len;
+
+	memcpy(data, batch->iov[i].iov_base, packet_len);
+
+	return packet_len;
+#else
+	/*
+	 *	No recvmmsg(), so we can only read one packet at a time.
+	 */
+	return udp_recv(sockfd, flags, socket_out, data, data_len, when);
+#endif
+}
+
+/** Queue a UDP packet for writing with udp_batch_flush()
+ *
+ * The packet is copied into the batch, so the caller can free or
+ * re-use the data as soon as this function returns.  If the batch
+ * is full, or the packet is for a different socket than the
+ * packets already queued, the batch is flushed first.
+ *
+ * @param[in] batch		to queue the packet in.
+ * @param[in] socket		we're writing to.  Must not be a connected socket.
+ * @param[in] data		to send.
+ * @param[in] data_len		length of data to send.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.  The packet was not queued.
+ */
+int udp_batch_send(udp_batch_t *batch, fr_socket_t const *socket, void const *data, size_t data_len)
+{
+	unsigned int	i;
+	socklen_t	remote_len;
+
+	if (unlikely(socket->proto != IPPROTO_UDP)) {
+		fr_strerror_printf("Invalid proto type %u", socket->proto);
+		return -1;
+	}
+
+	if (unlikely(data_len > batch->packet_size)) {
+		fr_strerror_printf("Packet too large (%zu > %zu)", data_len, batch->packet_size);
+		return -1;
+	}
+
+	if ((batch->received > 0) &&
+	    ((batch->received == batch->num) || (batch->sockfd != socket->fd)) &&
+	    (udp_batch_flush(batch) < 0)) return -1;
+
+#ifdef WITH_IO_URING
+	/*
+	 *	The kernel may still be using the buffers from the
+	 *	last flush, so we can't overwrite them until all of
+	 *	those sends have completed.
+	 */
+	if (batch->uring && (batch->received == 0) && batch->in_flight &&
+	    (udp_batch_uring_reap(batch, true) < 0)) return -1;
+#endif
+
+	i = batch->received;
+
+	if (fr_ipaddr_to_sockaddr(&batch->remote[i], &remote_len,
+				  &socket->inet.dst_ipaddr, socket->inet.dst_port) < 0) return -1;
+	if (fr_ipaddr_to_sockaddr(&batch->local[i], &batch->local_len[i],
+				  &socket->inet.src_ipaddr, socket->inet.src_port) < 0) return -1;
+
+	batch->msgvec[i].msg_hdr.msg_name = &batch->remote[i];
+	batch->msgvec[i].msg_hdr.msg_namelen = remote_len;
+	batch->msgvec[i].msg_hdr.msg_control = batch->cbuf + (i * UDP_BATCH_CBUF_SIZE);
+	batch->msgvec[i].msg_hdr.msg_flags = 0;
+	batch->ifindex[i] = socket->inet.ifindex;
+
+	memcpy(batch->iov[i].iov_base, data, data_len);
+	batch->iov[i].iov_len = data_len;
+
+	batch->sockfd = socket->fd;
+	batch->received++;
+
+	return 0;
+}
+
+/** Write all of the packets queued by udp_batch_send()
+ *
+ * Packets which could not be written are discarded, as with any
+ * other UDP write error.
+ *
+ * @param[in] batch		to write.
+ * @return
+ *	- >= 0 the number of packets written.
+ *	- < 0 if some packets could not be written.
+ */
+int udp_batch_flush(udp_batch_t *batch)
+{
+	unsigned int	queued = batch->received;
+	int		ret;
+
+	if (!queued) return 0;
+
+	batch->received = 0;
+
+#ifdef WITH_IO_URING
+	if (batch->uring) {
+		unsigned int		i;
+		struct io_uring_sqe	*sqe;
+
+		if (udp_batch_uring_reap(batch, false) < 0) return -1;
+
+		if (sendmmsgfromto_prepare(batch->sockfd, batch->msgvec, queued,
+					   batch->ifindex, batch->local, batch->local_len) < 0) {
+			fr_strerror_printf("udp_batch_flush failed: %s", fr_syserror(errno));
+			return -1;
+		}
+
+		for (i = 0; i < queued; i++) {
+			sqe = fr_io_uring_sqe_get(batch->uring);
+			if (!sqe) break;
+
+			sqe->opcode = IORING_OP_SENDMSG;
+			sqe->fd = batch->sockfd;
+			sqe->addr = (uintptr_t) &batch->msgvec[i].msg_hdr;
+			sqe->len = 1;
+		}
+
+		if (fr_io_uring_submit(batch->uring, 0) < 0) return -1;
+		batch->in_flight += i;
+
+		if (i < queued) {
+			fr_strerror_printf("udp_batch_flush wrote %u of %u packets: io_uring submission queue is full",
+					   i, queued);
+			return -1;
+		}
+
+		return i;
+	}
+#endif
+
+	ret = sendmmsgfromto(batch->sockfd, batch->msgvec, queued, 0,
+			     batch->ifindex, batch->local, batch->local_len);
+	if (ret < 0) {
+		fr_strerror_printf("udp_batch_flush failed: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	/*
+	 *	sendmmsg() stops at the first packet it can't send.
+	 *	There's no point in retrying the rest, as they'll
+	 *	likely fail for the same reason.
+	 */
+	if ((unsigned int) ret < queued) {
+		fr_strerror_printf("udp_batch_flush wrote %d of %u packets: %s",
+				   ret, queued, fr_syserror(errno));
+		return -1;
+	}
+
+	return ret;
+}
+
+/** Whether there are packets queued for writing
+ *
+ * @param[in] batch	to check.
+ * @return
+ *	- true if udp_batch_flush() has packets to write.
+ *	- false if the batch is empty.
+ */
+bool udp_batch_queued(udp_batch_t const *batch)
+{
+	return (batch->received > 0);
+}
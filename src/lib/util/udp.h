@@ -37,6 +37,8 @@ extern "C" {
 #define UDP_FLAGS_CONNECTED	(1 << 0)
 #define UDP_FLAGS_PEEK		(1 << 1)
 
+typedef struct udp_batch_s udp_batch_t;
+
 int udp_send(fr_socket_t const *socket, int flags, void *data, size_t data_len);
 
 int udp_recv_discard(int sockfd);
@@ -46,6 +48,23 @@ ssize_t udp_recv_peek(int sockfd, void *data, size_t data_len, int flags, fr_ipa
 ssize_t udp_recv(int sockfd, int flags,
 		 fr_socket_t *socket_out, void *data, size_t data_len, fr_time_t *when);
 
+udp_batch_t *udp_batch_alloc(TALLOC_CTX *ctx, unsigned int num, size_t packet_size);
+
+bool udp_batch_pending(udp_batch_t const *batch);
+
+int udp_batch_io_uring_recv(udp_batch_t *batch, int sockfd);
+
+int udp_batch_io_uring_send(udp_batch_t *batch);
+
+ssize_t udp_batch_recv(udp_batch_t *batch, int sockfd, int flags,
+		       fr_socket_t *socket_out, void *data, size_t data_len, fr_time_t *when);
+
+int udp_batch_send(udp_batch_t *batch, fr_socket_t const *socket, void const *data, size_t data_len);
+
+bool udp_batch_queued(udp_batch_t const *batch);
+
+int udp_batch_flush(udp_batch_t *batch);
+
 #ifdef __cplusplus
 }
 #endif
@@ -39,16 +39,34 @@ extern "C" {
 
 int	udpfromto_init(int s);
 
+void	udpfromto_cmsg_process(struct msghdr *msgh, int *ifindex,
+			       struct sockaddr *to, socklen_t *to_len, fr_time_t *when);
+
 int	recvfromto(int s, void *buf, size_t len, int flags,
 		   int *ifindex,
 	       	   struct sockaddr *from, socklen_t *fromlen,
 		   struct sockaddr *to, socklen_t *tolen,
 		   fr_time_t *when);
 
+#ifdef HAVE_RECVMMSG
+int	recvmmsgfromto(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+		       int *ifindex,
+		       struct sockaddr_storage *to, socklen_t *to_len,
+		       fr_time_t *when);
+#endif
+
 int	sendfromto(int s, void *buf, size_t len, int flags,
 		   int ifindex,
 		   struct sockaddr *from, socklen_t fromlen,
 		   struct sockaddr *to, socklen_t tolen);
+
+int	sendmmsgfromto_prepare(int s, struct mmsghdr *msgvec, unsigned int vlen,
+			       int const *ifindex,
+			       struct sockaddr_storage *from, socklen_t const *from_len);
+
+int	sendmmsgfromto(int s, struct mmsghdr *msgvec, unsigned int vlen, int flags,
+		       int const *ifindex,
+		       struct sockaddr_storage *from, socklen_t const *from_len);
 #ifdef __cplusplus
 }
 #endif
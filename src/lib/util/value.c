@@ -72,6 +72,8 @@ static_assert(SIZEOF_MEMBER(fr_value_box_t, vb_ifid) == 8,
 	      "vb_ifid has unexpected length");
 static_assert(SIZEOF_MEMBER(fr_value_box_t, vb_ether) == 6,
 	      "vb_ether has unexpected length");
+static_assert(SIZEOF_MEMBER(fr_value_box_t, datum.inline_buf) > 16,
+	      "inline value buffer too small for an authenticator");
 
 static_assert(SIZEOF_MEMBER(fr_value_box_t, datum.boolean) == 1,
 	      "datum.boolean has unexpected length");
@@ -500,9 +502,75 @@ static inline void fr_value_box_copy_meta(fr_value_box_t *dst, fr_value_box_t co
 	dst->enumv = src->enumv;
 	dst->type = src->type;
 	dst->tainted = src->tainted;
+	dst->borrowed = false;	/* callers set this if they didn't copy the buffer */
 	dst->next = NULL;	/* copy one */
 }
 
+/** Whether a value of len bytes can be stored in the box instead of a buffer allocated in ctx
+ *
+ * Only if the box is part of the ctx chunk, so that the value lives
+ * exactly as long as a buffer allocated in ctx would have.  Boxes on
+ * the stack, or in some other chunk, always get a talloced buffer, as
+ * callers may keep pointers to the value after the box has gone.
+ *
+ * @param[in] ctx	the buffer would be allocated in.
+ * @param[in] dst	box to store the value in.
+ * @param[in] len	of the value, including any \0 terminator.
+ */
+static inline CC_HINT(always_inline) bool value_box_inline_ok(TALLOC_CTX *ctx, fr_value_box_t const *dst, size_t len)
+{
+	uint8_t const *start = ctx;
+
+	if (!ctx || (len > sizeof(dst->datum.inline_buf))) return false;
+
+	return ((uint8_t const *)dst >= start) && ((uint8_t const *)(dst + 1) <= (start + talloc_get_size(ctx)));
+}
+
+/** Store a value in the box itself
+ *
+ * The box is marked as borrowing its buffer, so clearing it doesn't try
+ * to free anything, and anything which grows the value in place first
+ * moves it to a talloced buffer.
+ *
+ * @param[in] dst	to store the value in.  Type and meta data must already be set.
+ * @param[in] src	value.  May point into dst.
+ * @param[in] len	of the value, excluding any \0 terminator.
+ */
+static inline CC_HINT(always_inline) void value_box_inline_set(fr_value_box_t *dst, void const *src, size_t len)
+{
+	if (len) memmove(dst->datum.inline_buf, src, len);
+	if (dst->type == FR_TYPE_STRING) dst->datum.inline_buf[len] = '\0';
+
+	dst->datum.ptr = dst->datum.inline_buf;
+	dst->vb_length = len;
+	dst->borrowed = true;
+}
+
+/** Initialise a box and store a value in it
+ *
+ * @param[in] dst	to initialise.
+ * @param[in] type	of the value, either #FR_TYPE_STRING or #FR_TYPE_OCTETS.
+ * @param[in] enumv	Aliases for values.
+ * @param[in] src	value.  May point into dst.
+ * @param[in] len	of the value, excluding any \0 terminator.
+ * @param[in] tainted	Whether the value came from a trusted source.
+ */
+static inline CC_HINT(always_inline) void value_box_inline_init(fr_value_box_t *dst, fr_type_t type,
+								 fr_dict_attr_t const *enumv,
+								 void const *src, size_t len, bool tainted)
+{
+	uint8_t tmp[SIZEOF_MEMBER(fr_value_box_t, datum.inline_buf)];
+
+	/*
+	 *	Initialising the box would zero
+	 *	src if it's already in the box.
+	 */
+	if (len) memcpy(tmp, src, len);
+
+	fr_value_box_init(dst, type, enumv, tainted);
+	value_box_inline_set(dst, tmp, len);
+}
+
 /** Compare two values
  *
  * @param[in] a Value to compare.
@@ -1836,7 +1904,7 @@ static inline int fr_value_box_cast_to_strvalue(TALLOC_CTX *ctx, fr_value_box_t
 				/*
 				 *	Append and continue
 				 */
-				ret = fr_value_box_bstr_append_buffer(ctx, dst, tmp.vb_strvalue, tmp.tainted);
+				ret = fr_value_box_bstrn_append(ctx, dst, tmp.vb_strvalue, tmp.vb_length, tmp.tainted);
 				fr_value_box_clear(&tmp);
 				if (ret < 0) {
 				error:
@@ -1846,7 +1914,7 @@ static inline int fr_value_box_cast_to_strvalue(TALLOC_CTX *ctx, fr_value_box_t
 				continue;
 			}
 
-			if (fr_value_box_bstr_append_buffer(ctx, dst, vb->vb_strvalue, vb->tainted) < 0) goto error;
+			if (fr_value_box_bstrn_append(ctx, dst, vb->vb_strvalue, vb->vb_length, vb->tainted) < 0) goto error;
 		}
 	}
 		return 0;
@@ -1856,7 +1924,22 @@ static inline int fr_value_box_cast_to_strvalue(TALLOC_CTX *ctx, fr_value_box_t
 	 */
 	default:
 	{
-		char *str;
+		char	*str;
+
+		/*
+		 *	Most presentation formats are short
+		 *	enough to store in the box.
+		 */
+		if (value_box_inline_ok(ctx, dst, 1)) {
+			char	buffer[SIZEOF_MEMBER(fr_value_box_t, datum.inline_buf)];
+			ssize_t	slen;
+
+			slen = fr_value_box_print(&FR_SBUFF_OUT(buffer, sizeof(buffer)), src, NULL);
+			if (slen >= 0) {
+				value_box_inline_init(dst, FR_TYPE_STRING, dst_enumv, buffer, slen, src->tainted);
+				return 0;
+			}
+		}
 
 		fr_value_box_aprint(ctx, &str, src, NULL);
 		if (unlikely(!str)) return -1;
@@ -1920,7 +2003,7 @@ static inline int fr_value_box_cast_to_octets(TALLOC_CTX *ctx, fr_value_box_t *d
 				/*
 				 *	Append and continue
 				 */
-				ret = fr_value_box_mem_append_buffer(ctx, dst, tmp.vb_octets, tmp.tainted);
+				ret = fr_value_box_mem_append(ctx, dst, tmp.vb_octets, tmp.vb_length, tmp.tainted);
 				fr_value_box_clear(&tmp);
 				if (ret < 0) {
 				error:
@@ -1930,7 +2013,7 @@ static inline int fr_value_box_cast_to_octets(TALLOC_CTX *ctx, fr_value_box_t *d
 				continue;
 			}
 
-			if (fr_value_box_mem_append_buffer(ctx, dst, vb->vb_octets, vb->tainted) < 0) goto error;
+			if (fr_value_box_mem_append(ctx, dst, vb->vb_octets, vb->vb_length, vb->tainted) < 0) goto error;
 		}
 		return 0;
 	}
@@ -3118,7 +3201,8 @@ void fr_value_box_clear_value(fr_value_box_t *data)
 	switch (data->type) {
 	case FR_TYPE_OCTETS:
 	case FR_TYPE_STRING:
-		talloc_free(data->datum.ptr);
+		if (!data->borrowed) talloc_free(data->datum.ptr);
+		data->borrowed = false;
 		break;
 
 	case FR_TYPE_STRUCTURAL:
@@ -3204,6 +3288,12 @@ int fr_value_box_copy(TALLOC_CTX *ctx, fr_value_box_t *dst, const fr_value_box_t
 	{
 		char *str = NULL;
 
+		if (value_box_inline_ok(ctx, dst, src->vb_length + 1)) {
+			fr_value_box_copy_meta(dst, src);
+			value_box_inline_set(dst, src->vb_strvalue, src->vb_length);
+			return 0;
+		}
+
 		/*
 		 *	Zero length strings still have a one uint8 buffer
 		 */
@@ -3220,6 +3310,12 @@ int fr_value_box_copy(TALLOC_CTX *ctx, fr_value_box_t *dst, const fr_value_box_t
 	{
 		uint8_t *bin = NULL;
 
+		if (value_box_inline_ok(ctx, dst, src->vb_length)) {
+			fr_value_box_copy_meta(dst, src);
+			value_box_inline_set(dst, src->vb_octets, src->vb_length);
+			return 0;
+		}
+
 		if (src->vb_length) {
 			bin = talloc_memdup(ctx, src->vb_octets, src->vb_length);
 			if (!bin) {
@@ -3258,6 +3354,28 @@ void fr_value_box_copy_shallow(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_value_bo
 
 	case FR_TYPE_STRING:
 	case FR_TYPE_OCTETS:
+		/*
+		 *	Inline values are small enough to copy,
+		 *	which means the copy doesn't depend on
+		 *	src staying around.
+		 */
+		if (fr_value_box_is_inline(src)) {
+			fr_value_box_copy_meta(dst, src);
+			value_box_inline_set(dst, src->datum.inline_buf, src->vb_length);
+			break;
+		}
+
+		/*
+		 *	Borrowed buffers aren't talloced, so we
+		 *	can't add a reference.  The copy borrows
+		 *	from the same owner.
+		 */
+		if (src->borrowed) {
+			dst->datum.ptr = src->datum.ptr;
+			fr_value_box_copy_meta(dst, src);
+			dst->borrowed = true;
+			break;
+		}
 		dst->datum.ptr = ctx ? talloc_reference(ctx, src->datum.ptr) : src->datum.ptr;
 		fr_value_box_copy_meta(dst, src);
 		break;
@@ -3277,6 +3395,12 @@ int fr_value_box_steal(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_value_box_t cons
 {
 	if (!fr_cond_assert(src->type != FR_TYPE_INVALID)) return -1;
 
+	/*
+	 *	There's nothing to steal, the buffer
+	 *	belongs to someone else.
+	 */
+	if (src->borrowed) return fr_value_box_copy(ctx, dst, src);
+
 	switch (src->type) {
 	default:
 		return fr_value_box_copy(ctx, dst, src);
@@ -3329,8 +3453,14 @@ int fr_value_box_strdup(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_dict_attr_t con
 			char const *src, bool tainted)
 {
 	char const	*str;
+	size_t		len = strlen(src);
 
-	str = talloc_typed_strdup(ctx, src);
+	if (value_box_inline_ok(ctx, dst, len + 1)) {
+		value_box_inline_init(dst, FR_TYPE_STRING, enumv, src, len, tainted);
+		return 0;
+	}
+
+	str = talloc_bstrndup(ctx, src, len);
 	if (!str) {
 		fr_strerror_const("Failed allocating string buffer");
 		return -1;
@@ -3338,7 +3468,7 @@ int fr_value_box_strdup(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_dict_attr_t con
 
 	fr_value_box_init(dst, FR_TYPE_STRING, enumv, tainted);
 	dst->vb_strvalue = str;
-	dst->vb_length = talloc_array_length(str) - 1;
+	dst->vb_length = len;
 
 	return 0;
 }
@@ -3359,6 +3489,15 @@ int fr_value_box_strtrim(TALLOC_CTX *ctx, fr_value_box_t *vb)
 	if (!fr_cond_assert(vb->type == FR_TYPE_STRING)) return -1;
 
 	len = strlen(vb->vb_strvalue);
+
+	/*
+	 *	Not our buffer to shrink.
+	 */
+	if (vb->borrowed) {
+		vb->vb_length = len;
+		return 0;
+	}
+
 	str = talloc_realloc(ctx, UNCONST(char *, vb->vb_strvalue), char, len + 1);
 	if (!str) {
 		fr_strerror_const("Failed re-allocing string buffer");
@@ -3493,6 +3632,8 @@ int fr_value_box_bstr_realloc(TALLOC_CTX *ctx, char **out, fr_value_box_t *dst,
 
 	fr_assert(dst->type == FR_TYPE_STRING);
 
+	if (dst->borrowed && (fr_value_box_unborrow(ctx, dst) < 0)) return -1;
+
 	memcpy(&cstr, &dst->vb_strvalue, sizeof(cstr));
 
 	clen = talloc_array_length(dst->vb_strvalue) - 1;
@@ -3534,6 +3675,11 @@ int fr_value_box_bstrndup(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_dict_attr_t c
 {
 	char const	*str;
 
+	if (value_box_inline_ok(ctx, dst, len + 1)) {
+		value_box_inline_init(dst, FR_TYPE_STRING, enumv, src, len, tainted);
+		return 0;
+	}
+
 	str = talloc_bstrndup(ctx, src, len);
 	if (!str) {
 		fr_strerror_const("Failed allocating string buffer");
@@ -3552,6 +3698,13 @@ int fr_value_box_bstrndup_dbuff(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_dict_at
 {
 	char	*str;
 
+	if (value_box_inline_ok(ctx, dst, len + 1)) {
+		fr_value_box_init(dst, FR_TYPE_STRING, enumv, tainted);
+		if (fr_dbuff_out_memcpy(dst->datum.inline_buf, dbuff, len) < 0) return -1;
+		value_box_inline_set(dst, dst->datum.inline_buf, len);
+		return 0;
+	}
+
 	str = talloc_array(ctx, char, len + 1);
 	if (!str) {
 		fr_strerror_printf("Failed allocating string buffer");
@@ -3673,9 +3826,22 @@ int fr_value_box_bstrn_append(TALLOC_CTX *ctx, fr_value_box_t *dst, char const *
 		return -1;
 	}
 
-	ptr = dst->datum.ptr;
-	if (!fr_cond_assert(ptr)) return -1;
+	if (!fr_cond_assert(dst->datum.ptr)) return -1;
 
+	/*
+	 *	Append in place if the result still fits
+	 */
+	if (fr_value_box_is_inline(dst) && ((dst->vb_length + len + 1) <= sizeof(dst->datum.inline_buf))) {
+		memcpy(dst->datum.inline_buf + dst->vb_length, src, len);
+		dst->vb_length += len;
+		dst->datum.inline_buf[dst->vb_length] = '\0';
+		dst->tainted = dst->tainted || tainted;
+		return 0;
+	}
+
+	if (dst->borrowed && (fr_value_box_unborrow(ctx, dst) < 0)) return -1;
+
+	ptr = dst->datum.ptr;
 	if (talloc_reference_count(ptr) > 0) {
 		fr_strerror_printf("%s: Boxed value has too many references", __FUNCTION__);
 		return -1;
@@ -3787,6 +3953,8 @@ int fr_value_box_mem_realloc(TALLOC_CTX *ctx, uint8_t **out, fr_value_box_t *dst
 
 	fr_assert(dst->type == FR_TYPE_OCTETS);
 
+	if (dst->borrowed && (fr_value_box_unborrow(ctx, dst) < 0)) return -1;
+
 	memcpy(&cbin, &dst->vb_octets, sizeof(cbin));
 
 	clen = talloc_array_length(dst->vb_octets);
@@ -3833,6 +4001,11 @@ int fr_value_box_memdup(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_dict_attr_t con
 {
 	uint8_t *bin;
 
+	if (value_box_inline_ok(ctx, dst, len)) {
+		value_box_inline_init(dst, FR_TYPE_OCTETS, enumv, src, len, tainted);
+		return 0;
+	}
+
 	bin = talloc_memdup(ctx, src, len);
 	if (!bin) {
 		fr_strerror_const("Failed allocating octets buffer");
@@ -3852,6 +4025,13 @@ int fr_value_box_memdup_dbuff(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_dict_attr
 {
 	uint8_t *bin;
 
+	if (value_box_inline_ok(ctx, dst, len)) {
+		fr_value_box_init(dst, FR_TYPE_OCTETS, enumv, tainted);
+		if (fr_dbuff_out_memcpy(dst->datum.inline_buf, dbuff, len) < (ssize_t) len) return -1;
+		value_box_inline_set(dst, dst->datum.inline_buf, len);
+		return 0;
+	}
+
 	bin = talloc_size(ctx, len);
 	if (!bin) {
 		fr_strerror_printf("Failed allocating octets buffer");
@@ -3930,6 +4110,79 @@ void fr_value_box_memdup_buffer_shallow(TALLOC_CTX *ctx, fr_value_box_t *dst, fr
 	dst->vb_length = talloc_array_length(src);
 }
 
+/** Point a box at a region of a buffer owned by something else
+ *
+ * Unlike #fr_value_box_memdup_shallow the box is marked as borrowed, so
+ * clearing it won't try to free the buffer, and any attempt to modify
+ * the value in place will first copy it into a buffer the box owns.
+ *
+ * The caller MUST ensure that the owner of src outlives the box.
+ *
+ * @param[in] dst 	to assign buffer to.
+ * @param[in] enumv	Aliases for values.
+ * @param[in] src	a region of a buffer.  Need not be talloced.
+ * @param[in] len	of the region.
+ * @param[in] tainted	Whether the value came from a trusted source.
+ */
+void fr_value_box_memdup_borrow(fr_value_box_t *dst, fr_dict_attr_t const *enumv,
+				uint8_t const *src, size_t len, bool tainted)
+{
+	fr_value_box_init(dst, FR_TYPE_OCTETS, enumv, tainted);
+	dst->vb_octets = src;
+	dst->vb_length = len;
+	dst->borrowed = true;
+}
+
+/** Give a box that borrowed its buffer a private copy of the data
+ *
+ * @param[in] ctx	to allocate the new buffer in.
+ * @param[in] vb	to convert.  Does nothing if vb doesn't
+ *			borrow its buffer.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_value_box_unborrow(TALLOC_CTX *ctx, fr_value_box_t *vb)
+{
+	if (!vb->borrowed) return 0;
+
+	switch (vb->type) {
+	case FR_TYPE_STRING:
+	{
+		char *str;
+
+		str = talloc_bstrndup(ctx, vb->vb_strvalue, vb->vb_length);
+		if (!str) {
+			fr_strerror_const("Failed allocating string buffer");
+			return -1;
+		}
+		vb->vb_strvalue = str;
+	}
+		break;
+
+	case FR_TYPE_OCTETS:
+	{
+		uint8_t *bin;
+
+		bin = talloc_memdup(ctx, vb->vb_octets, vb->vb_length);
+		if (!bin) {
+			fr_strerror_const("Failed allocating octets buffer");
+			return -1;
+		}
+		talloc_set_type(bin, uint8_t);
+		vb->vb_octets = bin;
+	}
+		break;
+
+	default:
+		break;
+	}
+
+	vb->borrowed = false;
+
+	return 0;
+}
+
 /** Append data to an existing fr_value_box_t
  *
  * @param[in] ctx	Where to allocate any talloc buffers required.
@@ -3957,6 +4210,18 @@ int fr_value_box_mem_append(TALLOC_CTX *ctx, fr_value_box_t *dst, uint8_t const
 
 	if (!fr_cond_assert(dst->datum.ptr)) return -1;
 
+	/*
+	 *	Append in place if the result still fits
+	 */
+	if (fr_value_box_is_inline(dst) && ((dst->vb_length + len) <= sizeof(dst->datum.inline_buf))) {
+		memcpy(dst->datum.inline_buf + dst->vb_length, src, len);
+		dst->vb_length += len;
+		dst->tainted = dst->tainted || tainted;
+		return 0;
+	}
+
+	if (dst->borrowed && (fr_value_box_unborrow(ctx, dst) < 0)) return -1;
+
 	if (talloc_reference_count(dst->datum.ptr) > 0) {
 		fr_strerror_printf("%s: Boxed value has too many references", __FUNCTION__);
 		return -1;
@@ -4544,6 +4809,7 @@ finish:
 	dst->vb_length = ret;
 	dst->type = *dst_type;
 	dst->tainted = tainted;
+	dst->borrowed = false;
 
 	/*
 	 *	Fixup enumvs
@@ -118,6 +118,21 @@ struct value_box_s {
 				uint8_t const	*octets;	//!< Pointer to binary string.
 				void		*ptr;		//!< generic pointer.
 			};
+
+			/*
+			 *	Short values are stored here instead of in
+			 *	a separate buffer.  Sized to use the space
+			 *	the larger members of datum already take up.
+			 *
+			 *	Callers must not assume strvalue/octets
+			 *	were allocated with talloc, and boxes must
+			 *	be copied with fr_value_box_copy() or
+			 *	fr_value_box_copy_shallow().  A plain struct
+			 *	copy still points at the source box's
+			 *	inline_buf, so is only valid for as long as
+			 *	the source box is.
+			 */
+			uint8_t		inline_buf[sizeof(fr_value_box_list_t) - sizeof(void *)];
 		};
 
 		/*
@@ -161,6 +176,10 @@ struct value_box_s {
 
 	bool				tainted;		//!< i.e. did it come from an untrusted source
 
+	bool				borrowed;		//!< datum.ptr points into a buffer owned by
+								///< something else, or into datum.inline_buf,
+								///< so must not be freed or resized.
+
 	fr_dict_attr_t const		*enumv;			//!< Enumeration values.
 
 	fr_value_box_t			*next;			//!< Next in a series of value_box.
@@ -370,6 +389,16 @@ static inline CC_HINT(always_inline) void fr_value_box_init_null(fr_value_box_t
 	fr_value_box_init(vb, FR_TYPE_INVALID, NULL, false);
 }
 
+/** Whether the value of a string or octets box is stored in the box itself
+ *
+ * Inline values are treated as borrowed, and are moved to a talloced
+ * buffer if they need to grow.
+ */
+static inline CC_HINT(always_inline) bool fr_value_box_is_inline(fr_value_box_t const *vb)
+{
+	return vb->borrowed && (vb->datum.ptr == vb->datum.inline_buf);
+}
+
 /** Allocate a value box of a specific type
  *
  * Allocates memory for the box, and sets the length of the value
@@ -707,6 +736,11 @@ void		fr_value_box_memdup_shallow(fr_value_box_t *dst, fr_dict_attr_t const *enu
 void		fr_value_box_memdup_buffer_shallow(TALLOC_CTX *ctx, fr_value_box_t *dst, fr_dict_attr_t const *enumv,
 						   uint8_t const *src, bool tainted);
 
+void		fr_value_box_memdup_borrow(fr_value_box_t *dst, fr_dict_attr_t const *enumv,
+					   uint8_t const *src, size_t len, bool tainted);
+
+int		fr_value_box_unborrow(TALLOC_CTX *ctx, fr_value_box_t *vb);
+
 int		fr_value_box_mem_append(TALLOC_CTX *ctx, fr_value_box_t *dst,
 				       uint8_t const *src, size_t len, bool tainted);
 
@@ -45,6 +45,9 @@ typedef struct {
 
 	fr_io_address_t			*connection;		//!< for connected sockets.
 
+	udp_batch_t			*batch;			//!< for io_uring receives.  NULL if reading
+								//!< the socket directly.
+
 	fr_stats_t			stats;			//!< statistics for this socket
 }  proto_dhcpv4_udp_thread_t;
 
@@ -70,6 +73,9 @@ typedef struct {
 	bool				recv_buff_is_set;	//!< Whether we were provided with a receive
 								//!< buffer value.
 	bool				dynamic_clients;	//!< whether we have dynamic clients
+	bool				per_network_socket;	//!< open one socket per network thread
+	bool				cpu_steering;		//!< steer packets to sockets by CPU
+	bool				io_uring;		//!< use io_uring for reads
 
 	RADCLIENT_LIST			*clients;		//!< local clients
 	RADCLIENT			*default_client;	//!< default 0/0 client
@@ -102,6 +108,10 @@ static const CONF_PARSER udp_listen_config[] = {
 
 	{ FR_CONF_OFFSET("broadcast", FR_TYPE_BOOL, proto_dhcpv4_udp_t, broadcast) } ,
 
+	{ FR_CONF_OFFSET("per_network_socket", FR_TYPE_BOOL, proto_dhcpv4_udp_t, per_network_socket) } ,
+	{ FR_CONF_OFFSET("cpu_steering", FR_TYPE_BOOL, proto_dhcpv4_udp_t, cpu_steering) } ,
+	{ FR_CONF_OFFSET("io_uring", FR_TYPE_BOOL, proto_dhcpv4_udp_t, io_uring), .dflt = "no" } ,
+
 	{ FR_CONF_OFFSET("dynamic_clients", FR_TYPE_BOOL, proto_dhcpv4_udp_t, dynamic_clients) } ,
 	{ FR_CONF_POINTER("networks", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) networks_config },
 
@@ -156,7 +166,12 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	 */
 	flags = UDP_FLAGS_CONNECTED * (thread->connection != NULL);
 
-	data_size = udp_recv(thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
+	if (thread->batch) {
+		data_size = udp_batch_recv(thread->batch, thread->sockfd, flags, &address->socket,
+					   buffer, buffer_len, recv_time_p);
+	} else {
+		data_size = udp_recv(thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
+	}
 	if (data_size < 0) {
 		RATE_LIMIT_GLOBAL(PERROR, "Read error (%zd)", data_size);
 		return data_size;
@@ -477,6 +492,14 @@ send_reply:
 }
 
 
+static bool mod_read_pending(fr_listen_t const *li)
+{
+	proto_dhcpv4_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_dhcpv4_udp_thread_t);
+
+	return thread->batch && udp_batch_pending(thread->batch);
+}
+
+
 static int mod_connection_set(fr_listen_t *li, fr_io_address_t *connection)
 {
 	proto_dhcpv4_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_dhcpv4_udp_thread_t);
@@ -495,6 +518,13 @@ static void mod_network_get(void *instance, int *ipproto, bool *dynamic_clients,
 	*trie = inst->trie;
 }
 
+static bool mod_shard_get(void const *instance)
+{
+	proto_dhcpv4_udp_t const *inst = talloc_get_type_abort_const(instance, proto_dhcpv4_udp_t);
+
+	return inst->per_network_socket;
+}
+
 
 /** Open a UDP listener for DHCPV4
  *
@@ -547,8 +577,37 @@ static int mod_open(fr_listen_t *li)
 		goto error;
 	}
 
+	/*
+	 *	Once the first socket of the group is bound, steer
+	 *	packets to the socket for the CPU which received them.
+	 */
+	if (inst->cpu_steering && (li->num_shards > 1) && (li->shard == 0) &&
+	    (fr_socket_reuseport_cpu_steer(sockfd, li->num_shards) < 0)) {
+		PWARN("Failed enabling CPU steering");
+	}
+
 	thread->sockfd = sockfd;
 
+	/*
+	 *	With io_uring, packets are received without the
+	 *	socket becoming readable, so the network thread
+	 *	waits on the ring's eventfd for reads.  Replies
+	 *	are still written directly to the socket.
+	 */
+	if (inst->io_uring && !thread->connection) {
+		int fd = -1;
+
+		thread->batch = udp_batch_alloc(thread, 1, inst->max_packet_size);
+		if (thread->batch) fd = udp_batch_io_uring_recv(thread->batch, sockfd);
+
+		if (fd < 0) {
+			PWARN("Failed enabling io_uring for receives, falling back to recvfrom()");
+			TALLOC_FREE(thread->batch);
+		} else {
+			li->read_fd = fd;
+		}
+	}
+
 	fr_assert((cf_parent(inst->cs) != NULL) && (cf_parent(cf_parent(inst->cs)) != NULL));	/* listen { ... } */
 
 	thread->name = fr_app_io_socket_name(thread, &proto_dhcpv4_udp,
@@ -560,6 +619,20 @@ static int mod_open(fr_listen_t *li)
 }
 
 
+/** Close the socket, and any io_uring eventfd we're waiting on
+ *
+ */
+static int mod_close(fr_listen_t *li)
+{
+	proto_dhcpv4_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_dhcpv4_udp_thread_t);
+
+	TALLOC_FREE(thread->batch);
+
+	close(thread->sockfd);
+	return 0;
+}
+
+
 /** Set the file descriptor for this socket.
  *
  */
@@ -647,6 +720,13 @@ static int mod_compare(UNUSED void const *instance, UNUSED void *thread_instance
 	return (a->message_type < b->message_type) - (a->message_type > b->message_type);
 }
 
+static uint32_t mod_track_hash(void const *track)
+{
+	proto_dhcpv4_track_t const *a = track;
+
+	return fr_hash_update(&a->message_type, sizeof(a->message_type), fr_hash(&a->xid, sizeof(a->xid)));
+}
+
 static char const *mod_name(fr_listen_t *li)
 {
 	proto_dhcpv4_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_dhcpv4_udp_thread_t);
@@ -814,13 +894,17 @@ fr_app_io_t proto_dhcpv4_udp = {
 	.track_duplicates	= true,
 
 	.open			= mod_open,
+	.close			= mod_close,
 	.read			= mod_read,
+	.read_pending		= mod_read_pending,
 	.write			= mod_write,
 	.fd_set			= mod_fd_set,
 	.track			= mod_track_create,
 	.compare		= mod_compare,
+	.track_hash		= mod_track_hash,
 	.connection_set		= mod_connection_set,
 	.network_get		= mod_network_get,
+	.shard_get		= mod_shard_get,
 	.client_find		= mod_client_find,
 	.get_name      		= mod_name,
 };
@@ -70,6 +70,8 @@ typedef struct {
 	bool				recv_buff_is_set;	//!< Whether we were provided with a receive
 								//!< buffer value.
 	bool				dynamic_clients;	//!< whether we have dynamic clients
+	bool				per_network_socket;	//!< open one socket per network thread
+	bool				cpu_steering;		//!< steer packets to sockets by CPU
 
 	RADCLIENT_LIST			*clients;		//!< local clients
 	RADCLIENT			*default_client;	//!< default 0/0 client
@@ -102,6 +104,9 @@ static const CONF_PARSER udp_listen_config[] = {
 
 	{ FR_CONF_OFFSET("hop_limit", FR_TYPE_UINT32, proto_dhcpv6_udp_t, hop_limit) },
 
+	{ FR_CONF_OFFSET("per_network_socket", FR_TYPE_BOOL, proto_dhcpv6_udp_t, per_network_socket) } ,
+	{ FR_CONF_OFFSET("cpu_steering", FR_TYPE_BOOL, proto_dhcpv6_udp_t, cpu_steering) } ,
+
 	{ FR_CONF_OFFSET("dynamic_clients", FR_TYPE_BOOL, proto_dhcpv6_udp_t, dynamic_clients) } ,
 	{ FR_CONF_POINTER("networks", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) networks_config },
 
@@ -276,6 +281,13 @@ static void mod_network_get(void *instance, int *ipproto, bool *dynamic_clients,
 	*trie = inst->trie;
 }
 
+static bool mod_shard_get(void const *instance)
+{
+	proto_dhcpv6_udp_t const *inst = talloc_get_type_abort_const(instance, proto_dhcpv6_udp_t);
+
+	return inst->per_network_socket;
+}
+
 
 /** Open a UDP listener for DHCPv6
  *
@@ -349,6 +361,15 @@ static int mod_open(fr_listen_t *li)
 		}
 	}
 
+	/*
+	 *	Once the first socket of the group is bound, steer
+	 *	packets to the socket for the CPU which received them.
+	 */
+	if (inst->cpu_steering && (li->num_shards > 1) && (li->shard == 0) &&
+	    (fr_socket_reuseport_cpu_steer(sockfd, li->num_shards) < 0)) {
+		PWARN("Failed enabling CPU steering");
+	}
+
 	thread->sockfd = sockfd;
 
 	fr_assert((cf_parent(inst->cs) != NULL) && (cf_parent(cf_parent(inst->cs)) != NULL));	/* listen { ... } */
@@ -446,6 +467,13 @@ static int mod_compare(UNUSED void const *instance, UNUSED void *thread_instance
 	return memcmp(a->client_id, b->client_id, a->client_id_len);
 }
 
+static uint32_t mod_track_hash(void const *track)
+{
+	proto_dhcpv6_track_t const *a = track;
+
+	return fr_hash(&a->header, sizeof(a->header));
+}
+
 
 static char const *mod_name(fr_listen_t *li)
 {
@@ -667,8 +695,10 @@ fr_app_io_t proto_dhcpv6_udp = {
 	.fd_set			= mod_fd_set,
 	.track			= mod_track_create,
 	.compare		= mod_compare,
+	.track_hash		= mod_track_hash,
 	.connection_set		= mod_connection_set,
 	.network_get		= mod_network_get,
+	.shard_get		= mod_shard_get,
 	.client_find		= mod_client_find,
 	.get_name      		= mod_name,
 };
@@ -83,9 +83,13 @@ static CONF_PARSER const proto_radius_config[] = {
 	 */
 	{ FR_CONF_OFFSET("tunnel_password_zeros", FR_TYPE_BOOL, proto_radius_t, tunnel_password_zeros) } ,
 
+	{ FR_CONF_OFFSET("zero_copy", FR_TYPE_BOOL, proto_radius_t, zero_copy) } ,
+
 	{ FR_CONF_POINTER("limit", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) limit_config },
 	{ FR_CONF_POINTER("priority", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) priority_config },
 
+	{ FR_CONF_OFFSET("affinity", FR_TYPE_STRING | FR_TYPE_MULTI, proto_radius_t, affinity) },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -192,6 +196,7 @@ static int mod_decode(void const *instance, request_t *request, uint8_t *const d
 	fr_io_address_t const  	*address = track->address;
 	RADCLIENT const		*client;
 	fr_dcursor_t		cursor;
+	ssize_t			slen;
 
 	fr_assert(data[0] < FR_RADIUS_MAX_PACKET_CODE);
 
@@ -219,11 +224,21 @@ static int mod_decode(void const *instance, request_t *request, uint8_t *const d
 	 *	Note that we don't set a limit on max_attributes here.
 	 *	That MUST be set and checked in the underlying
 	 *	transport, via a call to fr_radius_ok().
+	 *
+	 *	With zero_copy, octets attributes point into
+	 *	packet->data, which lives as long as the request.
 	 */
 	fr_dcursor_init(&cursor, &request->request_pairs);
-	if (fr_radius_decode(request->request_ctx, request->packet->data, request->packet->data_len,
-			     NULL, client->secret, talloc_array_length(client->secret) - 1,
-			     &cursor) < 0) {
+	if (inst->zero_copy) {
+		slen = fr_radius_decode_borrow(request->request_ctx, request->packet->data, request->packet->data_len,
+					       NULL, client->secret, talloc_array_length(client->secret) - 1,
+					       &cursor);
+	} else {
+		slen = fr_radius_decode(request->request_ctx, request->packet->data, request->packet->data_len,
+					NULL, client->secret, talloc_array_length(client->secret) - 1,
+					&cursor);
+	}
+	if (slen < 0) {
 		RPEDEBUG("Failed decoding packet");
 		return -1;
 	}
@@ -472,6 +487,37 @@ static int mod_priority_set(void const *instance, uint8_t const *buffer, UNUSED
 	return inst->priorities[buffer[0]];
 }
 
+/** Hash the attributes which identify a session
+ *
+ * The packet has already been verified by the transport, so we
+ * can just walk over the attributes.
+ */
+static uint32_t mod_affinity_get(void const *instance, uint8_t const *buffer, size_t buflen)
+{
+	proto_radius_t const	*inst = talloc_get_type_abort_const(instance, proto_radius_t);
+	uint8_t const		*p, *end;
+	uint32_t		hash = 0;
+	bool			found = false;
+
+	if (!inst->affinity || (buflen < RADIUS_HEADER_LENGTH)) return 0;
+
+	end = buffer + ((buffer[2] << 8) | buffer[3]);
+	if (end > (buffer + buflen)) end = buffer + buflen;
+
+	for (p = buffer + RADIUS_HEADER_LENGTH; (p + 2) <= end; p += p[1]) {
+		if ((p[1] < 2) || ((p + p[1]) > end)) break;
+
+		if (!inst->affinity_attrs[p[0]]) continue;
+
+		hash = fr_hash_update(p, p[1], hash);
+		found = true;
+	}
+
+	if (!found) return 0;
+
+	return hash ? hash : 1;
+}
+
 /** Open listen sockets/connect to external event source
  *
  * @param[in] instance	Ctx data for this application.
@@ -528,6 +574,32 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, 1024);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65535);
 
+	/*
+	 *	We only look at the raw packet, so we can only use
+	 *	top-level attributes.
+	 */
+	if (inst->affinity) {
+		size_t i;
+
+		for (i = 0; i < talloc_array_length(inst->affinity); i++) {
+			fr_dict_attr_t const *da;
+
+			da = fr_dict_attr_by_name(NULL, fr_dict_root(dict_radius), inst->affinity[i]);
+			if (!da) {
+				cf_log_err(conf, "Unknown attribute '%s' in 'affinity'", inst->affinity[i]);
+				return -1;
+			}
+
+			if (!da->parent->flags.is_root || (da->attr > UINT8_MAX)) {
+				cf_log_err(conf, "Attribute '%s' in 'affinity' must be a top-level RADIUS attribute",
+					   inst->affinity[i]);
+				return -1;
+			}
+
+			inst->affinity_attrs[da->attr] = true;
+		}
+	}
+
 	/*
 	 *	Instantiate the master io submodule
 	 */
@@ -627,5 +699,6 @@ fr_app_t proto_radius = {
 	.decode			= mod_decode,
 	.encode			= mod_encode,
 	.entry_point_set	= mod_entry_point_set,
-	.priority		= mod_priority_set
+	.priority		= mod_priority_set,
+	.affinity		= mod_affinity_get
 };
@@ -40,6 +40,11 @@ typedef struct {
 
 	bool				tunnel_password_zeros;		//!< check for trailing zeroes in Tunnel-Password.
 
+	bool				zero_copy;			//!< octets attributes reference the packet.
+
 	uint32_t			priorities[FR_RADIUS_MAX_PACKET_CODE];	//!< priorities for individual packets
+
+	char const			**affinity;			//!< attributes which identify a session.
+	bool				affinity_attrs[UINT8_MAX + 1];	//!< lookup of the above, by attribute number.
 } proto_radius_t;
 
@@ -375,6 +375,14 @@ static int mod_compare(void const *instance, UNUSED void *thread_instance, UNUSE
 	return (a[0] < b[0]) - (a[0] > b[0]);
 }
 
+/** Hash the ID and code, which mod_compare() always checks
+ *
+ */
+static uint32_t mod_track_hash(void const *track)
+{
+	return fr_hash(track, 2);
+}
+
 
 static char const *mod_name(fr_listen_t *li)
 {
@@ -595,6 +603,7 @@ fr_app_io_t proto_radius_tcp = {
 	.write			= mod_write,
 	.fd_set			= mod_fd_set,
 	.compare		= mod_compare,
+	.track_hash		= mod_track_hash,
 	.connection_set		= mod_connection_set,
 	.network_get		= mod_network_get,
 	.client_find		= mod_client_find,
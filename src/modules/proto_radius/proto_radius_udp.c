@@ -44,6 +44,9 @@ typedef struct {
 
 	fr_io_address_t			*connection;		//!< for connected sockets.
 
+	udp_batch_t			*batch;			//!< for reading multiple packets at once.
+	udp_batch_t			*send_batch;		//!< for writing multiple packets at once.
+
 	fr_stats_t			stats;			//!< statistics for this socket
 } proto_radius_udp_thread_t;
 
@@ -61,12 +64,18 @@ typedef struct {
 	uint32_t			max_packet_size;	//!< for message ring buffer.
 	uint32_t			max_attributes;		//!< Limit maximum decodable attributes.
 
+	uint32_t			recv_batch;		//!< How many packets to read per system call.
+	uint32_t			send_batch;		//!< How many packets to write per system call.
+
 	uint16_t			port;			//!< Port to listen on.
 
 	bool				recv_buff_is_set;	//!< Whether we were provided with a recv_buff
 	bool				send_buff_is_set;	//!< Whether we were provided with a send_buff
 	bool				dynamic_clients;	//!< whether we have dynamic clients
+	bool				per_network_socket;	//!< open one socket per network thread
+	bool				cpu_steering;		//!< steer packets to sockets by CPU
 	bool				dedup_authenticator;	//!< dedup using the request authenticator
+	bool				io_uring;		//!< use io_uring for batched reads and writes
 
 	RADCLIENT_LIST			*clients;		//!< local clients
 
@@ -98,12 +107,19 @@ static const CONF_PARSER udp_listen_config[] = {
 	{ FR_CONF_OFFSET_IS_SET("send_buff", FR_TYPE_UINT32, proto_radius_udp_t, send_buff) },
 
 	{ FR_CONF_OFFSET("accept_conflicting_packets", FR_TYPE_BOOL, proto_radius_udp_t, dedup_authenticator) } ,
+	{ FR_CONF_OFFSET("per_network_socket", FR_TYPE_BOOL, proto_radius_udp_t, per_network_socket) } ,
+	{ FR_CONF_OFFSET("cpu_steering", FR_TYPE_BOOL, proto_radius_udp_t, cpu_steering) } ,
+
 	{ FR_CONF_OFFSET("dynamic_clients", FR_TYPE_BOOL, proto_radius_udp_t, dynamic_clients) } ,
 	{ FR_CONF_POINTER("networks", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) networks_config },
 
 	{ FR_CONF_OFFSET("max_packet_size", FR_TYPE_UINT32, proto_radius_udp_t, max_packet_size), .dflt = "4096" } ,
        	{ FR_CONF_OFFSET("max_attributes", FR_TYPE_UINT32, proto_radius_udp_t, max_attributes), .dflt = STRINGIFY(RADIUS_MAX_ATTRIBUTES) } ,
 
+	{ FR_CONF_OFFSET("recv_batch", FR_TYPE_UINT32, proto_radius_udp_t, recv_batch), .dflt = "1" } ,
+	{ FR_CONF_OFFSET("send_batch", FR_TYPE_UINT32, proto_radius_udp_t, send_batch), .dflt = "1" } ,
+	{ FR_CONF_OFFSET("io_uring", FR_TYPE_BOOL, proto_radius_udp_t, io_uring), .dflt = "no" } ,
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -134,7 +150,12 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 	 */
 	flags = UDP_FLAGS_CONNECTED * (thread->connection != NULL);
 
-	data_size = udp_recv(thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
+	if (thread->batch && !thread->connection) {
+		data_size = udp_batch_recv(thread->batch, thread->sockfd, flags, &address->socket,
+					   buffer, buffer_len, recv_time_p);
+	} else {
+		data_size = udp_recv(thread->sockfd, flags, &address->socket, buffer, buffer_len, recv_time_p);
+	}
 	if (data_size < 0) {
 		PDEBUG2("proto_radius_udp got read error");
 		return data_size;
@@ -193,6 +214,29 @@ static ssize_t mod_read(fr_listen_t *li, void **packet_ctx, fr_time_t *recv_time
 }
 
 
+static bool mod_read_pending(fr_listen_t const *li)
+{
+	proto_radius_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_radius_udp_thread_t);
+
+	return thread->batch && udp_batch_pending(thread->batch);
+}
+
+
+/** Send one packet, either directly, or by queuing it for mod_flush()
+ *
+ */
+static inline ssize_t udp_write(proto_radius_udp_thread_t *thread, fr_socket_t const *socket, int flags,
+				void *packet, size_t packet_len)
+{
+	if (thread->send_batch && !thread->connection) {
+		if (udp_batch_send(thread->send_batch, socket, packet, packet_len) < 0) return -1;
+
+		return packet_len;
+	}
+
+	return udp_send(socket, flags, packet, packet_len);
+}
+
 static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t request_time,
 			 uint8_t *buffer, size_t buffer_len, UNUSED size_t written)
 {
@@ -235,7 +279,7 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 
 			memcpy(&packet, &track->reply, sizeof(packet)); /* const issues */
 
-			(void) udp_send(&socket, flags, packet, track->reply_len);
+			(void) udp_write(thread, &socket, flags, packet, track->reply_len);
 		}
 
 		return buffer_len;
@@ -250,7 +294,7 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 	 *	Only write replies if they're RADIUS packets.
 	 *	sometimes we want to NOT send a reply...
 	 */
-	data_size = udp_send(&socket, flags, buffer, buffer_len);
+	data_size = udp_write(thread, &socket, flags, buffer, buffer_len);
 
 	/*
 	 *	This socket is dead.  That's an error...
@@ -269,6 +313,24 @@ static ssize_t mod_write(fr_listen_t *li, void *packet_ctx, UNUSED fr_time_t req
 }
 
 
+/** Write all of the packets queued by mod_write()
+ *
+ */
+static int mod_flush(fr_listen_t *li)
+{
+	proto_radius_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_radius_udp_thread_t);
+
+	if (!thread->send_batch) return 0;
+
+	if (udp_batch_flush(thread->send_batch) < 0) {
+		PERROR("proto_radius_udp failed writing replies");
+		return -1;
+	}
+
+	return 0;
+}
+
+
 static int mod_connection_set(fr_listen_t *li, fr_io_address_t *connection)
 {
 	proto_radius_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_radius_udp_thread_t);
@@ -287,6 +349,13 @@ static void mod_network_get(void *instance, int *ipproto, bool *dynamic_clients,
 	*trie = inst->trie;
 }
 
+static bool mod_shard_get(void const *instance)
+{
+	proto_radius_udp_t const *inst = talloc_get_type_abort_const(instance, proto_radius_udp_t);
+
+	return inst->per_network_socket;
+}
+
 
 /** Open a UDP listener for RADIUS
  *
@@ -349,8 +418,61 @@ static int mod_open(fr_listen_t *li)
 		goto error;
 	}
 
+	/*
+	 *	Once the first socket of the group is bound, steer
+	 *	packets to the socket for the CPU which received them.
+	 */
+	if (inst->cpu_steering && (li->num_shards > 1) && (li->shard == 0) &&
+	    (fr_socket_reuseport_cpu_steer(sockfd, li->num_shards) < 0)) {
+		PWARN("Failed enabling CPU steering");
+	}
+
 	thread->sockfd = sockfd;
 
+	/*
+	 *	Read multiple packets per system call.  io_uring
+	 *	always needs a batch, as it reads packets into the
+	 *	batch buffers.
+	 */
+	if ((inst->recv_batch > 1) || (inst->io_uring && !thread->connection)) {
+		thread->batch = udp_batch_alloc(thread, inst->recv_batch, inst->max_packet_size);
+		if (!thread->batch) {
+			close(sockfd);
+			PERROR("Failed allocating receive batch");
+			goto error;
+		}
+	}
+
+	if ((inst->send_batch > 1) || (inst->io_uring && !thread->connection)) {
+		thread->send_batch = udp_batch_alloc(thread, inst->send_batch, inst->max_packet_size);
+		if (!thread->send_batch) {
+			close(sockfd);
+			PERROR("Failed allocating send batch");
+			goto error;
+		}
+	}
+
+	/*
+	 *	With io_uring, packets are received without the
+	 *	socket becoming readable, so the network thread
+	 *	waits on the ring's eventfd for reads.  It still
+	 *	uses the socket to wait for writes.
+	 */
+	if (inst->io_uring && !thread->connection) {
+		int fd;
+
+		fd = udp_batch_io_uring_recv(thread->batch, sockfd);
+		if (fd < 0) {
+			PWARN("Failed enabling io_uring for receives, falling back to recvmmsg()");
+		} else {
+			li->read_fd = fd;
+		}
+
+		if (udp_batch_io_uring_send(thread->send_batch) < 0) {
+			PWARN("Failed enabling io_uring for sends, falling back to sendmmsg()");
+		}
+	}
+
 	fr_assert((cf_parent(inst->cs) != NULL) && (cf_parent(cf_parent(inst->cs)) != NULL));	/* listen { ... } */
 
 	thread->name = fr_app_io_socket_name(thread, &proto_radius_udp,
@@ -361,6 +483,20 @@ static int mod_open(fr_listen_t *li)
 	return 0;
 }
 
+/** Close the socket, and any io_uring eventfd we're waiting on
+ *
+ */
+static int mod_close(fr_listen_t *li)
+{
+	proto_radius_udp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_radius_udp_thread_t);
+
+	TALLOC_FREE(thread->send_batch);
+	TALLOC_FREE(thread->batch);
+
+	close(thread->sockfd);
+	return 0;
+}
+
 /** Set the file descriptor for this socket.
  *
  */
@@ -414,6 +550,14 @@ static int mod_compare(void const *instance, UNUSED void *thread_instance, UNUSE
 	return (a[0] < b[0]) - (a[0] > b[0]);
 }
 
+/** Hash the ID and code, which mod_compare() always checks
+ *
+ */
+static uint32_t mod_track_hash(void const *track)
+{
+	return fr_hash(track, 2);
+}
+
 
 static char const *mod_name(fr_listen_t *li)
 {
@@ -453,6 +597,12 @@ static int mod_bootstrap(void *instance, CONF_SECTION *cs)
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, >=, 20);
 	FR_INTEGER_BOUND_CHECK("max_packet_size", inst->max_packet_size, <=, 65536);
 
+	FR_INTEGER_BOUND_CHECK("recv_batch", inst->recv_batch, >=, 1);
+	FR_INTEGER_BOUND_CHECK("recv_batch", inst->recv_batch, <=, 1024);
+
+	FR_INTEGER_BOUND_CHECK("send_batch", inst->send_batch, >=, 1);
+	FR_INTEGER_BOUND_CHECK("send_batch", inst->send_batch, <=, 1024);
+
 	if (!inst->port) {
 		struct servent *s;
 
@@ -540,13 +690,18 @@ fr_app_io_t proto_radius_udp = {
 	.track_duplicates	= true,
 
 	.open			= mod_open,
+	.close			= mod_close,
 	.read			= mod_read,
+	.read_pending		= mod_read_pending,
 	.write			= mod_write,
+	.flush			= mod_flush,
 	.fd_set			= mod_fd_set,
 	.track			= mod_track_create,
 	.compare		= mod_compare,
+	.track_hash		= mod_track_hash,
 	.connection_set		= mod_connection_set,
 	.network_get		= mod_network_get,
+	.shard_get		= mod_shard_get,
 	.client_find		= mod_client_find,
 	.get_name      		= mod_name,
 };
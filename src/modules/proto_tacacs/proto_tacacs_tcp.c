@@ -67,6 +67,8 @@ typedef struct {
 
 	bool				recv_buff_is_set;	//!< Whether we were provided with a recv_buff
 	bool				dynamic_clients;	//!< whether we have dynamic clients
+	bool				per_network_socket;	//!< open one socket per network thread
+	bool				cpu_steering;		//!< steer packets to sockets by CPU
 
 	RADCLIENT_LIST			*clients;		//!< local clients
 
@@ -93,6 +95,9 @@ static const CONF_PARSER tcp_listen_config[] = {
 	{ FR_CONF_OFFSET("port", FR_TYPE_UINT16, proto_tacacs_tcp_t, port), .dflt = "49" },
 	{ FR_CONF_OFFSET_IS_SET("recv_buff", FR_TYPE_UINT32, proto_tacacs_tcp_t, recv_buff) },
 
+	{ FR_CONF_OFFSET("per_network_socket", FR_TYPE_BOOL, proto_tacacs_tcp_t, per_network_socket) } ,
+	{ FR_CONF_OFFSET("cpu_steering", FR_TYPE_BOOL, proto_tacacs_tcp_t, cpu_steering) } ,
+
 	{ FR_CONF_OFFSET("dynamic_clients", FR_TYPE_BOOL, proto_tacacs_tcp_t, dynamic_clients) } ,
 	{ FR_CONF_POINTER("networks", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) networks_config },
 
@@ -256,6 +261,13 @@ static void mod_network_get(void *instance, int *ipproto, bool *dynamic_clients,
 	*trie = inst->trie;
 }
 
+static bool mod_shard_get(void const *instance)
+{
+	proto_tacacs_tcp_t const *inst = talloc_get_type_abort_const(instance, proto_tacacs_tcp_t);
+
+	return inst->per_network_socket;
+}
+
 /** Open a TCP listener for TACACS+
  *
  */
@@ -276,6 +288,20 @@ static int mod_open(fr_listen_t *li)
 		return -1;
 	}
 
+	/*
+	 *	Set SO_REUSEPORT before bind, so that each network
+	 *	thread can have its own socket on the same address.
+	 */
+	if (inst->per_network_socket) {
+		int on = 1;
+
+		if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+			ERROR("Failed to set socket 'reuseport': %s", fr_syserror(errno));
+			close(sockfd);
+			return -1;
+		}
+	}
+
 	if (fr_socket_bind(sockfd, &inst->ipaddr, &port, inst->interface) < 0) {
 		close(sockfd);
 		PERROR("Failed binding socket");
@@ -288,6 +314,15 @@ static int mod_open(fr_listen_t *li)
 		goto error;
 	}
 
+	/*
+	 *	Once the first socket of the group is bound, steer
+	 *	packets to the socket for the CPU which received them.
+	 */
+	if (inst->cpu_steering && (li->num_shards > 1) && (li->shard == 0) &&
+	    (fr_socket_reuseport_cpu_steer(sockfd, li->num_shards) < 0)) {
+		PWARN("Failed enabling CPU steering");
+	}
+
 	thread->sockfd = sockfd;
 
 	fr_assert((cf_parent(inst->cs) != NULL) && (cf_parent(cf_parent(inst->cs)) != NULL));	/* listen { ... } */
@@ -376,6 +411,13 @@ static int mod_compare(UNUSED void const *instance, UNUSED void *thread_instance
 	return (a->type < b->type) - (a->type > b->type);
 }
 
+static uint32_t mod_track_hash(void const *track)
+{
+	proto_tacacs_track_t const *a = talloc_get_type_abort_const(track, proto_tacacs_track_t);
+
+	return fr_hash_update(&a->type, sizeof(a->type), fr_hash(&a->session_id, sizeof(a->session_id)));
+}
+
 static char const *mod_name(fr_listen_t *li)
 {
 	proto_tacacs_tcp_thread_t	*thread = talloc_get_type_abort(li->thread_instance, proto_tacacs_tcp_thread_t);
@@ -489,8 +531,10 @@ fr_app_io_t proto_tacacs_tcp = {
 	.fd_set			= mod_fd_set,
 	.track			= mod_track_create,
 	.compare		= mod_compare,
+	.track_hash		= mod_track_hash,
 	.connection_set		= mod_connection_set,
 	.network_get		= mod_network_get,
+	.shard_get		= mod_shard_get,
 	.client_find		= mod_client_find,
 	.get_name		= mod_name,
 };
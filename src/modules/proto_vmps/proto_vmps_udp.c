@@ -389,6 +389,13 @@ static int mod_compare(UNUSED void const *instance, UNUSED void *thread_instance
 	return (a->opcode < b->opcode) - (a->opcode > b->opcode);
 }
 
+static uint32_t mod_track_hash(void const *track)
+{
+	proto_vmps_track_t const *a = talloc_get_type_abort_const(track, proto_vmps_track_t);
+
+	return fr_hash_update(&a->opcode, sizeof(a->opcode), fr_hash(&a->transaction_id, sizeof(a->transaction_id)));
+}
+
 static int mod_bootstrap(void *instance, CONF_SECTION *cs)
 {
 	proto_vmps_udp_t	*inst = talloc_get_type_abort(instance, proto_vmps_udp_t);
@@ -520,6 +527,7 @@ fr_app_io_t proto_vmps_udp = {
 	.fd_set			= mod_fd_set,
 	.track			= mod_track_create,
 	.compare		= mod_compare,
+	.track_hash		= mod_track_hash,
 	.connection_set		= mod_connection_set,
 	.network_get		= mod_network_get,
 	.client_find		= mod_client_find,
@@ -39,11 +39,13 @@ typedef struct {
 
 typedef struct {
 	char const 		*options;	//!< Connection options
+	bool			binary;		//!< Store entries in the binary format.
 	fr_pool_t	*pool;
 } rlm_cache_memcached_t;
 
 static const CONF_PARSER driver_config[] = {
 	{ FR_CONF_OFFSET("options", FR_TYPE_STRING | FR_TYPE_REQUIRED, rlm_cache_memcached_t, options), .dflt = "--SERVER=localhost" },
+	{ FR_CONF_OFFSET("binary", FR_TYPE_BOOL, rlm_cache_memcached_t, binary), .dflt = "yes" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -182,10 +184,19 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
 		return CACHE_ERROR;
 	}
 	RDEBUG2("Retrieved %zu bytes from memcached", len);
-	RDEBUG2("%s", from_store);
 
 	c = talloc_zero(NULL, rlm_cache_entry_t);
-	ret = cache_deserialize(c, request->dict, from_store, len);
+
+	/*
+	 *	Entries may have been written in either format,
+	 *	regardless of what we're configured to write.
+	 */
+	if (CACHE_SERIALIZED_IS_BINARY(from_store, len)) {
+		ret = cache_deserialize_binary(c, request->dict, (uint8_t *)from_store, len);
+	} else {
+		RDEBUG2("%s", from_store);
+		ret = cache_deserialize(c, request->dict, from_store, len);
+	}
 	free(from_store);
 	if (ret < 0) {
 		RPERROR("Invalid entry");
@@ -204,28 +215,49 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
  *
  * @copydetails cache_entry_insert_t
  */
-static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, void *instance,
 					 request_t *request, void *handle, const rlm_cache_entry_t *c)
 {
+	rlm_cache_memcached_t *driver = instance;
 	rlm_cache_memcached_handle_t *mandle = handle;
 
 	memcached_return_t ret;
 
 	TALLOC_CTX *pool;
-	char *to_store;
+	char *to_store = NULL;
+	size_t len = 0;
 
 	pool = talloc_pool(NULL, 1024);
 	if (!pool) return CACHE_ERROR;
 
-	if (cache_serialize(pool, &to_store, c) < 0) {
-		talloc_free(pool);
+	/*
+	 *	Not every entry can be represented in the binary
+	 *	format, those that can't are stored as text.
+	 */
+	if (driver->binary) {
+		uint8_t	*data;
+		ssize_t	slen;
+
+		slen = cache_serialize_binary(pool, &data, c);
+		if (slen < 0) {
+			RPDEBUG2("Storing entry as text");
+		} else {
+			to_store = (char *)data;
+			len = (size_t)slen;
+		}
+	}
 
-		return CACHE_ERROR;
+	if (!to_store) {
+		if (cache_serialize(pool, &to_store, c) < 0) {
+			talloc_free(pool);
+
+			return CACHE_ERROR;
+		}
+		if (to_store) len = talloc_array_length(to_store) - 1;
 	}
 
 	ret = memcached_set(mandle->handle, (char const *)c->key, c->key_len,
-		            to_store ? to_store : "",
-		            to_store ? talloc_array_length(to_store) - 1 : 0, c->expires, 0);
+		            to_store ? to_store : "", len, c->expires, 0);
 	talloc_free(pool);
 	if (ret != MEMCACHED_SUCCESS) {
 		RERROR("Failed storing entry: %s: %s", memcached_strerror(mandle->handle, ret),
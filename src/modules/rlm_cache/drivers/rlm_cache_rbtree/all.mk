@@ -0,0 +1,3 @@
+TARGET		:= rlm_cache_rbtree.a
+SOURCES		:= rlm_cache_rbtree.c
+TGT_LDLIBS	:= $(LIBS)
@@ -274,7 +274,7 @@ static cache_status_t cache_entry_insert(rlm_cache_config_t const *config, void
  */
 static cache_status_t cache_entry_set_ttl(UNUSED rlm_cache_config_t const *config, void *instance,
 					  request_t *request, UNUSED void *handle,
-					  rlm_cache_entry_t *c)
+					  rlm_cache_entry_t *c, fr_unix_time_t expires)
 {
 	rlm_cache_rbtree_t *driver = talloc_get_type_abort(instance, rlm_cache_rbtree_t);
 
@@ -286,6 +286,7 @@ static cache_status_t cache_entry_set_ttl(UNUSED rlm_cache_config_t const *confi
 		RERROR("Entry not in heap");
 		return CACHE_ERROR;
 	}
+	c->expires = expires;
 
 	if (fr_heap_insert(driver->heap, c) < 0) {
 		rbtree_deletebydata(driver->cache, c);	/* make sure we don't leak entries... */
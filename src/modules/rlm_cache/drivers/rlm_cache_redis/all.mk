@@ -0,0 +1,15 @@
+#  This needs to be cleared explicitly, as the libfreeradius-redis.mk
+#  might not always be available, and the TARGETNAME from the previous
+#  target may stick around.
+TARGETNAME:=
+-include $(top_builddir)/src/lib/redis/all.mk
+
+ifneq "${TARGETNAME}" ""
+  TARGETNAME	:= rlm_cache_redis
+  TARGET	:= $(TARGETNAME).a
+endif
+
+SOURCES		:= $(TARGETNAME).c ../../serialize.c
+
+SRC_CFLAGS	+= -I$(top_builddir)/src/lib/redis
+TGT_PREREQS	:= libfreeradius-redis.a libfreeradius-internal.a
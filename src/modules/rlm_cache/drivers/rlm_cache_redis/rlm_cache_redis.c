@@ -27,23 +27,28 @@
 #include <freeradius-devel/util/debug.h>
 
 #include "../../rlm_cache.h"
+#include "../../serialize.h"
 #include <freeradius-devel/redis/base.h>
 #include <freeradius-devel/redis/cluster.h>
-static CONF_PARSER driver_config[] = {
-	REDIS_COMMON_CONFIG,
-	CONF_PARSER_TERMINATOR
-};
 
 typedef struct {
 	fr_redis_conf_t		conf;		//!< Connection parameters for the Redis server.
 						//!< Must be first field in this struct.
 
+	bool			binary;		//!< Store entries in the binary format.
+
 	tmpl_t		*created_attr;	//!< LHS of the Cache-Created map.
 	tmpl_t		*expires_attr;	//!< LHS of the Cache-Expires map.
 
 	fr_redis_cluster_t	*cluster;
 } rlm_cache_redis_t;
 
+static CONF_PARSER driver_config[] = {
+	REDIS_COMMON_CONFIG,
+	{ FR_CONF_OFFSET("binary", FR_TYPE_BOOL, rlm_cache_redis_t, binary), .dflt = "yes" },
+	CONF_PARSER_TERMINATOR
+};
+
 static fr_dict_t const *dict_freeradius;
 
 extern fr_dict_autoload_t rlm_cache_redis_dict[];
@@ -178,6 +183,28 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
 		return CACHE_MISS;
 	}
 
+	/*
+	 *	Entries in the binary format are a list with
+	 *	a single element.
+	 */
+	if ((reply->elements == 1) && (reply->element[0]->type == REDIS_REPLY_STRING) &&
+	    CACHE_SERIALIZED_IS_BINARY(reply->element[0]->str, reply->element[0]->len)) {
+		c = talloc_zero(NULL, rlm_cache_entry_t);
+		if (cache_deserialize_binary(c, request->dict, (uint8_t const *)reply->element[0]->str,
+					     reply->element[0]->len) < 0) {
+			RPERROR("Invalid entry");
+			talloc_free(c);
+			goto error;
+		}
+		fr_redis_reply_free(&reply);
+
+		c->key = talloc_memdup(c, key, key_len);
+		c->key_len = key_len;
+		*out = c;
+
+		return CACHE_OK;
+	}
+
 	if (reply->elements % 3) {
 		REDEBUG("Invalid number of reply elements (%zu).  "
 			"Reply must contain triplets of keys operators and values",
@@ -315,8 +342,6 @@ static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config
 	tmpl_value(&expires_value)->vb_date = c->expires;
 	expires.next = c->maps;	/* Head of the list */
 
-	for (cnt = 0, map = &created; map; cnt++, map = map->next);
-
 	/*
 	 *	The majority of serialized entries should be under 1k.
 	 *
@@ -325,6 +350,36 @@ static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config
 	pool = talloc_pool(request, 1024);
 	if (!pool) return CACHE_ERROR;
 
+	/*
+	 *	Not every entry can be represented in the binary
+	 *	format, those that can't are stored as K/V pairs.
+	 */
+	if (driver->binary) {
+		uint8_t	*data;
+		ssize_t	slen;
+
+		slen = cache_serialize_binary(pool, &data, c);
+		if (slen < 0) {
+			RPDEBUG2("Storing entry as K/V pairs");
+		} else {
+			argv = talloc_array(pool, char const *, 3);	/* cmd + key + entry */
+			argv_len = talloc_array(pool, size_t, 3);
+
+			argv[0] = command;
+			argv_len[0] = sizeof(command) - 1;
+
+			argv[1] = (char const *)c->key;
+			argv_len[1] = c->key_len;
+
+			argv[2] = (char const *)data;
+			argv_len[2] = (size_t)slen;
+
+			goto pipeline;
+		}
+	}
+
+	for (cnt = 0, map = &created; map; cnt++, map = map->next);
+
 	argv_p = argv = talloc_array(pool, char const *, (cnt * 3) + 2);	/* pair = 3 + cmd + key */
 	argv_len_p = argv_len = talloc_array(pool, size_t, (cnt * 3) + 2);	/* pair = 3 + cmd + key */
 
@@ -347,6 +402,7 @@ static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config
 		argv_len_p += 3;
 	}
 
+pipeline:
 	RDEBUG3("Pipelining commands");
 
 	for (s_ret = fr_redis_cluster_state_init(&state, &conn, driver->cluster, request, c->key, c->key_len, false);
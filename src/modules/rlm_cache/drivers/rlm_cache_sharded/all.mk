@@ -0,0 +1,5 @@
+TARGET		:= rlm_cache_sharded.a
+SOURCES		:= rlm_cache_sharded.c
+TGT_LDLIBS	:= $(LIBS)
+
+SUBMAKEFILES	:= rlm_cache_sharded_tests.mk
@@ -0,0 +1,1093 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_cache_sharded.c
+ * @brief In memory cache, split into shards, with lock-free lookups.
+ *
+ * Entries are spread over a number of shards by a hash of their key.  Each
+ * shard is a fixed size hash table, where each bucket is a singly linked list
+ * of entries.
+ *
+ * Lookups never take a lock.  They walk the bucket using atomic loads, and
+ * entries are only ever published once they're complete.  Writers (insert,
+ * expire and eviction) serialise on the mutex of the shard they're modifying.
+ *
+ * Entries which have been unlinked may still be in use by readers, so they're
+ * "retired" instead of being freed.  A retired entry is only freed once every
+ * reader that could have seen it has released its handle.  This is tracked
+ * with a global epoch.  Each thread has its own reader record, on its own
+ * cache line, where it publishes the epoch it's reading in, so readers never
+ * write to shared memory.  Writers advance the epoch, and free retired
+ * entries, once every active reader has caught up.  The handle returned by
+ * #cache_acquire is the thread's reader record.
+ *
+ * Each shard has a memory budget.  When inserting an entry would exceed it,
+ * entries are evicted using the CLOCK (second chance) algorithm.  Lookups
+ * mark entries as referenced, and the clock hand clears the mark, only
+ * evicting entries which haven't been referenced since the hand last passed.
+ *
+ * Retired entries count against the budget of their shard until they're
+ * freed.  Evicting an entry doesn't free its memory straight away, so the
+ * budget available to a writer is whatever entries retired by earlier writers
+ * have left.  If a reader holds on to its handle for long enough that the
+ * retired entries use the whole budget, inserts fail until they're freed.
+ *
+ * Expired entries are removed a few at a time, whenever a shard is modified,
+ * so the cost of expiry is spread across requests.
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+#include <freeradius-devel/server/base.h>
+#include <freeradius-devel/util/debug.h>
+#include <freeradius-devel/util/dlist.h>
+#include <freeradius-devel/util/hash.h>
+#include <freeradius-devel/util/thread_local.h>
+#include "../../rlm_cache.h"
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
+/** Maximum number of entries examined for expiry each time a shard is modified
+ *
+ */
+#define CACHE_SWEEP_MAX		(8)
+
+#define CACHE_CACHE_LINE_SIZE	(64)
+
+typedef struct rlm_cache_sharded_entry_s rlm_cache_sharded_entry_t;
+typedef struct rlm_cache_sharded_reader_s rlm_cache_sharded_reader_t;
+typedef struct rlm_cache_sharded_thread_reader_s rlm_cache_sharded_thread_reader_t;
+
+struct rlm_cache_sharded_entry_s {
+	rlm_cache_entry_t			fields;		//!< Entry data.  Must come first.
+
+	_Atomic(rlm_cache_sharded_entry_t *)	next;		//!< Next entry in the same bucket.
+
+	uint32_t				hash;		//!< Hash of the key.
+	size_t					size;		//!< Memory used by the entry, counted
+								//!< against the shard's budget.
+	atomic_bool				referenced;	//!< Set on lookup, cleared by the clock hand.
+	uint64_t				retired;	//!< Epoch the entry was unlinked in.
+
+	fr_dlist_t				entry;		//!< Entry in the clock list of the shard,
+								//!< or in the retired list once unlinked.
+};
+
+/** The reader record of a single thread
+ *
+ * Only ever written by the thread that owns it.  Writers read it to determine
+ * whether the epoch can be advanced.
+ */
+struct rlm_cache_sharded_reader_s {
+	atomic_uint_fast64_t			epoch;		//!< Epoch + 1 the thread is reading in,
+								//!< or 0 if it holds no handles.
+	unsigned int				depth;		//!< Handles held by the thread.
+
+	rlm_cache_sharded_reader_t		*next;		//!< Next record registered with the driver.
+} CC_HINT(aligned(CACHE_CACHE_LINE_SIZE));
+
+/** Maps a driver instance to the reader record of the current thread
+ *
+ */
+struct rlm_cache_sharded_thread_reader_s {
+	uint64_t				id;		//!< Of the driver instance.
+	rlm_cache_sharded_reader_t		*reader;	//!< Owned by the driver instance.
+
+	rlm_cache_sharded_thread_reader_t	*next;		//!< Next driver instance used by this thread.
+};
+
+/** Reader records of the current thread, one per driver instance it has used
+ *
+ * The records themselves belong to the driver instance, so only the id is
+ * examined until a match is found.  Instances which have been freed will
+ * never match, as ids aren't reused.
+ */
+static _Thread_local rlm_cache_sharded_thread_reader_t	**cache_thread_readers;
+
+/** Source of driver instance ids
+ *
+ */
+static atomic_uint_fast64_t				cache_driver_id;
+
+/** A portion of the cache, with its own lock, table and memory budget
+ *
+ */
+typedef struct {
+	pthread_mutex_t				mutex;		//!< Serialises writers.  Readers never lock.
+
+	_Atomic(rlm_cache_sharded_entry_t *)	*bucket;	//!< Heads of the bucket lists.
+	uint32_t				mask;		//!< Number of buckets - 1.
+
+	fr_dlist_head_t				clock;		//!< Entries, in the order the clock hand
+								//!< visits them.  The head is the hand.
+	rlm_cache_sharded_entry_t		*sweep;		//!< Next entry the sweeper will examine.
+								//!< NULL to start from the hand.
+	size_t					size;		//!< Memory used by entries in this shard.
+	atomic_uint_fast32_t			num;		//!< Entries in this shard.
+	atomic_size_t				retired_size;	//!< Memory used by entries unlinked from
+								//!< this shard, which haven't been freed yet.
+
+	atomic_uint_fast64_t			hits;		//!< Lookups which found an entry.
+	atomic_uint_fast64_t			misses;		//!< Lookups which didn't.
+	uint64_t				evicted;	//!< Entries removed to stay within the budget.
+	uint64_t				expired;	//!< Expired entries removed by the sweeper.
+} CC_HINT(aligned(CACHE_CACHE_LINE_SIZE)) rlm_cache_sharded_shard_t;
+
+typedef struct {
+	uint32_t				num_shards;	//!< Number of shards, a power of 2.
+	uint32_t				num_buckets;	//!< Total number of buckets.
+	size_t					max_size;	//!< Memory budget for all entries.
+
+	rlm_cache_sharded_shard_t		*shard;		//!< Array of shards.
+	uint8_t					shard_bits;	//!< log2(num_shards).
+	size_t					shard_max_size;	//!< Memory budget of each shard.
+
+	uint64_t				id;		//!< Unique id of this instance.
+	atomic_uint_fast64_t			epoch;		//!< Current reclamation epoch.
+	rlm_cache_sharded_reader_t		*readers;	//!< Reader records of all threads which
+								//!< have used this instance.
+
+	pthread_mutex_t				retired_mutex;	//!< Protects the retired list and
+								//!< the list of reader records.
+	fr_dlist_head_t				retired;	//!< Unlinked entries, waiting to be freed.
+	atomic_uint_fast32_t			num_retired;	//!< Entries in the retired list, so readers
+								//!< can check for work without locking.
+} rlm_cache_sharded_t;
+
+static const CONF_PARSER driver_config[] = {
+	{ FR_CONF_OFFSET("shards", FR_TYPE_UINT32, rlm_cache_sharded_t, num_shards), .dflt = "16" },
+	{ FR_CONF_OFFSET("buckets", FR_TYPE_UINT32, rlm_cache_sharded_t, num_buckets), .dflt = "16384" },
+	{ FR_CONF_OFFSET("max_size", FR_TYPE_SIZE, rlm_cache_sharded_t, max_size), .dflt = "64M" },
+	CONF_PARSER_TERMINATOR
+};
+
+static fr_cmd_table_t cmd_cache_sharded_table[];
+
+/** Round up to the next power of 2
+ *
+ */
+static inline uint32_t cache_roundup_pow2(uint32_t num)
+{
+	uint32_t out = 1;
+
+	while (out < num) out <<= 1;
+
+	return out;
+}
+
+/** Return the shard an entry with the specified key hash belongs in
+ *
+ */
+static inline CC_HINT(always_inline) rlm_cache_sharded_shard_t *cache_shard(rlm_cache_sharded_t const *driver,
+									     uint32_t hash)
+{
+	return &driver->shard[hash & (driver->num_shards - 1)];
+}
+
+/** Return the bucket an entry with the specified key hash belongs in
+ *
+ * Uses different bits of the hash to the ones used to select the shard.
+ */
+static inline CC_HINT(always_inline) _Atomic(rlm_cache_sharded_entry_t *) *cache_bucket(rlm_cache_sharded_t const *driver,
+											 rlm_cache_sharded_shard_t *shard,
+											 uint32_t hash)
+{
+	return &shard->bucket[(hash >> driver->shard_bits) & shard->mask];
+}
+
+/** Find the link pointing to an entry
+ *
+ * @note Called with the shard mutex held.
+ *
+ * @param[in] driver	instance.
+ * @param[in] shard	the entry is in.
+ * @param[in] hash	of the key.
+ * @param[in] key	to find, if entry is NULL.
+ * @param[in] key_len	length of key.
+ * @param[in] entry	to find.  If NULL, the first entry matching key is found.
+ * @return
+ *	- The link (either the bucket head, or the next field of the
+ *	  previous entry) pointing to the entry.
+ *	- NULL if no entry matched.
+ */
+static _Atomic(rlm_cache_sharded_entry_t *) *cache_link_find(rlm_cache_sharded_t const *driver,
+							      rlm_cache_sharded_shard_t *shard, uint32_t hash,
+							      uint8_t const *key, size_t key_len,
+							      rlm_cache_sharded_entry_t const *entry)
+{
+	_Atomic(rlm_cache_sharded_entry_t *)	*link;
+	rlm_cache_sharded_entry_t		*c;
+
+	for (link = cache_bucket(driver, shard, hash);
+	     (c = atomic_load_explicit(link, memory_order_relaxed));
+	     link = &c->next) {
+		if (entry) {
+			if (c == entry) return link;
+			continue;
+		}
+
+		if ((c->hash == hash) && (c->fields.key_len == key_len) &&
+		    (memcmp(c->fields.key, key, key_len) == 0)) return link;
+	}
+
+	return NULL;
+}
+
+/** Remove an entry from the clock list, keeping the sweeper's position valid
+ *
+ * @note Called with the shard mutex held.
+ */
+static inline CC_HINT(always_inline) void cache_clock_remove(rlm_cache_sharded_shard_t *shard,
+							     rlm_cache_sharded_entry_t *c)
+{
+	if (shard->sweep == c) shard->sweep = fr_dlist_next(&shard->clock, c);
+	fr_dlist_remove(&shard->clock, c);
+}
+
+/** Add an entry, which no longer counts towards the shard's size, to the list to retire
+ *
+ * Its memory counts against the shard's budget until it's freed.
+ *
+ * @note Called with the shard mutex held.
+ *
+ * @param[in] shard	the entry was in.
+ * @param[in] c		which has been removed from the clock list.
+ * @param[out] to_retire	list to add the entry to.
+ */
+static inline CC_HINT(always_inline) void cache_shard_retire(rlm_cache_sharded_shard_t *shard,
+							     rlm_cache_sharded_entry_t *c, fr_dlist_head_t *to_retire)
+{
+	atomic_fetch_add_explicit(&shard->retired_size, c->size, memory_order_relaxed);
+
+	fr_dlist_insert_tail(to_retire, c);
+}
+
+/** Unlink an entry from its shard
+ *
+ * The entry's next pointer is left intact, so that readers currently
+ * looking at the entry can continue walking the bucket.
+ *
+ * @note Called with the shard mutex held.
+ *
+ * @param[in] shard	the entry is in.
+ * @param[in] link	pointing to the entry.
+ * @param[in] c		to unlink.
+ * @param[out] to_retire	list to add the entry to.
+ */
+static void cache_entry_unlink(rlm_cache_sharded_shard_t *shard, _Atomic(rlm_cache_sharded_entry_t *) *link,
+			       rlm_cache_sharded_entry_t *c, fr_dlist_head_t *to_retire)
+{
+	atomic_store_explicit(link, atomic_load_explicit(&c->next, memory_order_relaxed), memory_order_release);
+
+	cache_clock_remove(shard, c);
+	shard->size -= c->size;
+	atomic_fetch_sub_explicit(&shard->num, 1, memory_order_relaxed);
+
+	cache_shard_retire(shard, c, to_retire);
+}
+
+/** Remove expired entries, continuing from where the last sweep stopped
+ *
+ * The sweeper has its own position in the clock list, so it doesn't disturb
+ * the order the clock hand visits entries in.
+ *
+ * @note Called with the shard mutex held.
+ */
+static void cache_shard_sweep(rlm_cache_sharded_t const *driver, rlm_cache_sharded_shard_t *shard,
+			      fr_unix_time_t now, fr_dlist_head_t *to_retire)
+{
+	rlm_cache_sharded_entry_t	*c;
+	unsigned int			i, num;
+
+	num = fr_dlist_num_elements(&shard->clock);
+	if (num > CACHE_SWEEP_MAX) num = CACHE_SWEEP_MAX;
+
+	for (i = 0; i < num; i++) {
+		c = shard->sweep;
+		if (!c) c = fr_dlist_head(&shard->clock);
+		if (!c) break;
+
+		shard->sweep = fr_dlist_next(&shard->clock, c);
+
+		if (c->fields.expires < now) {
+			cache_entry_unlink(shard,
+					   cache_link_find(driver, shard, c->hash, NULL, 0, c), c, to_retire);
+			shard->expired++;
+		}
+	}
+}
+
+/** Evict entries until there's room for an entry of the specified size
+ *
+ * Uses the CLOCK algorithm.  Entries which have been referenced since the hand
+ * last passed them get a second chance.
+ *
+ * Evicted entries are only freed once no reader can be using them, so the
+ * memory used by entries which were retired before we were called is set
+ * aside first.  Entries evicted here count against the budget from the next
+ * write onwards.
+ *
+ * @note Called with the shard mutex held.
+ *
+ * @return
+ *	- true if there's room for the entry.
+ *	- false if retired entries, which haven't been freed yet, leave no room.
+ */
+static bool cache_shard_evict(rlm_cache_sharded_t const *driver, rlm_cache_sharded_shard_t *shard,
+			      size_t size, fr_unix_time_t now, fr_dlist_head_t *to_retire)
+{
+	rlm_cache_sharded_entry_t	*c;
+	size_t				retired_size;
+
+	retired_size = atomic_load_explicit(&shard->retired_size, memory_order_relaxed);
+	if (retired_size + size > driver->shard_max_size) return false;
+	size += retired_size;
+
+	while ((shard->size + size > driver->shard_max_size) && (c = fr_dlist_head(&shard->clock))) {
+		if ((c->fields.expires >= now) && atomic_load_explicit(&c->referenced, memory_order_relaxed)) {
+			atomic_store_explicit(&c->referenced, false, memory_order_relaxed);
+			fr_dlist_remove(&shard->clock, c);
+			fr_dlist_insert_tail(&shard->clock, c);
+			continue;
+		}
+
+		cache_entry_unlink(shard, cache_link_find(driver, shard, c->hash, NULL, 0, c), c, to_retire);
+		if (c->fields.expires < now) {
+			shard->expired++;
+		} else {
+			shard->evicted++;
+		}
+	}
+
+	return true;
+}
+
+/** Free retired entries which can no longer be referenced by any reader
+ *
+ * Advances the epoch if every active reader is reading in the current epoch.
+ * An entry retired in epoch N may be referenced by readers which registered
+ * in epochs N-1 and N, so it can be freed once the epoch reaches N+2.
+ * If no reader is active, nothing can be referencing the retired entries, so
+ * they're all freed.  This keeps memory waiting to be freed, which counts
+ * against the shards' budgets, to a minimum.
+ *
+ * Only called by writers, so readers never have to wait on the retired mutex.
+ *
+ * @note Called with the retired mutex held.
+ */
+static void cache_reclaim(rlm_cache_sharded_t *driver)
+{
+	rlm_cache_sharded_entry_t	*c;
+	rlm_cache_sharded_reader_t	*r;
+	uint64_t			epoch, reading;
+	bool				active = false;
+
+	/*
+	 *	Pairs with the fence in cache_acquire, so any
+	 *	reader we don't see here, can't see the entries
+	 *	which were unlinked before we got here.
+	 */
+	atomic_thread_fence(memory_order_seq_cst);
+	epoch = atomic_load(&driver->epoch);
+
+	for (r = driver->readers; r; r = r->next) {
+		reading = atomic_load(&r->epoch);
+		if (!reading) continue;
+
+		active = true;
+		if (reading != (epoch + 1)) break;
+	}
+	if (!r) atomic_store(&driver->epoch, ++epoch);
+
+	while ((c = fr_dlist_head(&driver->retired)) && (!active || ((c->retired + 2) <= epoch))) {
+		fr_dlist_remove(&driver->retired, c);
+		atomic_fetch_sub_explicit(&driver->num_retired, 1, memory_order_relaxed);
+		atomic_fetch_sub_explicit(&cache_shard(driver, c->hash)->retired_size, c->size, memory_order_relaxed);
+		talloc_free(c);
+	}
+}
+
+/** Retire entries unlinked from a shard, and free any that are no longer in use
+ *
+ * @note Called with no mutexes held.
+ */
+static void cache_retire(rlm_cache_sharded_t *driver, fr_dlist_head_t *to_retire)
+{
+	rlm_cache_sharded_entry_t	*c;
+	uint64_t			epoch;
+
+	if (fr_dlist_empty(to_retire)) {
+		/*
+		 *	Nothing new to retire, but still
+		 *	opportunistically free the backlog.
+		 */
+		if ((atomic_load_explicit(&driver->num_retired, memory_order_relaxed) == 0) ||
+		    (pthread_mutex_trylock(&driver->retired_mutex) != 0)) return;
+	} else {
+		pthread_mutex_lock(&driver->retired_mutex);
+	}
+
+	/*
+	 *	Must be read after the entries were unlinked.
+	 */
+	epoch = atomic_load(&driver->epoch);
+	while ((c = fr_dlist_pop_head(to_retire))) {
+		c->retired = epoch;
+		fr_dlist_insert_tail(&driver->retired, c);
+		atomic_fetch_add_explicit(&driver->num_retired, 1, memory_order_relaxed);
+	}
+
+	cache_reclaim(driver);
+	pthread_mutex_unlock(&driver->retired_mutex);
+}
+
+/** Cleanup a cache_sharded instance
+ *
+ */
+static int mod_detach(void *instance)
+{
+	rlm_cache_sharded_t		*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	rlm_cache_sharded_entry_t	*c;
+	uint32_t			i;
+
+	if (!driver->shard) return 0;
+
+	for (i = 0; i < driver->num_shards; i++) {
+		rlm_cache_sharded_shard_t *shard = &driver->shard[i];
+
+		if (!shard->bucket) continue;
+
+		while ((c = fr_dlist_pop_head(&shard->clock))) talloc_free(c);
+		pthread_mutex_destroy(&shard->mutex);
+	}
+
+	while ((c = fr_dlist_pop_head(&driver->retired))) talloc_free(c);
+	pthread_mutex_destroy(&driver->retired_mutex);
+
+	/*
+	 *	Reader records are children of the driver,
+	 *	and are freed with it.
+	 */
+
+	return 0;
+}
+
+/** Allocate the shards of a cache_sharded instance
+ *
+ * Split out from #mod_instantiate so the driver can be tested without a
+ * configuration.
+ *
+ * @param[in] driver	with a validated configuration.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int cache_sharded_init(rlm_cache_sharded_t *driver)
+{
+	uint32_t		i, buckets;
+
+	while ((1U << driver->shard_bits) < driver->num_shards) driver->shard_bits++;
+	buckets = cache_roundup_pow2(driver->num_buckets / driver->num_shards);
+	driver->shard_max_size = driver->max_size / driver->num_shards;
+
+	if (pthread_mutex_init(&driver->retired_mutex, NULL) != 0) {
+		ERROR("Failed initializing mutex: %s", fr_syserror(errno));
+		return -1;
+	}
+	fr_dlist_talloc_init(&driver->retired, rlm_cache_sharded_entry_t, entry);
+	driver->id = atomic_fetch_add(&cache_driver_id, 1);
+
+	if (!talloc_aligned_array(driver, (void **)&driver->shard, CACHE_CACHE_LINE_SIZE,
+				  sizeof(driver->shard[0]) * driver->num_shards)) {
+		ERROR("Failed allocating shards");
+		return -1;
+	}
+	memset(driver->shard, 0, sizeof(driver->shard[0]) * driver->num_shards);
+
+	for (i = 0; i < driver->num_shards; i++) {
+		rlm_cache_sharded_shard_t *shard = &driver->shard[i];
+
+		if (pthread_mutex_init(&shard->mutex, NULL) != 0) {
+			ERROR("Failed initializing mutex: %s", fr_syserror(errno));
+			return -1;
+		}
+
+		shard->bucket = talloc_zero_array(driver, _Atomic(rlm_cache_sharded_entry_t *), buckets);
+		if (!shard->bucket) {
+			pthread_mutex_destroy(&shard->mutex);
+			ERROR("Failed allocating buckets");
+			return -1;
+		}
+		shard->mask = buckets - 1;
+
+		fr_dlist_talloc_init(&shard->clock, rlm_cache_sharded_entry_t, entry);
+	}
+
+	return 0;
+}
+
+/** Create a new cache_sharded instance
+ *
+ * @param instance	A uint8_t array of inst_size if inst_size > 0, else NULL,
+ *			this should contain the result of parsing the driver's
+ *			CONF_PARSER array that it specified in the interface struct.
+ * @param conf		section holding driver specific #CONF_PAIR (s).
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_instantiate(void *instance, CONF_SECTION *conf)
+{
+	rlm_cache_sharded_t	*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	CONF_SECTION		*parent = cf_item_to_section(cf_parent(conf));
+	char const		*name;
+
+	FR_INTEGER_BOUND_CHECK("shards", driver->num_shards, >=, 1);
+	FR_INTEGER_BOUND_CHECK("shards", driver->num_shards, <=, 1024);
+	if (driver->num_shards != cache_roundup_pow2(driver->num_shards)) {
+		cf_log_err(conf, "\"shards\" must be a power of 2");
+		return -1;
+	}
+
+	FR_INTEGER_BOUND_CHECK("buckets", driver->num_buckets, >=, driver->num_shards);
+	FR_SIZE_BOUND_CHECK("max_size", driver->max_size, >=, (size_t)1024 * driver->num_shards);
+
+	if (cache_sharded_init(driver) < 0) return -1;
+
+	name = cf_section_name2(parent);
+	if (!name) name = cf_section_name1(parent);
+
+	if (fr_command_register_hook(NULL, name, driver, cmd_cache_sharded_table) < 0) {
+		PERROR("Failed registering radmin commands for cache %s", name);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Custom allocation function for the driver
+ *
+ * Allows allocation of cache entry structures with additional fields.
+ *
+ * @copydetails cache_entry_alloc_t
+ */
+static rlm_cache_entry_t *cache_entry_alloc(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+					    request_t *request)
+{
+	rlm_cache_sharded_entry_t *c;
+
+	c = talloc_zero(NULL, rlm_cache_sharded_entry_t);
+	if (!c) {
+		RERROR("Failed allocating cache entry");
+		return NULL;
+	}
+
+	return (rlm_cache_entry_t *)c;
+}
+
+/** Locate a cache entry
+ *
+ * Doesn't take any locks.  The entry remains valid until the handle is released.
+ *
+ * @copydetails cache_entry_find_t
+ */
+static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
+				       UNUSED rlm_cache_config_t const *config, void *instance,
+				       UNUSED request_t *request, UNUSED void *handle, uint8_t const *key, size_t key_len)
+{
+	rlm_cache_sharded_t		*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	rlm_cache_sharded_shard_t	*shard;
+	rlm_cache_sharded_entry_t	*c;
+	uint32_t			hash;
+
+	fr_assert(handle);
+
+	hash = fr_hash(key, key_len);
+	shard = cache_shard(driver, hash);
+
+	for (c = atomic_load_explicit(cache_bucket(driver, shard, hash), memory_order_acquire);
+	     c;
+	     c = atomic_load_explicit(&c->next, memory_order_acquire)) {
+		if ((c->hash == hash) && (c->fields.key_len == key_len) &&
+		    (memcmp(c->fields.key, key, key_len) == 0)) break;
+	}
+
+	if (!c) {
+		atomic_fetch_add_explicit(&shard->misses, 1, memory_order_relaxed);
+		*out = NULL;
+		return CACHE_MISS;
+	}
+
+	atomic_fetch_add_explicit(&shard->hits, 1, memory_order_relaxed);
+	if (!atomic_load_explicit(&c->referenced, memory_order_relaxed)) {
+		atomic_store_explicit(&c->referenced, true, memory_order_relaxed);
+	}
+	*out = &c->fields;
+
+	return CACHE_OK;
+}
+
+/** Free an entry and remove it from the data store
+ *
+ * @copydetails cache_entry_expire_t
+ */
+static cache_status_t cache_entry_expire(UNUSED rlm_cache_config_t const *config, void *instance,
+					 request_t *request, UNUSED void *handle,
+					 uint8_t const *key, size_t key_len)
+{
+	rlm_cache_sharded_t				*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	rlm_cache_sharded_shard_t			*shard;
+	_Atomic(rlm_cache_sharded_entry_t *)		*link;
+	uint32_t					hash;
+	fr_dlist_head_t					to_retire;
+
+	if (!request) return CACHE_ERROR;
+
+	fr_dlist_talloc_init(&to_retire, rlm_cache_sharded_entry_t, entry);
+
+	hash = fr_hash(key, key_len);
+	shard = cache_shard(driver, hash);
+
+	pthread_mutex_lock(&shard->mutex);
+	link = cache_link_find(driver, shard, hash, key, key_len, NULL);
+	if (!link) {
+		pthread_mutex_unlock(&shard->mutex);
+		return CACHE_MISS;
+	}
+	cache_entry_unlink(shard, link, atomic_load_explicit(link, memory_order_relaxed), &to_retire);
+	cache_shard_sweep(driver, shard, fr_time_to_unix_time(request->packet->timestamp), &to_retire);
+	pthread_mutex_unlock(&shard->mutex);
+
+	cache_retire(driver, &to_retire);
+
+	return CACHE_OK;
+}
+
+/** Insert a new entry into the data store
+ *
+ * Replaces any existing entry with the same key.  Entries are evicted
+ * from the shard if necessary, to keep it within its memory budget.
+ *
+ * @copydetails cache_entry_insert_t
+ */
+static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, void *instance,
+					 request_t *request, UNUSED void *handle,
+					 rlm_cache_entry_t const *entry)
+{
+	rlm_cache_sharded_t				*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	rlm_cache_sharded_entry_t			*c = UNCONST(rlm_cache_sharded_entry_t *, entry), *old;
+	rlm_cache_sharded_shard_t			*shard;
+	_Atomic(rlm_cache_sharded_entry_t *)		*link;
+	fr_unix_time_t					now;
+	fr_dlist_head_t					to_retire;
+
+	if (!request) return CACHE_ERROR;
+
+	/*
+	 *	The entry is complete, so we can work out how
+	 *	much memory it uses outside of the lock.
+	 */
+	c->size = talloc_total_size(c);
+	if (c->size > driver->shard_max_size) {
+		RERROR("Entry uses %zu bytes, which is more than the maximum of %zu bytes per shard",
+		       c->size, driver->shard_max_size);
+		return CACHE_ERROR;
+	}
+	c->hash = fr_hash(c->fields.key, c->fields.key_len);
+	atomic_store_explicit(&c->referenced, false, memory_order_relaxed);
+
+	fr_dlist_talloc_init(&to_retire, rlm_cache_sharded_entry_t, entry);
+	now = fr_time_to_unix_time(request->packet->timestamp);
+	shard = cache_shard(driver, c->hash);
+
+	pthread_mutex_lock(&shard->mutex);
+	cache_shard_sweep(driver, shard, now, &to_retire);
+
+	/*
+	 *	Allow overwriting.  The old entry stays in its
+	 *	bucket until the new one takes its place, but
+	 *	it no longer counts against the budget, and
+	 *	can't be chosen for eviction.
+	 */
+	link = cache_link_find(driver, shard, c->hash, c->fields.key, c->fields.key_len, NULL);
+	if (link) {
+		old = atomic_load_explicit(link, memory_order_relaxed);
+		fr_assert(old != c);
+
+		cache_clock_remove(shard, old);
+		shard->size -= old->size;
+	} else {
+		old = NULL;
+	}
+
+	if (!cache_shard_evict(driver, shard, c->size, now, &to_retire)) {
+		size_t retired_size = atomic_load_explicit(&shard->retired_size, memory_order_relaxed);
+
+		if (old) {
+			fr_dlist_insert_tail(&shard->clock, old);
+			shard->size += old->size;
+		}
+		pthread_mutex_unlock(&shard->mutex);
+
+		cache_retire(driver, &to_retire);
+
+		RERROR("No room for entry using %zu bytes, entries waiting to be freed use %zu of the "
+		       "%zu bytes allowed per shard", c->size, retired_size, driver->shard_max_size);
+		return CACHE_ERROR;
+	}
+
+	if (old) {
+		/*
+		 *	Eviction may have unlinked the entry
+		 *	before the old one, so find it again.
+		 */
+		link = cache_link_find(driver, shard, c->hash, NULL, 0, old);
+		fr_assert(link);
+
+		atomic_store_explicit(&c->next, atomic_load_explicit(&old->next, memory_order_relaxed),
+				      memory_order_relaxed);
+		atomic_store_explicit(link, c, memory_order_release);
+		cache_shard_retire(shard, old, &to_retire);
+	} else {
+		link = cache_bucket(driver, shard, c->hash);
+		atomic_store_explicit(&c->next, atomic_load_explicit(link, memory_order_relaxed), memory_order_relaxed);
+		atomic_store_explicit(link, c, memory_order_release);
+		atomic_fetch_add_explicit(&shard->num, 1, memory_order_relaxed);
+	}
+
+	fr_dlist_insert_tail(&shard->clock, c);
+	shard->size += c->size;
+	pthread_mutex_unlock(&shard->mutex);
+
+	cache_retire(driver, &to_retire);
+
+	return CACHE_OK;
+}
+
+/** Update the TTL of an entry
+ *
+ * Readers may be looking at the entry, so published entries are never
+ * modified.  Instead a replacement, with the new expiry time, takes over the
+ * key and maps of the old entry, and its place in the bucket and clock list.
+ * The old entry is retired.
+ *
+ * The key and maps stay valid for readers of the old entry, as the replacement
+ * can only be retired, and freed, after the old entry.
+ *
+ * @copydetails cache_entry_set_ttl_t
+ */
+static cache_status_t cache_entry_set_ttl(UNUSED rlm_cache_config_t const *config, void *instance,
+					  request_t *request, UNUSED void *handle,
+					  rlm_cache_entry_t *entry, fr_unix_time_t expires)
+{
+	rlm_cache_sharded_t				*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	rlm_cache_sharded_entry_t			*old = (rlm_cache_sharded_entry_t *)entry, *c;
+	rlm_cache_sharded_shard_t			*shard;
+	_Atomic(rlm_cache_sharded_entry_t *)		*link;
+	map_t						*map;
+	fr_dlist_head_t					to_retire;
+
+	c = talloc_zero(NULL, rlm_cache_sharded_entry_t);
+	if (!c) {
+		RERROR("Failed allocating cache entry");
+		return CACHE_ERROR;
+	}
+
+	fr_dlist_talloc_init(&to_retire, rlm_cache_sharded_entry_t, entry);
+	shard = cache_shard(driver, old->hash);
+
+	pthread_mutex_lock(&shard->mutex);
+
+	/*
+	 *	Another writer may have replaced or removed
+	 *	the entry since we found it.
+	 */
+	link = cache_link_find(driver, shard, old->hash, NULL, 0, old);
+	if (!link) {
+		pthread_mutex_unlock(&shard->mutex);
+		talloc_free(c);
+		RWDEBUG("Entry was removed before its TTL could be updated");
+		return CACHE_MISS;
+	}
+
+	c->fields.key = talloc_steal(c, old->fields.key);
+	c->fields.key_len = old->fields.key_len;
+	atomic_store_explicit(&c->fields.hits, atomic_load_explicit(&old->fields.hits, memory_order_relaxed),
+			      memory_order_relaxed);
+	c->fields.created = old->fields.created;
+	c->fields.expires = expires;
+	c->fields.maps = old->fields.maps;
+	for (map = c->fields.maps; map; map = map->next) talloc_steal(c, map);
+
+	c->hash = old->hash;
+	c->size = talloc_total_size(c);
+	atomic_store_explicit(&c->referenced, atomic_load_explicit(&old->referenced, memory_order_relaxed),
+			      memory_order_relaxed);
+
+	atomic_store_explicit(&c->next, atomic_load_explicit(&old->next, memory_order_relaxed), memory_order_relaxed);
+	atomic_store_explicit(link, c, memory_order_release);
+
+	fr_dlist_insert_after(&shard->clock, old, c);
+	cache_clock_remove(shard, old);
+
+	/*
+	 *	Only the old entry itself is left to free.
+	 */
+	shard->size = shard->size - old->size + c->size;
+	old->size = talloc_total_size(old);
+	cache_shard_retire(shard, old, &to_retire);
+	pthread_mutex_unlock(&shard->mutex);
+
+	cache_retire(driver, &to_retire);
+
+	return CACHE_OK;
+}
+
+/** Return the number of entries in the cache
+ *
+ * @copydetails cache_entry_count_t
+ */
+static uint32_t cache_entry_count(UNUSED rlm_cache_config_t const *config, void *instance,
+				  request_t *request, UNUSED void *handle)
+{
+	rlm_cache_sharded_t	*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	uint32_t		num = 0, i;
+
+	if (!request) return CACHE_ERROR;
+
+	for (i = 0; i < driver->num_shards; i++) {
+		num += atomic_load_explicit(&driver->shard[i].num, memory_order_relaxed);
+	}
+
+	return num;
+}
+
+/** Free the reader records of a thread on exit
+ *
+ * Only the mappings are freed.  The records belong to the driver instances,
+ * and stay inactive until the instance is freed.
+ */
+static void _cache_thread_readers_free(void *arg)
+{
+	talloc_free(arg);
+}
+
+/** Return the reader record of this thread, registering one with the driver if necessary
+ *
+ */
+static rlm_cache_sharded_reader_t *cache_reader(rlm_cache_sharded_t *driver)
+{
+	rlm_cache_sharded_thread_reader_t	**head, *tr;
+	rlm_cache_sharded_reader_t		*r;
+
+	head = cache_thread_readers;
+	if (likely(head != NULL)) {
+		for (tr = *head; tr; tr = tr->next) if (tr->id == driver->id) return tr->reader;
+	} else {
+		head = talloc_zero(NULL, rlm_cache_sharded_thread_reader_t *);
+		if (!head) return NULL;
+		fr_thread_local_set_destructor(cache_thread_readers, _cache_thread_readers_free, head);
+	}
+
+	tr = talloc_zero(head, rlm_cache_sharded_thread_reader_t);
+	if (!tr) return NULL;
+
+	/*
+	 *	Writers walk the list of records, and allocate
+	 *	nothing from the driver, so the retired mutex
+	 *	serialises allocation too.
+	 */
+	pthread_mutex_lock(&driver->retired_mutex);
+	if (!talloc_aligned_array(driver, (void **)&r, CACHE_CACHE_LINE_SIZE, sizeof(*r))) {
+		pthread_mutex_unlock(&driver->retired_mutex);
+		talloc_free(tr);
+		return NULL;
+	}
+	memset(r, 0, sizeof(*r));
+	r->next = driver->readers;
+	driver->readers = r;
+	pthread_mutex_unlock(&driver->retired_mutex);
+
+	tr->id = driver->id;
+	tr->reader = r;
+	tr->next = *head;
+	*head = tr;
+
+	return r;
+}
+
+/** Register as a reader
+ *
+ * Any entry found, or unlinked by another thread, after this point will not
+ * be freed until the handle is released.
+ *
+ * @copydetails cache_acquire_t
+ */
+static int cache_acquire(void **handle, UNUSED rlm_cache_config_t const *config, void *instance,
+			 request_t *request)
+{
+	rlm_cache_sharded_t		*driver = talloc_get_type_abort(instance, rlm_cache_sharded_t);
+	rlm_cache_sharded_reader_t	*r;
+	uint64_t			epoch;
+
+	r = cache_reader(driver);
+	if (!r) {
+		RERROR("Failed allocating reader record");
+		return -1;
+	}
+
+	/*
+	 *	The thread is already reading, and the
+	 *	epoch can't move past it.
+	 */
+	if (r->depth++ > 0) goto done;
+
+	/*
+	 *	If the epoch moved between us reading it and
+	 *	publishing it, a writer may have checked our
+	 *	record before it was published, so try again.
+	 */
+	for (;;) {
+		epoch = atomic_load_explicit(&driver->epoch, memory_order_relaxed);
+		atomic_store_explicit(&r->epoch, epoch + 1, memory_order_relaxed);
+		atomic_thread_fence(memory_order_seq_cst);
+		if (atomic_load_explicit(&driver->epoch, memory_order_relaxed) == epoch) break;
+	}
+
+done:
+	*handle = r;
+
+	return 0;
+}
+
+/** Unregister as a reader
+ *
+ * Retired entries are freed by writers, so this never touches shared state.
+ *
+ * @copydetails cache_release_t
+ */
+static void cache_release(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+			  UNUSED request_t *request, rlm_cache_handle_t *handle)
+{
+	rlm_cache_sharded_reader_t	*r = handle;
+
+	fr_assert(r->depth > 0);
+
+	if (--r->depth > 0) return;
+
+	atomic_store_explicit(&r->epoch, 0, memory_order_release);
+}
+
+static int cmd_stats_cache_sharded(FILE *fp, UNUSED FILE *fp_err, void *ctx, fr_cmd_info_t const *info)
+{
+	rlm_cache_sharded_t const	*driver = ctx;
+	uint64_t			hits = 0, misses = 0, evicted = 0, expired = 0;
+	size_t				size = 0, retired_size = 0;
+	uint32_t			num = 0, i;
+	bool				shards = (info->argc > 0) && (strcmp(info->argv[0], "shards") == 0);
+
+	/*
+	 *	Counters are read without locking, so they
+	 *	may be slightly inconsistent with each other.
+	 */
+	for (i = 0; i < driver->num_shards; i++) {
+		rlm_cache_sharded_shard_t *shard = &driver->shard[i];
+
+		if (shards) {
+			fprintf(fp, "shard.%u.entries\t\t%u\n", i,
+				(uint32_t)atomic_load_explicit(&shard->num, memory_order_relaxed));
+			fprintf(fp, "shard.%u.size\t\t\t%zu\n", i, shard->size);
+			fprintf(fp, "shard.%u.retired_size\t\t%zu\n", i,
+				atomic_load_explicit(&shard->retired_size, memory_order_relaxed));
+			fprintf(fp, "shard.%u.hits\t\t\t%" PRIu64 "\n", i,
+				(uint64_t)atomic_load_explicit(&shard->hits, memory_order_relaxed));
+			fprintf(fp, "shard.%u.misses\t\t\t%" PRIu64 "\n", i,
+				(uint64_t)atomic_load_explicit(&shard->misses, memory_order_relaxed));
+			fprintf(fp, "shard.%u.evicted\t\t%" PRIu64 "\n", i, shard->evicted);
+			fprintf(fp, "shard.%u.expired\t\t%" PRIu64 "\n", i, shard->expired);
+		}
+
+		num += atomic_load_explicit(&shard->num, memory_order_relaxed);
+		size += shard->size;
+		retired_size += atomic_load_explicit(&shard->retired_size, memory_order_relaxed);
+		hits += atomic_load_explicit(&shard->hits, memory_order_relaxed);
+		misses += atomic_load_explicit(&shard->misses, memory_order_relaxed);
+		evicted += shard->evicted;
+		expired += shard->expired;
+	}
+
+	fprintf(fp, "entries\t\t\t\t%u\n", num);
+	fprintf(fp, "size\t\t\t\t%zu\n", size);
+	fprintf(fp, "retired_size\t\t\t%zu\n", retired_size);
+	fprintf(fp, "max_size\t\t\t%zu\n", driver->max_size);
+	fprintf(fp, "hits\t\t\t\t%" PRIu64 "\n", hits);
+	fprintf(fp, "misses\t\t\t\t%" PRIu64 "\n", misses);
+	fprintf(fp, "evicted\t\t\t\t%" PRIu64 "\n", evicted);
+	fprintf(fp, "expired\t\t\t\t%" PRIu64 "\n", expired);
+	fprintf(fp, "epoch\t\t\t\t%" PRIu64 "\n", (uint64_t)atomic_load(&driver->epoch));
+
+	return 0;
+}
+
+/*
+ *	Registered under the same "stats cache <name>" tree as
+ *	the cache module's own commands.
+ */
+static fr_cmd_table_t cmd_cache_sharded_table[] = {
+	{
+		.parent = "stats",
+		.name = "cache",
+		.help = "Statistics for caches.",
+		.read_only = true
+	},
+
+	{
+		.parent = "stats cache",
+		.add_name = true,
+		.name = "driver",
+		.syntax = "[shards]",
+		.func = cmd_stats_cache_sharded,
+		.help = "Show statistics for the sharded in-memory driver of a specific cache.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
+extern rlm_cache_driver_t rlm_cache_sharded;
+rlm_cache_driver_t rlm_cache_sharded = {
+	.name		= "rlm_cache_sharded",
+	.magic		= RLM_MODULE_INIT,
+	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
+	.inst_size	= sizeof(rlm_cache_sharded_t),
+	.config		= driver_config,
+	.alloc		= cache_entry_alloc,
+
+	.find		= cache_entry_find,
+	.insert		= cache_entry_insert,
+	.expire		= cache_entry_expire,
+	.set_ttl	= cache_entry_set_ttl,
+	.count		= cache_entry_count,
+
+	.acquire	= cache_acquire,
+	.release	= cache_release,
+};
@@ -0,0 +1,301 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for the sharded in-memory cache driver
+ *
+ * @file src/modules/rlm_cache/drivers/rlm_cache_sharded/rlm_cache_sharded_tests.c
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+static void sharded_tests_init(void) __attribute__((constructor));
+
+#include <freeradius-devel/util/acutest.h>
+
+#include "rlm_cache_sharded.c"
+
+static TALLOC_CTX	*autofree;
+
+static void sharded_tests_init(void)
+{
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("rlm_cache_sharded_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	if (!fr_dict_global_ctx_init(autofree, "share/dictionary")) goto error;
+
+	/*
+	 *	The driver logs errors against requests
+	 */
+	if (log_global_init(&default_log, false) < 0) goto error;
+
+	/*
+	 *	Initialise attributes that go in requests
+	 */
+	if (request_global_init() < 0) goto error;
+}
+
+static request_t *request_fake_alloc(void)
+{
+	request_t	*request;
+
+	request = request_local_alloc(autofree, NULL);
+	TEST_CHECK(request != NULL);
+
+	request->packet = fr_radius_packet_alloc(request, false);
+	TEST_CHECK(request->packet != NULL);
+	request->packet->timestamp = fr_time();
+
+	return request;
+}
+
+/** A driver instance with a single shard, and the smallest budget allowed
+ *
+ */
+static rlm_cache_sharded_t *driver_alloc(void)
+{
+	rlm_cache_sharded_t	*driver;
+
+	driver = talloc_zero(autofree, rlm_cache_sharded_t);
+	TEST_CHECK(driver != NULL);
+
+	driver->num_shards = 1;
+	driver->num_buckets = 64;
+	driver->max_size = 1024;
+	TEST_CHECK(cache_sharded_init(driver) == 0);
+
+	return driver;
+}
+
+static void driver_free(rlm_cache_sharded_t *driver)
+{
+	mod_detach(driver);
+	talloc_free(driver);
+}
+
+static cache_status_t entry_insert(rlm_cache_sharded_t *driver, request_t *request, unsigned int i,
+				   fr_time_delta_t ttl)
+{
+	rlm_cache_entry_t	*c;
+	char			key[32];
+	size_t			key_len;
+	cache_status_t		ret;
+
+	key_len = snprintf(key, sizeof(key), "key-%u", i);
+
+	c = cache_entry_alloc(NULL, driver, request);
+	TEST_CHECK(c != NULL);
+
+	c->key = talloc_memdup(c, key, key_len);
+	c->key_len = key_len;
+	c->created = fr_time_to_unix_time(request->packet->timestamp);
+	c->expires = c->created + fr_unix_time_from_nsec(ttl);
+
+	ret = cache_entry_insert(NULL, driver, request, NULL, c);
+	if (ret != CACHE_OK) talloc_free(c);
+
+	return ret;
+}
+
+static rlm_cache_entry_t *entry_find(rlm_cache_sharded_t *driver, request_t *request, void *handle, unsigned int i)
+{
+	rlm_cache_entry_t	*c;
+	char			key[32];
+	size_t			key_len;
+
+	key_len = snprintf(key, sizeof(key), "key-%u", i);
+
+	if (cache_entry_find(&c, NULL, driver, request, handle, (uint8_t const *)key, key_len) != CACHE_OK) return NULL;
+
+	return c;
+}
+
+/** Run the writer side of reclamation, without modifying the cache
+ *
+ */
+static void cache_reclaim_now(rlm_cache_sharded_t *driver)
+{
+	fr_dlist_head_t		to_retire;
+
+	fr_dlist_talloc_init(&to_retire, rlm_cache_sharded_entry_t, entry);
+	cache_retire(driver, &to_retire);
+}
+
+static void sharded_evict(void)
+{
+	rlm_cache_sharded_t		*driver = driver_alloc();
+	rlm_cache_sharded_shard_t	*shard = &driver->shard[0];
+	request_t			*request = request_fake_alloc();
+	void				*handle;
+	unsigned int			i, num = 100;
+
+	TEST_CASE("Insert more entries than fit in max_size");
+	for (i = 0; i < num; i++) {
+		TEST_CHECK(entry_insert(driver, request, i, fr_time_delta_from_sec(60)) == CACHE_OK);
+		TEST_CHECK(shard->size <= driver->shard_max_size);
+		TEST_MSG("Shard uses %zu bytes, budget is %zu bytes", shard->size, driver->shard_max_size);
+	}
+
+	TEST_CASE("Entries were evicted, and none expired");
+	TEST_CHECK(shard->evicted > 0);
+	TEST_CHECK(shard->expired == 0);
+	TEST_CHECK(cache_entry_count(NULL, driver, request, NULL) == (num - shard->evicted));
+	TEST_MSG("Expected %" PRIu64 " entries, got %u",
+		 num - shard->evicted, cache_entry_count(NULL, driver, request, NULL));
+	TEST_CHECK(fr_dlist_num_elements(&shard->clock) == (num - shard->evicted));
+
+	TEST_CASE("The most recent entry is still there, and the first was evicted");
+	TEST_CHECK(cache_acquire(&handle, NULL, driver, request) == 0);
+	TEST_CHECK(entry_find(driver, request, handle, num - 1) != NULL);
+	TEST_CHECK(entry_find(driver, request, handle, 0) == NULL);
+	cache_release(NULL, driver, request, handle);
+
+	TEST_CASE("Entries larger than the budget are rejected");
+	driver->shard_max_size = sizeof(rlm_cache_sharded_entry_t);
+	TEST_CHECK(entry_insert(driver, request, num, fr_time_delta_from_sec(60)) == CACHE_ERROR);
+
+	talloc_free(request);
+	driver_free(driver);
+}
+
+static void sharded_expire(void)
+{
+	rlm_cache_sharded_t		*driver = driver_alloc();
+	rlm_cache_sharded_shard_t	*shard = &driver->shard[0];
+	request_t			*request = request_fake_alloc();
+	unsigned int			i, num;
+
+	TEST_CASE("Fill the cache with entries that expire after one second");
+	for (num = 0; ; num++) {
+		TEST_CHECK(entry_insert(driver, request, num, fr_time_delta_from_sec(1)) == CACHE_OK);
+		if (shard->evicted > 0) break;
+	}
+	num = cache_entry_count(NULL, driver, request, NULL);
+	TEST_CHECK(num > CACHE_SWEEP_MAX);
+
+	TEST_CASE("Inserting after they expired removes them, rather than evicting");
+	request->packet->timestamp += fr_time_delta_from_sec(2);
+	shard->evicted = 0;
+	for (i = 0; i < num; i++) {
+		TEST_CHECK(entry_insert(driver, request, 1000 + i, fr_time_delta_from_sec(60)) == CACHE_OK);
+	}
+	TEST_CHECK(shard->expired == num);
+	TEST_MSG("Expected %u expired, got %" PRIu64, num, shard->expired);
+	TEST_CHECK(shard->evicted == 0);
+	TEST_CHECK(cache_entry_count(NULL, driver, request, NULL) == num);
+
+	talloc_free(request);
+	driver_free(driver);
+}
+
+static void sharded_set_ttl(void)
+{
+	rlm_cache_sharded_t		*driver = driver_alloc();
+	request_t			*request = request_fake_alloc();
+	rlm_cache_entry_t		*old, *new;
+	fr_unix_time_t			expires;
+	void				*handle;
+	unsigned int			i;
+
+	TEST_CHECK(entry_insert(driver, request, 0, fr_time_delta_from_sec(60)) == CACHE_OK);
+
+	TEST_CHECK(cache_acquire(&handle, NULL, driver, request) == 0);
+	old = entry_find(driver, request, handle, 0);
+	TEST_CHECK(old != NULL);
+	atomic_fetch_add(&old->hits, 3);
+
+	TEST_CASE("Updating the TTL publishes a replacement, and leaves the old entry intact");
+	expires = old->expires + fr_unix_time_from_sec(60);
+	TEST_CHECK(cache_entry_set_ttl(NULL, driver, request, handle, old, expires) == CACHE_OK);
+
+	new = entry_find(driver, request, handle, 0);
+	TEST_CHECK(new != NULL);
+	TEST_CHECK(new != old);
+	TEST_CHECK(new->expires == expires);
+	TEST_CHECK(old->expires != expires);
+	TEST_CHECK(atomic_load(&new->hits) == 3);
+	TEST_CHECK(new->key == old->key);
+	TEST_CHECK(cache_entry_count(NULL, driver, request, NULL) == 1);
+	TEST_CHECK(driver->shard[0].size == ((rlm_cache_sharded_entry_t *)new)->size);
+
+	TEST_CASE("The old entry is retired, and can't be freed while we hold the handle");
+	TEST_CHECK(atomic_load(&driver->num_retired) == 1);
+	for (i = 0; i < 3; i++) cache_reclaim_now(driver);
+	TEST_CHECK(atomic_load(&driver->num_retired) == 1);
+	TEST_CHECK(old->key_len == new->key_len);
+
+	TEST_CASE("Once released, writers free it");
+	cache_release(NULL, driver, request, handle);
+	for (i = 0; i < 3; i++) cache_reclaim_now(driver);
+	TEST_CHECK(atomic_load(&driver->num_retired) == 0);
+	TEST_MSG("Expected 0 retired, got %u", (unsigned int)atomic_load(&driver->num_retired));
+
+	talloc_free(request);
+	driver_free(driver);
+}
+
+static void sharded_retired_budget(void)
+{
+	rlm_cache_sharded_t		*driver = driver_alloc();
+	rlm_cache_sharded_shard_t	*shard = &driver->shard[0];
+	request_t			*request = request_fake_alloc();
+	void				*handle;
+	unsigned int			i, num;
+	size_t				retired_size;
+
+	TEST_CHECK(cache_acquire(&handle, NULL, driver, request) == 0);
+
+	TEST_CASE("While we hold a handle, entries waiting to be freed fill the budget");
+	for (num = 0; num < 100; num++) {
+		retired_size = atomic_load(&shard->retired_size);
+		if (entry_insert(driver, request, num, fr_time_delta_from_sec(60)) != CACHE_OK) break;
+
+		TEST_CHECK(shard->size + retired_size <= driver->shard_max_size);
+		TEST_MSG("Shard uses %zu bytes, with %zu bytes waiting to be freed, budget is %zu bytes",
+			 shard->size, retired_size, driver->shard_max_size);
+	}
+	TEST_CHECK(num < 100);
+	TEST_CHECK(shard->evicted > 0);
+
+	TEST_CASE("Inserts fail without evicting anything");
+	num = cache_entry_count(NULL, driver, request, NULL);
+	TEST_CHECK(entry_insert(driver, request, 1000, fr_time_delta_from_sec(60)) == CACHE_ERROR);
+	TEST_CHECK(cache_entry_count(NULL, driver, request, NULL) == num);
+
+	TEST_CASE("Once released, the retired entries are freed, and inserts succeed");
+	cache_release(NULL, driver, request, handle);
+	cache_reclaim_now(driver);
+	TEST_CHECK(atomic_load(&shard->retired_size) == 0);
+	TEST_MSG("Expected 0 bytes waiting to be freed, got %zu", atomic_load(&shard->retired_size));
+	TEST_CHECK(entry_insert(driver, request, 1000, fr_time_delta_from_sec(60)) == CACHE_OK);
+
+	for (i = 0; i < 3; i++) cache_reclaim_now(driver);
+	TEST_CHECK(atomic_load(&shard->retired_size) == 0);
+
+	talloc_free(request);
+	driver_free(driver);
+}
+
+TEST_LIST = {
+	{ "sharded_evict",	sharded_evict },
+	{ "sharded_expire",	sharded_expire },
+	{ "sharded_set_ttl",	sharded_set_ttl },
+	{ "sharded_retired_budget",	sharded_retired_budget },
+
+	{ NULL }
+};
@@ -30,21 +30,32 @@ RCSID("$Id$")
 #include <freeradius-devel/server/module.h>
 #include <freeradius-devel/server/modpriv.h>
 #include <freeradius-devel/server/dl_module.h>
+#include <freeradius-devel/unlang/base.h>
 #include <freeradius-devel/util/debug.h>
 
 #include "rlm_cache.h"
 
 extern module_t rlm_cache;
 
+static const CONF_PARSER l1_config[] = {
+	{ FR_CONF_OFFSET("max_entries", FR_TYPE_UINT32, rlm_cache_config_t, l1_max_entries), .dflt = "0" },
+	{ FR_CONF_OFFSET("ttl", FR_TYPE_TIME_DELTA, rlm_cache_config_t, l1_ttl), .dflt = "1.0" },
+	CONF_PARSER_TERMINATOR
+};
+
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("driver", FR_TYPE_STRING, rlm_cache_config_t, driver_name), .dflt = "rlm_cache_rbtree" },
 	{ FR_CONF_OFFSET("key", FR_TYPE_TMPL | FR_TYPE_REQUIRED, rlm_cache_config_t, key) },
 	{ FR_CONF_OFFSET("ttl", FR_TYPE_UINT32, rlm_cache_config_t, ttl), .dflt = "500" },
+	{ FR_CONF_OFFSET("negative_ttl", FR_TYPE_UINT32, rlm_cache_config_t, negative_ttl), .dflt = "0" },
 	{ FR_CONF_OFFSET("max_entries", FR_TYPE_UINT32, rlm_cache_config_t, max_entries), .dflt = "0" },
 
 	/* Should be a type which matches time_t, @fixme before 2038 */
 	{ FR_CONF_OFFSET("epoch", FR_TYPE_INT32, rlm_cache_config_t, epoch), .dflt = "0" },
 	{ FR_CONF_OFFSET("add_stats", FR_TYPE_BOOL, rlm_cache_config_t, stats), .dflt = "no" },
+	{ FR_CONF_OFFSET("single_flight", FR_TYPE_BOOL, rlm_cache_config_t, single_flight), .dflt = "no" },
+	{ FR_CONF_OFFSET("single_flight_timeout", FR_TYPE_TIME_DELTA, rlm_cache_config_t, single_flight_timeout), .dflt = "1.0" },
+	{ FR_CONF_POINTER("l1", FR_TYPE_SUBSECTION, NULL), .subcs = (void const *) l1_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -74,6 +85,181 @@ fr_dict_attr_autoload_t rlm_cache_dict_attr[] = {
 	{ NULL }
 };
 
+/** How often a request waiting for another request to insert an entry checks if it's done
+ *
+ */
+#define CACHE_FLIGHT_POLL_INTERVAL	fr_time_delta_from_msec(10)
+
+/** A key which a request is retrieving data for
+ *
+ * Allocated in the ctx of the request doing the retrieval, so it's
+ * removed automatically if that request never inserts an entry.
+ */
+typedef struct {
+	uint8_t const		*key;			//!< Key being retrieved.
+	size_t			key_len;		//!< Length of the key.
+	request_t const		*owner;			//!< Request doing the retrieval.
+	rlm_cache_flights_t	*flights;		//!< Tree we're in.
+	fr_rb_node_t		node;			//!< Entry in the tree of keys being retrieved.
+} rlm_cache_flight_t;
+
+/** State for a request waiting for another request to insert an entry
+ *
+ */
+typedef struct {
+	uint8_t const		*key;			//!< Key being waited on.
+	size_t			key_len;		//!< Length of the key.
+	fr_time_t		timeout;		//!< When we stop waiting.
+} rlm_cache_wait_t;
+
+typedef struct rlm_cache_thread_s rlm_cache_thread_t;
+
+/** An entry in a worker's local cache
+ *
+ * Wraps an entry retrieved from the driver.  The wrapped entry is freed
+ * with the driver's free callback when this is freed.
+ */
+typedef struct {
+	rlm_cache_entry_t	*c;			//!< Entry retrieved from the driver.
+	rlm_cache_thread_t	*thread;		//!< Thread instance the entry belongs to.
+	fr_unix_time_t		expires;		//!< When we stop serving the entry locally.
+	fr_rb_node_t		node;			//!< Entry in the tree of local entries.
+	fr_dlist_t		entry;			//!< Entry in the LRU list.
+} rlm_cache_l1_entry_t;
+
+/** Thread specific data for the cache module
+ *
+ */
+struct rlm_cache_thread_s {
+	rlm_cache_t const	*inst;			//!< Module instance.
+	rbtree_t		*l1;			//!< Local entries, by key.  NULL if the
+							//!< local cache is disabled.
+	fr_dlist_head_t		lru;			//!< Local entries, least recently used first.
+	rlm_cache_tier_stats_t	stats;			//!< Per-tier counters.
+	fr_dlist_t		entry;			//!< Entry in the instance's list of threads.
+};
+
+static unlang_action_t cache_it(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request,
+				bool may_wait);
+
+/** Compare two flights by key
+ *
+ */
+static int cache_flight_cmp(void const *one, void const *two)
+{
+	rlm_cache_flight_t const *a = one, *b = two;
+	int ret;
+
+	ret = (a->key_len > b->key_len) - (a->key_len < b->key_len);
+	if (ret != 0) return ret;
+
+	return memcmp(a->key, b->key, a->key_len);
+}
+
+static int _cache_flight_free(rlm_cache_flight_t *flight)
+{
+	pthread_mutex_lock(&flight->flights->mutex);
+	rbtree_deletebydata(flight->flights->tree, flight);
+	pthread_mutex_unlock(&flight->flights->mutex);
+
+	return 0;
+}
+
+static int _cache_flights_free(rlm_cache_flights_t *flights)
+{
+	pthread_mutex_destroy(&flights->mutex);
+
+	return 0;
+}
+
+static int _cache_threads_free(rlm_cache_threads_t *threads)
+{
+	pthread_mutex_destroy(&threads->mutex);
+
+	return 0;
+}
+
+/** Register the current request as the one retrieving data for a key
+ *
+ * @param[in] inst	Module instance.
+ * @param[in] request	The current request.
+ * @param[in] key	being retrieved.
+ * @param[in] key_len	Length of key.
+ * @return
+ *	- true if the current request is now, or already was, retrieving data for the key.
+ *	- false if another request is retrieving data for the key.
+ */
+static bool cache_flight_join(rlm_cache_t const *inst, request_t *request, uint8_t const *key, size_t key_len)
+{
+	rlm_cache_flight_t	*flight, find = { .key = key, .key_len = key_len };
+	bool			owner;
+
+	pthread_mutex_lock(&inst->flights->mutex);
+	flight = rbtree_finddata(inst->flights->tree, &find);
+	if (flight) {
+		owner = (flight->owner == request);
+		pthread_mutex_unlock(&inst->flights->mutex);
+		return owner;
+	}
+
+	MEM(flight = talloc_zero(request, rlm_cache_flight_t));
+	MEM(flight->key = talloc_memdup(flight, key, key_len));
+	flight->key_len = key_len;
+	flight->owner = request;
+	flight->flights = inst->flights;
+
+	if (!rbtree_insert(inst->flights->tree, flight)) {
+		pthread_mutex_unlock(&inst->flights->mutex);
+		talloc_free(flight);
+		return true;	/* Just do the retrieval */
+	}
+	talloc_set_destructor(flight, _cache_flight_free);
+	pthread_mutex_unlock(&inst->flights->mutex);
+
+	RDEBUG2("Marked \"%pV\" as being retrieved by this request",
+		fr_box_strvalue_len((char const *)key, key_len));
+
+	return true;
+}
+
+/** Remove the current request's claim on a key, if it has one
+ *
+ * Requests waiting on the key will check the cache again.
+ */
+static void cache_flight_release(rlm_cache_t const *inst, request_t *request, uint8_t const *key, size_t key_len)
+{
+	rlm_cache_flight_t	*flight, find = { .key = key, .key_len = key_len };
+
+	pthread_mutex_lock(&inst->flights->mutex);
+	flight = rbtree_finddata(inst->flights->tree, &find);
+	if (!flight || (flight->owner != request)) {
+		pthread_mutex_unlock(&inst->flights->mutex);
+		return;
+	}
+	pthread_mutex_unlock(&inst->flights->mutex);
+
+	/*
+	 *	Only the owner frees the flight, so it's
+	 *	still valid here.
+	 */
+	talloc_free(flight);
+}
+
+/** Check whether any request is retrieving data for a key
+ *
+ */
+static bool cache_flight_in_progress(rlm_cache_t const *inst, uint8_t const *key, size_t key_len)
+{
+	bool in_progress;
+
+	pthread_mutex_lock(&inst->flights->mutex);
+	in_progress = (rbtree_finddata(inst->flights->tree,
+				       &(rlm_cache_flight_t){ .key = key, .key_len = key_len }) != NULL);
+	pthread_mutex_unlock(&inst->flights->mutex);
+
+	return in_progress;
+}
+
 /** Get exclusive use of a handle to access the cache
  *
  */
@@ -184,7 +370,7 @@ static rlm_rcode_t cache_merge(rlm_cache_t const *inst, request_t *request, rlm_
 	if (inst->config.stats) {
 		fr_assert(request->packet != NULL);
 		MEM(pair_update_request(&vp, attr_cache_entry_hits) >= 0);
-		vp->vp_uint32 = c->hits;
+		vp->vp_uint32 = atomic_load_explicit(&c->hits, memory_order_relaxed);
 	}
 
 	return merged > 0 ?
@@ -248,14 +434,190 @@ static unlang_action_t cache_find(rlm_rcode_t *p_result, rlm_cache_entry_t **out
 		RETURN_MODULE_NOTFOUND;	/* Couldn't find a non-expired entry */
 	}
 
-	RDEBUG2("Found entry for \"%pV\"", fr_box_strvalue_len((char const *)key, key_len));
+	if (!c->maps) {
+		RDEBUG2("Found negative entry for \"%pV\"", fr_box_strvalue_len((char const *)key, key_len));
+	} else {
+		RDEBUG2("Found entry for \"%pV\"", fr_box_strvalue_len((char const *)key, key_len));
+	}
 
-	c->hits++;
+	atomic_fetch_add_explicit(&c->hits, 1, memory_order_relaxed);
 	*out = c;
 
 	RETURN_MODULE_OK;
 }
 
+/** Compare two local entries by key
+ *
+ */
+static int cache_l1_cmp(void const *one, void const *two)
+{
+	rlm_cache_l1_entry_t const *a = one, *b = two;
+	int ret;
+
+	ret = (a->c->key_len > b->c->key_len) - (a->c->key_len < b->c->key_len);
+	if (ret != 0) return ret;
+
+	return memcmp(a->c->key, b->c->key, a->c->key_len);
+}
+
+static int _cache_l1_entry_free(rlm_cache_l1_entry_t *l1e)
+{
+	rlm_cache_thread_t *t = l1e->thread;
+
+	rbtree_deletebydata(t->l1, l1e);
+	fr_dlist_remove(&t->lru, l1e);
+	t->inst->driver->free(l1e->c);
+
+	return 0;
+}
+
+/** Find an entry in the worker's local cache
+ *
+ * Entries past their local expiry, or created before the epoch, are removed.
+ *
+ * @return
+ *	- The entry.  This belongs to the local cache and must not be freed.
+ *	- NULL if there's no usable local entry.
+ */
+static rlm_cache_entry_t *cache_l1_find(rlm_cache_thread_t *t, request_t *request,
+					uint8_t const *key, size_t key_len)
+{
+	rlm_cache_t const	*inst = t->inst;
+	rlm_cache_l1_entry_t	*l1e;
+
+	l1e = rbtree_finddata(t->l1, &(rlm_cache_l1_entry_t){
+					.c = &(rlm_cache_entry_t){ .key = key, .key_len = key_len }
+				  });
+	if (!l1e) {
+		t->stats.l1_misses++;
+		return NULL;
+	}
+
+	if ((l1e->expires < fr_time_to_unix_time(request->packet->timestamp)) ||
+	    (l1e->c->created < fr_unix_time_from_sec(inst->config.epoch))) {
+		RDEBUG3("Local entry for \"%pV\" is stale, removing it",
+			fr_box_strvalue_len((char const *)key, key_len));
+		talloc_free(l1e);
+		t->stats.l1_misses++;
+		return NULL;
+	}
+
+	/*
+	 *	Most recently used entries go at the tail
+	 */
+	fr_dlist_remove(&t->lru, l1e);
+	fr_dlist_insert_tail(&t->lru, l1e);
+	t->stats.l1_hits++;
+
+	RDEBUG2("Found local entry for \"%pV\"", fr_box_strvalue_len((char const *)key, key_len));
+
+	atomic_fetch_add_explicit(&l1e->c->hits, 1, memory_order_relaxed);
+
+	return l1e->c;
+}
+
+/** Add an entry retrieved from the driver to the worker's local cache
+ *
+ * The entry is served locally until it expires, or for l1.ttl, whichever
+ * comes first.  If the local cache is full, the least recently used
+ * entry is evicted.
+ *
+ * @return
+ *	- true if the local cache now owns the entry.
+ *	- false if it wasn't added, and the caller should free it as normal.
+ */
+static bool cache_l1_insert(rlm_cache_thread_t *t, request_t *request, rlm_cache_entry_t *c)
+{
+	rlm_cache_t const	*inst = t->inst;
+	rlm_cache_l1_entry_t	*l1e;
+
+	if (fr_dlist_num_elements(&t->lru) >= inst->config.l1_max_entries) {
+		talloc_free(fr_dlist_head(&t->lru));
+		t->stats.l1_evicted++;
+	}
+
+	MEM(l1e = talloc_zero(t, rlm_cache_l1_entry_t));
+	l1e->c = c;
+	l1e->thread = t;
+	l1e->expires = fr_time_to_unix_time(request->packet->timestamp) + inst->config.l1_ttl;
+	if (c->expires < l1e->expires) l1e->expires = c->expires;
+
+	if (!rbtree_insert(t->l1, l1e)) {
+		talloc_free(l1e);
+		return false;
+	}
+	fr_dlist_insert_tail(&t->lru, l1e);
+	talloc_set_destructor(l1e, _cache_l1_entry_free);
+
+	return true;
+}
+
+/** Remove an entry from the worker's local cache, after we've written to the driver
+ *
+ * Other workers may still serve their own copies until l1.ttl passes.
+ */
+static void cache_l1_remove(rlm_cache_thread_t *t, request_t *request, uint8_t const *key, size_t key_len)
+{
+	rlm_cache_l1_entry_t	*l1e;
+
+	l1e = rbtree_finddata(t->l1, &(rlm_cache_l1_entry_t){
+					.c = &(rlm_cache_entry_t){ .key = key, .key_len = key_len }
+				  });
+	if (!l1e) return;
+
+	RDEBUG3("Removing local entry for \"%pV\"", fr_box_strvalue_len((char const *)key, key_len));
+	talloc_free(l1e);
+	t->stats.l1_invalidated++;
+}
+
+/** Find a cached entry, checking the worker's local cache before the driver
+ *
+ * Entries found by the driver are added to the local cache, if it's enabled.
+ *
+ * @param[out] p_result	Result of the lookup, as for #cache_find.
+ * @param[out] out	Where to write the entry.
+ * @param[out] local	Whether the entry belongs to the local cache, in which
+ *			case the caller must not free it.
+ * @param[in] t		Thread instance.
+ * @param[in] request	The current request.
+ * @param[in] handle	Driver handle.
+ * @param[in] key	to lookup.
+ * @param[in] key_len	Length of key.
+ */
+static unlang_action_t cache_find_tiered(rlm_rcode_t *p_result, rlm_cache_entry_t **out, bool *local,
+					 rlm_cache_thread_t *t, request_t *request,
+					 rlm_cache_handle_t **handle, uint8_t const *key, size_t key_len)
+{
+	rlm_rcode_t rcode;
+
+	*local = false;
+
+	if (t->l1) {
+		*out = cache_l1_find(t, request, key, key_len);
+		if (*out) {
+			*local = true;
+			RETURN_MODULE_OK;
+		}
+	}
+
+	cache_find(&rcode, out, t->inst, request, handle, key, key_len);
+	switch (rcode) {
+	case RLM_MODULE_OK:
+		t->stats.l2_hits++;
+		if (t->l1) *local = cache_l1_insert(t, request, *out);
+		break;
+
+	case RLM_MODULE_NOTFOUND:
+		t->stats.l2_misses++;
+		break;
+
+	default:
+		break;
+	}
+
+	RETURN_MODULE_RCODE(rcode);
+}
+
 /** Expire a cache entry (removing it from the datastore)
  *
  * @return
@@ -286,6 +648,10 @@ static unlang_action_t cache_expire(rlm_rcode_t *p_result,
 }
 
 /** Create and insert a cache entry
+ *
+ * If none of the maps produce any attributes to cache, a negative entry is
+ * inserted instead, using negative_ttl.  This stops repeated lookups for
+ * things the backend doesn't know about.
  *
  * @return
  *	- #RLM_MODULE_OK on success.
@@ -294,7 +660,7 @@ static unlang_action_t cache_expire(rlm_rcode_t *p_result,
  */
 static unlang_action_t cache_insert(rlm_rcode_t *p_result,
 				    rlm_cache_t const *inst, request_t *request, rlm_cache_handle_t **handle,
-				    uint8_t const *key, size_t key_len, int ttl)
+				    uint8_t const *key, size_t key_len, int ttl, int negative_ttl)
 {
 	map_t		const *map;
 	map_t		**last, *c_map;
@@ -318,12 +684,6 @@ static unlang_action_t cache_insert(rlm_rcode_t *p_result,
 	c->key = talloc_memdup(c, key, key_len);
 	c->key_len = key_len;
 
-	/*
-	 *	All in NSEC resolution
-	 */
-	c->created = c->expires = fr_time_to_unix_time(request->packet->timestamp);
-	c->expires += fr_time_delta_from_sec(ttl);
-
 	last = &c->maps;
 
 	RDEBUG2("Creating new cache entry");
@@ -427,6 +787,17 @@ static unlang_action_t cache_insert(rlm_rcode_t *p_result,
 	}
 	talloc_free(pool);
 
+	if (!c->maps) {
+		RDEBUG2("Nothing to cache, creating negative entry");
+		ttl = negative_ttl;
+	}
+
+	/*
+	 *	All in NSEC resolution
+	 */
+	c->created = c->expires = fr_time_to_unix_time(request->packet->timestamp);
+	c->expires += fr_time_delta_from_sec(ttl);
+
 	/*
 	 *	Check to see if we need to merge the entry into the request
 	 */
@@ -464,14 +835,17 @@ static unlang_action_t cache_insert(rlm_rcode_t *p_result,
  */
 static unlang_action_t cache_set_ttl(rlm_rcode_t *p_result,
 				     rlm_cache_t const *inst, request_t *request,
-				     rlm_cache_handle_t **handle, rlm_cache_entry_t *c)
+				     rlm_cache_handle_t **handle, rlm_cache_entry_t *c, fr_unix_time_t expires)
 {
 	/*
-	 *	Call the driver's insert method to overwrite the old entry
+	 *	Call the driver's insert method to overwrite the old entry.
+	 *	The entry is private to this request, so can be updated
+	 *	in place.
 	 */
 	if (!inst->driver->set_ttl) for (;;) {
 		cache_status_t ret;
 
+		c->expires = expires;
 		ret = inst->driver->insert(&inst->config, inst->driver_inst->dl_inst->data, request, *handle, c);
 		switch (ret) {
 		case CACHE_RECONNECT:
@@ -494,7 +868,8 @@ static unlang_action_t cache_set_ttl(rlm_rcode_t *p_result,
 	for (;;) {
 		cache_status_t ret;
 
-		ret = inst->driver->set_ttl(&inst->config, inst->driver_inst->dl_inst->data, request, *handle, c);
+		ret = inst->driver->set_ttl(&inst->config, inst->driver_inst->dl_inst->data, request, *handle,
+					    c, expires);
 		switch (ret) {
 		case CACHE_RECONNECT:
 			if (cache_reconnect(handle, inst, request) == 0) continue;
@@ -526,6 +901,55 @@ static int cache_verify(map_t *map, void *ctx)
 	return 0;
 }
 
+/** Wake up a request waiting for another request to insert an entry
+ *
+ */
+static void _cache_wait_poll(UNUSED module_ctx_t const *mctx, request_t *request,
+			     UNUSED void *rctx, UNUSED fr_time_t fired)
+{
+	unlang_interpret_mark_resumable(request);
+}
+
+/** Stop waiting if the request is cancelled
+ *
+ */
+static void mod_cache_wait_signal(UNUSED module_ctx_t const *mctx, request_t *request, void *rctx,
+				  fr_state_signal_t action)
+{
+	if (action != FR_SIGNAL_CANCEL) return;
+
+	(void) unlang_module_timeout_delete(request, rctx);
+}
+
+/** Check whether the request we're waiting on has inserted an entry
+ *
+ * If it has, or it gave up, or we've waited long enough, repeat the
+ * cache operation.  Otherwise keep waiting.
+ */
+static unlang_action_t mod_cache_wait_resume(rlm_rcode_t *p_result, module_ctx_t const *mctx,
+					     request_t *request, void *rctx)
+{
+	rlm_cache_t const	*inst = talloc_get_type_abort_const(mctx->instance, rlm_cache_t);
+	rlm_cache_wait_t	*wait = talloc_get_type_abort(rctx, rlm_cache_wait_t);
+	fr_time_t		now = fr_time();
+
+	if (cache_flight_in_progress(inst, wait->key, wait->key_len)) {
+		if (now < wait->timeout) {
+			if (unlang_module_timeout_add(request, _cache_wait_poll, wait,
+						      now + CACHE_FLIGHT_POLL_INTERVAL) == 0) {
+				return unlang_module_yield(request, mod_cache_wait_resume, mod_cache_wait_signal, wait);
+			}
+			RPWDEBUG("Failed adding timer, not waiting any longer");
+		} else {
+			RWDEBUG("Timed out waiting for another request to retrieve data for \"%pV\"",
+				fr_box_strvalue_len((char const *)wait->key, wait->key_len));
+		}
+	}
+	talloc_free(wait);
+
+	return cache_it(p_result, mctx, request, false);
+}
+
 /** Do caching checks
  *
  * Since we can update ANY VP list, we do exactly the same thing for all sections
@@ -533,11 +957,19 @@ static int cache_verify(map_t *map, void *ctx)
  *
  * If you want to cache something different in different sections, configure
  * another cache module.
+ *
+ * @param[out] p_result		Result of the cache operation.
+ * @param[in] mctx		Module instance data.
+ * @param[in] request		The current request.
+ * @param[in] may_wait		Whether we may wait for another request to insert an entry,
+ *				if single_flight is enabled.
  */
-static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+static unlang_action_t CC_HINT(nonnull) cache_it(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request,
+						 bool may_wait)
 {
 	rlm_cache_entry_t	*c = NULL;
 	rlm_cache_t const	*inst = talloc_get_type_abort_const(mctx->instance, rlm_cache_t);
+	rlm_cache_thread_t	*t = talloc_get_type_abort(mctx->thread, rlm_cache_thread_t);
 
 	rlm_cache_handle_t	*handle;
 
@@ -545,6 +977,7 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 	fr_pair_t		*vp;
 
 	bool			merge = true, insert = true, expire = false, set_ttl = false;
+	bool			local = false, written = false;
 	int			exists = -1;
 
 	uint8_t			buffer[1024];
@@ -553,6 +986,7 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 	rlm_rcode_t		rcode = RLM_MODULE_NOOP;
 
 	int			ttl = inst->config.ttl;
+	int			negative_ttl = inst->config.negative_ttl ? (int)inst->config.negative_ttl : ttl;
 
 	key_len = tmpl_expand((char const **)&key, (char *)buffer, sizeof(buffer),
 			      request, inst->config.key, NULL, NULL);
@@ -579,7 +1013,7 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 			RETURN_MODULE_FAIL;
 		}
 
-		cache_find(&rcode, &c, inst, request, &handle, key, key_len);
+		cache_find_tiered(&rcode, &c, &local, t, request, &handle, key, key_len);
 		if (rcode == RLM_MODULE_FAIL) goto finish;
 		fr_assert(!inst->driver->acquire || handle);
 
@@ -609,6 +1043,7 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 			set_ttl = true;
 			ttl = vp->vp_int32;
 		}
+		negative_ttl = ttl;
 	}
 
 	RINDENT();
@@ -626,7 +1061,7 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 	 *	recording whether the entry existed.
 	 */
 	if (merge) {
-		cache_find(&rcode, &c, inst, request, &handle, key, key_len);
+		cache_find_tiered(&rcode, &c, &local, t, request, &handle, key, key_len);
 		switch (rcode) {
 		case RLM_MODULE_FAIL:
 			goto finish;
@@ -647,6 +1082,46 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 		fr_assert(!inst->driver->acquire || handle);
 	}
 
+	/*
+	 *	A lookup which missed.  Either we're about to
+	 *	expand the update section and insert the result,
+	 *	or, if inserts aren't allowed, the caller is
+	 *	probably going to query a backend, then call us
+	 *	again to insert the result.
+	 *
+	 *	Only let one request do that per key.  Other
+	 *	requests wait for it to finish, then check the
+	 *	cache again.
+	 */
+	if (inst->flights && (exists == 0) && !expire && !set_ttl &&
+	    !cache_flight_join(inst, request, key, key_len) && may_wait) {
+		rlm_cache_wait_t *wait;
+
+		/*
+		 *	Don't hold the handle whilst we're waiting.
+		 */
+		cache_free(inst, &c);
+		cache_release(inst, request, &handle);
+
+		MEM(wait = talloc_zero(request, rlm_cache_wait_t));
+		MEM(wait->key = talloc_memdup(wait, key, key_len));
+		wait->key_len = key_len;
+		wait->timeout = fr_time() + inst->config.single_flight_timeout;
+
+		if (unlang_module_timeout_add(request, _cache_wait_poll, wait,
+					      fr_time() + CACHE_FLIGHT_POLL_INTERVAL) < 0) {
+			RPWDEBUG("Failed adding timer, not waiting for other request");
+			talloc_free(wait);
+			goto clear;
+		}
+
+		RDEBUG2("Another request is retrieving data for \"%pV\", waiting up to %pVs for it",
+			fr_box_strvalue_len((char const *)key, key_len),
+			fr_box_time_delta(inst->config.single_flight_timeout));
+
+		return unlang_module_yield(request, mod_cache_wait_resume, mod_cache_wait_signal, wait);
+	}
+
 	/*
 	 *	Expire the entry if told to, and we either don't know whether
 	 *	it exists, or we know it does.
@@ -660,6 +1135,7 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 
 			fr_assert(!set_ttl);
 			cache_expire(&tmp, inst, request, &handle, key, key_len);
+			written = true;
 			switch (tmp) {
 			case RLM_MODULE_FAIL:
 				rcode = RLM_MODULE_FAIL;
@@ -691,7 +1167,7 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 	if ((exists < 0) && (insert || set_ttl)) {
 		rlm_rcode_t tmp;
 
-		cache_find(&tmp, &c, inst, request, &handle, key, key_len);
+		cache_find_tiered(&tmp, &c, &local, t, request, &handle, key, key_len);
 		switch (tmp) {
 		case RLM_MODULE_FAIL:
 			rcode = RLM_MODULE_FAIL;
@@ -720,9 +1196,9 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 
 		fr_assert(c);
 
-		c->expires = fr_time_to_unix_time(request->packet->timestamp) + fr_unix_time_from_sec(ttl);
-
-		cache_set_ttl(&tmp, inst, request, &handle, c);
+		cache_set_ttl(&tmp, inst, request, &handle, c,
+			      fr_time_to_unix_time(request->packet->timestamp) + fr_unix_time_from_sec(ttl));
+		written = true;
 		switch (tmp) {
 		case RLM_MODULE_FAIL:
 			rcode = RLM_MODULE_FAIL;
@@ -747,7 +1223,8 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 	if (insert && (exists == 0)) {
 		rlm_rcode_t tmp;
 
-		cache_insert(&tmp, inst, request, &handle, key, key_len, ttl);
+		cache_insert(&tmp, inst, request, &handle, key, key_len, ttl, negative_ttl);
+		written = true;
 		switch (tmp) {
 		case RLM_MODULE_FAIL:
 			rcode = RLM_MODULE_FAIL;
@@ -770,9 +1247,23 @@ static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, modu
 
 
 finish:
-	cache_free(inst, &c);
+	if (!local) cache_free(inst, &c);
 	cache_release(inst, request, &handle);
 
+	/*
+	 *	Our local copy of anything we changed is
+	 *	now stale.
+	 */
+	if (written && t->l1) cache_l1_remove(t, request, key, key_len);
+
+	/*
+	 *	If we were retrieving data for this key,
+	 *	we've either inserted it, or failed to.
+	 *	Either way, let the waiting requests go.
+	 */
+	if (inst->flights && insert) cache_flight_release(inst, request, key, key_len);
+
+clear:
 	/*
 	 *	Clear control attributes
 	 */
@@ -800,6 +1291,11 @@ finish:
 	RETURN_MODULE_RCODE(rcode);
 }
 
+static unlang_action_t CC_HINT(nonnull) mod_cache_it(rlm_rcode_t *p_result, module_ctx_t const *mctx, request_t *request)
+{
+	return cache_it(p_result, mctx, request, true);
+}
+
 /** Allow single attribute values to be retrieved from the cache
  *
  * @ingroup xlat_functions
@@ -882,6 +1378,114 @@ static ssize_t cache_xlat(TALLOC_CTX *ctx, char **out, UNUSED size_t freespace,
 	return ret;
 }
 
+static int cmd_stats_cache_tiers(FILE *fp, UNUSED FILE *fp_err, void *ctx, UNUSED fr_cmd_info_t const *info)
+{
+	rlm_cache_t const	*inst = ctx;
+	rlm_cache_thread_t	*t = NULL;
+	rlm_cache_tier_stats_t	stats = { 0 };
+	uint32_t		entries = 0;
+
+	/*
+	 *	Counters are updated by the workers without
+	 *	locking, so they may be slightly inconsistent
+	 *	with each other.
+	 */
+	pthread_mutex_lock(&inst->threads->mutex);
+	while ((t = fr_dlist_next(&inst->threads->list, t))) {
+		if (t->l1) entries += fr_dlist_num_elements(&t->lru);
+		stats.l1_hits += t->stats.l1_hits;
+		stats.l1_misses += t->stats.l1_misses;
+		stats.l1_evicted += t->stats.l1_evicted;
+		stats.l1_invalidated += t->stats.l1_invalidated;
+		stats.l2_hits += t->stats.l2_hits;
+		stats.l2_misses += t->stats.l2_misses;
+	}
+	pthread_mutex_unlock(&inst->threads->mutex);
+
+	fprintf(fp, "l1.entries\t\t\t%u\n", entries);
+	fprintf(fp, "l1.hits\t\t\t\t%" PRIu64 "\n", stats.l1_hits);
+	fprintf(fp, "l1.misses\t\t\t%" PRIu64 "\n", stats.l1_misses);
+	fprintf(fp, "l1.evicted\t\t\t%" PRIu64 "\n", stats.l1_evicted);
+	fprintf(fp, "l1.invalidated\t\t\t%" PRIu64 "\n", stats.l1_invalidated);
+	fprintf(fp, "l2.hits\t\t\t\t%" PRIu64 "\n", stats.l2_hits);
+	fprintf(fp, "l2.misses\t\t\t%" PRIu64 "\n", stats.l2_misses);
+
+	return 0;
+}
+
+/*
+ *	Drivers may register their own commands under
+ *	"stats cache <name>", too.
+ */
+static fr_cmd_table_t cmd_cache_table[] = {
+	{
+		.parent = "stats",
+		.name = "cache",
+		.help = "Statistics for caches.",
+		.read_only = true
+	},
+
+	{
+		.parent = "stats cache",
+		.add_name = true,
+		.name = "tiers",
+		.func = cmd_stats_cache_tiers,
+		.help = "Show hits and misses in the local cache (l1) and the driver (l2) for a specific cache.",
+		.read_only = true
+	},
+
+	CMD_TABLE_END
+};
+
+/** Create the worker's local cache, if it's enabled
+ *
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance,
+				  UNUSED fr_event_list_t *el, void *thread)
+{
+	rlm_cache_t		*inst = instance;
+	rlm_cache_thread_t	*t = talloc_get_type_abort(thread, rlm_cache_thread_t);
+
+	t->inst = inst;
+
+	if (inst->config.l1_max_entries > 0) {
+		/*
+		 *	Entries are freed explicitly in
+		 *	mod_thread_detach.
+		 */
+		MEM(t->l1 = rbtree_talloc_alloc(t, rlm_cache_l1_entry_t, node, cache_l1_cmp, NULL, 0));
+		fr_dlist_talloc_init(&t->lru, rlm_cache_l1_entry_t, entry);
+	}
+
+	pthread_mutex_lock(&inst->threads->mutex);
+	fr_dlist_insert_tail(&inst->threads->list, t);
+	pthread_mutex_unlock(&inst->threads->mutex);
+
+	return 0;
+}
+
+/** Free the worker's local cache
+ *
+ */
+static int mod_thread_detach(UNUSED fr_event_list_t *el, void *thread)
+{
+	rlm_cache_thread_t	*t = talloc_get_type_abort(thread, rlm_cache_thread_t);
+	rlm_cache_t const	*inst = t->inst;
+
+	pthread_mutex_lock(&inst->threads->mutex);
+	fr_dlist_remove(&inst->threads->list, t);
+	pthread_mutex_unlock(&inst->threads->mutex);
+
+	if (t->l1) {
+		rlm_cache_l1_entry_t *l1e;
+
+		while ((l1e = fr_dlist_head(&t->lru))) talloc_free(l1e);
+		TALLOC_FREE(t->l1);
+	}
+
+	return 0;
+}
+
 /** Free any memory allocated under the instance
  *
  */
@@ -1011,6 +1615,56 @@ static int mod_instantiate(void *instance, CONF_SECTION *conf)
 		return -1;
 	}
 
+	if (inst->config.single_flight) {
+		MEM(inst->flights = talloc_zero(inst, rlm_cache_flights_t));
+		if (pthread_mutex_init(&inst->flights->mutex, NULL) != 0) {
+			cf_log_err(conf, "Failed initializing mutex: %s", fr_syserror(errno));
+			talloc_free(inst->flights);
+			inst->flights = NULL;
+			return -1;
+		}
+		talloc_set_destructor(inst->flights, _cache_flights_free);
+
+		/*
+		 *	Flights are owned by the requests that
+		 *	created them, so the tree doesn't free them.
+		 */
+		MEM(inst->flights->tree = rbtree_talloc_alloc(inst->flights, rlm_cache_flight_t, node,
+							      cache_flight_cmp, NULL, 0));
+	}
+
+	/*
+	 *	A local cache only saves anything if the driver
+	 *	has to retrieve a copy of the entry from
+	 *	somewhere.  Drivers which keep entries in memory
+	 *	don't register a free callback.
+	 */
+	if ((inst->config.l1_max_entries > 0) && !inst->driver->free) {
+		cf_log_warn(conf, "Ignoring 'l1' section, driver \"%s\" keeps entries in memory already",
+			    inst->driver->name);
+		inst->config.l1_max_entries = 0;
+	}
+
+	if ((inst->config.l1_max_entries > 0) && (inst->config.l1_ttl <= 0)) {
+		cf_log_err(conf, "Must set 'l1.ttl' to a positive value");
+		return -1;
+	}
+
+	MEM(inst->threads = talloc_zero(inst, rlm_cache_threads_t));
+	if (pthread_mutex_init(&inst->threads->mutex, NULL) != 0) {
+		cf_log_err(conf, "Failed initializing mutex: %s", fr_syserror(errno));
+		talloc_free(inst->threads);
+		inst->threads = NULL;
+		return -1;
+	}
+	talloc_set_destructor(inst->threads, _cache_threads_free);
+	fr_dlist_talloc_init(&inst->threads->list, rlm_cache_thread_t, entry);
+
+	if (fr_command_register_hook(NULL, inst->config.name, inst, cmd_cache_table) < 0) {
+		PERROR("Failed registering radmin commands for cache %s", inst->config.name);
+		return -1;
+	}
+
 	return 0;
 }
 
@@ -1031,6 +1685,9 @@ module_t rlm_cache = {
 	.bootstrap	= mod_bootstrap,
 	.instantiate	= mod_instantiate,
 	.detach		= mod_detach,
+	.thread_inst_size	= sizeof(rlm_cache_thread_t),
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
 	.methods = {
 		[MOD_AUTHORIZE]		= mod_cache_it,
 		[MOD_PREACCT]		= mod_cache_it,
@@ -30,6 +30,12 @@ RCSIDH(cache_h, "$Id$")
 #include <freeradius-devel/server/map.h>
 #include <freeradius-devel/protocol/freeradius/freeradius.internal.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/util/stdatomic.h>
+#endif
+
 typedef struct rlm_cache_driver_s rlm_cache_driver_t;
 
 typedef void rlm_cache_handle_t;
@@ -53,11 +59,53 @@ typedef struct {
 	char const		*driver_name;		//!< Driver name.
 	tmpl_t		*key;			//!< What to expand to get the value of the key.
 	uint32_t		ttl;			//!< How long an entry is valid for.
+	uint32_t		negative_ttl;		//!< How long an entry with nothing cached in it
+							//!< is valid for.  0 means use ttl.
 	uint32_t		max_entries;		//!< Maximum entries allowed.
 	int32_t			epoch;			//!< Time after which entries are considered valid.
 	bool			stats;			//!< Generate statistics.
+
+	bool			single_flight;		//!< Whether requests which miss on a key, which
+							//!< another request is already retrieving data for,
+							//!< wait for that request to insert an entry.
+	fr_time_delta_t		single_flight_timeout;	//!< Maximum time to wait for the other request.
+
+	uint32_t		l1_max_entries;		//!< Maximum entries in each worker's local cache.
+							//!< 0 disables the local cache.
+	fr_time_delta_t		l1_ttl;			//!< Maximum time an entry is served from a
+							//!< worker's local cache.
 } rlm_cache_config_t;
 
+/** Keys which a request is currently retrieving data for
+ *
+ */
+typedef struct {
+	pthread_mutex_t		mutex;			//!< Protects the tree.  Requests from any
+							//!< thread may check it.
+	rbtree_t		*tree;			//!< Tree of #rlm_cache_flight_t, by key.
+} rlm_cache_flights_t;
+
+/** Per-tier counters for a worker
+ *
+ * The L1 is the worker's local cache, the L2 is the driver.
+ */
+typedef struct {
+	uint64_t		l1_hits;		//!< Lookups answered by the local cache.
+	uint64_t		l1_misses;		//!< Lookups the local cache couldn't answer.
+	uint64_t		l1_evicted;		//!< Entries evicted from the local cache to make room.
+	uint64_t		l1_invalidated;		//!< Entries removed because of a local write.
+	uint64_t		l2_hits;		//!< Lookups answered by the driver.
+	uint64_t		l2_misses;		//!< Lookups the driver couldn't answer.
+} rlm_cache_tier_stats_t;
+
+/** Workers' counters, so they can be summed
+ *
+ */
+typedef struct {
+	pthread_mutex_t		mutex;			//!< Protects the list.
+	fr_dlist_head_t		list;			//!< List of #rlm_cache_thread_t.
+} rlm_cache_threads_t;
+
 /*
  *	Define a structure for our module configuration.
  *
@@ -74,12 +122,19 @@ typedef struct {
 	map_t		*maps;			//!< Attribute map applied to users.
 							//!< and profiles.
 	CONF_SECTION		*cs;
+
+	rlm_cache_flights_t	*flights;		//!< Keys being retrieved, if single_flight
+							//!< is enabled.
+
+	rlm_cache_threads_t	*threads;		//!< Thread instances, for statistics.
 } rlm_cache_t;
 
 typedef struct {
 	uint8_t const		*key;			//!< Key used to identify entry.
 	size_t			key_len;		//!< Length of key data.
-	long long int		hits;			//!< How many times the entry has been retrieved.
+	atomic_llong		hits;			//!< How many times the entry has been retrieved.
+							//!< Atomic, as some drivers share entries between
+							//!< workers.
 	fr_unix_time_t		created;		//!< When the entry was created.
 	fr_unix_time_t		expires;		//!< When the entry expires.
 
@@ -185,8 +240,9 @@ typedef cache_status_t	(*cache_entry_expire_t)(rlm_cache_config_t const *config,
 
 /** Update the ttl of an entry in the cace
  *
- * @note This callback optional. If it's not specified the cache code will expire and
- *	 recreate the entry with a new TTL.
+ * @note This callback optional. If it's not specified the cache code will update
+ *	 c->expires in place, and insert the entry again, so drivers without it must
+ *	 not share entries between threads.
  *
  * If the #rlm_cache_handle_t is inviable, the driver should return #CACHE_RECONNECT, to have
  * it reinitialised/reconnected.
@@ -196,7 +252,9 @@ typedef cache_status_t	(*cache_entry_expire_t)(rlm_cache_config_t const *config,
  * @param[in] request The current request.
  * @param[in] handle the driver gave us when we called #cache_acquire_t, or NULL if no
  *	#cache_acquire_t callback was provided.
- * @param[in] c to update the TTL of. c->ttl will have been set to the new value.
+ * @param[in] c to update the TTL of.
+ * @param[in] expires the new expiry time.  The driver must update c->expires itself,
+ *	as the entry may be shared with other threads.
  * @return
  *	- #CACHE_RECONNECT - If handle needs to be reinitialised/reconnected.
  *	- #CACHE_ERROR - If the entry TTL couldn't be updated.
@@ -204,7 +262,7 @@ typedef cache_status_t	(*cache_entry_expire_t)(rlm_cache_config_t const *config,
  */
 typedef cache_status_t	(*cache_entry_set_ttl_t)(rlm_cache_config_t const *config, void *instance,
 						 request_t *request, void *handle,
-						 rlm_cache_entry_t *c);
+						 rlm_cache_entry_t *c, fr_unix_time_t expires);
 
 /** Get the number of entries in the cache
  *
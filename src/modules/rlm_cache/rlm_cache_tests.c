@@ -0,0 +1,376 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests for the cache module, using a driver which copies entries
+ *
+ * Time based behaviour, and the worker's local cache, are tested here
+ * rather than in the module tests.  Entries expire relative to the time
+ * the request was received, and that can't be changed from unlang.  The
+ * local cache is only used with drivers which register a free callback,
+ * and the ones in the module tests don't.
+ *
+ * @file src/modules/rlm_cache/rlm_cache_tests.c
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+static void cache_tests_init(void) __attribute__((constructor));
+
+#include <freeradius-devel/util/acutest.h>
+
+#include "rlm_cache.c"
+
+static TALLOC_CTX	*autofree;
+
+#define DRIVER_MAX_ENTRIES	8
+
+/** A driver which returns copies of entries, so must register a free callback
+ *
+ * Like drivers which serialise entries to an external store.
+ */
+typedef struct {
+	rlm_cache_entry_t	*entry[DRIVER_MAX_ENTRIES];	//!< Stored entries.
+	unsigned int		finds;				//!< Calls to find.
+	unsigned int		frees;				//!< Calls to free.
+} fake_driver_t;
+
+static fake_driver_t	fake;
+
+static rlm_cache_entry_t *fake_copy(TALLOC_CTX *ctx, rlm_cache_entry_t const *c)
+{
+	rlm_cache_entry_t *copy;
+
+	MEM(copy = talloc_zero(ctx, rlm_cache_entry_t));
+	MEM(copy->key = talloc_memdup(copy, c->key, c->key_len));
+	copy->key_len = c->key_len;
+	copy->created = c->created;
+	copy->expires = c->expires;
+
+	return copy;
+}
+
+static int fake_slot(uint8_t const *key, size_t key_len)
+{
+	int i;
+
+	for (i = 0; i < DRIVER_MAX_ENTRIES; i++) {
+		if (fake.entry[i] && (fake.entry[i]->key_len == key_len) &&
+		    (memcmp(fake.entry[i]->key, key, key_len) == 0)) return i;
+	}
+
+	return -1;
+}
+
+static void fake_free(rlm_cache_entry_t *c)
+{
+	fake.frees++;
+	talloc_free(c);
+}
+
+static cache_status_t fake_find(rlm_cache_entry_t **out, UNUSED rlm_cache_config_t const *config,
+				UNUSED void *instance, UNUSED request_t *request, UNUSED void *handle,
+				uint8_t const *key, size_t key_len)
+{
+	int i;
+
+	fake.finds++;
+
+	i = fake_slot(key, key_len);
+	if (i < 0) return CACHE_MISS;
+
+	*out = fake_copy(NULL, fake.entry[i]);
+
+	return CACHE_OK;
+}
+
+static cache_status_t fake_insert(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+				  UNUSED request_t *request, UNUSED void *handle, rlm_cache_entry_t const *c)
+{
+	int i;
+
+	i = fake_slot(c->key, c->key_len);
+	if (i < 0) for (i = 0; (i < DRIVER_MAX_ENTRIES) && fake.entry[i]; i++);
+	if (i == DRIVER_MAX_ENTRIES) return CACHE_ERROR;
+
+	talloc_free(fake.entry[i]);
+	fake.entry[i] = fake_copy(autofree, c);
+
+	return CACHE_OK;
+}
+
+static cache_status_t fake_expire(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+				  UNUSED request_t *request, UNUSED void *handle,
+				  uint8_t const *key, size_t key_len)
+{
+	int i;
+
+	i = fake_slot(key, key_len);
+	if (i < 0) return CACHE_MISS;
+
+	TALLOC_FREE(fake.entry[i]);
+
+	return CACHE_OK;
+}
+
+static rlm_cache_driver_t const fake_driver = {
+	.name		= "fake",
+	.free		= fake_free,
+	.find		= fake_find,
+	.insert		= fake_insert,
+	.expire		= fake_expire
+};
+
+static void cache_tests_init(void)
+{
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("rlm_cache_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	if (!fr_dict_global_ctx_init(autofree, "share/dictionary")) goto error;
+
+	if (log_global_init(&default_log, false) < 0) goto error;
+
+	if (request_global_init() < 0) goto error;
+
+	/*
+	 *	The module checks control attributes on insert
+	 */
+	if (fr_dict_autoload(rlm_cache_dict) < 0) goto error;
+	if (fr_dict_attr_autoload(rlm_cache_dict_attr) < 0) goto error;
+}
+
+static request_t *request_fake_alloc(void)
+{
+	request_t	*request;
+
+	request = request_local_alloc(autofree, NULL);
+	TEST_CHECK(request != NULL);
+
+	request->packet = fr_radius_packet_alloc(request, false);
+	TEST_CHECK(request->packet != NULL);
+	request->packet->timestamp = fr_time();
+
+	return request;
+}
+
+/** A module instance with no update section, using the fake driver
+ *
+ */
+static rlm_cache_t *inst_alloc(void)
+{
+	rlm_cache_t	*inst;
+
+	memset(&fake, 0, sizeof(fake));
+
+	inst = talloc_zero(autofree, rlm_cache_t);
+	TEST_CHECK(inst != NULL);
+
+	inst->config.name = "test";
+	inst->config.ttl = 10;
+	inst->config.negative_ttl = 2;
+
+	inst->driver = &fake_driver;
+	inst->driver_inst = talloc_zero(inst, module_instance_t);
+	inst->driver_inst->dl_inst = talloc_zero(inst->driver_inst, dl_module_inst_t);
+
+	return inst;
+}
+
+static void inst_free(rlm_cache_t *inst)
+{
+	int i;
+
+	for (i = 0; i < DRIVER_MAX_ENTRIES; i++) TALLOC_FREE(fake.entry[i]);
+	talloc_free(inst);
+}
+
+/** A worker, with its local cache, as done by mod_instantiate and mod_thread_instantiate
+ *
+ */
+static rlm_cache_thread_t *thread_alloc(rlm_cache_t *inst)
+{
+	rlm_cache_thread_t	*t;
+
+	inst->threads = talloc_zero(inst, rlm_cache_threads_t);
+	TEST_CHECK(inst->threads != NULL);
+	TEST_CHECK(pthread_mutex_init(&inst->threads->mutex, NULL) == 0);
+	talloc_set_destructor(inst->threads, _cache_threads_free);
+	fr_dlist_talloc_init(&inst->threads->list, rlm_cache_thread_t, entry);
+
+	t = talloc_zero(inst, rlm_cache_thread_t);
+	TEST_CHECK(t != NULL);
+	TEST_CHECK(mod_thread_instantiate(NULL, inst, NULL, t) == 0);
+
+	return t;
+}
+
+static void thread_free(rlm_cache_thread_t *t)
+{
+	TEST_CHECK(mod_thread_detach(NULL, t) == 0);
+	talloc_free(t);
+}
+
+static void entry_insert(rlm_cache_t *inst, request_t *request, char const *key)
+{
+	rlm_cache_handle_t	*handle = NULL;
+	rlm_rcode_t		rcode;
+
+	cache_insert(&rcode, inst, request, &handle, (uint8_t const *)key, strlen(key),
+		     inst->config.ttl, inst->config.ttl);
+	TEST_CHECK(rcode == RLM_MODULE_OK);
+}
+
+/** Find an entry, returning whether it was served by the local cache
+ *
+ */
+static rlm_cache_entry_t *entry_find(rlm_cache_thread_t *t, request_t *request, char const *key, bool *local)
+{
+	rlm_cache_handle_t	*handle = NULL;
+	rlm_cache_entry_t	*c;
+	rlm_rcode_t		rcode;
+
+	cache_find_tiered(&rcode, &c, local, t, request, &handle, (uint8_t const *)key, strlen(key));
+	if (rcode != RLM_MODULE_OK) return NULL;
+
+	return c;
+}
+
+static void cache_negative_ttl(void)
+{
+	rlm_cache_t		*inst = inst_alloc();
+	request_t		*request = request_fake_alloc();
+	rlm_cache_handle_t	*handle = NULL;
+	rlm_cache_entry_t	*c;
+	rlm_rcode_t		rcode;
+	uint8_t const		*key = (uint8_t const *)"negative";
+	size_t			key_len = strlen("negative");
+
+	TEST_CASE("Nothing to cache creates a negative entry, using negative_ttl");
+	cache_insert(&rcode, inst, request, &handle, key, key_len, inst->config.ttl, inst->config.negative_ttl);
+	TEST_CHECK(rcode == RLM_MODULE_OK);
+	TEST_CHECK(fake.entry[0] != NULL);
+	TEST_CHECK((fake.entry[0]->expires - fake.entry[0]->created) == fr_unix_time_from_sec(2));
+	TEST_MSG("Expected TTL 2s, got %" PRId64 "ns", fake.entry[0]->expires - fake.entry[0]->created);
+	TEST_CHECK(fake.frees == 1);
+	TEST_MSG("The inserted entry should be freed through the driver");
+
+	TEST_CASE("The negative entry is found before negative_ttl");
+	request->packet->timestamp += fr_time_delta_from_sec(1);
+	cache_find(&rcode, &c, inst, request, &handle, key, key_len);
+	TEST_CHECK(rcode == RLM_MODULE_OK);
+	TEST_CHECK(c && !c->maps);
+	cache_free(inst, &c);
+
+	TEST_CASE("After negative_ttl, it's removed from the driver and not found");
+	request->packet->timestamp += fr_time_delta_from_sec(2);
+	cache_find(&rcode, &c, inst, request, &handle, key, key_len);
+	TEST_CHECK(rcode == RLM_MODULE_NOTFOUND);
+	TEST_CHECK(c == NULL);
+	TEST_CHECK(fake_slot(key, key_len) < 0);
+	TEST_CHECK(fake.frees == 3);
+
+	talloc_free(request);
+	inst_free(inst);
+}
+
+static void cache_l1(void)
+{
+	rlm_cache_t		*inst = inst_alloc();
+	request_t		*request = request_fake_alloc();
+	rlm_cache_thread_t	*t;
+	rlm_cache_entry_t	*a, *c;
+	unsigned int		finds, frees;
+	bool			local;
+
+	inst->config.l1_max_entries = 2;
+	inst->config.l1_ttl = fr_time_delta_from_sec(1);
+	t = thread_alloc(inst);
+	TEST_CHECK(t->l1 != NULL);
+
+	entry_insert(inst, request, "a");
+	entry_insert(inst, request, "b");
+	entry_insert(inst, request, "c");
+	frees = fake.frees;
+
+	TEST_CASE("Entries found by the driver are added to the local cache");
+	a = entry_find(t, request, "a", &local);
+	TEST_CHECK(a != NULL);
+	TEST_CHECK(local);
+	TEST_CHECK(fake.finds == 1);
+	TEST_CHECK((t->stats.l1_misses == 1) && (t->stats.l2_hits == 1));
+	TEST_CHECK(fr_dlist_num_elements(&t->lru) == 1);
+
+	TEST_CASE("The next lookup is served locally, without calling the driver");
+	TEST_CHECK(entry_find(t, request, "a", &local) == a);
+	TEST_CHECK(local);
+	TEST_CHECK(fake.finds == 1);
+	TEST_CHECK(t->stats.l1_hits == 1);
+	TEST_CHECK(atomic_load(&a->hits) == 2);
+
+	TEST_CASE("Misses in both tiers are counted");
+	TEST_CHECK(entry_find(t, request, "z", &local) == NULL);
+	TEST_CHECK(!local);
+	TEST_CHECK(t->stats.l2_misses == 1);
+
+	TEST_CASE("When full, the least recently used entry is evicted, and freed by the driver");
+	TEST_CHECK(entry_find(t, request, "b", &local) != NULL);
+	TEST_CHECK(entry_find(t, request, "a", &local) == a);	/* b is now the least recently used */
+	TEST_CHECK(entry_find(t, request, "c", &local) != NULL);
+	TEST_CHECK(t->stats.l1_evicted == 1);
+	TEST_CHECK(fake.frees == frees + 1);
+	TEST_MSG("Expected %u frees, got %u", frees + 1, fake.frees);
+
+	finds = fake.finds;
+	TEST_CHECK(entry_find(t, request, "a", &local) == a);
+	TEST_CHECK(fake.finds == finds);
+	TEST_MSG("Entry \"a\" should still be local");
+
+	TEST_CASE("Local writes remove the local entry");
+	frees = fake.frees;
+	cache_l1_remove(t, request, (uint8_t const *)"c", 1);
+	TEST_CHECK(t->stats.l1_invalidated == 1);
+	TEST_CHECK(fake.frees == frees + 1);
+	TEST_CHECK(fr_dlist_num_elements(&t->lru) == 1);
+
+	TEST_CASE("Entries aren't served locally for longer than l1.ttl");
+	request->packet->timestamp += fr_time_delta_from_msec(1500);
+	finds = fake.finds;
+	frees = fake.frees;
+	c = entry_find(t, request, "a", &local);
+	TEST_CHECK(c != NULL);
+	TEST_CHECK(local);
+	TEST_CHECK(fake.finds == finds + 1);
+	TEST_CHECK(fake.frees == frees + 1);
+	TEST_MSG("The stale entry should be freed by the driver");
+
+	TEST_CASE("Entries still held locally are freed by the driver when the worker exits");
+	frees = fake.frees;
+	thread_free(t);
+	TEST_CHECK(fake.frees == frees + 1);
+	TEST_CHECK(fr_dlist_num_elements(&inst->threads->list) == 0);
+
+	talloc_free(request);
+	inst_free(inst);
+}
+
+TEST_LIST = {
+	{ "cache_negative_ttl",	cache_negative_ttl },
+	{ "cache_l1",		cache_l1 },
+
+	{ NULL }
+};
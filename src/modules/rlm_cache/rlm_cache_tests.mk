@@ -0,0 +1,7 @@
+TARGET      := rlm_cache_tests
+SOURCES     := rlm_cache_tests.c
+
+TGT_PREREQS += libfreeradius-server.a libfreeradius-unlang.a libfreeradius-util.a
+
+TGT_LDLIBS  := $(LIBS) $(GPERFTOOLS_LIBS)
+TGT_LDFLAGS := $(LDFLAGS) $(GPERFTOOLS_LDFLAGS)
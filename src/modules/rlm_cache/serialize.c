@@ -25,9 +25,17 @@
  */
 RCSID("$Id$")
 
+#include <freeradius-devel/internal/internal.h>
+#include <freeradius-devel/util/dbuff.h>
+
 #include "rlm_cache.h"
 #include "serialize.h"
 
+/** Flags for each map in a binary entry
+ *
+ */
+#define CACHE_BINARY_MAP_INTERNAL	0x01		//!< Attribute is from the internal dictionary.
+
 /** Serialize a cache entry as a humanly readable string
  *
  * @param ctx to alloc new string in. Should be a talloc pool a little bigger
@@ -44,10 +52,19 @@ int cache_serialize(TALLOC_CTX *ctx, char **out, rlm_cache_entry_t const *c)
 	char		attr[256];	/* Attr name buffer */
 	map_t	*map;
 
-	char		*to_store = NULL;
+	char		*to_store = NULL, *expires, *created;
 
-	to_store = talloc_typed_asprintf(ctx, "Cache-Expires = %pV\nCache-Created = %pV\n",
-					 fr_box_date(c->expires), fr_box_date(c->created));
+	/*
+	 *	Dates are printed with spaces, so they must be
+	 *	quoted to be parsed again.
+	 */
+	fr_value_box_aprint_quoted(ctx, &expires, fr_box_date(c->expires), T_SINGLE_QUOTED_STRING);
+	fr_value_box_aprint_quoted(ctx, &created, fr_box_date(c->created), T_SINGLE_QUOTED_STRING);
+	if (expires && created) {
+		to_store = talloc_typed_asprintf(ctx, "Cache-Expires = %s\nCache-Created = %s\n", expires, created);
+	}
+	talloc_free(expires);
+	talloc_free(created);
 	if (!to_store) return -1;
 
 	/*
@@ -74,7 +91,7 @@ int cache_serialize(TALLOC_CTX *ctx, char **out, rlm_cache_entry_t const *c)
 			goto error;
 		}
 
-		fr_value_box_aprint(value_pool, &value, tmpl_value(map->rhs), &fr_value_escape_single);
+		fr_value_box_aprint_quoted(value_pool, &value, tmpl_value(map->rhs), T_SINGLE_QUOTED_STRING);
 		if (!value) goto error;
 
 		to_store = talloc_asprintf_append_buffer(to_store, "%s %s %s\n", attr,
@@ -134,7 +151,11 @@ int cache_deserialize(rlm_cache_entry_t *c, fr_dict_t const *dict, char *in, ssi
 			goto error;
 		}
 
-		if (!tmpl_is_unresolved(map->rhs)) {
+		/*
+		 *	Unquoted numbers and addresses are parsed
+		 *	as data, everything else is a literal.
+		 */
+		if (!tmpl_is_unresolved(map->rhs) && !tmpl_is_data(map->rhs)) {
 			fr_strerror_printf("Pair right hand side \"%s\" parsed as %s, needed literal.  "
 					   "Check serialized data quoting", map->rhs->name,
 					   fr_table_str_by_value(tmpl_type_table, map->rhs->type, "<INVALID>"));
@@ -177,3 +198,273 @@ int cache_deserialize(rlm_cache_entry_t *c, fr_dict_t const *dict, char *in, ssi
 
 	return 0;
 }
+
+/** Serialize a cache entry in a compact binary form
+ *
+ * A header is written first, followed by the list, operator and flags of
+ * each map, and its attribute and value in the internal encoding.
+ *
+ * @verbatim
+   +-----+---------+----------+---------+---------+------+----+-------+--------+
+   | tag | version | protocol | created | expires | list | op | flags | pair   | ...
+   +-----+---------+----------+---------+---------+------+----+-------+--------+
+      1       1          4         8         8       1     1      1    variable
+   @endverbatim
+ *
+ * Attributes from the internal dictionary are flagged as such.  All others
+ * must belong to the same protocol, whose number goes in the header.
+ *
+ * Entries which can't be represented this way, because they contain unknown
+ * attributes, or attributes from more than one protocol, produce an error,
+ * and should be serialized with #cache_serialize instead.
+ *
+ * @param[in] ctx	to allocate the buffer in.
+ * @param[out] out	Where to write a pointer to the serialized entry.
+ * @param[in] c		Cache entry to serialize.
+ * @return
+ *	- >0 the length of the serialized entry.
+ *	- -1 on failure.
+ */
+ssize_t cache_serialize_binary(TALLOC_CTX *ctx, uint8_t **out, rlm_cache_entry_t const *c)
+{
+	fr_dbuff_t		dbuff;
+	fr_dbuff_uctx_talloc_t	tctx;
+	fr_dbuff_marker_t	protocol;
+	fr_dict_t const		*dict = NULL;
+	map_t			*map;
+	TALLOC_CTX		*pool;
+
+	if (!fr_dbuff_init_talloc(ctx, &dbuff, &tctx, 256, SIZE_MAX)) return -1;
+
+	pool = talloc_pool(ctx, 256);
+	if (!pool) {
+	error:
+		talloc_free(pool);
+		talloc_free(fr_dbuff_buff(&dbuff));
+		return -1;
+	}
+
+	if (fr_dbuff_in_bytes(&dbuff, CACHE_SERIALIZE_BINARY_TAG, CACHE_SERIALIZE_BINARY_VERSION) < 0) goto error;
+
+	/*
+	 *	Protocol gets filled in once we've seen the maps
+	 */
+	fr_dbuff_marker(&protocol, &dbuff);
+	if ((fr_dbuff_in(&dbuff, (uint32_t)0) < 0) ||
+	    (fr_dbuff_in(&dbuff, (uint64_t)c->created) < 0) ||
+	    (fr_dbuff_in(&dbuff, (uint64_t)c->expires) < 0)) goto error;
+
+	for (map = c->maps; map; map = map->next) {
+		fr_dict_attr_t const	*da;
+		fr_dict_t const		*map_dict;
+		fr_pair_list_t		list;
+		fr_dcursor_t		cursor;
+		fr_pair_t		*vp;
+		uint8_t			flags = 0;
+
+		if (!tmpl_is_attr(map->lhs) || !tmpl_is_data(map->rhs) ||
+		    (tmpl_request(map->lhs) != REQUEST_CURRENT)) {
+			fr_strerror_printf("Can't serialize \"%s\" in binary form", map->lhs->name);
+			goto error;
+		}
+
+		da = tmpl_da(map->lhs);
+		switch (da->type) {
+		case FR_TYPE_STRUCTURAL:
+			fr_strerror_printf("Can't serialize %s attribute \"%s\" in binary form",
+					   fr_table_str_by_value(fr_value_box_type_table, da->type, "<INVALID>"),
+					   da->name);
+			goto error;
+
+		default:
+			break;
+		}
+
+		if (da->flags.is_unknown) {
+			fr_strerror_printf("Can't serialize unknown attribute \"%s\" in binary form", da->name);
+			goto error;
+		}
+
+		map_dict = fr_dict_by_da(da);
+		if (map_dict == fr_dict_internal()) {
+			flags |= CACHE_BINARY_MAP_INTERNAL;
+		} else if (!dict) {
+			dict = map_dict;
+		} else if (map_dict != dict) {
+			fr_strerror_printf("Can't serialize attributes from more than one protocol in binary form");
+			goto error;
+		}
+
+		if (fr_dbuff_in_bytes(&dbuff, (uint8_t)tmpl_list(map->lhs), (uint8_t)map->op, flags) < 0) goto error;
+
+		/*
+		 *	The encoder works on pairs.  These come out
+		 *	of the pool, which is reset after each one.
+		 */
+		vp = fr_pair_afrom_da(pool, da);
+		if (!vp || (fr_value_box_copy(vp, &vp->data, tmpl_value(map->rhs)) < 0)) goto error;
+
+		fr_pair_list_init(&list);
+		fr_pair_add(&list, vp);
+		fr_dcursor_init(&cursor, &list);
+
+		if (fr_internal_encode_pair(&dbuff, &cursor, NULL) <= 0) {
+			fr_strerror_printf_push("Failed encoding \"%s\"", map->lhs->name);
+			goto error;
+		}
+		talloc_free_children(pool);
+	}
+
+	if (dict && (fr_dbuff_in(&protocol, (uint32_t)fr_dict_root(dict)->attr) < 0)) goto error;
+
+	talloc_free(pool);
+
+	*out = fr_dbuff_buff(&dbuff);
+	return fr_dbuff_used(&dbuff);
+}
+
+/** Build a map from a decoded pair
+ *
+ * Cheaper than map_afrom_vp(), as the value is moved rather than
+ * copied, and string values double as the name of the RHS.
+ *
+ * @param[in] ctx	to allocate the map in.
+ * @param[in] list	the pair was cached from.
+ * @param[in] op	to apply the pair with.
+ * @param[in] vp	to take the value from.  The value is stolen.
+ * @return the new map.
+ */
+static map_t *cache_map_afrom_vp(TALLOC_CTX *ctx, tmpl_pair_list_t list, fr_token_t op, fr_pair_t *vp)
+{
+	map_t		*map;
+	fr_value_box_t	*value;
+	char		*name;
+	size_t		len;
+
+	MEM(map = talloc_zero(ctx, map_t));
+	map->op = op;
+
+	MEM(map->lhs = tmpl_alloc(map, TMPL_TYPE_ATTR, T_BARE_WORD, NULL, 0));
+	tmpl_attr_set_leaf_da(map->lhs, vp->da);
+	tmpl_attr_set_leaf_num(map->lhs, NUM_ANY);
+	tmpl_attr_set_request(map->lhs, REQUEST_CURRENT);
+	tmpl_attr_set_list(map->lhs, list);
+
+	MEM(name = talloc_typed_asprintf(map->lhs, "%s.%s",
+					 fr_table_str_by_value(pair_list_table, list, "<INVALID>"), vp->da->name));
+	tmpl_set_name_shallow(map->lhs, T_BARE_WORD, name, talloc_array_length(name) - 1);
+
+	MEM(map->rhs = tmpl_alloc(map, TMPL_TYPE_DATA, T_BARE_WORD, NULL, -1));
+	value = tmpl_value(map->rhs);
+	MEM(fr_value_box_steal(map->rhs, value, &vp->data) == 0);
+
+	if (value->type == FR_TYPE_STRING) {
+		tmpl_set_name_shallow(map->rhs,
+				      is_printable(value->vb_strvalue, value->vb_length) ?
+				      T_SINGLE_QUOTED_STRING : T_DOUBLE_QUOTED_STRING,
+				      value->vb_strvalue, value->vb_length);
+	} else {
+		len = fr_value_box_aprint(map->rhs, &name, value, NULL);
+		tmpl_set_name_shallow(map->rhs, T_BARE_WORD, name, len);
+	}
+
+	return map;
+}
+
+/** Converts an entry serialized with #cache_serialize_binary back into a structure
+ *
+ * @param[in] c		Cache entry to populate (should already be allocated)
+ * @param[in] dict	Protocol dictionary of the current request.  Must match the
+ *			protocol the entry was created with.
+ * @param[in] in	Serialized entry.
+ * @param[in] inlen	Length of the serialized entry.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int cache_deserialize_binary(rlm_cache_entry_t *c, fr_dict_t const *dict, uint8_t const *in, size_t inlen)
+{
+	fr_dbuff_t	dbuff = FR_DBUFF_TMP(in, inlen);
+	map_t		**last = &c->maps;
+	uint8_t		tag, version;
+	uint32_t	protocol;
+	uint64_t	created, expires;
+
+	if ((fr_dbuff_out(&tag, &dbuff) <= 0) || (tag != CACHE_SERIALIZE_BINARY_TAG)) {
+		fr_strerror_const("Not a binary cache entry");
+		return -1;
+	}
+
+	if (fr_dbuff_out(&version, &dbuff) <= 0) {
+	truncated:
+		fr_strerror_const("Binary cache entry is truncated");
+		return -1;
+	}
+
+	if (version != CACHE_SERIALIZE_BINARY_VERSION) {
+		fr_strerror_printf("Unsupported binary cache entry version %u", version);
+		return -1;
+	}
+
+	if ((fr_dbuff_out(&protocol, &dbuff) <= 0) ||
+	    (fr_dbuff_out(&created, &dbuff) <= 0) ||
+	    (fr_dbuff_out(&expires, &dbuff) <= 0)) goto truncated;
+
+	if (protocol && (protocol != fr_dict_root(dict)->attr)) {
+		fr_strerror_printf("Binary cache entry was created for protocol %u, not %s",
+				   protocol, fr_dict_root(dict)->name);
+		return -1;
+	}
+
+	c->created = created;
+	c->expires = expires;
+
+	while (fr_dbuff_remaining(&dbuff) > 0) {
+		uint8_t		list, op, flags;
+		fr_pair_list_t	vps;
+		fr_dcursor_t	cursor;
+		fr_pair_t	*vp;
+		map_t		*map;
+
+		if ((fr_dbuff_out(&list, &dbuff) <= 0) ||
+		    (fr_dbuff_out(&op, &dbuff) <= 0) ||
+		    (fr_dbuff_out(&flags, &dbuff) <= 0)) goto truncated;
+
+		if (list >= PAIR_LIST_UNKNOWN) {
+			fr_strerror_printf("Binary cache entry contains invalid list %u", list);
+			return -1;
+		}
+
+		fr_pair_list_init(&vps);
+		fr_dcursor_init(&cursor, &vps);
+
+		if (fr_internal_decode_pair_dbuff(c, &cursor,
+						  (flags & CACHE_BINARY_MAP_INTERNAL) ? fr_dict_internal() : dict,
+						  &dbuff, NULL) <= 0) {
+			fr_strerror_printf_push("Failed decoding binary cache entry");
+			fr_pair_list_free(&vps);
+			return -1;
+		}
+
+		/*
+		 *	If the dictionaries changed since the entry
+		 *	was created, the attribute may not exist.
+		 */
+		vp = fr_pair_list_head(&vps);
+		if (!vp || fr_pair_list_next(&vps, vp) || vp->da->flags.is_unknown) {
+			fr_strerror_const("Binary cache entry contains attributes not in the dictionary");
+			fr_pair_list_free(&vps);
+			return -1;
+		}
+
+		map = cache_map_afrom_vp(c, list, op, vp);
+		fr_pair_list_free(&vps);
+
+		MAP_VERIFY(map);
+
+		*last = map;
+		last = &(*last)->next;
+	}
+
+	return 0;
+}
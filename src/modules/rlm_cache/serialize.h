@@ -26,5 +26,25 @@
  */
 RCSIDH(serialize_h, "$Id$")
 
-int cache_serialize(TALLOC_CTX *ctx, char **out, rlm_cache_entry_t const *c);
-int cache_deserialize(rlm_cache_entry_t *c, fr_dict_t const *dict, char *in, ssize_t inlen);
+/** First byte of entries serialized with cache_serialize_binary()
+ *
+ * Text entries start with an attribute name, so never start with this.
+ */
+#define CACHE_SERIALIZE_BINARY_TAG	0xff
+
+/** Version of the binary format.  Entries with a different version are rejected
+ *
+ */
+#define CACHE_SERIALIZE_BINARY_VERSION	0x01
+
+/** Whether a serialized entry is in the binary form
+ *
+ */
+#define CACHE_SERIALIZED_IS_BINARY(_in, _inlen) \
+	(((_inlen) > 0) && (((uint8_t const *)(_in))[0] == CACHE_SERIALIZE_BINARY_TAG))
+
+int	cache_serialize(TALLOC_CTX *ctx, char **out, rlm_cache_entry_t const *c);
+int	cache_deserialize(rlm_cache_entry_t *c, fr_dict_t const *dict, char *in, ssize_t inlen);
+
+ssize_t	cache_serialize_binary(TALLOC_CTX *ctx, uint8_t **out, rlm_cache_entry_t const *c);
+int	cache_deserialize_binary(rlm_cache_entry_t *c, fr_dict_t const *dict, uint8_t const *in, size_t inlen);
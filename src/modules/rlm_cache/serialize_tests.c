@@ -0,0 +1,305 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/** Tests and benchmarks for serializing cache entries
+ *
+ * The benchmark compares the text and binary formats.  It's only run
+ * if FR_TEST_BENCHMARK is set.
+ *
+ * @file src/modules/rlm_cache/serialize_tests.c
+ *
+ * @copyright 2021 The FreeRADIUS server project
+ */
+static void serialize_tests_init(void) __attribute__((constructor));
+
+#include <freeradius-devel/util/acutest.h>
+#include <freeradius-devel/util/acutest_helpers.h>
+#include <freeradius-devel/util/time.h>
+
+#include "rlm_cache.h"
+#include "serialize.h"
+
+#define SERIALIZE_BENCH_SIZE	(20000)
+
+static char const	*dict_dir = "share/dictionary";
+
+static TALLOC_CTX	*autofree;
+static fr_dict_t	*dict_internal;
+static fr_dict_t	*dict_test;
+
+/** Attributes for a typical subscriber profile
+ *
+ * Defined here, so the test doesn't depend on loading a protocol library.
+ */
+static struct {
+	char const	*name;
+	fr_type_t	type;
+} test_attrs[] = {
+	{ "Service-Type",		FR_TYPE_UINT32 },
+	{ "Framed-Protocol",		FR_TYPE_UINT32 },
+	{ "Framed-IP-Address",		FR_TYPE_IPV4_ADDR },
+	{ "Framed-IP-Netmask",		FR_TYPE_IPV4_ADDR },
+	{ "Filter-Id",			FR_TYPE_STRING },
+	{ "Reply-Message",		FR_TYPE_STRING },
+	{ "Framed-Route",		FR_TYPE_STRING },
+	{ "Class",			FR_TYPE_OCTETS },
+	{ "Session-Timeout",		FR_TYPE_UINT32 },
+	{ "Idle-Timeout",		FR_TYPE_UINT32 },
+	{ "Acct-Interim-Interval",	FR_TYPE_UINT32 },
+	{ "Framed-Pool",		FR_TYPE_STRING },
+	{ "Framed-IPv6-Prefix",		FR_TYPE_IPV6_PREFIX },
+	{ NULL }
+};
+
+/** A typical subscriber profile, as cached from a database
+ *
+ */
+static char const profile[] =
+	"reply.Service-Type := 2\n"
+	"reply.Framed-Protocol := 1\n"
+	"reply.Framed-IP-Address := 192.0.2.10\n"
+	"reply.Framed-IP-Netmask := 255.255.255.0\n"
+	"reply.Framed-IPv6-Prefix := 2001:db8:1234::/48\n"
+	"reply.Session-Timeout := 86400\n"
+	"reply.Idle-Timeout := 3600\n"
+	"reply.Acct-Interim-Interval := 300\n"
+	"reply.Framed-Pool := 'residential-pool-01'\n"
+	"reply.Filter-Id := 'subscriber-100mbit-in'\n"
+	"reply.Framed-Route += '198.51.100.0/24 192.0.2.10 1'\n"
+	"reply.Framed-Route += '203.0.113.0/25 192.0.2.10 1'\n"
+	"reply.Class := 0x70726f66696c653a7265736964656e7469616c3a31303030\n"
+	"reply.Reply-Message := 'Welcome back, your plan renews on the 1st'\n"
+	"control.Tmp-String-0 := 'subscriber-0001234567'\n"
+	"control.Tmp-Integer-0 := 100000\n";
+
+static void serialize_tests_init(void)
+{
+	int i;
+
+	autofree = talloc_autofree_context();
+	if (!autofree) {
+	error:
+		fr_perror("serialize_tests");
+		fr_exit_now(EXIT_FAILURE);
+	}
+
+	if (!fr_dict_global_ctx_init(autofree, dict_dir)) goto error;
+	if (fr_dict_internal_afrom_file(&dict_internal, FR_DICTIONARY_INTERNAL_DIR) < 0) goto error;
+
+	dict_test = fr_dict_alloc("test", 666);
+	if (!dict_test) goto error;
+
+	for (i = 0; test_attrs[i].name; i++) {
+		if (fr_dict_attr_add(dict_test, fr_dict_root(dict_test), test_attrs[i].name, i + 1,
+				     test_attrs[i].type, &(fr_dict_attr_flags_t){ 0 }) < 0) goto error;
+	}
+}
+
+/** Build the entry from the text form of the profile
+ *
+ */
+static rlm_cache_entry_t *profile_entry_alloc(void)
+{
+	rlm_cache_entry_t	*c;
+	char			*text;
+
+	c = talloc_zero(autofree, rlm_cache_entry_t);
+	TEST_CHECK(c != NULL);
+
+	text = talloc_strdup(c, profile);
+	TEST_CHECK(cache_deserialize(c, dict_test, text, -1) == 0);
+	if (!TEST_CHECK(c->maps != NULL)) fr_perror("serialize_tests");
+	talloc_free(text);
+
+	/*
+	 *	The text form only has second precision.
+	 */
+	c->created = fr_unix_time_from_sec(fr_unix_time_to_sec(fr_time_to_unix_time(fr_time())));
+	c->expires = c->created + fr_time_delta_from_sec(3600);
+
+	return c;
+}
+
+static void entry_cmp(rlm_cache_entry_t const *a, rlm_cache_entry_t const *b)
+{
+	map_t const *ma, *mb;
+
+	TEST_CHECK(a->created == b->created);
+	TEST_CHECK(a->expires == b->expires);
+
+	for (ma = a->maps, mb = b->maps;
+	     ma && mb;
+	     ma = ma->next, mb = mb->next) {
+		TEST_CASE(ma->lhs->name);
+		TEST_CHECK(tmpl_da(ma->lhs) == tmpl_da(mb->lhs));
+		TEST_CHECK(tmpl_list(ma->lhs) == tmpl_list(mb->lhs));
+		TEST_CHECK(ma->op == mb->op);
+		TEST_CHECK(fr_value_box_cmp(tmpl_value(ma->rhs), tmpl_value(mb->rhs)) == 0);
+	}
+	TEST_CHECK(!ma && !mb);
+}
+
+static void serialize_binary(void)
+{
+	rlm_cache_entry_t	*c, *decoded;
+	uint8_t			*data;
+	ssize_t			len;
+
+	c = profile_entry_alloc();
+
+	len = cache_serialize_binary(c, &data, c);
+	TEST_CHECK(len > 0);
+	TEST_CHECK(CACHE_SERIALIZED_IS_BINARY(data, len));
+
+	decoded = talloc_zero(c, rlm_cache_entry_t);
+	if (!TEST_CHECK(cache_deserialize_binary(decoded, dict_test, data, len) == 0)) fr_perror("serialize_tests");
+	entry_cmp(c, decoded);
+
+	/*
+	 *	Every truncation must be rejected, rather
+	 *	than producing a partial entry.
+	 */
+	TEST_CASE("Truncated entries");
+	while (--len > 0) {
+		rlm_cache_entry_t *partial = talloc_zero(c, rlm_cache_entry_t);
+
+		(void) cache_deserialize_binary(partial, dict_test, data, len);
+		talloc_free(partial);
+	}
+
+	TEST_CASE("Unsupported version");
+	data[1] = CACHE_SERIALIZE_BINARY_VERSION + 1;
+	TEST_CHECK(cache_deserialize_binary(talloc_zero(c, rlm_cache_entry_t), dict_test,
+					    data, talloc_array_length(data)) < 0);
+
+	talloc_free(c);
+}
+
+static void serialize_text(void)
+{
+	rlm_cache_entry_t	*c, *decoded;
+	char			*text;
+
+	c = profile_entry_alloc();
+
+	TEST_CHECK(cache_serialize(c, &text, c) == 0);
+	TEST_MSG("%s", text);
+
+	decoded = talloc_zero(c, rlm_cache_entry_t);
+	if (!TEST_CHECK(cache_deserialize(decoded, dict_test, text, -1) == 0)) fr_perror("serialize_tests");
+	entry_cmp(c, decoded);
+
+	talloc_free(c);
+}
+
+static void serialize_text_is_not_binary(void)
+{
+	rlm_cache_entry_t	*c;
+	char			*text;
+
+	c = profile_entry_alloc();
+
+	TEST_CHECK(cache_serialize(c, &text, c) == 0);
+	TEST_CHECK(!CACHE_SERIALIZED_IS_BINARY(text, strlen(text)));
+	TEST_CHECK(cache_deserialize_binary(talloc_zero(c, rlm_cache_entry_t), dict_test,
+					    (uint8_t *)text, strlen(text)) < 0);
+
+	talloc_free(c);
+}
+
+static void serialize_benchmark(void)
+{
+	rlm_cache_entry_t	*c, *decoded;
+	TALLOC_CTX		*pool;
+	char			*text, *copy;
+	uint8_t			*data;
+	size_t			text_len;
+	ssize_t			data_len;
+	fr_time_t		start;
+	fr_time_delta_t		text_enc, text_dec, bin_enc, bin_dec;
+	int			i;
+
+	TEST_BENCHMARK();
+
+	c = profile_entry_alloc();
+	pool = talloc_pool(c, 8192);
+
+	TEST_CHECK(cache_serialize(c, &text, c) == 0);
+	text_len = strlen(text);
+	copy = talloc_array(c, char, text_len + 1);
+
+	data_len = cache_serialize_binary(c, &data, c);
+	TEST_CHECK(data_len > 0);
+
+	start = fr_time();
+	for (i = 0; i < SERIALIZE_BENCH_SIZE; i++) {
+		char *out;
+
+		(void) cache_serialize(pool, &out, c);
+		talloc_free_children(pool);
+	}
+	text_enc = fr_time() - start;
+
+	/*
+	 *	cache_deserialize() writes to its input, so
+	 *	it gets a fresh copy each time.
+	 */
+	start = fr_time();
+	for (i = 0; i < SERIALIZE_BENCH_SIZE; i++) {
+		memcpy(copy, text, text_len + 1);
+		decoded = talloc_zero(pool, rlm_cache_entry_t);
+		if (cache_deserialize(decoded, dict_test, copy, text_len) < 0) break;
+		talloc_free_children(pool);
+	}
+	text_dec = fr_time() - start;
+
+	start = fr_time();
+	for (i = 0; i < SERIALIZE_BENCH_SIZE; i++) {
+		uint8_t *out;
+
+		(void) cache_serialize_binary(pool, &out, c);
+		talloc_free_children(pool);
+	}
+	bin_enc = fr_time() - start;
+
+	start = fr_time();
+	for (i = 0; i < SERIALIZE_BENCH_SIZE; i++) {
+		decoded = talloc_zero(pool, rlm_cache_entry_t);
+		if (cache_deserialize_binary(decoded, dict_test, data, data_len) < 0) break;
+		talloc_free_children(pool);
+	}
+	bin_dec = fr_time() - start;
+
+	TEST_CHECK((size_t)data_len < text_len);
+
+	printf("\n%d iterations\n", SERIALIZE_BENCH_SIZE);
+	printf("text   %4zu bytes, serialize %" PRIu64 " ns/op, deserialize %" PRIu64 " ns/op\n",
+	       text_len, (uint64_t) text_enc / SERIALIZE_BENCH_SIZE, (uint64_t) text_dec / SERIALIZE_BENCH_SIZE);
+	printf("binary %4zd bytes, serialize %" PRIu64 " ns/op, deserialize %" PRIu64 " ns/op\n",
+	       data_len, (uint64_t) bin_enc / SERIALIZE_BENCH_SIZE, (uint64_t) bin_dec / SERIALIZE_BENCH_SIZE);
+
+	talloc_free(c);
+}
+
+TEST_LIST = {
+	{ "serialize_text",			serialize_text },
+	{ "serialize_binary",			serialize_binary },
+	{ "serialize_text_is_not_binary",	serialize_text_is_not_binary },
+
+	{ "serialize_benchmark",		serialize_benchmark },
+
+	{ NULL }
+};
@@ -0,0 +1,7 @@
+TARGET      := serialize_tests
+SOURCES     := serialize_tests.c serialize.c
+
+TGT_PREREQS += libfreeradius-internal.a libfreeradius-server.a libfreeradius-unlang.a libfreeradius-util.a
+
+TGT_LDLIBS  := $(LIBS) $(GPERFTOOLS_LIBS)
+TGT_LDFLAGS := $(LDFLAGS) $(GPERFTOOLS_LDFLAGS)
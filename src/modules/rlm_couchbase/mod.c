@@ -906,6 +906,9 @@ int mod_load_client_documents(rlm_couchbase_t *inst, CONF_SECTION *tmpl, CONF_SE
 
 	free_and_return:
 
+	/* build the lookup tables for the new clients */
+	if (retval == 0) (void) client_list_compile(NULL);
+
 	/* free rows */
 	if (jrows) {
 		json_object_put(jrows);
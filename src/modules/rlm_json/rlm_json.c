@@ -452,6 +452,7 @@ static rlm_rcode_t mod_map_proc(UNUSED void *mod_inst, void *proc_inst, request_
 	rlm_json_jpath_to_eval_t	to_eval;
 
 	char const			*json_str = NULL;
+	size_t				json_len;
 
 	if (!*json) {
 		REDEBUG("JSON map input cannot be (null)");
@@ -463,14 +464,15 @@ static rlm_rcode_t mod_map_proc(UNUSED void *mod_inst, void *proc_inst, request_
 		return RLM_MODULE_FAIL;
 	}
 	json_str = (*json)->vb_strvalue;
+	json_len = (*json)->vb_length;
 
-	if ((talloc_array_length(json_str) - 1) == 0) {
+	if (json_len == 0) {
 		REDEBUG("JSON map input length must be > 0");
 		return RLM_MODULE_FAIL;
 	}
 
 	tok = json_tokener_new();
-	to_eval.root = json_tokener_parse_ex(tok, json_str, (int)(talloc_array_length(json_str) - 1));
+	to_eval.root = json_tokener_parse_ex(tok, json_str, (int)json_len);
 	if (!to_eval.root) {
 		REMARKER(json_str, tok->char_offset, "%s", json_tokener_error_desc(json_tokener_get_error(tok)));
 		rcode = RLM_MODULE_FAIL;
@@ -262,6 +262,8 @@ int rlm_ldap_client_load(rlm_ldap_t const *inst, CONF_SECTION *tmpl, CONF_SECTIO
 	} while ((entry = ldap_next_entry(conn->handle, entry)));
 
 finish:
+	if (ret == 0) (void) client_list_compile(NULL);
+
 	talloc_free(attrs);
 	if (dn) ldap_memfree(dn);
 	if (result) ldap_msgfree(result);
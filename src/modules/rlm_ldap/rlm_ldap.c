@@ -620,7 +620,7 @@ static int rlm_ldap_groupcmp(void *instance, request_t *request, UNUSED fr_pair_
 		char	*norm;
 		size_t	len;
 
-		MEM(norm = talloc_array(check, char, talloc_array_length(check->vp_strvalue)));
+		MEM(norm = talloc_array(check, char, check->vp_length + 1));
 		len = fr_ldap_util_normalise_dn(norm, check->vp_strvalue);
 
 		/*
@@ -1894,7 +1894,7 @@ do {\
 
 		RDEBUG3("Configuring HTTP auth type %s, user \"%pV\", password \"%pV\"",
 			fr_table_str_by_value(http_auth_table, auth, "<INVALID>"),
-			fr_box_strvalue_buffer(username), fr_box_strvalue_buffer(password));
+			fr_box_strvalue(username), fr_box_strvalue(password));
 
 		if ((auth >= REST_HTTP_AUTH_BASIC) &&
 		    (auth <= REST_HTTP_AUTH_ANY_SAFE)) {
@@ -296,7 +296,13 @@ static ssize_t internal_decode_pair(TALLOC_CTX *ctx, fr_pair_list_t *head, fr_di
 		FR_PROTO_TRACE("Decoding %s - %s", da->name,
 			       fr_table_str_by_value(fr_value_box_type_table, da->type, "?Unknown?"));
 
-		slen = internal_decode_pair(ctx, head, parent_da, &work_dbuff, decoder_ctx);
+		/*
+		 *	Here, and for the types below, the children
+		 *	(or the value) are limited to the length of
+		 *	this attribute, so we can decode multiple
+		 *	attributes from one buffer.
+		 */
+		slen = internal_decode_pair(ctx, head, parent_da, &FR_DBUFF_MAX(&work_dbuff, len), decoder_ctx);
 		if (slen <= 0) goto error;
 		break;
 
@@ -306,12 +312,12 @@ static ssize_t internal_decode_pair(TALLOC_CTX *ctx, fr_pair_list_t *head, fr_di
 	case FR_TYPE_TLV:
 		if (unlikely(tainted)) goto bad_tainted;
 
-		slen = internal_decode_tlv(ctx, head, da, &work_dbuff, decoder_ctx);
+		slen = internal_decode_tlv(ctx, head, da, &FR_DBUFF_MAX(&work_dbuff, len), decoder_ctx);
 		if (slen <= 0) goto error;
 		break;
 
 	case FR_TYPE_GROUP:
-		slen = internal_decode_group(ctx, head, da, &work_dbuff, decoder_ctx);
+		slen = internal_decode_group(ctx, head, da, &FR_DBUFF_MAX(&work_dbuff, len), decoder_ctx);
 		if (slen <= 0) goto error;
 		break;
 
@@ -320,7 +326,8 @@ static ssize_t internal_decode_pair(TALLOC_CTX *ctx, fr_pair_list_t *head, fr_di
 		 *	It's ok for this function to return 0
 		 *	we can have zero length strings.
 		 */
-		slen = internal_decode_pair_value_dbuff(ctx, head, da, &work_dbuff, tainted, decoder_ctx);
+		slen = internal_decode_pair_value_dbuff(ctx, head, da, &FR_DBUFF_MAX(&work_dbuff, len),
+							tainted, decoder_ctx);
 		if (slen < 0) goto error;
 	}
 
@@ -1001,11 +1001,8 @@ ssize_t fr_radius_encode_dbuff(fr_dbuff_t *dbuff, uint8_t const *original,
 	return fr_dbuff_set(dbuff, &work_dbuff);
 }
 
-/** Decode a raw RADIUS packet into VPs.
- *
- */
-ssize_t	fr_radius_decode(TALLOC_CTX *ctx, uint8_t const *packet, size_t packet_len, uint8_t const *original,
-			 char const *secret, UNUSED size_t secret_len, fr_dcursor_t *cursor)
+static ssize_t radius_decode(TALLOC_CTX *ctx, uint8_t const *packet, size_t packet_len, uint8_t const *original,
+			     char const *secret, fr_dcursor_t *cursor, bool borrow)
 {
 	ssize_t			slen;
 	uint8_t const		*attr, *end;
@@ -1014,6 +1011,10 @@ ssize_t	fr_radius_decode(TALLOC_CTX *ctx, uint8_t const *packet, size_t packet_l
 	memset(&packet_ctx, 0, sizeof(packet_ctx));
 	packet_ctx.tmp_ctx = talloc_init_const("tmp");
 	packet_ctx.secret = secret;
+	if (borrow) {
+		packet_ctx.borrow = packet;
+		packet_ctx.borrow_len = packet_len;
+	}
 	memcpy(packet_ctx.vector, original ? original + 4 : packet + 4, sizeof(packet_ctx.vector));
 
 	attr = packet + 20;
@@ -1052,6 +1053,27 @@ ssize_t	fr_radius_decode(TALLOC_CTX *ctx, uint8_t const *packet, size_t packet_l
 	return packet_len;
 }
 
+/** Decode a raw RADIUS packet into VPs.
+ *
+ */
+ssize_t	fr_radius_decode(TALLOC_CTX *ctx, uint8_t const *packet, size_t packet_len, uint8_t const *original,
+			 char const *secret, UNUSED size_t secret_len, fr_dcursor_t *cursor)
+{
+	return radius_decode(ctx, packet, packet_len, original, secret, cursor, false);
+}
+
+/** Decode a raw RADIUS packet into VPs, without copying octets values
+ *
+ * Octets attributes reference the packet directly, so the packet
+ * MUST NOT be freed or modified until the decoded pairs have been
+ * freed.  Values which are modified get their own copy of the data.
+ */
+ssize_t	fr_radius_decode_borrow(TALLOC_CTX *ctx, uint8_t const *packet, size_t packet_len, uint8_t const *original,
+				char const *secret, UNUSED size_t secret_len, fr_dcursor_t *cursor)
+{
+	return radius_decode(ctx, packet, packet_len, original, secret, cursor, true);
+}
+
 int fr_radius_init(void)
 {
 	if (instance_count > 0) {
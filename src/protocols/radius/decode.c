@@ -1572,6 +1572,18 @@ ssize_t fr_radius_decode_pair_value(TALLOC_CTX *ctx, fr_dcursor_t *cursor, fr_di
 
 	default:
 	decode:
+		/*
+		 *	The value is in the packet the caller gave
+		 *	us, so point at it instead of copying it.
+		 *	Decrypted and concatenated values are in
+		 *	temporary buffers, and still get copied.
+		 */
+		if ((vp->da->type == FR_TYPE_OCTETS) && packet_ctx->borrow &&
+		    (p >= packet_ctx->borrow) && ((p + data_len) <= (packet_ctx->borrow + packet_ctx->borrow_len))) {
+			fr_value_box_memdup_borrow(&vp->data, vp->da, p, data_len, true);
+			break;
+		}
+
 		if (fr_value_box_from_network(vp, &vp->data, vp->da->type, vp->da, p, data_len, true) < 0) {
 			/*
 			 *	Paranoid loop prevention
@@ -131,6 +131,10 @@ ssize_t		fr_radius_encode_dbuff(fr_dbuff_t *dbuff, uint8_t const *original,
 ssize_t		fr_radius_decode(TALLOC_CTX *ctx, uint8_t const *packet, size_t packet_len, uint8_t const *original,
 				 char const *secret, UNUSED size_t secret_len, fr_dcursor_t *cursor) CC_HINT(nonnull(1,2,5,7));
 
+ssize_t		fr_radius_decode_borrow(TALLOC_CTX *ctx, uint8_t const *packet, size_t packet_len,
+					uint8_t const *original, char const *secret, UNUSED size_t secret_len,
+					fr_dcursor_t *cursor) CC_HINT(nonnull(1,2,5,7));
+
 int		fr_radius_init(void);
 
 void		fr_radius_free(void);
@@ -174,6 +178,10 @@ typedef struct {
 	int			salt_offset;		//!< for tunnel passwords
 	bool 			tunnel_password_zeros;
 
+	uint8_t const		*borrow;		//!< octets values may reference this buffer
+							///< instead of copying it.
+	size_t			borrow_len;		//!< length of the borrowed buffer.
+
 	uint8_t			tag;			//!< current tag for encoding
 	fr_radius_tag_ctx_t    	**tags;			//!< for decoding tagged attributes
 } fr_radius_ctx_t;